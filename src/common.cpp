@@ -0,0 +1,128 @@
+#include "common.hpp"
+
+namespace yitu_codec_common {
+
+MemoryBudget gMemoryBudget;
+
+int parse_param_map(int argc, char *argv[], std::map<std::string, std::string> &arg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string param(argv[i]);
+        size_t pos = param.find('=');
+        if (pos != std::string::npos && param.substr(0, 2) == "--") {
+            std::string key = param.substr(2, pos - 2);
+            std::string value = param.substr(pos + 1);
+            arg[key] = value;
+        } else {
+            std::cout << "Invalid parameter format: " << param << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int string_to_bool(const std::string &str) {
+    return str == "1";
+}
+
+int string_to_int(const std::string &str) {
+    return std::stoi(str);
+}
+
+std::vector<int> string_to_int_list(const std::string &str) {
+    std::vector<int> list;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            list.push_back(string_to_int(item));
+        }
+    }
+    return list;
+}
+
+int parse_json_line(const std::string &line, std::map<std::string, std::string> &obj) {
+    size_t i = 0, n = line.size();
+    auto skip_space = [&]() {
+        while (i < n && isspace((unsigned char)line[i])) i++;
+    };
+    auto read_string = [&](std::string &out) -> bool {
+        if (i >= n || line[i] != '"') return false;
+        i++;
+        while (i < n && line[i] != '"') {
+            char c = line[i++];
+            if (c == '\\' && i < n) {
+                c = line[i++];
+                switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    default: break;
+                }
+            }
+            out.push_back(c);
+        }
+        if (i >= n) return false;
+        i++;
+        return true;
+    };
+
+    skip_space();
+    if (i >= n || line[i] != '{') return 1;
+    i++;
+    skip_space();
+    if (i < n && line[i] == '}') return 0;
+    while (i < n) {
+        std::string key, value;
+        skip_space();
+        if (!read_string(key)) return 1;
+        skip_space();
+        if (i >= n || line[i] != ':') return 1;
+        i++;
+        skip_space();
+        if (i < n && line[i] == '"') {
+            if (!read_string(value)) return 1;
+        } else {
+            while (i < n && line[i] != ',' && line[i] != '}' && !isspace((unsigned char)line[i])) {
+                value.push_back(line[i++]);
+            }
+            if (value.empty()) return 1;
+        }
+        obj[key] = value;
+        skip_space();
+        if (i < n && line[i] == ',') {
+            i++;
+            continue;
+        }
+        if (i < n && line[i] == '}') return 0;
+        return 1;
+    }
+    return 1;
+}
+
+std::string json_escape(const std::string &str) {
+    std::string out;
+    for (char c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default: out.push_back(c);
+        }
+    }
+    return out;
+}
+
+YuvFormat string_to_yuvformat(const std::string &str) {
+    if ((str == "I420") || (str == "i420")) {
+        return YUV_FORMAT_I420;
+    }
+    if ((str == "NV12") || (str == "nv12")) {
+        return YUV_FORMAT_NV12;
+    }
+    TF_LOG_ERROR("ERROR: Unknown YUV format. %s.", str.c_str());
+    exit(-1);
+}
+
+}  // namespace yitu_codec_common
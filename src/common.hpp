@@ -10,17 +10,23 @@
 #include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <set>
 #include <sstream>
 #include <thread>
 #include <unordered_set>
+#include <utility>
 
 #include "libtfdec.h"
+#include "logger.hpp"
 #include "tfenc_api.h"
 #include "tfgh.h"
 
@@ -58,6 +64,24 @@ class Semaphore {
         count--;
     }
 
+    /// @brief 带超时的 wait
+    /// @return false 超时
+    inline bool wait_for(int timeoutMs) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return count > 0; })) {
+            return false;
+        }
+        count--;
+        return true;
+    }
+
+    /// 重置计数, 用于丢弃已无法归还的资源(如故障解码器中的在途帧)
+    inline void reset(int count_) {
+        std::unique_lock<std::mutex> lock(mtx);
+        count = count_;
+        cv.notify_all();
+    }
+
     inline int getCount() {
         return count;
     }
@@ -68,7 +92,10 @@ class Semaphore {
     int count;
 };
 
-// 帧数据结构
+// 帧数据结构, 侵入式引用计数
+// 新建时引用计数为 1, 同一帧送往多个下游(文件/编码/缩略图/分析)时每个下游 Retain 一次, 各自用完后 Release,
+// 最后一次 Release 时释放; 分发只增加计数, 不拷贝帧数据
+// 被共享(RefCount() > 1)的帧只读, 需要就地修改时先调用 MakeWritable 取得独占的帧(写时拷贝)
 class FrameData {
    public:
     FrameData() {
@@ -76,7 +103,7 @@ class FrameData {
         length = 0L;
         timestamp = 0L;
         isEnd = true;
-        handled = 0;
+        isKey = false;
     }
 
     FrameData(unsigned char *data, unsigned long length, unsigned long timestamp, bool isEnd) {
@@ -85,29 +112,66 @@ class FrameData {
         this->length = length;
         this->timestamp = timestamp;
         this->isEnd = isEnd;
-        this->handled = 0;
+        this->isKey = false;
     }
 
-    ~FrameData() {
-        if (data != NULL) {
-            delete[] data;
-            data = NULL;
+    FrameData(const FrameData &) = delete;
+    FrameData &operator=(const FrameData &) = delete;
+
+    /// 增加一个引用, 返回自身, 便于 queue->Push(frameData->Retain())
+    FrameData *Retain() {
+        refCount.fetch_add(1, std::memory_order_relaxed);
+        return this;
+    }
+
+    /// 释放一个引用, 最后一个引用释放时删除帧; 调用后不能再访问该帧
+    void Release() {
+        if (refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    int RefCount() const {
+        return refCount.load(std::memory_order_acquire);
+    }
+
+    bool IsShared() const {
+        return RefCount() > 1;
+    }
+
+    /// @brief 写时拷贝: 未被共享时直接返回该帧, 否则拷贝一份并释放调用方持有的引用
+    /// 修改共享帧(旁路队列/FrameRef/Retain 过的帧)之前必须经过这里, 之后才能 GetWritableData
+    /// @return 调用方独占的帧, 取代传入的 frameData
+    static FrameData *MakeWritable(FrameData *frameData) {
+        if (!frameData->IsShared()) {
+            return frameData;
         }
+        FrameData *copy = new FrameData(frameData->data, frameData->length, frameData->timestamp, frameData->isEnd);
+        copy->isKey = frameData->isKey;
+        copy->ingressTime = frameData->ingressTime;
+        frameData->Release();
+        return copy;
     }
 
-    unsigned char *GetData() {
+    /// 帧数据只读, 帧可能被多个下游共享
+    const unsigned char *GetData() const {
         return data;
     }
 
-    unsigned long GetLength() {
+    /// 可写的帧数据, 仅在独占(未被共享)时返回, 共享时返回 NULL, 需先 MakeWritable
+    unsigned char *GetWritableData() {
+        return IsShared() ? NULL : data;
+    }
+
+    unsigned long GetLength() const {
         return length;
     }
 
-    unsigned long GetTimestamp() {
+    unsigned long GetTimestamp() const {
         return timestamp;
     }
 
-    bool GetIsEnd() {
+    bool GetIsEnd() const {
         return isEnd;
     }
 
@@ -128,22 +192,427 @@ class FrameData {
         this->isEnd = isEnd;
     }
 
-    void IncHandled() {
-        handled++;
+    /// 压缩帧是否为关键帧, 解码帧无意义
+    bool GetIsKey() const {
+        return isKey;
+    }
+
+    void SetIsKey(bool isKey) {
+        this->isKey = isKey;
+    }
+
+    /// 进入流水线(读取到压缩帧)的时间, 解码帧沿用对应压缩帧的时间, 用于统计端到端延迟
+    std::chrono::steady_clock::time_point GetIngressTime() const {
+        return ingressTime;
     }
 
-    int GetHandled() {
-        return handled;
+    void SetIngressTime(std::chrono::steady_clock::time_point ingressTime) {
+        this->ingressTime = ingressTime;
     }
 
    private:
+    /// 只能通过 Release 释放
+    ~FrameData() {
+        if (data != NULL) {
+            delete[] data;
+            data = NULL;
+        }
+    }
+
     unsigned char *data;
     unsigned long length;
     /// 本程序中，timestamp 被设置为视频帧号，用于在callback中找到相关编号
     unsigned long timestamp;
     bool isEnd;
-    /// 处理的次数，用于统计被多次使用的次数
-    int handled;
+    bool isKey;
+    std::atomic<int> refCount{1};
+    std::chrono::steady_clock::time_point ingressTime;
+};
+
+// 持有一个帧引用, 拷贝时 Retain, 析构时 Release; 用于需要自动管理生命周期的场合(如流水线图中分叉的帧)
+class FrameRef {
+   public:
+    FrameRef() : frameData(nullptr) {
+    }
+
+    /// 接管调用方持有的一个引用, 不增加计数
+    explicit FrameRef(FrameData *frameData) : frameData(frameData) {
+    }
+
+    FrameRef(const FrameRef &other) : frameData(other.frameData != nullptr ? other.frameData->Retain() : nullptr) {
+    }
+
+    FrameRef(FrameRef &&other) : frameData(other.frameData) {
+        other.frameData = nullptr;
+    }
+
+    FrameRef &operator=(FrameRef other) {
+        std::swap(frameData, other.frameData);
+        return *this;
+    }
+
+    ~FrameRef() {
+        if (frameData != nullptr) {
+            frameData->Release();
+        }
+    }
+
+    FrameData *Get() const {
+        return frameData;
+    }
+
+    FrameData *operator->() const {
+        return frameData;
+    }
+
+    explicit operator bool() const {
+        return frameData != nullptr;
+    }
+
+   private:
+    FrameData *frameData;
+};
+
+// I420 帧视图, 不持有数据, 各平面独立的起始地址与行距
+// 解码器按对齐后的尺寸(如 1920x1088)输出时, 可见区域只是左上角的一部分; 裁剪只调整指针, 不拷贝
+// FrameView 可写, 用于画布与自有buffer; ConstFrameView 只读, 用于可能被共享的解码帧. 可写视图可以直接当作只读视图使用
+template <typename Sample>
+struct BasicFrameView {
+    Sample *planes[3];
+    /// 各平面每行字节数
+    int strides[3];
+    /// 可见区域宽高(像素)
+    int width;
+    int height;
+    /// 底层buffer的平面尺寸(像素)
+    int codedWidth;
+    int codedHeight;
+    /// 每个采样的字节数, 8 bit 为 1, 高位深为 2
+    int bytesPerSample;
+
+    BasicFrameView() {
+    }
+
+    /// 可写视图转为只读视图; 反方向不能转换
+    template <typename Other>
+    BasicFrameView(const BasicFrameView<Other> &other) {
+        for (int plane = 0; plane < 3; plane++) {
+            planes[plane] = other.planes[plane];
+            strides[plane] = other.strides[plane];
+        }
+        width = other.width;
+        height = other.height;
+        codedWidth = other.codedWidth;
+        codedHeight = other.codedHeight;
+        bytesPerSample = other.bytesPerSample;
+    }
+
+    /// @brief 按连续存放的 I420 构造, 平面尺寸为 codedWidth x codedHeight, 可见区域为左上角 width x height
+    static BasicFrameView FromI420(Sample *data, int codedWidth, int codedHeight, int width, int height, int bytesPerSample = 1) {
+        BasicFrameView view;
+        int chromaWidth = (codedWidth + 1) / 2;
+        int chromaHeight = (codedHeight + 1) / 2;
+        view.planes[0] = data;
+        view.planes[1] = data + (size_t)codedWidth * codedHeight * bytesPerSample;
+        view.planes[2] = view.planes[1] + (size_t)chromaWidth * chromaHeight * bytesPerSample;
+        view.strides[0] = codedWidth * bytesPerSample;
+        view.strides[1] = chromaWidth * bytesPerSample;
+        view.strides[2] = chromaWidth * bytesPerSample;
+        view.width = width;
+        view.height = height;
+        view.codedWidth = codedWidth;
+        view.codedHeight = codedHeight;
+        view.bytesPerSample = bytesPerSample;
+        return view;
+    }
+
+    /// @brief 取子区域, 起点与宽高取偶数, 保证色度对齐
+    BasicFrameView Crop(int x, int y, int cropWidth, int cropHeight) const {
+        BasicFrameView view = *this;
+        x &= ~1;
+        y &= ~1;
+        view.planes[0] += (size_t)y * strides[0] + (size_t)x * bytesPerSample;
+        view.planes[1] += (size_t)(y / 2) * strides[1] + (size_t)(x / 2) * bytesPerSample;
+        view.planes[2] += (size_t)(y / 2) * strides[2] + (size_t)(x / 2) * bytesPerSample;
+        view.width = cropWidth & ~1;
+        view.height = cropHeight & ~1;
+        return view;
+    }
+
+    /// 第 plane 个平面的可见宽高(像素), 色度平面为亮度的一半
+    int PlaneWidth(int plane) const {
+        return plane == 0 ? width : (width + 1) / 2;
+    }
+    int PlaneHeight(int plane) const {
+        return plane == 0 ? height : (height + 1) / 2;
+    }
+
+    /// 各平面之间与行之间都没有填充, 可以当作连续的 I420 使用
+    bool IsPacked() const {
+        int chromaWidth = (width + 1) / 2;
+        return strides[0] == width * bytesPerSample && strides[1] == chromaWidth * bytesPerSample && strides[2] == strides[1] &&
+               planes[1] == planes[0] + (size_t)strides[0] * height && planes[2] == planes[1] + (size_t)strides[1] * ((height + 1) / 2);
+    }
+};
+
+typedef BasicFrameView<uint8_t> FrameView;
+typedef BasicFrameView<const uint8_t> ConstFrameView;
+
+// 超出内存预算时的处理方式: 阻塞等待其他阶段释放, 或丢弃(仅用于可以丢帧的阶段)
+enum BudgetPolicy {
+    BUDGET_BLOCK = 0,
+    BUDGET_SHED
+};
+
+// 进程级内存预算, 所有排队中的帧与任务内复用的buffer都计入, limit 为 0 表示不限
+// 当前没有任何占用时, 单次申请即使超过上限也放行, 避免大帧永远无法进入
+class MemoryBudget {
+   public:
+    MemoryBudget(long limit = 0)
+        : limit(limit), used(0), peak(0) {
+    }
+
+    void SetLimit(long limit) {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->limit = limit;
+        cv.notify_all();
+    }
+
+    long GetLimit() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return limit;
+    }
+
+    long GetUsed() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return used;
+    }
+
+    long GetPeak() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return peak;
+    }
+
+    /// @brief 申请 bytes 字节
+    /// @param force 不为空且返回 true 时立即放行, 调用方据此保证流水线总能前进; 在预算锁内调用
+    /// @return BUDGET_SHED 且超出预算时返回 false, 其他情况阻塞直到申请成功
+    bool Acquire(long bytes, BudgetPolicy policy, const std::function<bool()> &force = nullptr) {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto admit = [this, bytes, &force] {
+            return limit <= 0 || used == 0 || used + bytes <= limit || (force && force());
+        };
+        if (policy == BUDGET_SHED) {
+            if (!admit()) return false;
+        } else {
+            cv.wait(lock, admit);
+        }
+        used += bytes;
+        if (used > peak) peak = used;
+        return true;
+    }
+
+    void Release(long bytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        used -= bytes;
+        cv.notify_all();
+    }
+
+   private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    long limit;
+    long used;
+    long peak;
+};
+
+/// 进程内唯一的内存预算, 默认不限
+extern MemoryBudget gMemoryBudget;
+
+// 单个任务的内存记账, 同时计入全局预算, 用于按任务上报占用
+class MemoryAccount {
+   public:
+    MemoryAccount(MemoryBudget *budget = &gMemoryBudget)
+        : budget(budget), used(0), peak(0) {
+    }
+
+    ~MemoryAccount() {
+        if (used > 0) {
+            budget->Release(used);
+        }
+    }
+
+    bool Charge(long bytes, BudgetPolicy policy, const std::function<bool()> &force = nullptr) {
+        if (!budget->Acquire(bytes, policy, force)) {
+            return false;
+        }
+        long now = used += bytes;
+        long last = peak;
+        while (now > last && !peak.compare_exchange_weak(last, now)) {
+        }
+        return true;
+    }
+
+    void Uncharge(long bytes) {
+        used -= bytes;
+        budget->Release(bytes);
+    }
+
+    long Used() {
+        return used;
+    }
+
+    long Peak() {
+        return peak;
+    }
+
+   private:
+    MemoryBudget *budget;
+    std::atomic<long> used;
+    std::atomic<long> peak;
+};
+
+// 有界帧队列, 同时按帧数和字节数限制, 0 表示不限
+// Push 在超出限制时阻塞, Pop 在队列为空时阻塞, 取代 信号量 + std::queue + usleep 轮询
+// 结束帧不受限制, 队列为空时单帧超过字节上限也允许放入, 避免死锁
+// 设置了 MemoryAccount 时, 排队中的帧同时计入内存预算
+class FrameQueue {
+   public:
+    FrameQueue(int maxFrames = 0, long maxBytes = 0)
+        : maxFrames(maxFrames), maxBytes(maxBytes), bytes(0), account(nullptr), policy(BUDGET_BLOCK) {
+    }
+
+    ~FrameQueue() {
+        for (FrameData *frameData : frames) {
+            uncharge(frameData);
+            frameData->Release();
+        }
+    }
+
+    /// 在使用队列之前设置
+    void SetAccount(MemoryAccount *account, BudgetPolicy policy) {
+        this->account = account;
+        this->policy = policy;
+    }
+
+    void SetLimits(int maxFrames, long maxBytes) {
+        std::lock_guard<std::mutex> lock(mtx);
+        this->maxFrames = maxFrames;
+        this->maxBytes = maxBytes;
+        notFull.notify_all();
+    }
+
+    /// 超出内存预算且策略为 BUDGET_SHED 时返回 false, 帧未入队, 由调用方释放
+    /// 每个队列只有一个生产者, 队列为空时不受预算限制, 保证下游总有帧可以处理, 各阶段不会互相等待
+    bool Push(FrameData *frameData) {
+        if (account != nullptr && !frameData->GetIsEnd()) {
+            if (!account->Charge(frameData->GetLength(), policy, [this] { return Size() == 0; })) {
+                return false;
+            }
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!frameData->GetIsEnd()) {
+            notFull.wait(lock, [this, frameData] { return has_room(frameData->GetLength()); });
+        }
+        frames.push_back(frameData);
+        bytes += frameData->GetLength();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    FrameData *Pop() {
+        FrameData *frameData;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            notEmpty.wait(lock, [this] { return !frames.empty(); });
+            frameData = frames.front();
+            frames.pop_front();
+            bytes -= frameData->GetLength();
+            notFull.notify_one();
+        }
+        // 在队列锁外归还预算, 归还时会唤醒所有等待预算的生产者重新检查
+        uncharge(frameData);
+        return frameData;
+    }
+
+    int Size() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return frames.size();
+    }
+
+    long Bytes() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return bytes;
+    }
+
+   private:
+    void uncharge(FrameData *frameData) {
+        if (account != nullptr && !frameData->GetIsEnd()) {
+            account->Uncharge(frameData->GetLength());
+        }
+    }
+
+    bool has_room(unsigned long length) {
+        if (frames.empty()) return true;
+        if (maxFrames > 0 && (int)frames.size() >= maxFrames) return false;
+        if (maxBytes > 0 && bytes + (long)length > maxBytes) return false;
+        return true;
+    }
+
+    std::mutex mtx;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<FrameData *> frames;
+    int maxFrames;
+    long maxBytes;
+    long bytes;
+    MemoryAccount *account;
+    BudgetPolicy policy;
+};
+
+// 延迟统计, 1ms 粒度直方图, 超过上限的计入最后一格
+class LatencyStats {
+   public:
+    LatencyStats()
+        : histogram(kMaxMs + 1, 0), count(0), sumMs(0), maxMs(0) {
+    }
+
+    void Add(double ms) {
+        int bucket = ms < 0 ? 0 : (ms > kMaxMs ? kMaxMs : (int)ms);
+        histogram[bucket]++;
+        count++;
+        sumMs += ms;
+        if (ms > maxMs) maxMs = ms;
+    }
+
+    long Count() const {
+        return count;
+    }
+
+    double AvgMs() const {
+        return count > 0 ? sumMs / count : 0;
+    }
+
+    double MaxMs() const {
+        return maxMs;
+    }
+
+    /// @param p 百分位, 如 0.99
+    double PercentileMs(double p) const {
+        long target = (long)ceil(count * p);
+        long seen = 0;
+        for (int i = 0; i <= kMaxMs; i++) {
+            seen += histogram[i];
+            if (seen >= target && seen > 0) return i + 1;
+        }
+        return 0;
+    }
+
+   private:
+    static const int kMaxMs = 10000;
+    std::vector<long> histogram;
+    long count;
+    double sumMs;
+    double maxMs;
 };
 
 /// YUV数据格式
@@ -155,40 +624,72 @@ enum YuvFormat {
 };
 
 // 参数解析函数  --key=val 解析为 std::map<key,val>
-int parse_param_map(int argc, char *argv[], std::map<std::string, std::string> &arg) {
-    for (int i = 1; i < argc; ++i) {
-        std::string param(argv[i]);
-        size_t pos = param.find('=');
-        if (pos != std::string::npos && param.substr(0, 2) == "--") {
-            std::string key = param.substr(2, pos - 2);
-            std::string value = param.substr(pos + 1);
-            arg[key] = value;
-        } else {
-            std::cout << "Invalid parameter format: " << param << std::endl;
-            return 1;
-        }
+int parse_param_map(int argc, char *argv[], std::map<std::string, std::string> &arg);
+
+int string_to_bool(const std::string &str);
+
+int string_to_int(const std::string &str);
+
+// 逗号分隔的整数列表, 如 "2,3"
+std::vector<int> string_to_int_list(const std::string &str);
+
+// JSON 行解析  {"key":"val","n":1} 解析为 std::map<key,val>
+// 只支持单层对象, 数字/布尔/null 按原文保存为字符串
+int parse_json_line(const std::string &line, std::map<std::string, std::string> &obj);
+
+// JSON 字符串转义
+std::string json_escape(const std::string &str);
+
+// 单层 JSON 对象拼接, Str() 输出以换行结尾的一行
+class JsonLine {
+   public:
+    JsonLine &Add(const std::string &key, const std::string &val) {
+        return AddRaw(key, "\"" + json_escape(val) + "\"");
     }
-    return 0;
-}
 
-int string_to_bool(const std::string &str) {
-    return str == "1";
-}
+    JsonLine &Add(const std::string &key, const char *val) {
+        return Add(key, std::string(val));
+    }
 
-int string_to_int(const std::string &str) {
-    return std::stoi(str);
-}
+    JsonLine &Add(const std::string &key, int val) {
+        return AddRaw(key, std::to_string(val));
+    }
 
-YuvFormat string_to_yuvformat(const std::string &str) {
-    if ((str == "I420") || (str == "i420")) {
-        return YUV_FORMAT_I420;
+    JsonLine &Add(const std::string &key, long val) {
+        return AddRaw(key, std::to_string(val));
     }
-    if ((str == "NV12") || (str == "nv12")) {
-        return YUV_FORMAT_NV12;
+
+    JsonLine &Add(const std::string &key, double val) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", val);
+        return AddRaw(key, buf);
     }
-    printf("ERROR: Unknown YUV format. %s.", str.c_str());
-    exit(-1);
-}
+
+    JsonLine &Add(const std::string &key, bool val) {
+        return AddRaw(key, val ? "true" : "false");
+    }
+
+    /// 直接写入已是JSON格式的值, 如数组或嵌套对象
+    JsonLine &AddRaw(const std::string &key, const std::string &raw) {
+        if (!body.empty()) body += ",";
+        body += "\"" + json_escape(key) + "\":" + raw;
+        return *this;
+    }
+
+    /// 不带换行的对象文本, 用于嵌套
+    std::string Object() const {
+        return "{" + body + "}";
+    }
+
+    std::string Str() const {
+        return Object() + "\n";
+    }
+
+   private:
+    std::string body;
+};
+
+YuvFormat string_to_yuvformat(const std::string &str);
 
 }  // namespace yitu_codec_common
 #endif  // COMMON_HPP
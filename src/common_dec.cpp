@@ -0,0 +1,1238 @@
+#include "common_dec.hpp"
+#include "mux.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+namespace yitu_codec_dec {
+
+BufferProfile batch_buffer_profile() {
+    BufferProfile profile;
+    profile.inFrameCacheSize = 512;
+    profile.inFrameCacheBytes = 0;
+    profile.outFrameCacheSize = 512;
+    profile.outFrameCacheBytes = 0;
+    profile.frameHardwareCacheSize = 32;
+    profile.outBufferNum = 4;
+    profile.maxFrameLatencyMs = 0;
+    profile.paceInput = false;
+    profile.outBudgetPolicy = BUDGET_BLOCK;
+    return profile;
+}
+
+BufferProfile density_buffer_profile() {
+    BufferProfile profile = batch_buffer_profile();
+    profile.inFrameCacheSize = 32;
+    profile.outFrameCacheSize = 4;
+    // 一帧在解码, 一帧排队, 再留两帧吸收抖动
+    profile.frameHardwareCacheSize = 4;
+    profile.outBufferNum = 3;
+    return profile;
+}
+
+BufferProfile live_buffer_profile(int width, int height, double frameRate, int latencyTargetMs) {
+    if (frameRate <= 0) {
+        frameRate = 30;
+    }
+    double frameIntervalMs = 1000.0 / frameRate;
+    long frameBytes = (long)width * height * 3 / 2;
+    // 延迟预算大致三分: 压缩帧排队 / 硬件解码 / 解码帧排队, 每个队列至少2帧以吸收抖动
+    int queueFrames = std::max(2, (int)(latencyTargetMs / 3 / frameIntervalMs));
+
+    BufferProfile profile;
+    profile.inFrameCacheSize = queueFrames;
+    // 压缩帧按 I 帧约为原始帧的 1/10 估算
+    profile.inFrameCacheBytes = std::max(frameBytes / 10 * queueFrames, 1L << 20);
+    profile.outFrameCacheSize = queueFrames;
+    profile.outFrameCacheBytes = frameBytes * queueFrames;
+    // 一帧在解码, 一帧排队, 保证硬件不空闲
+    profile.frameHardwareCacheSize = 2;
+    // tfdec 建议 3~5, 取下限
+    profile.outBufferNum = 3;
+    profile.maxFrameLatencyMs = latencyTargetMs;
+    profile.paceInput = true;
+    // 超出内存预算时丢弃解码帧而不是拖慢整条流
+    profile.outBudgetPolicy = BUDGET_SHED;
+    return profile;
+}
+
+int run_dec(DecContext *ctx) {
+    ctx->session->ctx.store(ctx, std::memory_order_release);
+
+    std::thread loadFramesThread;
+    loadFramesThread = std::thread(&load_frames, ctx);
+
+    std::thread enqueueFramesThread;
+    enqueueFramesThread = std::thread(&enqueue_frames, ctx);
+
+    std::thread saveFileThread;
+    saveFileThread = std::thread(&save_file, ctx);
+
+    loadFramesThread.join();
+    enqueueFramesThread.join();
+    saveFileThread.join();
+
+    // 压缩帧都已经加载完，且都已经
+    // 等待所有解码的回调完
+    int i = 0;
+    while (!ctx->decodeCompleted) {
+        if (((i++) % 100) == 0) {
+            TF_LOG_INFO("Waiting for decoding callback: Loaded: %d, Enqueued: %d, Decoded: %d.\n", ctx->loadedFrameCount.load(),
+                        ctx->tfEnqueuedFrameCount.load(), ctx->decodedFrameCount.load());
+        }
+        usleep(10000);
+    }
+    TF_LOG_INFO("Decode complete: Loaded: %d, Enqueued: %d, Decoded: %d.\n", ctx->loadedFrameCount.load(), ctx->tfEnqueuedFrameCount.load(),
+                ctx->decodedFrameCount.load());
+    TF_LOG_INFO("Latency: avg %.1f ms, p99 %.1f ms, max %.1f ms, dropped: %d.\n", ctx->latency.AvgMs(), ctx->latency.PercentileMs(0.99),
+                ctx->latency.MaxMs(), ctx->droppedFrameCount.load());
+    TF_LOG_INFO("Memory: peak %ld bytes, process used %ld / limit %ld bytes.\n", ctx->memory.Peak(), gMemoryBudget.GetUsed(),
+                gMemoryBudget.GetLimit());
+
+    if (ctx->failoverCount > 0) {
+        TF_LOG_INFO("Decoder failover: %d times, duplicate frames dropped: %d, now on device %d.\n", ctx->failoverCount.load(),
+                    ctx->duplicateFrameCount.load(), ctx->session->deviceIndex);
+    }
+
+    ctx->session->ctx.store(nullptr, std::memory_order_release);
+    // 故障session的回调已不再送入本任务, 销毁可能因设备无响应而较慢
+    for (DecSession *session : ctx->retiredSessions) {
+        destroy_session(session);
+    }
+    ctx->retiredSessions.clear();
+    return ctx->failed ? -1 : 0;
+}
+
+int open_decoded_stream(const std::string &fileName, int deviceIndex, const BufferProfile &profile, DecodedStream *stream) {
+    if (read_video_file(fileName, &stream->videoInfo) != 0) {
+        TF_LOG_ERROR("ERROR: Unable to read %s.\n", fileName.c_str());
+        return -1;
+    }
+    stream->videoOpened = true;
+    VideoInfo *videoInfo = &stream->videoInfo;
+    stream->session = create_session(deviceIndex, videoInfo->role, videoInfo->width, videoInfo->height, profile.outBufferNum);
+    if (stream->session == nullptr) {
+        TF_LOG_ERROR("ERROR: Unable to create decoder session for %s.\n", fileName.c_str());
+        return -1;
+    }
+    stream->ctx.reset(new DecContext(profile));
+    stream->ctx->videoInfo = videoInfo;
+    stream->ctx->session = stream->session;
+    stream->ctx->frameSink = &stream->queue;
+    stream->queue.SetAccount(&stream->memory, BUDGET_BLOCK);
+    return 0;
+}
+
+void start_decoded_stream(DecodedStream *stream) {
+    stream->thread = std::thread([stream] {
+        int ret = run_dec(stream->ctx.get());
+        stream->ret = ret != 0 || stream->ctx->decoderFailed ? -1 : 0;
+    });
+}
+
+FrameData *pop_decoded_frame(DecodedStream *stream) {
+    if (stream->ended) {
+        return nullptr;
+    }
+    FrameData *frameData = stream->queue.Pop();
+    if (frameData->GetIsEnd()) {
+        frameData->Release();
+        stream->ended = true;
+        return nullptr;
+    }
+    return frameData;
+}
+
+int close_decoded_stream(DecodedStream *stream) {
+    if (stream->thread.joinable()) {
+        stream->ctx->cancelled = true;
+        FrameData *frameData;
+        while ((frameData = pop_decoded_frame(stream)) != nullptr) {
+            frameData->Release();
+        }
+        stream->thread.join();
+    }
+    if (stream->session != nullptr) {
+        // 发生故障切换时 ctx->session 为新session, 原session已由 run_dec 销毁
+        destroy_session(stream->ctx != nullptr ? stream->ctx->session : stream->session);
+        stream->session = nullptr;
+    }
+    if (stream->videoOpened) {
+        close_video_file(&stream->videoInfo);
+        stream->videoOpened = false;
+    }
+    return stream->ret;
+}
+
+void load_frames(DecContext *ctx) {
+    TF_LOG_INFO("Load frames thread start.\n");
+    VideoInfo *videoInfo = ctx->videoInfo;
+
+    // 准备过滤器
+    AVBSFContext *bsf_ctx = nullptr;
+    if (open_bitstream_filter(videoInfo, &bsf_ctx) != 0) {
+        ctx->failed = true;
+        ctx->cancelled = true;
+    }
+    // 准备读取数据
+    AVPacket *pAvPacket;
+    pAvPacket = av_packet_alloc();
+
+    // 按时间戳节奏读取时, 以第一帧的读取时间为基准
+    AVRational timeBase = videoInfo->avFormatContext->streams[videoInfo->videoIndex]->time_base;
+    AVRational microseconds = {1, 1000000};
+    int64_t firstTs = AV_NOPTS_VALUE;
+    auto paceStart = std::chrono::steady_clock::now();
+
+    int totalFrameCount = 0, totalVideoFrameCount = 0;
+    while (!ctx->cancelled) {
+        if (av_read_frame(videoInfo->avFormatContext, pAvPacket) >= 0) {
+            if (pAvPacket->stream_index == videoInfo->videoIndex) {
+                if (ctx->packetSelector) {
+                    PacketAction action = ctx->packetSelector(ctx, pAvPacket);
+                    if (action != PACKET_DECODE) {
+                        av_packet_unref(pAvPacket);
+                        if (action == PACKET_STOP) {
+                            break;
+                        }
+                        continue;
+                    }
+                }
+                totalVideoFrameCount++;
+                if (ctx->profile.paceInput) {
+                    int64_t ts = pAvPacket->dts != AV_NOPTS_VALUE ? pAvPacket->dts : pAvPacket->pts;
+                    if (ts != AV_NOPTS_VALUE) {
+                        if (firstTs == AV_NOPTS_VALUE) {
+                            firstTs = ts;
+                            paceStart = std::chrono::steady_clock::now();
+                        }
+                        std::this_thread::sleep_until(paceStart + std::chrono::microseconds(av_rescale_q(ts - firstTs, timeBase, microseconds)));
+                    }
+                }
+                // 执行packet过滤
+                if (bsf_ctx != nullptr && filter_packet(bsf_ctx, pAvPacket) != 0) {
+                    continue;
+                }
+
+                // 压缩帧的时间戳为读取序号, pts 在回调中取回
+                unsigned long sequence = ctx->nextSequence++;
+                FrameData *frameData = new FrameData(pAvPacket->data, pAvPacket->size, sequence, false);
+                frameData->SetIsKey(pAvPacket->flags & AV_PKT_FLAG_KEY);
+                frameData->SetIngressTime(std::chrono::steady_clock::now());
+                ctx->loadedFrameCount++;
+                {
+                    std::lock_guard<std::mutex> lock(ctx->pendingLock);
+                    ctx->pendingFrames[sequence] = {(unsigned long)pAvPacket->pts, frameData->GetIngressTime()};
+                }
+
+                ctx->inFrameQueue.Push(frameData);
+
+                TF_LOG_DEBUG("Frame loaded. %d. Timestamp: %ld\n", ctx->loadedFrameCount.load(), pAvPacket->pts);
+            } else if (ctx->auxPacketSink != nullptr) {
+                // 音频/字幕不解码, 走独立队列直接交给 muxer
+                ctx->auxPacketSink->Push(av_packet_clone(pAvPacket));
+            }
+            totalFrameCount++;
+
+        } else {
+            // 无数据或者错误
+            break;
+        }
+        av_packet_unref(pAvPacket);
+    }
+    if (ctx->auxPacketSink != nullptr) {
+        ctx->auxPacketSink->Push(nullptr);
+    }
+    // 插入结束帧，此帧不计入视频帧统计
+    FrameData *frameData = new FrameData();
+    frameData->SetIsEnd(true);
+    ctx->inFrameQueue.Push(frameData);
+
+    TF_LOG_DEBUG("Frame loaded. %d\n", ctx->loadedFrameCount.load());
+
+    // 清理资源
+    av_packet_free(&pAvPacket);
+    av_bsf_free(&bsf_ctx);
+    ctx->loadCompleted = true;
+    TF_LOG_INFO("Load frames thread complete.\n");
+}
+
+int open_bitstream_filter(const VideoInfo *videoInfo, AVBSFContext **bsf) {
+    *bsf = nullptr;
+    if (!videoInfo->gNeedFilter && !videoInfo->gNeedFilterH265) {
+        return 0;
+    }
+    const char *filterName = videoInfo->gNeedFilter ? "h264_mp4toannexb" : "hevc_mp4toannexb";
+    const AVBitStreamFilter *filter = av_bsf_get_by_name(filterName);
+    if (filter == nullptr || av_bsf_alloc(filter, bsf) < 0) {
+        // 分配比特流过滤器上下文失败
+        TF_LOG_ERROR("ERROR: Failed to allocate bitstream filter context.\n");
+        return -1;
+    }
+    // 过滤器需要从 extradata(avcC/hvcC) 中取得 SPS/PPS, 在关键帧前插入
+    AVStream *stream = videoInfo->avFormatContext->streams[videoInfo->videoIndex];
+    (*bsf)->time_base_in = stream->time_base;
+    if (avcodec_parameters_copy((*bsf)->par_in, stream->codecpar) < 0 || av_bsf_init(*bsf) < 0) {
+        TF_LOG_ERROR("ERROR: Failed to init bitstream filter %s.\n", filterName);
+        av_bsf_free(bsf);
+        return -1;
+    }
+    return 0;
+}
+
+int filter_packet(AVBSFContext *bsf, AVPacket *packet) {
+    if (av_bsf_send_packet(bsf, packet) != 0) {
+        av_packet_unref(packet);
+        return -1;
+    }
+    // mp4toannexb 每输入一个packet输出一个, 取不到时视为出错
+    if (av_bsf_receive_packet(bsf, packet) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+bool jpeg_needs_cpu(TFDEC_DECODER_ROLE role, int width, int height) {
+    return role == DECODER_JPEG && (width > MAX_HW_JPEG_Width || height > MAX_HW_JPEG_Height);
+}
+
+// CPU 解码一帧 JPEG, 与硬件解码一样经 callback 送入输出队列
+static void decode_jpeg_frame(DecSession *session, FrameData *frameData) {
+    DecContext *ctx = session->ctx.load(std::memory_order_acquire);
+    if (frameData->GetIsEnd()) {
+        callback(NULL, NULL, 0, frameData->GetTimestamp(), TFDEC_BUFFER_FLAG_EOS, session);
+        return;
+    }
+    ctx->tfEnqueuedFrameCount++;
+
+    tfg::TFSession *jpeg = session->jpegSession;
+    int size = session->width * session->height * 3 / 2;
+    session->jpegBuffer.resize(size);
+    if (jpeg->ReadJpeg(const_cast<unsigned char *>(frameData->GetData()), frameData->GetLength()) != 0 || jpeg->GetImgWidth() != session->width ||
+        jpeg->GetImgHeight() != session->height ||
+        jpeg->BufferImg(session->jpegBuffer.data(), session->width, session->height, tfg::TFSAMP_I420Planar) != 0) {
+        // 损坏的帧直接丢弃, 与硬件解码器行为一致
+        TF_LOG_ERROR("ERROR: CPU jpeg decode failed. Timestamp: %ld\n", frameData->GetTimestamp());
+        {
+            std::lock_guard<std::mutex> lock(ctx->pendingLock);
+            ctx->pendingFrames.erase(frameData->GetTimestamp());
+        }
+        ctx->droppedFrameCount++;
+        ctx->cacheHardware_sem.notify();
+        return;
+    }
+    callback(NULL, session->jpegBuffer.data(), size, frameData->GetTimestamp(), TFDEC_BUFFER_FLAG_ENDOFFRAME, session);
+}
+
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 归还一个硬件空位, 开启设备调度时同时归还调度器空位
+static void release_hardware_slot(DecContext *ctx) {
+    ctx->cacheHardware_sem.notify();
+    yitu_codec_sched::DeviceScheduler *scheduler = ctx->scheduler;
+    if (scheduler != nullptr) {
+        scheduler->Complete(&ctx->sched);
+    }
+}
+
+// 直播帧的截止时间: 读取时间加延迟上限, 没有读取时间或不限延迟时从现在算起
+static int64_t frame_deadline_ms(DecContext *ctx, FrameData *frameData) {
+    int64_t ingress = steady_ms();
+    if (frameData->GetIngressTime().time_since_epoch().count() != 0) {
+        ingress = std::chrono::duration_cast<std::chrono::milliseconds>(frameData->GetIngressTime().time_since_epoch()).count();
+    }
+    return ingress + ctx->profile.maxFrameLatencyMs;
+}
+
+// 故障切换用的重放buffer: 最早的未送出帧所在 GOP 起, 已送入解码器的压缩帧(时间戳为读取序号)
+struct ReplayBuffer {
+    std::deque<FrameData *> frames;
+    /// 超出帧数上限, 无法从关键帧完整重放
+    bool overflowed = false;
+    /// 切换时无法完整重放, 丢弃压缩帧直到下一个关键帧
+    bool skipToKeyframe = false;
+
+    ~ReplayBuffer() {
+        for (FrameData *frameData : frames) {
+            frameData->Release();
+        }
+    }
+
+    /// 序号小于 floor 的帧不会再重放, 不再需要去重记录; 在 deliveredLock 内调用
+    static void advance_floor(DecContext *ctx, unsigned long floor) {
+        if (floor <= ctx->deliveredFloor) {
+            return;
+        }
+        ctx->deliveredFloor = floor;
+        ctx->deliveredSequences.erase(ctx->deliveredSequences.begin(), ctx->deliveredSequences.lower_bound(floor));
+    }
+
+    // 去掉最早的未送出帧之前的完整 GOP, 这些帧的解码结果都已送出, 重放时不再需要
+    void Prune(DecContext *ctx) {
+        std::lock_guard<std::mutex> lock(ctx->deliveredLock);
+        size_t keep = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            if (frames[i]->GetIsKey()) {
+                keep = i;
+            }
+            if (frames[i]->GetTimestamp() >= ctx->deliveredFloor && ctx->deliveredSequences.count(frames[i]->GetTimestamp()) == 0) {
+                break;
+            }
+        }
+        if (keep == 0) {
+            return;
+        }
+        advance_floor(ctx, frames[keep]->GetTimestamp());
+        for (size_t i = 0; i < keep; i++) {
+            frames[i]->Release();
+        }
+        frames.erase(frames.begin(), frames.begin() + keep);
+    }
+
+    /// 记录已送入解码器的帧, 取得所有权
+    void Add(DecContext *ctx, FrameData *frameData) {
+        if (frameData->GetIsKey()) {
+            skipToKeyframe = false;
+            if (overflowed) {
+                // 之前的帧已不完整, 从本关键帧重新开始
+                for (FrameData *old : frames) {
+                    old->Release();
+                }
+                frames.clear();
+                overflowed = false;
+                std::lock_guard<std::mutex> lock(ctx->deliveredLock);
+                advance_floor(ctx, frameData->GetTimestamp());
+            }
+            Prune(ctx);
+        } else if (frames.empty()) {
+            // 开头不是关键帧, 无法重放
+            overflowed = true;
+        }
+        if (!overflowed && (int)frames.size() >= ctx->replayBufferFrames) {
+            Prune(ctx);
+            if ((int)frames.size() >= ctx->replayBufferFrames) {
+                TF_LOG_WARN("WARNING: Replay buffer full (%d frames), decoder failover will skip to the next keyframe.\n", ctx->replayBufferFrames);
+                overflowed = true;
+            }
+        }
+        if (overflowed) {
+            // 无法完整重放时不会重放, 本帧及之前的帧都不需要去重
+            std::lock_guard<std::mutex> lock(ctx->deliveredLock);
+            advance_floor(ctx, frameData->GetTimestamp() + 1);
+            frameData->Release();
+            return;
+        }
+        frames.push_back(frameData);
+    }
+};
+
+// 自 since 起解码器超时没有回调, 回调阻塞在输出队列(下游慢)时不算; 输入断流期间解码器没有输出是正常的, 从开始等待时计时
+static bool decoder_hung(DecContext *ctx, int64_t since) {
+    return !ctx->callbackBlocked && steady_ms() - std::max<int64_t>(ctx->lastDecoderActivityMs, since) > ctx->hangTimeoutMs;
+}
+
+/// @brief 等待硬件空位后送入一帧
+/// @param replay 重放的帧不计入入队统计
+/// @return 0 成功, -1 解码器故障
+static int submit_frame(DecContext *ctx, FrameData *frameData, bool replay) {
+    // 等待tfdec内存空闲, 在途帧长时间没有回调时判定故障
+    int64_t waitStart = steady_ms();
+    while (!ctx->cacheHardware_sem.wait_for(100)) {
+        if (decoder_hung(ctx, waitStart)) {
+            TF_LOG_ERROR("ERROR: No decoder callback for %d ms.\n", ctx->hangTimeoutMs);
+            return -1;
+        }
+    }
+    // 设备调度: 直播按截止时间优先, 批处理按权重分享; 调度器保底放行, 等待中在途帧长时间没有回调仍判定故障
+    // 取消后不再等待调度, 直接送入让解码器尽快冲刷到结束(在途帧仍受 cacheHardware_sem 限制)
+    yitu_codec_sched::DeviceScheduler *scheduler = ctx->scheduler;
+    if (scheduler != nullptr) {
+        int64_t deadlineMs = frame_deadline_ms(ctx, frameData);
+        while (!ctx->cancelled && !scheduler->Acquire(&ctx->sched, deadlineMs, 100)) {
+            if (decoder_hung(ctx, waitStart)) {
+                TF_LOG_ERROR("ERROR: No decoder callback for %d ms.\n", ctx->hangTimeoutMs);
+                return -1;
+            }
+        }
+    }
+
+    // 加入TF设备的buffer
+    void *buffer = NULL;
+    int size = 0;
+    unsigned int flag = TFDEC_BUFFER_FLAG_EOS;
+    unsigned long timestamp = frameData->GetTimestamp();
+    if (!frameData->GetIsEnd()) {
+        // tfdec 只读取输入 buffer; 压缩帧可能同时在重放buffer中
+        buffer = const_cast<unsigned char *>(frameData->GetData());
+        size = frameData->GetLength();
+        flag = TFDEC_BUFFER_FLAG_ENDOFFRAME;
+    }
+
+    int64_t start = steady_ms();
+    int ret = 0;
+    while (true) {
+        ret = tfdec_enqueue_buffer(ctx->session->handle, buffer, size, timestamp, flag);
+        if (ret == TFDEC_STATUS_SUCCESS) {
+            break;
+        }
+        if (ret == TFDEC_STATUS_INTERNAL_ERROR) {
+            TF_LOG_ERROR("ERROR: tfdec_enqueue_buffer internal error.\n");
+            return -1;
+        }
+        TF_LOG_DEBUG("Frame enqueue failed. ret: %d.\n", ret);
+        if (steady_ms() - start >= ctx->hangTimeoutMs) {
+            TF_LOG_ERROR("ERROR: tfdec_enqueue_buffer has kept failing for %d ms, ret: %d.\n", ctx->hangTimeoutMs, ret);
+            return -1;
+        }
+        usleep(10);
+    }
+    ctx->lastDecoderActivityMs = steady_ms();
+    if (flag != TFDEC_BUFFER_FLAG_EOS && !replay) {
+        ctx->tfEnqueuedFrameCount++;
+        TF_LOG_DEBUG("Frame enqueued. Count: %d, Timestamp: %ld, ret: %d.\n", ctx->tfEnqueuedFrameCount.load(), timestamp, ret);
+    }
+    return 0;
+}
+
+// 在其他设备上重建session并重放, 故障设备排在最后; 重放中再次故障时继续切换
+// @return 0 成功, -1 无法恢复
+static int recover_session(DecContext *ctx, ReplayBuffer *replay, bool eosSent) {
+    while (!ctx->failoverDevices.empty() && ctx->failoverCount < ctx->maxFailovers) {
+        DecSession *failed = ctx->session;
+        // 故障session此后的回调直接归还, 不再送入本任务
+        failed->ctx.store(nullptr, std::memory_order_release);
+        ctx->failoverCount++;
+
+        std::vector<int> devices;
+        for (int device : ctx->failoverDevices) {
+            if (device != failed->deviceIndex) {
+                devices.push_back(device);
+            }
+        }
+        if (devices.size() < ctx->failoverDevices.size()) {
+            devices.push_back(failed->deviceIndex);
+        }
+        DecSession *session = nullptr;
+        for (int device : devices) {
+            // 故障切换中不能无限等待设备容量, 每次排队最多等待 hangTimeoutMs
+            session = create_session(device, failed->role, failed->width, failed->height, failed->outBufferNum, failed->lite,
+                                     ctx->hangTimeoutMs);
+            if (session != nullptr) {
+                break;
+            }
+        }
+        if (session == nullptr) {
+            TF_LOG_ERROR("ERROR: Decoder failover: no device available.\n");
+            failed->ctx.store(ctx, std::memory_order_release);
+            return -1;
+        }
+        {
+            // 故障session中的在途帧不会再归还空位, 其迟到的回调按 ctx->session 判断后忽略
+            std::lock_guard<std::mutex> lock(ctx->sessionLock);
+            ctx->retiredSessions.push_back(failed);
+            session->ctx.store(ctx, std::memory_order_release);
+            ctx->session = session;
+            ctx->cacheHardware_sem.reset(ctx->profile.frameHardwareCacheSize);
+        }
+        if (ctx->scheduler != nullptr) {
+            ctx->scheduler.load()->Detach(&ctx->sched);
+            ctx->scheduler = yitu_codec_sched::dec_scheduler(session->deviceIndex);
+            ctx->scheduler.load()->Attach(&ctx->sched);
+        }
+        ctx->lastDecoderActivityMs = steady_ms();
+        TF_LOG_INFO("Decoder failover %d: device %d -> %d, replay %zu frames.\n", ctx->failoverCount.load(), failed->deviceIndex,
+                    session->deviceIndex, replay->overflowed ? 0 : replay->frames.size());
+
+        int ret = 0;
+        if (replay->overflowed) {
+            TF_LOG_WARN("WARNING: Replay buffer incomplete, skip to the next keyframe.\n");
+            replay->skipToKeyframe = true;
+        } else {
+            for (FrameData *frameData : replay->frames) {
+                ret = submit_frame(ctx, frameData, true);
+                if (ret != 0) {
+                    break;
+                }
+            }
+        }
+        if (ret == 0 && eosSent) {
+            FrameRef end(new FrameData());
+            ret = submit_frame(ctx, end.Get(), true);
+        }
+        if (ret == 0) {
+            return 0;
+        }
+    }
+    if (ctx->failoverDevices.empty()) {
+        TF_LOG_ERROR("ERROR: Decoder session on device %d failed, no failover device.\n", ctx->session->deviceIndex);
+    } else {
+        TF_LOG_ERROR("ERROR: Decoder failover limit %d reached.\n", ctx->maxFailovers);
+    }
+    return -1;
+}
+
+// 无法恢复时任务失败: 排空输入队列让读取线程退出, 代替解码器送出结束帧让保存线程退出
+static void abort_decode(DecContext *ctx, bool endPopped) {
+    ctx->decoderFailed = true;
+    ctx->failed = true;
+    ctx->cancelled = true;
+    ctx->session->ctx.store(nullptr, std::memory_order_release);
+    while (!endPopped) {
+        FrameData *frameData = ctx->inFrameQueue.Pop();
+        endPopped = frameData->GetIsEnd();
+        frameData->Release();
+    }
+    ctx->outFrameQueue.Push(new FrameData());
+    ctx->callbackCompleted = true;
+}
+
+// 跳过的压缩帧不会有回调, 按丢帧处理
+static void discard_frame(DecContext *ctx, FrameData *frameData) {
+    {
+        std::lock_guard<std::mutex> lock(ctx->pendingLock);
+        ctx->pendingFrames.erase(frameData->GetTimestamp());
+    }
+    ctx->droppedFrameCount++;
+    frameData->Release();
+}
+
+void enqueue_frames(DecContext *ctx) {
+    TF_LOG_INFO("Enqueue frames thread start.\n");
+    ctx->lastDecoderActivityMs = steady_ms();
+    // CPU 解码 JPEG 不占用设备, 不参与调度
+    if (ctx->session->jpegSession == nullptr) {
+        ctx->scheduler = yitu_codec_sched::dec_scheduler(ctx->session->deviceIndex);
+        if (ctx->scheduler != nullptr) {
+            ctx->scheduler.load()->Attach(&ctx->sched);
+        }
+    }
+    ReplayBuffer replay;
+    bool failover = !ctx->failoverDevices.empty();
+    bool aborted = false;
+    bool endPopped = false;
+    while (!endPopped) {
+        // 压缩帧加载慢时在此等待
+        FrameData *frameData = ctx->inFrameQueue.Pop();
+        endPopped = frameData->GetIsEnd();
+
+        if (ctx->session->jpegSession != nullptr) {
+            ctx->cacheHardware_sem.wait();
+            decode_jpeg_frame(ctx->session, frameData);
+            frameData->Release();
+            continue;
+        }
+
+        bool sent = false;
+        while (!aborted && !sent) {
+            if (replay.skipToKeyframe && !endPopped && !frameData->GetIsKey()) {
+                break;
+            }
+            if (submit_frame(ctx, frameData, false) == 0) {
+                sent = true;
+            } else if (recover_session(ctx, &replay, false) != 0) {
+                aborted = true;
+            }
+        }
+        if (aborted) {
+            frameData->Release();
+            break;
+        }
+        if (!sent) {
+            discard_frame(ctx, frameData);
+        } else if (failover && !endPopped) {
+            replay.Add(ctx, frameData);
+        } else {
+            frameData->Release();
+        }
+    }
+
+    // EOS 已送入, 等待解码器送出剩余帧, 期间故障同样切换
+    int64_t eosStart = steady_ms();
+    while (!aborted && ctx->session->jpegSession == nullptr && !ctx->callbackCompleted) {
+        if (decoder_hung(ctx, eosStart)) {
+            TF_LOG_ERROR("ERROR: No decoder callback for %d ms after EOS.\n", ctx->hangTimeoutMs);
+            aborted = recover_session(ctx, &replay, true) != 0;
+            continue;
+        }
+        usleep(10000);
+    }
+    if (aborted) {
+        abort_decode(ctx, endPopped);
+    }
+    if (ctx->scheduler != nullptr) {
+        ctx->scheduler.load()->Detach(&ctx->sched);
+        ctx->scheduler = nullptr;
+    }
+    ctx->tfEnqueueCompleted = true;
+    TF_LOG_INFO("Enqueue frames thread complete.\n");
+}
+
+// 由解码帧大小推算平面尺寸: 依次尝试宽高按 16/32/64 对齐的组合, 都不符合时按可见尺寸处理
+static void infer_coded_size(DecContext *ctx, int size) {
+    int width = ctx->videoInfo->width;
+    int height = ctx->videoInfo->height;
+    long bytesPerSample = ctx->videoInfo->bitDepth > 8 ? 2 : 1;
+    ctx->codedWidth = width;
+    ctx->codedHeight = height;
+    if (size == (long)width * height * 3 / 2 * bytesPerSample) {
+        return;
+    }
+    const int aligns[] = {1, 16, 32, 64};
+    for (int wa : aligns) {
+        for (int ha : aligns) {
+            int codedWidth = (width + wa - 1) / wa * wa;
+            int codedHeight = (height + ha - 1) / ha * ha;
+            if (size == (long)codedWidth * codedHeight * 3 / 2 * bytesPerSample) {
+                ctx->codedWidth = codedWidth;
+                ctx->codedHeight = codedHeight;
+                TF_LOG_INFO("Decoder output is %dx%d for %dx%d video.\n", codedWidth, codedHeight, width, height);
+                return;
+            }
+        }
+    }
+    TF_LOG_WARN("WARNING: Unexpected decoded frame size %d for %dx%d video.\n", size, width, height);
+}
+
+ConstFrameView frame_view(const DecContext *ctx, const FrameData *frameData) {
+    int width = ctx->videoInfo->width;
+    int height = ctx->videoInfo->height;
+    int codedWidth = ctx->codedWidth > 0 ? ctx->codedWidth : width;
+    int codedHeight = ctx->codedHeight > 0 ? ctx->codedHeight : height;
+    return ConstFrameView::FromI420(frameData->GetData(), codedWidth, codedHeight, width, height, ctx->videoInfo->bitDepth > 8 ? 2 : 1);
+}
+
+/// 归还一个空位; 回调来自已切换下来的 session 时不归还, 其在途帧已随切换作废
+static bool release_session_slot(DecContext *ctx, DecSession *session) {
+    std::lock_guard<std::mutex> lock(ctx->sessionLock);
+    if (ctx->session != session) {
+        return false;
+    }
+    release_hardware_slot(ctx);
+    return true;
+}
+
+void callback(TFDEC_HANDLE session, void *buffer, int size, unsigned long timestamp, unsigned int flag, void *pUserdata) {
+    DecSession *decSession = (DecSession *)pUserdata;
+    DecContext *ctx = decSession->ctx.load(std::memory_order_acquire);
+    bool stale = ctx == nullptr;
+    if (!stale) {
+        std::lock_guard<std::mutex> lock(ctx->sessionLock);
+        stale = ctx->session != decSession;
+    }
+    if (stale) {
+        // 没有绑定任务的session(或已被切换下来的故障session), 直接归还
+        if (session != NULL) {
+            tfdec_return_output(session, buffer);
+        }
+        return;
+    }
+    ctx->lastDecoderActivityMs = steady_ms();
+    // timestamp 为压缩帧的读取序号
+    if (flag != TFDEC_BUFFER_FLAG_EOS && !ctx->failoverDevices.empty()) {
+        // 故障切换后从关键帧重放, 已送出过的帧丢弃
+        bool duplicate = false;
+        {
+            std::lock_guard<std::mutex> lock(ctx->deliveredLock);
+            if (timestamp >= ctx->deliveredFloor) {
+                duplicate = !ctx->deliveredSequences.insert(timestamp).second;
+            }
+        }
+        if (duplicate) {
+            if (session != NULL) {
+                tfdec_return_output(session, buffer);
+            }
+            release_session_slot(ctx, decSession);
+            ctx->duplicateFrameCount++;
+            return;
+        }
+    }
+    PendingFrame pending = {timestamp, std::chrono::steady_clock::time_point()};
+    if (flag != TFDEC_BUFFER_FLAG_EOS) {
+        std::lock_guard<std::mutex> lock(ctx->pendingLock);
+        auto it = ctx->pendingFrames.find(timestamp);
+        if (it != ctx->pendingFrames.end()) {
+            pending = it->second;
+            ctx->pendingFrames.erase(it);
+        }
+    }
+    // 解码输出存入内存, 时间戳还原为源视频 pts
+    FrameData *frameData = new FrameData((unsigned char *)buffer, size, pending.pts, false);
+    // 归还output buffer 解码器中数据-1; CPU 解码时 session 为 NULL, buffer 由 DecSession 持有
+    if (session != NULL) {
+        tfdec_return_output(session, buffer);
+    }
+    release_session_slot(ctx, decSession);
+
+    if (flag == TFDEC_BUFFER_FLAG_EOS) {
+        frameData->SetIsEnd(true);
+    } else {
+        frameData->SetIngressTime(pending.ingressTime);
+        // 保存线程经队列取帧后才读取, 无需另加锁
+        if (ctx->codedWidth == 0) {
+            infer_coded_size(ctx, size);
+        }
+        ctx->decodedFrameCount++;
+        ctx->decodedBytes += size;
+        TF_LOG_DEBUG("Frame decoded. count: %d, Timestamp: %ld\n", ctx->decodedFrameCount.load(), pending.pts);
+    }
+    // 入输出队列, 队列满时阻塞解码器回调线程; 入队后帧可能已被保存线程释放, 先取结束标记
+    bool isEnd = frameData->GetIsEnd();
+    ctx->callbackBlocked = true;
+    if (!ctx->outFrameQueue.Push(frameData)) {
+        // 超出内存预算被丢弃
+        ctx->droppedFrameCount++;
+        frameData->Release();
+    }
+    ctx->callbackBlocked = false;
+    ctx->lastDecoderActivityMs = steady_ms();
+    if (isEnd) {
+        ctx->callbackCompleted = true;
+    }
+}
+
+DeviceAdmission gDeviceAdmission;
+
+void DeviceAdmission::SetDefaultCapacity(const DeviceCapacity &capacity) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mDefaultCapacity = capacity;
+    mCv.notify_all();
+}
+
+void DeviceAdmission::SetCapacity(int deviceIndex, const DeviceCapacity &capacity) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mCapacities[deviceIndex] = capacity;
+    mCv.notify_all();
+}
+
+void DeviceAdmission::SetWaitTimeout(int timeoutMs) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mWaitTimeoutMs = timeoutMs;
+}
+
+void DeviceAdmission::SetReclaim(std::function<void(int deviceIndex)> reclaim) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mReclaim = reclaim;
+}
+
+// 在锁内调用; 设备上没有 session 时总是放行, 单个 session 超过内存容量也能创建
+bool DeviceAdmission::fits(int deviceIndex, long memoryBytes) {
+    auto it = mCapacities.find(deviceIndex);
+    const DeviceCapacity &capacity = it != mCapacities.end() ? it->second : mDefaultCapacity;
+    DeviceUsage &usage = mUsages[deviceIndex];
+    if (usage.measuredSessions > 0 && steady_ms() - usage.measuredAtMs > ADMIT_MEASURE_TTL_MS) {
+        TF_LOG_INFO("Decoder device %d measured capacity %d expired.\n", deviceIndex, usage.measuredSessions);
+        usage.measuredSessions = 0;
+    }
+    int maxSessions = capacity.maxSessions;
+    if (usage.measuredSessions > 0 && (maxSessions <= 0 || usage.measuredSessions < maxSessions)) {
+        maxSessions = usage.measuredSessions;
+    }
+    if (usage.sessions == 0) {
+        return true;
+    }
+    return (maxSessions <= 0 || usage.sessions < maxSessions) &&
+           (capacity.maxMemoryBytes <= 0 || usage.memoryBytes + memoryBytes <= capacity.maxMemoryBytes);
+}
+
+bool DeviceAdmission::Enter(int deviceIndex, long memoryBytes, int maxWaitMs) {
+    std::unique_lock<std::mutex> lock(mLock);
+    if (!fits(deviceIndex, memoryBytes) && mReclaim) {
+        // 先释放该设备上的空闲 session, 销毁时会回到 Leave, 不能持锁
+        std::function<void(int)> reclaim = mReclaim;
+        lock.unlock();
+        reclaim(deviceIndex);
+        lock.lock();
+    }
+    DeviceUsage &usage = mUsages[deviceIndex];
+    if (!fits(deviceIndex, memoryBytes)) {
+        bool admitted = false;
+        int timeoutMs = mWaitTimeoutMs;
+        if (maxWaitMs >= 0 && (timeoutMs < 0 || maxWaitMs < timeoutMs)) {
+            timeoutMs = maxWaitMs;
+        }
+        if (timeoutMs != 0) {
+            TF_LOG_INFO("Decoder device %d at capacity (%d sessions, %ld bytes), waiting.\n", deviceIndex, usage.sessions, usage.memoryBytes);
+            usage.waiting++;
+            auto ready = [this, deviceIndex, memoryBytes] { return fits(deviceIndex, memoryBytes); };
+            if (timeoutMs < 0) {
+                mCv.wait(lock, ready);
+                admitted = true;
+            } else {
+                admitted = mCv.wait_for(lock, std::chrono::milliseconds(timeoutMs), ready);
+            }
+            usage.waiting--;
+        }
+        if (!admitted) {
+            usage.rejected++;
+            return false;
+        }
+    }
+    usage.sessions++;
+    usage.memoryBytes += memoryBytes;
+    return true;
+}
+
+void DeviceAdmission::Leave(int deviceIndex, long memoryBytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    DeviceUsage &usage = mUsages[deviceIndex];
+    usage.sessions--;
+    usage.memoryBytes -= memoryBytes;
+    mCv.notify_all();
+}
+
+void DeviceAdmission::Created(int deviceIndex) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mUsages[deviceIndex].failStreak = 0;
+}
+
+bool DeviceAdmission::CreateFailed(int deviceIndex, long memoryBytes) {
+    std::lock_guard<std::mutex> lock(mLock);
+    DeviceUsage &usage = mUsages[deviceIndex];
+    usage.sessions--;
+    usage.memoryBytes -= memoryBytes;
+    // 其他原因(参数不支持/驱动偶发错误)的单次失败不记为容量, 同一 session 数下连续失败才记录
+    if (usage.failStreak == 0 || usage.failSessions != usage.sessions) {
+        usage.failStreak = 0;
+        usage.failSessions = usage.sessions;
+    }
+    usage.failStreak++;
+    if (usage.sessions > 0 && usage.failStreak >= ADMIT_MEASURE_FAILURES &&
+        (usage.measuredSessions == 0 || usage.sessions < usage.measuredSessions)) {
+        usage.measuredSessions = usage.sessions;
+        usage.measuredAtMs = steady_ms();
+        usage.failStreak = 0;
+        TF_LOG_INFO("Decoder device %d capacity measured: %d sessions.\n", deviceIndex, usage.measuredSessions);
+    }
+    mCv.notify_all();
+    return usage.sessions > 0;
+}
+
+DeviceUsage DeviceAdmission::Usage(int deviceIndex) {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mUsages[deviceIndex];
+}
+
+long session_memory_bytes(int width, int height, int outBufferNum, bool lite) {
+    long frameBytes = (long)width * height * 3 / 2;
+    return frameBytes * (outBufferNum + (lite ? 2 : 8));
+}
+
+DecSession *create_session(int deviceIndex, TFDEC_DECODER_ROLE role, int width, int height, int outBufferNum, bool lite,
+                           int maxWaitMs) {
+    // id -> useDev
+    std::string useDev = "/dev/mv500";
+    if (deviceIndex > 1) {
+        useDev = useDev + "-" + std::to_string(deviceIndex);
+    }
+    DecSession *session = new DecSession();
+    session->deviceIndex = deviceIndex;
+    session->role = role;
+    session->width = width;
+    session->height = height;
+    session->outBufferNum = outBufferNum;
+    session->lite = lite;
+    session->admittedBytes = 0;
+    session->jpegSession = nullptr;
+    if (jpeg_needs_cpu(role, width, height)) {
+        session->handle = NULL;
+        session->jpegSession = tfg::TFSession::CreateSession();
+        TF_LOG_INFO("Create CPU jpeg session for %dx%d (hardware limit %dx%d): %p\n", width, height, MAX_HW_JPEG_Width, MAX_HW_JPEG_Height,
+                    session->jpegSession);
+        if (session->jpegSession == nullptr) {
+            TF_LOG_ERROR("ERROR: Session create failed.\n");
+            delete session;
+            return NULL;
+        }
+        return session;
+    }
+    long bytes = session_memory_bytes(width, height, outBufferNum, lite);
+    for (int attempt = 0;; attempt++) {
+        if (!gDeviceAdmission.Enter(deviceIndex, bytes, maxWaitMs)) {
+            TF_LOG_ERROR("ERROR: Decoder device %d at capacity, session rejected.\n", deviceIndex);
+            delete session;
+            return NULL;
+        }
+        if (lite) {
+            session->handle = tfdec_create_lite(useDev.c_str(), role, width, height, outBufferNum, callback, session);
+        } else {
+            session->handle = tfdec_create(useDev.c_str(), role, width, height, outBufferNum, callback, session);
+        }
+        TF_LOG_INFO("Create session done. Session handle: %p%s\n", session->handle, lite ? " (lite)" : "");
+        if (session->handle != NULL) {
+            gDeviceAdmission.Created(deviceIndex);
+            break;
+        }
+        // 可能是设备通道用尽: 设备上还有其他 session 时排队等其释放后重试, 重试次数有限
+        if (!gDeviceAdmission.CreateFailed(deviceIndex, bytes) || attempt >= ADMIT_MAX_CREATE_RETRIES) {
+            TF_LOG_ERROR("ERROR: Session create failed.\n");
+            delete session;
+            return NULL;
+        }
+    }
+    session->admittedBytes = bytes;
+    return session;
+}
+
+void destroy_session(DecSession *session) {
+    TF_LOG_INFO("Destroy TF session.\n");
+    if (session->handle != NULL) {
+        tfdec_destroy(session->handle);
+        gDeviceAdmission.Leave(session->deviceIndex, session->admittedBytes);
+    }
+    if (session->jpegSession != nullptr) {
+        session->jpegSession->Destroy();
+    }
+    delete session;
+    TF_LOG_INFO("Destroy TF session done.\n");
+}
+
+int read_video_file(std::string fileName, VideoInfo *videoInfo) {
+    const char *filePath = fileName.c_str();
+    AVCodec *codec = NULL;
+
+    TFDEC_DECODER_ROLE role = DECODER_H264;
+
+    if (avformat_open_input(&videoInfo->avFormatContext, filePath, NULL, NULL) < 0) {
+        TF_LOG_INFO("can't open file %s\n", filePath);
+        return -1;
+    }
+
+    if (avformat_find_stream_info(videoInfo->avFormatContext, NULL) < 0) {
+        TF_LOG_INFO("can't recognise stream type.\n");
+    }
+
+    videoInfo->videoIndex = av_find_best_stream(videoInfo->avFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (videoInfo->videoIndex < 0) {
+        TF_LOG_INFO("no video stream in this file\n");
+        avformat_close_input(&videoInfo->avFormatContext);
+        return -1;
+    }
+    TF_LOG_INFO("video index: %d\n", videoInfo->videoIndex);
+
+    auto codecpar = videoInfo->avFormatContext->streams[videoInfo->videoIndex]->codecpar;
+    videoInfo->width = codecpar->width;
+    videoInfo->height = codecpar->height;
+    videoInfo->role = DECODER_H264;
+    // 像素格式未知时按 profile 判断 HEVC Main10
+    const AVPixFmtDescriptor *pixDesc = av_pix_fmt_desc_get((AVPixelFormat)codecpar->format);
+    videoInfo->bitDepth = pixDesc != nullptr ? pixDesc->comp[0].depth : 8;
+    if (pixDesc == nullptr && codecpar->codec_id == AV_CODEC_ID_HEVC && codecpar->profile == FF_PROFILE_HEVC_MAIN_10) {
+        videoInfo->bitDepth = 10;
+    }
+    if (videoInfo->bitDepth > 8) {
+        TF_LOG_INFO("---%d bit---\n", videoInfo->bitDepth);
+    }
+    switch (codecpar->codec_id) {
+        case AV_CODEC_ID_MPEG4:
+            videoInfo->role = DECODER_MPG4;
+            TF_LOG_INFO("---mpg4---\n");
+            if (codecpar->codec_tag == MKTAG('m', 'p', '4', 'v')) {
+                uint32_t head_size = codecpar->extradata_size;
+                uint8_t *stream_head = (uint8_t *)malloc(head_size);
+                memcpy(stream_head, codecpar->extradata, head_size);
+                free(stream_head);
+            }
+            break;
+
+        case AV_CODEC_ID_H264:
+            TF_LOG_INFO("---h264---\n");
+            videoInfo->role = DECODER_H264;
+            if (codecpar->codec_tag == MKTAG('a', 'v', 'c', '1') || codecpar->codec_tag == 0) {
+                TF_LOG_INFO("---H264 : need_filter---\n");
+                videoInfo->gNeedFilter = true;
+            }
+            break;
+
+        case AV_CODEC_ID_HEVC:
+            TF_LOG_INFO("---hevc---\n");
+            videoInfo->role = DECODER_HEVC;
+            if (codecpar->codec_tag == MKTAG('h', 'e', 'v', '1' || codecpar->codec_tag == 0)) {
+                TF_LOG_INFO("---H265 : need_filter---\n");
+                videoInfo->gNeedFilterH265 = true;
+            }
+            break;
+
+        case AV_CODEC_ID_VP8:
+            TF_LOG_INFO("---vp8---");
+            videoInfo->role = DECODER_VP8;
+            break;
+
+        case AV_CODEC_ID_MPEG2VIDEO:
+            TF_LOG_INFO("---mpeg2---");
+            videoInfo->role = DECODER_MPG2;
+            break;
+
+        case AV_CODEC_ID_MJPEG:
+            // 每个packet是一张完整的 JPEG, 不需要过滤; 超出硬件尺寸的由 create_session 改为 CPU 解码
+            TF_LOG_INFO("---mjpeg---\n");
+            videoInfo->role = DECODER_JPEG;
+            if (jpeg_needs_cpu(DECODER_JPEG, videoInfo->width, videoInfo->height)) {
+                TF_LOG_INFO("---MJPEG : %dx%d exceeds hardware limit, cpu decode---\n", videoInfo->width, videoInfo->height);
+            }
+            break;
+
+        default:
+            TF_LOG_WARN("WARNING: codec %s is not supported by tfdec, decoding as h264.\n", avcodec_get_name(codecpar->codec_id));
+            break;
+    }
+
+    return 0;
+}
+
+void close_video_file(VideoInfo *videoInfo) {
+    if (videoInfo->avFormatContext != nullptr) {
+        avformat_close_input(&videoInfo->avFormatContext);
+    }
+}
+
+// 写出可见区域, 带对齐填充时逐行写
+static void write_view(std::fstream *output, const ConstFrameView &view) {
+    if (view.IsPacked()) {
+        output->write((const char *)view.planes[0], (size_t)view.width * view.height * 3 / 2 * view.bytesPerSample);
+        return;
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        size_t rowBytes = (size_t)view.PlaneWidth(plane) * view.bytesPerSample;
+        for (int r = 0; r < view.PlaneHeight(plane); r++) {
+            output->write((const char *)view.planes[plane] + (size_t)r * view.strides[plane], rowBytes);
+        }
+    }
+}
+
+/// 每个旁路队列各取得一个引用; 结束帧必定入队, 普通帧被内存预算拒绝时计入丢帧
+static void push_taps(DecContext *ctx, FrameData *frameData) {
+    for (FrameQueue *tap : ctx->frameTaps) {
+        if (!tap->Push(frameData->Retain())) {
+            frameData->Release();
+            ctx->droppedFrameCount++;
+        }
+    }
+}
+
+void save_file(DecContext *ctx) {
+    std::string filename = ctx->outputFileName;
+    std::fstream gOutputFStream;
+    if (ctx->encoder == nullptr && ctx->frameSink == nullptr) {
+        gOutputFStream.open(filename, std::ios::out | std::ios::binary);
+        if (!gOutputFStream.is_open() || !gOutputFStream.good()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", filename.c_str());
+            ctx->failed = true;
+        }
+    }
+
+    // 丢弃静止帧后码流不再是固定帧率, 保留帧的显示时间(ms)按 mkvmerge timestamp v2 格式另存, 封装时据此恢复时间轴
+    std::fstream timestampFStream;
+    AVStream *stream = ctx->videoInfo->avFormatContext->streams[ctx->videoInfo->videoIndex];
+    int64_t startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    if (ctx->staticFilter.Enabled() || ctx->writeTimestamps) {
+        // 剪辑等分段编码时追加到同一个文件
+        bool append = ctx->encoder != nullptr && ctx->encoder->appendOutput;
+        std::string timestampFileName = filename + ".timestamps";
+        timestampFStream.open(timestampFileName, std::ios::out | (append ? std::ios::app : std::ios::trunc));
+        if (!timestampFStream.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", timestampFileName.c_str());
+            ctx->failed = true;
+        } else if (timestampFStream.tellp() == 0) {
+            timestampFStream << "# timestamp format v2\n";
+        }
+    }
+
+    auto lastProgress = std::chrono::steady_clock::now();
+    while (true) {
+        // 等待解码输出
+        FrameData *frameData = ctx->outFrameQueue.Pop();
+
+        if (frameData->GetIsEnd()) {
+            push_taps(ctx, frameData);
+            if (ctx->frameSink != nullptr) {
+                // 结束帧也转交下游, 通知其本路已结束
+                ctx->frameSink->Push(frameData);
+            } else {
+                frameData->Release();
+            }
+            if (ctx->encoder != nullptr && yitu_codec_enc::flush_encoder(ctx->encoder) != 0) {
+                ctx->encoderFlushFailed = true;
+            }
+            if (ctx->progressCallback) {
+                ctx->progressCallback(ctx);
+            }
+            ctx->decodeCompleted = true;
+            TF_LOG_INFO("save done!\n");
+            break;
+        }
+        if (ctx->frameSelector && !ctx->frameSelector(ctx, frameData)) {
+            frameData->Release();
+            continue;
+        }
+        // 直播模式下丢弃已超过延迟上限的帧, 让后续帧追上实时
+        bool hasIngressTime = frameData->GetIngressTime().time_since_epoch().count() != 0;
+        if (ctx->profile.maxFrameLatencyMs > 0 && hasIngressTime &&
+            std::chrono::steady_clock::now() - frameData->GetIngressTime() > std::chrono::milliseconds(ctx->profile.maxFrameLatencyMs)) {
+            ctx->droppedFrameCount++;
+            frameData->Release();
+            continue;
+        }
+        ctx->savedFrameCount++;
+        TF_LOG_DEBUG("save file frame size: %d\n", ctx->savedFrameCount.load());
+
+        // auto ret = tfg::I420_Planar_ScaleEx((uint8_t *)frameData->GetData(), nullptr, 1920, 1080,
+        //                          (uint8_t *)frameData->GetData(), nullptr, 1280, 720, tfg::INTERP_Bilinear);
+        if (ctx->frameCallback) {
+            ctx->frameCallback(ctx, frameData);
+        }
+        ConstFrameView view = frame_view(ctx, frameData);
+        bool isStatic = ctx->staticFilter.IsStatic(view.planes[0], view.width, view.height, view.strides[0]);
+        if (isStatic) {
+            ctx->staticFrameCount++;
+        } else if (ctx->encoder != nullptr) {
+            // 编码失败后继续消费队列直到结束帧, 保证解码器能正常冲刷
+            if (!ctx->failed && yitu_codec_enc::encode_view(ctx->encoder, view, (int64_t)frameData->GetTimestamp()) != 0) {
+                ctx->failed = true;
+            }
+        } else if (gOutputFStream.is_open()) {
+            write_view(&gOutputFStream, view);
+        }
+        if (timestampFStream.is_open() && !isStatic) {
+            double ms = ((int64_t)frameData->GetTimestamp() - startPts) * av_q2d(stream->time_base) * 1000;
+            timestampFStream << std::fixed << std::setprecision(3) << ms << "\n";
+        }
+        if (hasIngressTime) {
+            ctx->latency.Add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameData->GetIngressTime()).count());
+        }
+        if (!isStatic) {
+            push_taps(ctx, frameData);
+        }
+        if (ctx->frameSink != nullptr && !isStatic) {
+            // 转交下游后由下游释放, 下游队列满时在此阻塞
+            if (!ctx->frameSink->Push(frameData)) {
+                ctx->droppedFrameCount++;
+                frameData->Release();
+            }
+        } else {
+            frameData->Release();
+        }
+
+        if (ctx->progressCallback) {
+            auto now = std::chrono::steady_clock::now();
+            if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastProgress).count() >= ctx->progressIntervalMs) {
+                lastProgress = now;
+                ctx->progressCallback(ctx);
+            }
+        }
+    }
+
+    if (gOutputFStream.is_open()) {
+        gOutputFStream.close();
+    }
+    if (ctx->staticFilter.Enabled()) {
+        TF_LOG_INFO("Static frames skipped: %d of %d.\n", ctx->staticFrameCount.load(), ctx->savedFrameCount.load());
+    }
+}
+
+}  // namespace yitu_codec_dec
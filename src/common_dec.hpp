@@ -1,7 +1,16 @@
+#ifndef COMMON_DEC_HPP
+#define COMMON_DEC_HPP
+
 #include "common.hpp"
+#include "common_enc.hpp"
+#include "scheduler.hpp"
 
 using namespace yitu_codec_common;
 
+namespace yitu_codec_mux {
+class PacketQueue;
+}
+
 namespace yitu_codec_dec {
 
 // 视频文件信息
@@ -13,234 +22,255 @@ struct VideoInfo {
     TFDEC_DECODER_ROLE role;
     bool gNeedFilter;
     bool gNeedFilterH265;
+    /// 源视频位深, 大于 8 时 tfdec 输出低位对齐的 16 bit I420, 每帧 width*height*3 字节
+    int bitDepth;
 };
-// 解码结果统计
-int gLoadedFrameCount = 0;
-// 入解码器统计
-int gTfEnqueuedFrameCount = 0;
-// 解码完成flag
-bool gLoadCompleted = false;
-bool gTfEnqueueCompleted = false;
-bool gCallbackCompleted = false;
-bool gDecodeCompleted = false;
-
-int gDecodedFrameCount = 0;
-int gDecodedBytes = 0;
-
-// 输入输出帧数据列表
-std::queue<FrameData *> inFrameQueue;
-std::queue<FrameData *> outFrameQueue;
-/// 队列锁
-std::mutex inFrameQueueLock;
-std::mutex outFrameQueueLock;
-
-// 输入输出信号量控制
-Semaphore gInFrameCache_sem;
-Semaphore gOutFrameCache_sem;
-// PV用于控制硬解码单元buffer中的帧数
-Semaphore gCacheHardware_sem;
-// 控制器session
-TFDEC_HANDLE gSessionHandle;
-
-bool gDebugEnabled;
-
-// 线程声明
-void load_frames(VideoInfo *videoInfo);
-void enqueue_frames();
-void save_file();
-
-/// @brief 启动解码器 并启动解码 输入输出进程
-/// @param session 解码器控制器session
-/// @param inFrameCacheSize 内存帧缓存数量
-/// @param outFrameCacheSize 内存帧缓存数量
-/// @param frameHardwareCacheSize  tf解码器缓存数量
-/// @return
-int run_dec(VideoInfo *videoInfo, TFDEC_HANDLE session, int inFrameCacheSize, int outFrameCacheSize, int frameHardwareCacheSize) {
-    gSessionHandle = session;
-    // 缓存控制 信号量初始化
-    while (inFrameCacheSize--) {
-        gInFrameCache_sem.notify();
-    }
-    while (outFrameCacheSize--) {
-        gOutFrameCache_sem.notify();
-    }
-    while (frameHardwareCacheSize--) {
-        gCacheHardware_sem.notify();
-    }
-    // 数量列表清理
-    while (!inFrameQueue.empty()) inFrameQueue.pop();
-    while (!outFrameQueue.empty()) outFrameQueue.pop();
-
-    std::thread loadFramesThread;
-    loadFramesThread = std::thread(&load_frames, videoInfo);
-
-    std::thread enqueueFramesThread;
-    enqueueFramesThread = std::thread(&enqueue_frames);
-
-    std::thread saveFileThread;
-    saveFileThread = std::thread(&save_file);
-
-    loadFramesThread.join();
-    enqueueFramesThread.join();
-    saveFileThread.join();
-
-    // 压缩帧都已经加载完，且都已经
-    // 等待所有解码的回调完
-    int i = 0;
-    while (!gDecodeCompleted) {
-        if (((i++) % 100) == 0) {
-            printf("Waiting for decoding callback: Loaded: %d, Enqueued: %d, Decoded: %d.\n", gLoadedFrameCount,
-                   gTfEnqueuedFrameCount, gDecodedFrameCount);
-        }
-        usleep(10000);
-    }
-    printf("Decode complete: Loaded: %d, Enqueued: %d, Decoded: %d.\n", gLoadedFrameCount, gTfEnqueuedFrameCount,
-           gDecodedFrameCount);
 
-    return 0;
-}
+struct DecContext;
 
-void load_frames(VideoInfo *videoInfo) {
-    printf("Load frames thread start.\n");
-
-    // 准备过滤器
-    AVBSFContext *bsf_ctx = nullptr;
-    if (videoInfo->gNeedFilter || videoInfo->gNeedFilterH265) {
-        std::string filter_name;
-        if (videoInfo->gNeedFilter) filter_name = "h264_mp4toannexb";
-        if (videoInfo->gNeedFilterH265) filter_name = "hevc_mp4toannexb";
-        const AVBitStreamFilter *filter = av_bsf_get_by_name(filter_name.c_str());
-        int ret = av_bsf_alloc(filter, &bsf_ctx);
-        if (ret < 0) {
-            // 分配比特流过滤器上下文失败
-            printf("ERROR: Failed to allocate bitstream filter context.\n");
-            exit(-1);
-        }
-    }
-    // 准备读取数据
-    AVPacket *pAvPacket;
-    pAvPacket = av_packet_alloc();
-
-    int totalFrameCount = 0, totalVideoFrameCount = 0;
-    while (true) {
-        if (av_read_frame(videoInfo->avFormatContext, pAvPacket) >= 0) {
-            if (pAvPacket->stream_index == videoInfo->videoIndex) {
-                totalVideoFrameCount++;
-                // 执行packet过滤
-                if (videoInfo->gNeedFilter || videoInfo->gNeedFilterH265) {
-                    if (av_bsf_send_packet(bsf_ctx, pAvPacket) != 0) {
-                        av_packet_unref(pAvPacket);
-                        continue;
-                    }
-                    while (av_bsf_receive_packet(bsf_ctx, pAvPacket) != 0) {
-                        continue;
-                    }
-                }
-
-                FrameData *frameData = new FrameData(pAvPacket->data, pAvPacket->size, pAvPacket->pts, false);
-                gLoadedFrameCount++;
-
-                gInFrameCache_sem.wait();
-                inFrameQueueLock.lock();
-                inFrameQueue.push(frameData);
-                inFrameQueueLock.unlock();
-
-                if (gDebugEnabled) {
-                    printf("Frame loaded. %d. Timestamp: %ld\n", gLoadedFrameCount, frameData->GetTimestamp());
-                }
-            }
-            totalFrameCount++;
-
-        } else {
-            // 无数据或者错误
-            break;
-        }
-        av_packet_unref(pAvPacket);
+// 解码器session, 创建时作为user_data传给tfdec, 回调中据此找到当前绑定的解码任务
+// session可以在多个解码任务之间复用, 每个任务开始前重新绑定ctx
+struct DecSession {
+    TFDEC_HANDLE handle;
+    int deviceIndex;
+    TFDEC_DECODER_ROLE role;
+    int width;
+    int height;
+    int outBufferNum;
+    /// 以 tfdec_create_lite 创建, 内存占用更少, 用于高密度多路
+    bool lite;
+    /// 计入设备准入的估算内存, 销毁时归还
+    long admittedBytes;
+    /// 解码器回调线程读取, 绑定/切换任务的线程写入; 读取用 acquire, 写入用 release
+    std::atomic<DecContext *> ctx{nullptr};
+    /// JPEG 超出硬件解码尺寸时不创建 tfdec(handle 为 NULL), 改由 CPU 逐帧解码, 结果同样经 callback 送出
+    tfg::TFSession *jpegSession;
+    std::vector<uint8_t> jpegBuffer;
+};
+
+/// JPEG/MJPEG 宽或高超过 MAX_HW_JPEG_Width x MAX_HW_JPEG_Height 时硬件无法解码, 需走 CPU
+bool jpeg_needs_cpu(TFDEC_DECODER_ROLE role, int width, int height);
+
+// 读取线程对每个视频packet的处理方式
+enum PacketAction {
+    PACKET_DECODE = 0,
+    /// 跳过该packet, 继续读取
+    PACKET_SKIP,
+    /// 停止读取, 随后送入结束帧
+    PACKET_STOP
+};
+
+// 缓存策略
+// 批处理: 按帧数缓存, 追求吞吐; 直播: 按字节数与延迟限制缓存, 追求低延迟
+struct BufferProfile {
+    /// 压缩帧队列 帧数/字节数上限, 0 表示不限
+    int inFrameCacheSize;
+    long inFrameCacheBytes;
+    /// 解码帧队列 帧数/字节数上限, 0 表示不限
+    int outFrameCacheSize;
+    long outFrameCacheBytes;
+    /// 硬件解码单元中同时在途的帧数
+    int frameHardwareCacheSize;
+    /// tfdec 输出buffer数
+    int outBufferNum;
+    /// 解码帧从读取到送出的延迟上限, 超过的帧直接丢弃, 0 表示不丢帧
+    int maxFrameLatencyMs;
+    /// 按时间戳节奏读取输入, 以文件模拟实时源时使用
+    bool paceInput;
+    /// 解码帧超出进程内存预算时阻塞解码回调, 或直接丢帧; 压缩帧丢弃会破坏参考关系, 总是阻塞
+    BudgetPolicy outBudgetPolicy;
+};
+
+/// 批处理缓存策略, 即原先的 512/512/32, out_buffer_num=4
+BufferProfile batch_buffer_profile();
+
+/// 高密度缓存策略, 每路只保留保证硬件不空闲的最少缓存, 与 lite session 一起用于单卡几十路低分辨率流
+BufferProfile density_buffer_profile();
+
+/// @brief 直播缓存策略, 在保证实时的前提下取最小缓存
+/// @param width 视频宽
+/// @param height 视频高
+/// @param frameRate 帧率, 未知时传0按30处理
+/// @param latencyTargetMs 端到端延迟目标
+BufferProfile live_buffer_profile(int width, int height, double frameRate, int latencyTargetMs);
+
+// 已送入解码器、尚未输出的压缩帧的源视频 pts 与读取时间
+struct PendingFrame {
+    unsigned long pts;
+    std::chrono::steady_clock::time_point ingressTime;
+};
+
+// 单路解码任务上下文, 一个任务对应一个输入文件
+// 原先的全局统计量/队列/信号量都放在这里, 同一进程内可以先后运行多个任务
+struct DecContext {
+    DecContext(const BufferProfile &profile)
+        : profile(profile),
+          inFrameQueue(profile.inFrameCacheSize, profile.inFrameCacheBytes),
+          outFrameQueue(profile.outFrameCacheSize, profile.outFrameCacheBytes),
+          cacheHardware_sem(profile.frameHardwareCacheSize) {
+        inFrameQueue.SetAccount(&memory, BUDGET_BLOCK);
+        outFrameQueue.SetAccount(&memory, profile.outBudgetPolicy);
     }
-    // 插入结束帧，此帧不计入视频帧统计
-    FrameData *frameData = new FrameData();
-    frameData->SetIsEnd(true);
-    inFrameQueueLock.lock();
-    inFrameQueue.push(frameData);
-    inFrameQueueLock.unlock();
-
-    if (gDebugEnabled) {
-        printf("Frame loaded. %d\n", gLoadedFrameCount);
+
+    BufferProfile profile;
+    VideoInfo *videoInfo = nullptr;
+    DecSession *session = nullptr;
+    /// 不为空时解码结果送入编码器, 否则以I420原始数据写入 outputFileName
+    yitu_codec_enc::EncContext *encoder = nullptr;
+    std::string outputFileName;
+    /// 不为空时解码帧(连同结束帧)转交该队列, 由下游取出后释放, 既不编码也不写文件; 用于多路合成
+    FrameQueue *frameSink = nullptr;
+    /// 旁路队列, 每个保存的解码帧(连同结束帧)以共享引用送入每个队列, 只增加引用计数不拷贝, 由各下游取出后 Release
+    /// 与编码/写文件/frameSink 同时进行, 下游只读(需要修改时先 MakeWritable); 静态帧不送入; 旁路队列满时保存线程阻塞
+    /// 设置了内存预算的队列按整帧大小各自计入; Transcoder 的逐帧回调经此送出
+    std::vector<FrameQueue *> frameTaps;
+    /// 不为空时读取线程把音频/字幕 packet(不解码)拷贝送入该队列, 读取结束时送入结束标记; 用于封装输出
+    yitu_codec_mux::PacketQueue *auxPacketSink = nullptr;
+    /// 解码输出的平面尺寸, 解码器按宏块/CTU 对齐输出时大于可见尺寸(如 1920x1088); 由第一个解码帧的大小推算
+    int codedWidth = 0;
+    int codedHeight = 0;
+
+    // 解码结果统计
+    std::atomic<int> loadedFrameCount{0};
+    // 入解码器统计
+    std::atomic<int> tfEnqueuedFrameCount{0};
+    std::atomic<int> decodedFrameCount{0};
+    std::atomic<long> decodedBytes{0};
+    std::atomic<int> savedFrameCount{0};
+
+    // 解码完成flag
+    std::atomic<bool> loadCompleted{false};
+    std::atomic<bool> tfEnqueueCompleted{false};
+    std::atomic<bool> callbackCompleted{false};
+    std::atomic<bool> decodeCompleted{false};
+    // 取消标记, 置位后停止读取, 已入队的帧照常解码完成
+    std::atomic<bool> cancelled{false};
+    // 输出文件打开失败等错误
+    std::atomic<bool> failed{false};
+    // 编码器冲刷超时, 编码session不可复用
+    std::atomic<bool> encoderFlushFailed{false};
+
+    /// 本任务计入 gMemoryBudget 的内存: 排队中的帧与编码中间buffer, 需先于队列构造
+    MemoryAccount memory;
+    // 输入输出帧数据列表, 按 profile 限制帧数与字节数
+    FrameQueue inFrameQueue;
+    FrameQueue outFrameQueue;
+    // PV用于控制硬解码单元buffer中的帧数
+    Semaphore cacheHardware_sem;
+    /// 开启设备调度时, 送帧前还需向当前设备的调度器申请空位, 回调时与 cacheHardware_sem 一起归还; 类别与权重由任务设置
+    yitu_codec_sched::SchedClient sched;
+    std::atomic<yitu_codec_sched::DeviceScheduler *> scheduler{nullptr};
+
+    /// 压缩帧以单调递增的读取序号作为 tfdec 时间戳(裸流的 pts 可能缺失或重复), 回调中按序号取回 pts 与读取时间
+    std::atomic<unsigned long> nextSequence{0};
+    std::map<unsigned long, PendingFrame> pendingFrames;
+    std::mutex pendingLock;
+    /// 端到端延迟(读取压缩帧 -> 解码帧写出/送入编码器), 仅在保存线程中更新
+    LatencyStats latency;
+    /// 超过延迟上限或内存预算被丢弃的解码帧数
+    std::atomic<int> droppedFrameCount{0};
+
+    /// 解码session故障切换: tfdec_enqueue_buffer 持续失败或返回内部错误, 或在途帧超过 hangTimeoutMs 没有任何回调时,
+    /// 依次在 failoverDevices 中的设备上重建session, 从最近的关键帧起重新送入压缩帧, 已送出的解码帧不再重复送出
+    /// failoverDevices 为空时不切换, 任务失败; 切换后 ctx->session 为新session, 故障session由 run_dec 结束时销毁
+    std::vector<int> failoverDevices;
+    int maxFailovers = 3;
+    int hangTimeoutMs = 10000;
+    /// 重放buffer帧数上限, 超出(GOP 过长)时切换后跳到下一个关键帧, 其间的帧丢失
+    int replayBufferFrames = 600;
+    std::atomic<int> failoverCount{0};
+    /// 切换后重放产生的重复解码帧数(已丢弃)
+    std::atomic<int> duplicateFrameCount{0};
+    /// 故障且无法切换, session不可复用
+    std::atomic<bool> decoderFailed{false};
+    /// 解码器最近一次回调或成功入队的时间(steady_clock 毫秒), 回调阻塞在输出队列上时不算故障
+    std::atomic<int64_t> lastDecoderActivityMs{0};
+    std::atomic<bool> callbackBlocked{false};
+    /// 开启故障切换时记录已送出的解码帧序号, 用于丢弃重放产生的重复帧; 小于 deliveredFloor 的帧不会重放, 不记录
+    /// deliveredFloor 随重放buffer前移, 记录的序号不超过重放buffer与在途帧的范围
+    std::set<unsigned long> deliveredSequences;
+    unsigned long deliveredFloor = 0;
+    std::mutex deliveredLock;
+    /// 切换 session 与回调归还空位互斥, 故障 session 迟到的回调不会归还新 session 的空位
+    std::mutex sessionLock;
+    /// 切换下来的故障session
+    std::vector<DecSession *> retiredSessions;
+
+    /// 静止帧过滤, 开启时与上一保留帧相同的帧不编码/不写出, 保留帧的时间戳写入 outputFileName + ".timestamps"
+    yitu_codec_analysis::StaticFrameFilter staticFilter;
+    std::atomic<int> staticFrameCount{0};
+    /// 未开启静止帧过滤时也写出保留帧的时间戳, 质量评估据此对齐被丢弃(直播超时/内存预算/故障切换跳帧)之后的帧
+    bool writeTimestamps = false;
+
+    /// 不为空时由读取线程对每个视频packet(过滤前)调用, 用于只解码文件的一段
+    std::function<PacketAction(DecContext *, const AVPacket *)> packetSelector;
+    /// 不为空时由保存线程对每个解码帧调用, 返回 false 的帧不保存也不编码, 不计入统计
+    std::function<bool(DecContext *, FrameData *)> frameSelector;
+    /// 逐帧回调, 在保存线程中对每个解码帧调用(编码之前), 回调中 Retain 的帧在 Release 之前一直有效, 否则回调返回后即被释放
+    std::function<void(DecContext *, FrameData *)> frameCallback;
+    /// 进度回调, 在保存线程中调用, 不为空时至少间隔 progressIntervalMs 调用一次
+    std::function<void(DecContext *)> progressCallback;
+    int progressIntervalMs = 500;
+};
+
+/// @brief 启动解码 输入输出进程, 阻塞到解码结束
+/// @param ctx 解码任务上下文, videoInfo 与 session 需已设置; 发生故障切换时返回后 ctx->session 为新session
+/// @return 0 成功, 其他值失败
+int run_dec(DecContext *ctx);
+
+void load_frames(DecContext *ctx);
+
+// 解码到帧队列: 在独立线程中运行 run_dec, 解码帧送入 queue, 由调用方逐帧取出后 Release
+// 用于多路合成/时间线/质量评估/处理图等按帧消费解码结果的场合, 打开后可以在 start 之前设置 ctx 的 packetSelector 等
+struct DecodedStream {
+    DecodedStream(int queueFrames) : queue(queueFrames, 0) {
     }
 
-    // 清理资源
-    av_packet_free(&pAvPacket);
-    av_bsf_free(&bsf_ctx);
-    gLoadCompleted = true;
-    printf("Load frames thread complete.\n");
-}
+    VideoInfo videoInfo = VideoInfo();
+    bool videoOpened = false;
+    DecSession *session = nullptr;
+    std::unique_ptr<DecContext> ctx;
+    /// 队列中的帧计入进程内存预算, 需先于队列构造
+    MemoryAccount memory;
+    /// 解码帧队列, 由保存线程写入, 调用方取出
+    FrameQueue queue;
+    std::thread thread;
+    /// run_dec 的结果, 解码器故障时为 -1
+    int ret = 0;
+    /// 已取到结束帧
+    bool ended = false;
+};
+
+/// @brief 打开输入文件并创建解码session, 失败时已打开的资源由 close_decoded_stream 释放
+/// @param profile 解码缓存策略, 解码帧队列长度由 DecodedStream 构造时给出
+/// @return 0 成功, -1 失败
+int open_decoded_stream(const std::string &fileName, int deviceIndex, const BufferProfile &profile, DecodedStream *stream);
+
+/// 启动解码线程
+void start_decoded_stream(DecodedStream *stream);
+
+/// @brief 取下一个解码帧, 调用方用完后 Release
+/// @return 取到结束帧或已经结束时返回 NULL
+FrameData *pop_decoded_frame(DecodedStream *stream);
+
+/// @brief 提前结束时取消读取, 取走剩余的帧直到结束帧(保证解码器正常冲刷), 等待解码线程退出并释放session与文件
+/// 可以重复调用; ctx 保留到 stream 析构, 其他线程此时仍可置位 ctx->cancelled
+/// @return stream->ret
+int close_decoded_stream(DecodedStream *stream);
+
+/// @brief 按需创建 mp4 -> annexb 比特流过滤器(avcC/hvcC 封装的 H264/HEVC)
+/// @param bsf 输出过滤器, 不需要过滤时为 NULL, 用完以 av_bsf_free 释放
+/// @return 0 成功, -1 失败
+int open_bitstream_filter(const VideoInfo *videoInfo, AVBSFContext **bsf);
+
+/// @brief 过滤一个packet, 结果写回 packet
+/// @return 0 成功, -1 失败, 此时 packet 已被清空
+int filter_packet(AVBSFContext *bsf, AVPacket *packet);
 
 /**
  * 从inFrameQueue读取,向TF硬件插入帧
  */
-void enqueue_frames() {
-    printf("Enqueue frames thread start.\n");
-    FrameData *frameData = NULL;
-    while (true) {
-        // 等待tfdec内存空闲
-        gCacheHardware_sem.wait();
-        inFrameQueueLock.lock();
-        if (inFrameQueue.empty()) {
-            inFrameQueueLock.unlock();
-            // 压缩帧加载慢，需要等待
-            usleep(1000);
-            continue;
-        }
-        FrameData *frameData = inFrameQueue.front();
-        inFrameQueue.pop();
-        inFrameQueueLock.unlock();
-        // 释放队列
-        gInFrameCache_sem.notify();
-
-        // 加入TF设备的buffer
-        void *buffer = NULL;
-        int size = 0;
-        unsigned int flag = TFDEC_BUFFER_FLAG_EOS;
-        unsigned long timestamp = frameData->GetTimestamp();
-        if (!frameData->GetIsEnd()) {
-            buffer = frameData->GetData();
-            size = frameData->GetLength();
-            flag = TFDEC_BUFFER_FLAG_ENDOFFRAME;
-        }
-
-        int enqueueFailedCount = 0;
-        int ret = 0;
-        while (true) {
-            ret = tfdec_enqueue_buffer(gSessionHandle, buffer, size, timestamp, flag);
-            if (ret == TFDEC_STATUS_SUCCESS) {
-                break;
-            }
-            if (gDebugEnabled) {
-                printf("Frame enqueue failed. ret: %d.\n", ret);
-            }
-            enqueueFailedCount++;
-            usleep(10);
-            if (enqueueFailedCount >= (10000000 / 10)) {
-                printf("ERROR: tfdec_enqueue_buffer has kept failing for %d times.\n", enqueueFailedCount);
-                exit(-1);
-            }
-        }
-        if (flag != TFDEC_BUFFER_FLAG_EOS) {
-            gTfEnqueuedFrameCount++;
-            if (gDebugEnabled) {
-                printf("Frame enqueued. Count: %d, Timestamp: %ld, ret: %d.\n", gTfEnqueuedFrameCount, frameData->GetTimestamp(), ret);
-            }
-        }
-
-        // 最后一帧
-        if (frameData->GetIsEnd()) {
-            break;
-        }
-        delete frameData;
-    }
-    gTfEnqueueCompleted = true;
-    printf("Enqueue frames thread complete.\n");
-}
+void enqueue_frames(DecContext *ctx);
 
 /**
  * tf视频解码后的回调函数（按enqueue的顺序回调）
@@ -251,174 +281,109 @@ void enqueue_frames() {
  * @param flag          - 帧的结束标记
  *                          TFDEC_BUFFER_FLAG_ENDOFFRAME    一帧的结束
  *                          TFDEC_BUFFER_FLAG_EOS           整个流的结束
- * @param pdata         - 创建session时的user_data地址
+ * @param pdata         - 创建session时的user_data地址, 即 DecSession
  */
-void callback(TFDEC_HANDLE session, void *buffer, int size, unsigned long timestamp, unsigned int flag, void *pUserdata) {
-    // 解码输出存入内存
-    FrameData *frameData = new FrameData((unsigned char *)buffer, size, 0L, false);
-    // 归还output buffer 解码器中数据-1
-    tfdec_return_output(session, buffer);
-    gCacheHardware_sem.notify();
-
-    if (flag == TFDEC_BUFFER_FLAG_EOS) {
-        frameData->SetIsEnd(true);
-    } else {
-        gDecodedFrameCount++;
-        gDecodedBytes += size;
-        if (gDebugEnabled) {
-            printf("Frame decoded. count: %d, Timestamp: %ld\n", gDecodedFrameCount, timestamp);
-        }
-    }
-    // 入输出队列
-    gOutFrameCache_sem.wait();
-    outFrameQueueLock.lock();
-    outFrameQueue.push(frameData);
-    outFrameQueueLock.unlock();
-    if (frameData->GetIsEnd()) {
-        gCallbackCompleted = true;
-    }
-}
-
-/// @brief 创建解码器session
-/// @param deviceIndex  解码器设备id
-/// @param role 解码视频类型
-/// @param width 视频宽
-/// @param height 视频高
-/// @param userData 用户信息
-TFDEC_HANDLE create_session(int deviceIndex, TFDEC_DECODER_ROLE role, int width, int height, void *userData) {
-    // id -> useDev
-    std::string useDev = "/dev/mv500";
-    if (deviceIndex > 1) {
-        useDev = useDev + "-" + std::to_string(deviceIndex);
-    }
-    TFDEC_HANDLE session = tfdec_create(useDev.c_str(), role, width, height, 4, callback, userData);
-    printf("Create session done. Session handle: %p\n", session);
+void callback(TFDEC_HANDLE session, void *buffer, int size, unsigned long timestamp, unsigned int flag, void *pUserdata);
 
-    if (session == NULL) {
-        printf("ERROR: Session create failed.\n");
-        exit(-1);
-    }
-    return session;
-}
+/// @brief 解码帧的只读视图, 可见区域为视频宽高, 行距按 ctx 的平面尺寸; 解码帧可能被多个下游共享
+ConstFrameView frame_view(const DecContext *ctx, const FrameData *frameData);
 
-void destroy_session(TFDEC_HANDLE session) {
-    printf("Destroy TF session.\n");
-    tfdec_destroy(session);
-    printf("Destroy TF session done.\n");
-}
+// 单个解码设备的容量, 0 表示不限
+struct DeviceCapacity {
+    int maxSessions = 0;
+    long maxMemoryBytes = 0;
+};
 
-// 读取视频文件信息
-int read_video_file(std::string fileName, VideoInfo *videoInfo) {
-    const char *filePath = fileName.c_str();
-    AVCodec *codec = NULL;
+// 单个解码设备的占用
+struct DeviceUsage {
+    int sessions = 0;
+    long memoryBytes = 0;
+    /// 正在排队等待的创建请求数, 以及排队超时或不排队而被拒绝的次数
+    int waiting = 0;
+    int rejected = 0;
+    /// tfdec_create 在同一 session 数下连续失败 ADMIT_MEASURE_FAILURES 次时的 session 数, 即实测容量, 0 表示未测得
+    /// 实测容量在 ADMIT_MEASURE_TTL_MS 后失效, 之后重新探测, 偶发的失败不会永久压低容量
+    int measuredSessions = 0;
+    int64_t measuredAtMs = 0;
+    /// 连续创建失败的次数, 以及失败时的 session 数; 创建成功或 session 数变化时重新计数
+    int failStreak = 0;
+    int failSessions = 0;
+};
 
-    TFDEC_DECODER_ROLE role = DECODER_H264;
+/// 同一 session 数下连续失败多少次才记为实测容量
+static const int ADMIT_MEASURE_FAILURES = 3;
+/// 实测容量的有效期
+static const int64_t ADMIT_MEASURE_TTL_MS = 60000;
+/// create_session 在设备上还有其他 session 时排队重试的次数上限
+static const int ADMIT_MAX_CREATE_RETRIES = 5;
+
+// 解码设备准入控制: 按设备统计 session 数与估算内存, 达到容量时新的创建请求排队等待(或超时拒绝),
+// 而不是让 tfdec_create 以 NULL / ERROR_NO_CHANNEL_AVAILABLE 失败
+// 容量可以预先配置; tfdec_create 在同一 session 数下连续失败时以该 session 数作为实测容量, 有效期内按此排队
+// create_session/destroy_session 自动进出, CPU 解码的 JPEG session 不计入
+class DeviceAdmission {
+   public:
+    /// 未单独设置容量的设备使用默认容量
+    void SetDefaultCapacity(const DeviceCapacity &capacity);
+    void SetCapacity(int deviceIndex, const DeviceCapacity &capacity);
+    /// 排队等待的超时(ms), 小于0一直等待, 0 不等待直接拒绝
+    void SetWaitTimeout(int timeoutMs);
+    /// 设备达到容量时先调用, 用于销毁该设备上的空闲 session(如 session 池中的), 在锁外调用
+    void SetReclaim(std::function<void(int deviceIndex)> reclaim);
+
+    /// @brief 申请在设备上创建一个 session, 达到容量时排队
+    /// @param maxWaitMs 不小于0时排队最多等待该时间(与 SetWaitTimeout 取较小者), 用于故障切换等不能无限等待的场合
+    /// @return false 表示被拒绝
+    bool Enter(int deviceIndex, long memoryBytes, int maxWaitMs = -1);
+    void Leave(int deviceIndex, long memoryBytes);
+    /// @brief Enter 之后创建成功, 清除连续失败计数
+    void Created(int deviceIndex);
+    /// @brief Enter 之后创建失败, 撤销占用; 同一 session 数下连续失败时记录实测容量
+    /// @return 设备上还有其他 session 时返回 true, 可以再次 Enter 等待其释放后重试
+    bool CreateFailed(int deviceIndex, long memoryBytes);
+
+    DeviceUsage Usage(int deviceIndex);
+
+   private:
+    bool fits(int deviceIndex, long memoryBytes);
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    DeviceCapacity mDefaultCapacity;
+    std::map<int, DeviceCapacity> mCapacities;
+    std::map<int, DeviceUsage> mUsages;
+    int mWaitTimeoutMs = -1;
+    std::function<void(int deviceIndex)> mReclaim;
+};
 
-    if (avformat_open_input(&videoInfo->avFormatContext, filePath, NULL, NULL) < 0) {
-        printf("can't open file %s\n", filePath);
-        exit(1);
-    }
+/// 进程内唯一的解码设备准入控制, 默认不限容量, 只在创建失败后按实测容量排队
+extern DeviceAdmission gDeviceAdmission;
 
-    if (avformat_find_stream_info(videoInfo->avFormatContext, NULL) < 0) {
-        printf("can't recognise stream type.\n");
-    }
+/// @brief 估算一个解码session占用的设备内存: 输出buffer, 加上参考帧等内部buffer(lite 按更少的内部buffer估算)
+long session_memory_bytes(int width, int height, int outBufferNum, bool lite);
 
-    videoInfo->videoIndex = av_find_best_stream(videoInfo->avFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
-    if (videoInfo->videoIndex < 0) {
-        printf("no video stream in this file\n");
-        exit(1);
-    }
-    printf("video index: %d\n", videoInfo->videoIndex);
-
-    auto codecpar = videoInfo->avFormatContext->streams[videoInfo->videoIndex]->codecpar;
-    videoInfo->width = codecpar->width;
-    videoInfo->height = codecpar->height;
-    videoInfo->role = DECODER_H264;
-    switch (codecpar->codec_id) {
-        case AV_CODEC_ID_MPEG4:
-            videoInfo->role = DECODER_MPG4;
-            printf("---mpg4---\n");
-            if (codecpar->codec_tag == MKTAG('m', 'p', '4', 'v')) {
-                uint32_t head_size = codecpar->extradata_size;
-                uint8_t *stream_head = (uint8_t *)malloc(head_size);
-                memcpy(stream_head, codecpar->extradata, head_size);
-            }
-            break;
-
-        case AV_CODEC_ID_H264:
-            printf("---h264---\n");
-            videoInfo->role = DECODER_H264;
-            if (codecpar->codec_tag == MKTAG('a', 'v', 'c', '1') || codecpar->codec_tag == 0) {
-                printf("---H264 : need_filter---\n");
-                videoInfo->gNeedFilter = true;
-            }
-            break;
-
-        case AV_CODEC_ID_HEVC:
-            printf("---hevc---\n");
-            videoInfo->role = DECODER_HEVC;
-            if (codecpar->codec_tag == MKTAG('h', 'e', 'v', '1' || codecpar->codec_tag == 0)) {
-                printf("---H265 : need_filter---\n");
-                videoInfo->gNeedFilterH265 = true;
-            }
-            break;
-
-        case AV_CODEC_ID_VP8:
-            printf("---vp8---");
-            videoInfo->role = DECODER_VP8;
-            break;
-
-        case AV_CODEC_ID_MPEG2VIDEO:
-            printf("---mpeg2---");
-            videoInfo->role = DECODER_MPG2;
-            break;
-
-        default:
-            break;
-    }
+/// @brief 创建解码器session, 超出硬件尺寸的 JPEG 创建 CPU 解码session
+/// 经 gDeviceAdmission 准入, 设备达到容量时排队等待
+/// @param deviceIndex  解码器设备id
+/// @param role 解码视频类型
+/// @param width 视频宽
+/// @param height 视频高
+/// @param outBufferNum 解码器输出buffer数量, 建议3~5
+/// @param lite 以 tfdec_create_lite 创建
+/// @param maxWaitMs 不小于0时每次排队最多等待该时间, 见 DeviceAdmission::Enter
+/// @return 失败或被准入控制拒绝时返回NULL; 排队重试最多 ADMIT_MAX_CREATE_RETRIES 次
+DecSession *create_session(int deviceIndex, TFDEC_DECODER_ROLE role, int width, int height, int outBufferNum = 4, bool lite = false,
+                           int maxWaitMs = -1);
 
-    return 0;
-}
+void destroy_session(DecSession *session);
 
-void save_file() {
-    std::string filename = "/root/saibo/tf_codec/out/003_out.yuv";
-    std::fstream gOutputFStream;
-    gOutputFStream.open(filename, std::ios::out | std::ios::binary);
-    if (!gOutputFStream.is_open() || !gOutputFStream.good()) {
-        printf("ERROR: Unable to open file %s.\n", filename.c_str());
-    }
+// 读取视频文件信息
+// 成功返回0, 失败返回-1, 失败时无需调用 close_video_file
+int read_video_file(std::string fileName, VideoInfo *videoInfo);
 
-    int size = 0;
-    while (true) {
-        // 等待tfdec内存空闲
-        outFrameQueueLock.lock();
-        if (outFrameQueue.empty()) {
-            outFrameQueueLock.unlock();
-            // 压缩帧加载慢，需要等待
-            usleep(1000);
-            continue;
-        }
-        FrameData *frameData = outFrameQueue.front();
-        outFrameQueue.pop();
-        outFrameQueueLock.unlock();
-        // 释放队列
-        gOutFrameCache_sem.notify();
-
-        if (frameData->GetIsEnd()) {
-            gDecodeCompleted = true;
-            printf("save done!\n");
-            break;
-        }
-        size++;
-        printf("save file frame size: %d\n", size);
-
-        // auto ret = tfg::I420_Planar_ScaleEx((uint8_t *)frameData->GetData(), nullptr, 1920, 1080,
-        //                          (uint8_t *)frameData->GetData(), nullptr, 1280, 720, tfg::INTERP_Bilinear);
-        gOutputFStream.write((const char *)frameData->GetData(), frameData->GetLength());
-    }
+// 关闭 read_video_file 打开的文件
+void close_video_file(VideoInfo *videoInfo);
 
-    if (gOutputFStream.is_open()) {
-        gOutputFStream.close();
-    }
-}
+void save_file(DecContext *ctx);
 }  // namespace yitu_codec_dec
+#endif  // COMMON_DEC_HPP
@@ -0,0 +1,427 @@
+#include "common_enc.hpp"
+#include "mux.hpp"
+#include "task_pool.hpp"
+
+#include <algorithm>
+
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace yitu_codec_enc {
+
+tfenc_setting default_enc_setting() {
+    tfenc_setting setting;
+    memset(&setting, 0, sizeof(setting));
+    setting.pix_format = PIXFMT_NV12;
+    setting.profile = TF_PROFILE_INVALID;
+    setting.level = 41;
+    setting.bit_rate = 8000000;
+    setting.max_bit_rate = 8000000;
+    setting.gop = 25;
+    setting.frame_rate = 30;
+    setting.rc_mode = RC_CBR;
+    return setting;
+}
+
+// 一行 U 与一行 V 交错为一行 UV
+static void interleave_uv(const uint8_t *srcU, const uint8_t *srcV, int count, uint8_t *dstUV) {
+    int i = 0;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x2_t uv;
+        uv.val[0] = vld1q_u8(srcU + i);
+        uv.val[1] = vld1q_u8(srcV + i);
+        vst2q_u8(dstUV + 2 * i, uv);
+    }
+#endif
+    for (; i < count; i++) {
+        dstUV[2 * i] = srcU[i];
+        dstUV[2 * i + 1] = srcV[i];
+    }
+}
+
+// 转换色度行 [begin, end) 及对应的两行亮度
+static void i420_to_nv12_rows(const ConstFrameView &src, uint8_t *dst, int begin, int end) {
+    int width = src.width;
+    int height = src.height;
+    for (int r = begin * 2; r < std::min(end * 2, height); r++) {
+        memcpy(dst + (size_t)r * width, src.planes[0] + (size_t)r * src.strides[0], width);
+    }
+    uint8_t *dstUV = dst + (size_t)width * height;
+    for (int r = begin; r < std::min(end, height / 2); r++) {
+        interleave_uv(src.planes[1] + (size_t)r * src.strides[1], src.planes[2] + (size_t)r * src.strides[2], width / 2,
+                      dstUV + (size_t)r * width);
+    }
+}
+
+void i420_to_nv12(const ConstFrameView &src, uint8_t *dst) {
+    // 奇数高度时最后一行亮度没有对应的色度行
+    int rows = (src.height + 1) / 2;
+    yitu_codec_task::TaskPool *pool = yitu_codec_task::cpu_pool();
+    if (pool == nullptr) {
+        i420_to_nv12_rows(src, dst, 0, rows);
+        return;
+    }
+    // 按行切片, 每片至少 64 行色度, 小分辨率不切
+    pool->ParallelFor(rows, [&src, dst](int begin, int end) { i420_to_nv12_rows(src, dst, begin, end); }, 64);
+}
+
+void i420_to_nv12(const uint8_t *src, int width, int height, uint8_t *dst) {
+    i420_to_nv12(ConstFrameView::FromI420(src, width, height, width, height), dst);
+}
+
+void enc_callback(void *user_param, void *data, int len) {
+    EncContext *ctx = ((EncSession *)user_param)->ctx;
+    if (ctx == nullptr) {
+        return;
+    }
+    if (len == 0) {
+        std::lock_guard<std::mutex> lock(ctx->eosLock);
+        ctx->eos = true;
+        ctx->eosCv.notify_all();
+        return;
+    }
+    if (ctx->muxer != nullptr) {
+        int64_t pts = AV_NOPTS_VALUE;
+        {
+            std::lock_guard<std::mutex> lock(ctx->ptsLock);
+            if (!ctx->pendingPts.empty()) {
+                pts = ctx->pendingPts.front();
+            }
+        }
+        // 单独输出的参数集不消耗 pts
+        if (ctx->muxer->WriteVideo((const uint8_t *)data, len, pts) == 0) {
+            std::lock_guard<std::mutex> lock(ctx->ptsLock);
+            if (!ctx->pendingPts.empty()) {
+                ctx->pendingPts.pop_front();
+            }
+        }
+    } else if (ctx->outputFStream.is_open()) {
+        ctx->outputFStream.write((const char *)data, len);
+    }
+    ctx->packetCount++;
+    ctx->encodedBytes += len;
+    TF_LOG_DEBUG("Frame encoded. count: %d, size: %d\n", ctx->packetCount.load(), len);
+}
+
+void i420_16_to_8(const uint16_t *src, size_t count, int bitDepth, uint8_t *dst) {
+    int shift = bitDepth - 8;
+    size_t i = 0;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    int16x8_t right = vdupq_n_s16(-shift);
+    for (; i + 16 <= count; i += 16) {
+        uint8x8_t lo = vqmovn_u16(vshlq_u16(vld1q_u16(src + i), right));
+        uint8x8_t hi = vqmovn_u16(vshlq_u16(vld1q_u16(src + i + 8), right));
+        vst1q_u8(dst + i, vcombine_u8(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = (uint8_t)std::min(src[i] >> shift, 255);
+    }
+}
+
+void i420_16_to_8(const ConstFrameView &src, int bitDepth, uint8_t *dst) {
+    for (int plane = 0; plane < 3; plane++) {
+        int width = src.PlaneWidth(plane);
+        for (int r = 0; r < src.PlaneHeight(plane); r++) {
+            i420_16_to_8((const uint16_t *)(src.planes[plane] + (size_t)r * src.strides[plane]), width, bitDepth, dst);
+            dst += width;
+        }
+    }
+}
+
+// 单平面双线性缩放, 16.16 定点, 采样点取像素中心对齐; 行距以字节计
+static void scale_plane_16(const uint8_t *src, int srcStride, int srcWidth, int srcHeight, uint8_t *dst, int dstStride, int dstWidth,
+                           int dstHeight) {
+    std::vector<int> xIndex(dstWidth), xFrac(dstWidth);
+    for (int x = 0; x < dstWidth; x++) {
+        int64_t fx = std::max<int64_t>(0, (((int64_t)x * 2 + 1) * srcWidth * 65536 / dstWidth - 65536) / 2);
+        xIndex[x] = std::min((int)(fx >> 16), srcWidth - 1);
+        xFrac[x] = xIndex[x] == srcWidth - 1 ? 0 : (int)(fx & 0xffff);
+    }
+    for (int y = 0; y < dstHeight; y++) {
+        int64_t fy = std::max<int64_t>(0, (((int64_t)y * 2 + 1) * srcHeight * 65536 / dstHeight - 65536) / 2);
+        int y0 = std::min((int)(fy >> 16), srcHeight - 1);
+        int y1 = std::min(y0 + 1, srcHeight - 1);
+        int64_t wy = fy & 0xffff;
+        const uint16_t *row0 = (const uint16_t *)(src + (size_t)y0 * srcStride);
+        const uint16_t *row1 = (const uint16_t *)(src + (size_t)y1 * srcStride);
+        uint16_t *out = (uint16_t *)(dst + (size_t)y * dstStride);
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = xIndex[x];
+            int x1 = std::min(x0 + 1, srcWidth - 1);
+            int64_t wx = xFrac[x];
+            int64_t top = row0[x0] * (65536 - wx) + row0[x1] * wx;
+            int64_t bottom = row1[x0] * (65536 - wx) + row1[x1] * wx;
+            out[x] = (uint16_t)((top * (65536 - wy) + bottom * wy + ((int64_t)1 << 31)) >> 32);
+        }
+    }
+}
+
+int scale_view(const ConstFrameView &src, const FrameView &dst, tfg::INTERP_MODE mode) {
+    // tfg 接口的源参数未声明 const, 只读取
+    if (src.bytesPerSample == 1 && src.IsPacked() && dst.IsPacked()) {
+        return tfg::I420_Planar_ScaleEx(const_cast<uint8_t *>(src.planes[0]), nullptr, src.width, src.height, dst.planes[0], nullptr, dst.width, dst.height, mode);
+    }
+    for (int plane = 0; plane < 3; plane++) {
+        if (src.bytesPerSample == 2) {
+            scale_plane_16(src.planes[plane], src.strides[plane], src.PlaneWidth(plane), src.PlaneHeight(plane), dst.planes[plane],
+                           dst.strides[plane], dst.PlaneWidth(plane), dst.PlaneHeight(plane));
+            continue;
+        }
+        // tfg 按 Y 平面高度推算 U/V 位置, U/V 行距为 0 时只处理 Y 平面, 三个平面逐个按单平面缩放
+        int srcStride[3] = {src.strides[plane], 0, 0};
+        int dstStride[3] = {dst.strides[plane], 0, 0};
+        int ret = tfg::I420_Planar_ScaleEx(const_cast<uint8_t *>(src.planes[plane]), srcStride, src.PlaneWidth(plane), src.PlaneHeight(plane), dst.planes[plane],
+                                           dstStride, dst.PlaneWidth(plane), dst.PlaneHeight(plane), mode);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+void scale_i420_16(const uint16_t *src, int srcWidth, int srcHeight, uint16_t *dst, int dstWidth, int dstHeight) {
+    scale_view(ConstFrameView::FromI420((const uint8_t *)src, srcWidth, srcHeight, srcWidth, srcHeight, 2),
+               FrameView::FromI420((uint8_t *)dst, dstWidth, dstHeight, dstWidth, dstHeight, 2), tfg::INTERP_Bilinear);
+}
+
+// P010 采样高位对齐: 16 bit 源左移 16 - bitDepth 位, 8 bit 源放到高字节(即 10 bit 值左移 6 位)
+static void widen_row(const uint8_t *src, int count, int bytesPerSample, int shift, uint16_t *dst) {
+    int i = 0;
+    if (bytesPerSample == 2) {
+        const uint16_t *src16 = (const uint16_t *)src;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+        int16x8_t left = vdupq_n_s16(shift);
+        for (; i + 8 <= count; i += 8) {
+            vst1q_u16(dst + i, vshlq_u16(vld1q_u16(src16 + i), left));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] = src16[i] << shift;
+        }
+        return;
+    }
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t y = vld1q_u8(src + i);
+        vst1q_u16(dst + i, vshll_n_u8(vget_low_u8(y), 8));
+        vst1q_u16(dst + i + 8, vshll_n_u8(vget_high_u8(y), 8));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = src[i] << 8;
+    }
+}
+
+static void widen_uv_row(const uint8_t *srcU, const uint8_t *srcV, int count, int bytesPerSample, int shift, uint16_t *dstUV) {
+    int i = 0;
+    if (bytesPerSample == 2) {
+        const uint16_t *u = (const uint16_t *)srcU;
+        const uint16_t *v = (const uint16_t *)srcV;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+        int16x8_t left = vdupq_n_s16(shift);
+        for (; i + 8 <= count; i += 8) {
+            uint16x8x2_t uv;
+            uv.val[0] = vshlq_u16(vld1q_u16(u + i), left);
+            uv.val[1] = vshlq_u16(vld1q_u16(v + i), left);
+            vst2q_u16(dstUV + 2 * i, uv);
+        }
+#endif
+        for (; i < count; i++) {
+            dstUV[2 * i] = u[i] << shift;
+            dstUV[2 * i + 1] = v[i] << shift;
+        }
+        return;
+    }
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint16x8x2_t uv;
+        uv.val[0] = vshll_n_u8(vld1_u8(srcU + i), 8);
+        uv.val[1] = vshll_n_u8(vld1_u8(srcV + i), 8);
+        vst2q_u16(dstUV + 2 * i, uv);
+    }
+#endif
+    for (; i < count; i++) {
+        dstUV[2 * i] = srcU[i] << 8;
+        dstUV[2 * i + 1] = srcV[i] << 8;
+    }
+}
+
+void i420_to_nv12_10b(const ConstFrameView &src, int bitDepth, uint8_t *dst) {
+    int width = src.width;
+    int height = src.height;
+    int bytesPerSample = src.bytesPerSample;
+    int shift = 16 - bitDepth;
+    uint16_t *dstY = (uint16_t *)dst;
+    for (int r = 0; r < height; r++) {
+        widen_row(src.planes[0] + (size_t)r * src.strides[0], width, bytesPerSample, shift, dstY + (size_t)r * width);
+    }
+    uint16_t *dstUV = dstY + (size_t)width * height;
+    for (int r = 0; r < height / 2; r++) {
+        widen_uv_row(src.planes[1] + (size_t)r * src.strides[1], src.planes[2] + (size_t)r * src.strides[2], width / 2, bytesPerSample, shift,
+                     dstUV + (size_t)r * width);
+    }
+}
+
+void i420_to_nv12_10b(const uint16_t *src, int width, int height, int bitDepth, uint8_t *dst) {
+    i420_to_nv12_10b(ConstFrameView::FromI420((const uint8_t *)src, width, height, width, height, 2), bitDepth, dst);
+}
+
+void i420_to_nv12_10b(const uint8_t *src, int width, int height, uint8_t *dst) {
+    i420_to_nv12_10b(ConstFrameView::FromI420(src, width, height, width, height), 8, dst);
+}
+
+EncSession *create_enc_session(const tfenc_setting &setting) {
+    EncSession *session = new EncSession();
+    session->handle = NULL;
+    session->setting = setting;
+    session->setting.pix_format = setting.profile == PROFILE_HEVC_MAIN10 ? PIXFMT_NV12_10B : PIXFMT_NV12;
+    session->ctx = nullptr;
+    tfenc_callback callback;
+    callback.func = enc_callback;
+    callback.param = session;
+    int ret = tfenc_encoder_create(&session->handle, &session->setting, callback);
+    TF_LOG_INFO("Create encoder done. Encoder handle: %p, ret: %d\n", session->handle, ret);
+    if (TFENC_ERROR(ret) || session->handle == NULL) {
+        TF_LOG_ERROR("ERROR: Encoder create failed. ret: %d\n", ret);
+        delete session;
+        return NULL;
+    }
+    return session;
+}
+
+void destroy_enc_session(EncSession *session) {
+    TF_LOG_INFO("Destroy TF encoder.\n");
+    tfenc_encoder_destroy(session->handle);
+    delete session;
+    TF_LOG_INFO("Destroy TF encoder done.\n");
+}
+
+int open_encoder(EncContext *ctx, EncSession *session) {
+    ctx->session = session;
+    ctx->eos = false;
+    ctx->sceneDetector.Reset();
+    const tfenc_setting &setting = session->setting;
+    // 10 bit 编码时高位深源帧全程保持 16 bit, 否则先降为 8 bit
+    bool encode10Bit = setting.pix_format == PIXFMT_NV12_10B;
+    bool keep16Bit = ctx->bitDepth > 8 && encode10Bit;
+    size_t frameSize = setting.width * setting.height * 3 / 2;
+    if (ctx->bitDepth > 8 && !encode10Bit) {
+        ctx->depthBuffer.resize((size_t)ctx->srcWidth * ctx->srcHeight * 3 / 2);
+    }
+    if (ctx->srcWidth != (int)setting.width || ctx->srcHeight != (int)setting.height) {
+        ctx->scaleBuffer.resize(frameSize * (keep16Bit ? 2 : 1));
+    }
+    ctx->nv12Buffer.resize(frameSize * (encode10Bit ? 2 : 1));
+    ctx->pendingPts.clear();
+    if (ctx->muxer == nullptr) {
+        ctx->outputFStream.open(ctx->outputFileName, std::ios::out | std::ios::binary | (ctx->appendOutput ? std::ios::app : std::ios::trunc));
+        if (!ctx->outputFStream.is_open() || !ctx->outputFStream.good()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", ctx->outputFileName.c_str());
+            return -1;
+        }
+    }
+    if (ctx->memory != nullptr) {
+        ctx->chargedBytes = ctx->scaleBuffer.size() + ctx->nv12Buffer.size() + ctx->depthBuffer.size();
+        ctx->memory->Charge(ctx->chargedBytes, BUDGET_BLOCK);
+    }
+    ctx->scheduler = yitu_codec_sched::enc_scheduler(setting.device_id);
+    if (ctx->scheduler != nullptr) {
+        ctx->scheduler->Attach(&ctx->sched);
+    }
+    session->ctx = ctx;
+    return 0;
+}
+
+int encode_view(EncContext *ctx, const ConstFrameView &frame, int64_t pts) {
+    const tfenc_setting &setting = ctx->session->setting;
+    int width = setting.width;
+    int height = setting.height;
+    bool encode10Bit = setting.pix_format == PIXFMT_NV12_10B;
+    ConstFrameView src = frame;
+    int bitDepth = ctx->bitDepth;
+    if (!ctx->depthBuffer.empty()) {
+        i420_16_to_8(src, bitDepth, ctx->depthBuffer.data());
+        src = FrameView::FromI420(ctx->depthBuffer.data(), ctx->srcWidth, ctx->srcHeight, ctx->srcWidth, ctx->srcHeight);
+        bitDepth = 8;
+    }
+    if (!ctx->scaleBuffer.empty()) {
+        FrameView scaled = FrameView::FromI420(ctx->scaleBuffer.data(), width, height, width, height, bitDepth > 8 ? 2 : 1);
+        int ret = scale_view(src, scaled, ctx->interpMode);
+        if (ret != 0) {
+            TF_LOG_ERROR("ERROR: I420_Planar_ScaleEx failed. ret: %d\n", ret);
+            return ret;
+        }
+        src = scaled;
+    }
+    if (bitDepth == 8 && ctx->sceneDetector.Detect(src.planes[0], width, height, setting.gop, src.strides[0])) {
+        tfenc_restart_GOP(ctx->session->handle);
+        ctx->sceneCutCount++;
+        TF_LOG_DEBUG("Scene cut at frame %d.\n", ctx->submittedFrameCount.load());
+    }
+    if (encode10Bit) {
+        i420_to_nv12_10b(src, bitDepth, ctx->nv12Buffer.data());
+    } else {
+        i420_to_nv12(src, ctx->nv12Buffer.data());
+    }
+    if (ctx->muxer != nullptr) {
+        std::lock_guard<std::mutex> lock(ctx->ptsLock);
+        ctx->pendingPts.push_back(pts);
+    }
+    if (ctx->scheduler != nullptr) {
+        ctx->scheduler->Acquire(&ctx->sched, yitu_codec_sched::sched_now_ms() + ctx->schedLatencyMs, -1);
+    }
+    int ret = tfenc_process_frame(ctx->session->handle, ctx->nv12Buffer.data(), ctx->nv12Buffer.size());
+    if (ctx->scheduler != nullptr) {
+        ctx->scheduler->Complete(&ctx->sched);
+    }
+    if (TFENC_ERROR(ret)) {
+        TF_LOG_ERROR("ERROR: tfenc_process_frame failed. ret: %d\n", ret);
+        if (ctx->muxer != nullptr) {
+            std::lock_guard<std::mutex> lock(ctx->ptsLock);
+            ctx->pendingPts.pop_back();
+        }
+        return ret;
+    }
+    ctx->submittedFrameCount++;
+    return 0;
+}
+
+int encode_frame(EncContext *ctx, uint8_t *i420) {
+    int bytesPerSample = ctx->bitDepth > 8 ? 2 : 1;
+    return encode_view(ctx, FrameView::FromI420(i420, ctx->srcWidth, ctx->srcHeight, ctx->srcWidth, ctx->srcHeight, bytesPerSample));
+}
+
+int flush_encoder(EncContext *ctx, int timeoutMs) {
+    int ret = 0;
+    tfenc_process_frame(ctx->session->handle, NULL, 0);
+    {
+        std::unique_lock<std::mutex> lock(ctx->eosLock);
+        if (!ctx->eosCv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [ctx] { return ctx->eos; })) {
+            TF_LOG_ERROR("ERROR: Encoder flush timeout.\n");
+            ret = -1;
+        }
+    }
+    ctx->session->ctx = nullptr;
+    if (ctx->scheduler != nullptr) {
+        ctx->scheduler->Detach(&ctx->sched);
+        ctx->scheduler = nullptr;
+    }
+    if (ctx->outputFStream.is_open()) {
+        ctx->outputFStream.close();
+    }
+    std::vector<uint8_t>().swap(ctx->scaleBuffer);
+    std::vector<uint8_t>().swap(ctx->nv12Buffer);
+    std::vector<uint8_t>().swap(ctx->depthBuffer);
+    if (ctx->memory != nullptr && ctx->chargedBytes > 0) {
+        ctx->memory->Uncharge(ctx->chargedBytes);
+        ctx->chargedBytes = 0;
+    }
+    TF_LOG_INFO("Encode complete: Submitted: %d, Packets: %d, Bytes: %ld, Scene cuts: %d.\n", ctx->submittedFrameCount.load(),
+           ctx->packetCount.load(), ctx->encodedBytes.load(), ctx->sceneCutCount.load());
+    return ret;
+}
+
+}  // namespace yitu_codec_enc
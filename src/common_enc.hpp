@@ -0,0 +1,141 @@
+#ifndef COMMON_ENC_HPP
+#define COMMON_ENC_HPP
+
+#include "common.hpp"
+#include "frame_analysis.hpp"
+#include "scheduler.hpp"
+
+using namespace yitu_codec_common;
+
+namespace yitu_codec_mux {
+class Muxer;
+}
+
+namespace yitu_codec_enc {
+
+struct EncContext;
+
+// 编码器session, 创建时作为callback.param传给tfenc, 回调中据此找到当前绑定的编码任务
+// session可以在多个任务之间复用, 每个任务开始前重新绑定ctx
+struct EncSession {
+    TF_HANDLE handle;
+    tfenc_setting setting;
+    EncContext *ctx;
+};
+
+// 单路编码任务上下文
+struct EncContext {
+    EncSession *session = nullptr;
+    std::string outputFileName;
+    std::fstream outputFStream;
+    /// 追加写入 outputFileName 而不是覆盖, 用于把多段编码结果拼接到同一个文件
+    bool appendOutput = false;
+    /// 不为空时码流写入该容器(与音频/字幕交错), 不再打开 outputFileName
+    yitu_codec_mux::Muxer *muxer = nullptr;
+    /// 已送入编码器、尚未输出的帧的 pts, 编码器不重排序, 回调按先进先出取用
+    std::deque<int64_t> pendingPts;
+    std::mutex ptsLock;
+    /// 送入编码器前的源帧(I420)尺寸, 与编码尺寸不同时先缩放
+    int srcWidth = 0;
+    int srcHeight = 0;
+    /// 源帧位深, 大于 8 时每个采样占 2 字节(低位对齐的 16 bit I420)
+    int bitDepth = 8;
+    tfg::INTERP_MODE interpMode = tfg::INTERP_Bilinear;
+
+    /// 缩放与NV12转换的中间buffer, 任务内复用
+    std::vector<uint8_t> scaleBuffer;
+    std::vector<uint8_t> nv12Buffer;
+    /// 高位深源帧送入 8 bit 编码时先降位深
+    std::vector<uint8_t> depthBuffer;
+    /// 不为空时中间buffer计入该账户(及进程内存预算), open_encoder 时计入, flush_encoder 时释放
+    MemoryAccount *memory = nullptr;
+    long chargedBytes = 0;
+
+    /// 场景切换时调用 tfenc_restart_GOP 插入关键帧, 默认关闭; open_encoder 时重置
+    yitu_codec_analysis::SceneDetector sceneDetector;
+    std::atomic<int> sceneCutCount{0};
+
+    /// 开启设备调度时每次 tfenc_process_frame 前向编码设备的调度器申请空位, open_encoder 时加入, flush_encoder 时退出
+    yitu_codec_sched::SchedClient sched;
+    yitu_codec_sched::DeviceScheduler *scheduler = nullptr;
+    /// 直播帧的截止时间为送入编码时间加该值
+    int schedLatencyMs = 0;
+
+    // 编码统计
+    std::atomic<int> submittedFrameCount{0};
+    std::atomic<int> packetCount{0};
+    std::atomic<long> encodedBytes{0};
+
+    // 编码器回调 len 为 0 时表示流结束
+    std::mutex eosLock;
+    std::condition_variable eosCv;
+    bool eos = false;
+};
+
+/// 默认编码参数, profile 为 TF_PROFILE_INVALID 表示不编码
+tfenc_setting default_enc_setting();
+
+/// I420(yyyyuuvv) 转 NV12(yyyyuvuv), TF ENC 只接受 NV12
+void i420_to_nv12(const uint8_t *src, int width, int height, uint8_t *dst);
+/// 按视图逐行读取, 只转换可见区域, 输出为紧密排列的 NV12
+void i420_to_nv12(const ConstFrameView &src, uint8_t *dst);
+
+/// @brief 16 bit I420 降为 8 bit, 丢弃低位
+/// @param count 采样数
+/// @param bitDepth 源位深
+void i420_16_to_8(const uint16_t *src, size_t count, int bitDepth, uint8_t *dst);
+/// 按视图逐行降位深, 输出为可见区域紧密排列的 8 bit I420
+void i420_16_to_8(const ConstFrameView &src, int bitDepth, uint8_t *dst);
+
+/// @brief 按视图缩放, 源与目标都可以带行距或是另一帧的子区域(如画布上的一格), 裁剪不需要拷贝
+/// 8 bit 经 I420_Planar_ScaleEx 逐平面缩放, 16 bit 为双线性缩放; 源与目标位深需相同
+/// @return 0 成功, 其他值为 I420_Planar_ScaleEx 的返回值
+int scale_view(const ConstFrameView &src, const FrameView &dst, tfg::INTERP_MODE mode);
+
+/// @brief 16 bit I420 双线性缩放, 逐平面处理, 采样保持原位深
+void scale_i420_16(const uint16_t *src, int srcWidth, int srcHeight, uint16_t *dst, int dstWidth, int dstHeight);
+
+/// @brief I420 转 PIXFMT_NV12_10B, 即 16 bit 采样高位对齐的 NV12(P010): Y 平面后接 UV 交错平面
+/// @param bitDepth 源位深, 8 bit 源按左移补零升为 10 bit
+void i420_to_nv12_10b(const uint16_t *src, int width, int height, int bitDepth, uint8_t *dst);
+void i420_to_nv12_10b(const uint8_t *src, int width, int height, uint8_t *dst);
+/// 按视图逐行转换, bitDepth 只对 16 bit 视图有效
+void i420_to_nv12_10b(const ConstFrameView &src, int bitDepth, uint8_t *dst);
+
+/**
+ * tf视频编码后的回调函数
+ * @param user_param    - 创建编码器时的callback.param, 即 EncSession
+ * @param data          - 编码后的码流
+ * @param len           - 码流长度, 为0表示流结束
+ */
+void enc_callback(void *user_param, void *data, int len);
+
+/// @brief 创建编码器session
+/// @param setting 编码参数, PROFILE_HEVC_MAIN10 时输入格式固定为 PIXFMT_NV12_10B
+/// @return 失败返回NULL
+EncSession *create_enc_session(const tfenc_setting &setting);
+
+void destroy_enc_session(EncSession *session);
+
+/// @brief 绑定session并打开输出文件, 在送入第一帧前调用
+/// @return 0 成功, 其他值失败
+int open_encoder(EncContext *ctx, EncSession *session);
+
+/// @brief 编码一帧I420数据, 必要时先缩放到编码尺寸, 检测到场景切换时从该帧重新开始 GOP
+/// 源帧位深由 ctx->bitDepth 指定, 与编码器输入位深不同时自动升降; 场景切换检测只在 8 bit 数据上进行
+/// tfenc_process_frame 返回时已取走数据, 中间buffer可以立即复用
+int encode_frame(EncContext *ctx, uint8_t *i420);
+
+/// @brief 同 encode_frame, 源帧为视图, 可见区域需为 srcWidth x srcHeight
+/// 解码器输出带对齐填充时直接按行距读取, 不需要先裁剪拷贝
+/// @param pts 源帧 pts(源视频时间基), 写入容器时使用
+int encode_view(EncContext *ctx, const ConstFrameView &frame, int64_t pts = AV_NOPTS_VALUE);
+
+/// @brief 送入空帧冲刷编码器, 等待流结束回调后解绑session, 关闭输出文件并释放中间buffer
+/// 冲刷完成的session可以归还给session池, 供下一个任务使用
+/// @param timeoutMs 等待流结束回调的超时
+/// @return 0 成功, -1 超时(此时session状态未知, 不应复用)
+int flush_encoder(EncContext *ctx, int timeoutMs = 5000);
+
+}  // namespace yitu_codec_enc
+#endif  // COMMON_ENC_HPP
@@ -0,0 +1,469 @@
+#include "daemon.hpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace yitu_codec_daemon {
+
+volatile sig_atomic_t gDaemonStopRequested = 0;
+
+static void daemon_signal_handler(int) {
+    gDaemonStopRequested = 1;
+}
+
+/// 任务中的编码参数覆盖默认值
+static void parse_enc_setting(std::map<std::string, std::string> &req, tfenc_setting &setting) {
+    auto get = [&req](const char *key, uint32_t &val) {
+        auto it = req.find(key);
+        if (it != req.end() && !it->second.empty()) {
+            val = atoi(it->second.c_str());
+        }
+    };
+    uint32_t profile = setting.profile;
+    uint32_t rcMode = setting.rc_mode;
+    get("enc_profile", profile);
+    get("enc_rcmode", rcMode);
+    setting.profile = tf_profile(profile);
+    setting.rc_mode = tf_rcmode(rcMode);
+    get("enc_width", setting.width);
+    get("enc_height", setting.height);
+    get("enc_level", setting.level);
+    get("enc_bit_rate", setting.bit_rate);
+    get("enc_max_bit_rate", setting.max_bit_rate);
+    get("enc_gop", setting.gop);
+    get("enc_rate", setting.frame_rate);
+    get("enc_device_id", setting.device_id);
+}
+
+static std::string pool_stats_object(const yitu_codec_pool::PoolStats &stats) {
+    return JsonLine()
+        .Add("created", stats.created)
+        .Add("reused", stats.reused)
+        .Add("destroyed", stats.destroyed)
+        .Add("idle", stats.idle)
+        .Add("in_use", stats.inUse)
+        .Object();
+}
+
+Daemon::Daemon(const DaemonConfig &config)
+    : mConfig(config) {
+}
+
+int Daemon::Run() {
+    mListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (mListenFd < 0) {
+        TF_LOG_ERROR("ERROR: Unable to create unix socket.\n");
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (mConfig.socketPath.size() >= sizeof(addr.sun_path)) {
+        TF_LOG_ERROR("ERROR: Socket path too long: %s.\n", mConfig.socketPath.c_str());
+        close(mListenFd);
+        return -1;
+    }
+    strncpy(addr.sun_path, mConfig.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(mConfig.socketPath.c_str());
+    if (bind(mListenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(mListenFd, 16) < 0) {
+        TF_LOG_ERROR("ERROR: Unable to listen on %s.\n", mConfig.socketPath.c_str());
+        close(mListenFd);
+        return -1;
+    }
+
+    signal(SIGINT, daemon_signal_handler);
+    signal(SIGTERM, daemon_signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    mTranscoder.reset(new Transcoder(mConfig.transcoder));
+    TF_LOG_INFO("Daemon listening on %s with %d workers.\n", mConfig.socketPath.c_str(), mConfig.transcoder.workerCount);
+
+    serve_loop();
+
+    // 取消所有任务, 等待工作线程退出. 回调会获取 mMutex, 此处不能持锁
+    mTranscoder->CancelAll();
+    mTranscoder.reset();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &client : mClients) {
+        close(client.first);
+    }
+    mClients.clear();
+    close(mListenFd);
+    unlink(mConfig.socketPath.c_str());
+    TF_LOG_INFO("Daemon stopped.\n");
+    return 0;
+}
+
+/// 监听与读取客户端命令, 单线程 poll
+void Daemon::serve_loop() {
+    while (!gDaemonStopRequested && !mShutdownRequested) {
+        std::vector<struct pollfd> fds;
+        fds.push_back({mListenFd, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            // 发送失败或积压过多的客户端在此关闭, 工作线程中只做标记, 避免 poll 中的 fd 被关闭后复用
+            std::vector<int> broken;
+            for (auto &client : mClients) {
+                if (client.second.broken) {
+                    broken.push_back(client.first);
+                }
+            }
+            for (int fd : broken) {
+                drop_client_locked(fd);
+            }
+            for (auto &client : mClients) {
+                short events = POLLIN;
+                if (!client.second.writeBuffer.empty()) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({client.first, events, 0});
+            }
+        }
+        int ret = poll(fds.data(), fds.size(), 200);
+        if (ret <= 0) {
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(mListenFd, NULL, NULL);
+            if (fd >= 0) {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mClients[fd] = Client();
+            }
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].revents & POLLOUT) {
+                std::lock_guard<std::mutex> lock(mMutex);
+                auto it = mClients.find(fds[i].fd);
+                if (it != mClients.end()) {
+                    flush_locked(&it->second, fds[i].fd);
+                }
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                read_client(fds[i].fd);
+            }
+        }
+    }
+}
+
+void Daemon::read_client(int fd) {
+    char buf[4096];
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    std::vector<std::string> lines;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mClients.find(fd);
+        if (it == mClients.end()) {
+            return;
+        }
+        if (len <= 0) {
+            drop_client_locked(fd);
+            return;
+        }
+        std::string &pending = it->second.readBuffer;
+        pending.append(buf, len);
+        size_t pos;
+        while ((pos = pending.find('\n')) != std::string::npos) {
+            lines.push_back(pending.substr(0, pos));
+            pending.erase(0, pos + 1);
+        }
+        // 防止不换行的客户端无限占用内存
+        if (pending.size() > 65536) {
+            drop_client_locked(fd);
+            return;
+        }
+    }
+    for (const auto &line : lines) {
+        handle_line(fd, line);
+    }
+}
+
+void Daemon::drop_client_locked(int fd) {
+    close(fd);
+    mClients.erase(fd);
+    for (auto &job : mJobs) {
+        if (job.second->clientFd == fd) {
+            job.second->clientFd = -1;
+        }
+    }
+}
+
+void Daemon::handle_line(int fd, const std::string &line) {
+    if (line.find_first_not_of(" \t\r") == std::string::npos) {
+        return;
+    }
+    std::map<std::string, std::string> req;
+    if (parse_json_line(line, req)) {
+        send_to(fd, JsonLine().Add("event", "error").Add("message", "invalid json").Str());
+        return;
+    }
+    const std::string &cmd = req["cmd"];
+    if (cmd == "submit") {
+        submit(fd, req);
+    } else if (cmd == "cancel") {
+        cancel(fd, atol(req["job"].c_str()));
+    } else if (cmd == "status") {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mJobs.find(atol(req["job"].c_str()));
+        if (it == mJobs.end()) {
+            send_to_locked(fd, JsonLine().Add("event", "error").Add("message", "unknown job").Str());
+        } else {
+            send_to_locked(fd, job_line(*it->second, "status").Str());
+        }
+    } else if (cmd == "queue") {
+        std::lock_guard<std::mutex> lock(mMutex);
+        send_to_locked(fd, queue_line_locked().Str());
+    } else if (cmd == "watch") {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClients[fd].watchAll = true;
+    } else if (cmd == "shutdown") {
+        mShutdownRequested = true;
+    } else {
+        send_to(fd, JsonLine().Add("event", "error").Add("message", "unknown cmd").Str());
+    }
+}
+
+void Daemon::submit(int fd, std::map<std::string, std::string> &req) {
+    if (req["input"].empty() || req["output"].empty()) {
+        send_to(fd, JsonLine().Add("event", "error").Add("message", "input and output are required").Str());
+        return;
+    }
+    TranscodeJob job;
+    job.inputFileName = req["input"];
+    job.outputFileName = req["output"];
+    job.decDeviceIndex = req["device"].empty() ? mConfig.defaultDeviceIndex : atoi(req["device"].c_str());
+    job.failoverDeviceIndexes = string_to_int_list(req["failover_devices"]);
+    job.encSetting = mConfig.encSetting;
+    parse_enc_setting(req, job.encSetting);
+    job.live = req["live"] == "true" || string_to_bool(req["live"]);
+    if (!req["latency_ms"].empty()) {
+        job.latencyTargetMs = atoi(req["latency_ms"].c_str());
+    }
+    if (!req["weight"].empty()) {
+        job.weight = atoi(req["weight"].c_str());
+    }
+    job.trimStartSec = atof(req["trim_start"].c_str());
+    job.trimEndSec = atof(req["trim_end"].c_str());
+    job.sceneCut.enabled = req["scene_cut"] == "true" || string_to_bool(req["scene_cut"]);
+    if (!req["scene_cut_min_gop"].empty()) {
+        job.sceneCut.minGopFrames = atoi(req["scene_cut_min_gop"].c_str());
+    }
+    job.staticFrame.blockThreshold = atof(req["static_threshold"].c_str());
+    if (!req["static_max_skip"].empty()) {
+        job.staticFrame.maxSkipFrames = atoi(req["static_max_skip"].c_str());
+    }
+    job.allowStreamCopy = req["stream_copy"].empty() || req["stream_copy"] == "true" || string_to_bool(req["stream_copy"]);
+    job.passthroughAudio = req["audio"].empty() || req["audio"] == "true" || string_to_bool(req["audio"]);
+    job.measureQuality = req["quality"] == "true" || string_to_bool(req["quality"]);
+    job.onStarted = [this](long jobId, int workerIndex) { on_started(jobId, workerIndex); };
+    job.onProgress = [this](const JobProgress &progress) { on_progress(progress); };
+    job.onFinished = [this](const TranscodeResult &result) { on_finished(result); };
+    job.onQuality = [this](long jobId, int ret, const yitu_codec_quality::QualityStats &stats) { on_quality(jobId, ret, stats); };
+
+    // 持锁提交, 保证回调查找任务记录时记录已存在
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::shared_ptr<Job> record(new Job());
+    mTranscoder->Submit(job, &record->id);
+    record->inputFileName = job.inputFileName;
+    record->deviceIndex = job.decDeviceIndex;
+    record->clientFd = fd;
+    mJobs[record->id] = record;
+    emit_locked(*record, job_line(*record, "accepted").Add("position", (long)mTranscoder->QueuedCount()));
+}
+
+void Daemon::cancel(int fd, long jobId) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mJobs.find(jobId);
+        if (it == mJobs.end()) {
+            send_to_locked(fd, JsonLine().Add("event", "error").Add("message", "unknown job").Str());
+            return;
+        }
+        if (it->second->state != JOB_QUEUED && it->second->state != JOB_RUNNING) {
+            send_to_locked(fd, job_line(*it->second, "status").Str());
+            return;
+        }
+    }
+    // 取消排队中的任务会同步触发 on_finished, 不能持锁调用
+    mTranscoder->Cancel(jobId);
+}
+
+void Daemon::on_started(long jobId, int workerIndex) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mJobs.find(jobId);
+    if (it == mJobs.end()) {
+        return;
+    }
+    it->second->state = JOB_RUNNING;
+    emit_locked(*it->second, job_line(*it->second, "started").Add("worker", workerIndex));
+}
+
+void Daemon::on_progress(const JobProgress &progress) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mJobs.find(progress.jobId);
+    if (it == mJobs.end()) {
+        return;
+    }
+    it->second->progress = progress;
+    emit_locked(*it->second, job_line(*it->second, "progress")
+                                 .Add("loaded", progress.loadedFrameCount)
+                                 .Add("saved", progress.savedFrameCount)
+                                 .Add("mem_bytes", progress.memoryBytes));
+}
+
+/// 标记任务结束, 推送结束事件, 并淘汰过旧的历史任务
+void Daemon::on_finished(const TranscodeResult &result) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mJobs.find(result.jobId);
+    if (it == mJobs.end()) {
+        return;
+    }
+    Job &job = *it->second;
+    job.state = result.state;
+    job.progress.decodedFrameCount = result.decodedFrameCount;
+    job.error = result.error;
+    JsonLine line = job_line(job, job_state_name(result.state));
+    line.Add("packets", result.encodedPacketCount).Add("bytes", result.encodedBytes).Add("elapsed", result.elapsedSec);
+    line.Add("latency_avg_ms", result.avgLatencyMs).Add("latency_p99_ms", result.p99LatencyMs).Add("latency_max_ms", result.maxLatencyMs);
+    line.Add("dropped", result.droppedFrameCount).Add("peak_mem_bytes", result.peakMemoryBytes);
+    if (result.streamCopied) {
+        line.Add("stream_copy", true);
+    }
+    if (result.auxPacketCount > 0) {
+        line.Add("aux_packets", result.auxPacketCount);
+    }
+    if (result.failoverCount > 0) {
+        line.Add("failovers", result.failoverCount).Add("duplicate_frames", result.duplicateFrameCount);
+    }
+    if (result.sceneCutCount > 0) {
+        line.Add("scene_cuts", result.sceneCutCount);
+    }
+    if (result.staticFrameCount > 0) {
+        line.Add("static_frames", result.staticFrameCount);
+    }
+    if (result.copiedPacketCount > 0) {
+        line.Add("copied_packets", result.copiedPacketCount).Add("copied_bytes", result.copiedBytes);
+    }
+    if (result.qualityPending) {
+        line.Add("quality_pending", true);
+    }
+    if (!job.error.empty()) {
+        line.Add("message", job.error);
+    }
+    emit_locked(job, line);
+    mFinished.push_back(job.id);
+    while ((int)mFinished.size() > mConfig.finishedJobHistory) {
+        mJobs.erase(mFinished.front());
+        mFinished.pop_front();
+    }
+}
+
+/// 任务结束之后的质量评估结果, 任务记录已被淘汰时不再推送
+void Daemon::on_quality(long jobId, int ret, const yitu_codec_quality::QualityStats &stats) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mJobs.find(jobId);
+    if (it == mJobs.end()) {
+        return;
+    }
+    JsonLine line = job_line(*it->second, "quality");
+    if (ret != 0) {
+        line.Add("message", "quality measurement failed");
+    } else {
+        line.Add("quality_frames", stats.frameCount).Add("psnr_avg", stats.avgPsnr).Add("psnr_min", stats.minPsnr);
+        line.Add("psnr_global", stats.globalPsnr).Add("ssim_avg", stats.avgSsim).Add("ssim_min", stats.minSsim);
+    }
+    emit_locked(*it->second, line);
+}
+
+JsonLine Daemon::job_line(const Job &job, const char *event) {
+    JsonLine line;
+    line.Add("event", event).Add("job", job.id).Add("state", job_state_name(job.state));
+    line.Add("input", job.inputFileName).Add("device", job.deviceIndex);
+    if (job.state != JOB_QUEUED) {
+        line.Add("decoded", job.progress.decodedFrameCount);
+    }
+    if (job.state == JOB_RUNNING) {
+        line.Add("mem_bytes", job.progress.memoryBytes);
+    }
+    return line;
+}
+
+JsonLine Daemon::queue_line_locked() {
+    std::string queued = "[";
+    std::string running = "[";
+    for (auto &job : mJobs) {
+        if (job.second->state == JOB_QUEUED) {
+            if (queued.size() > 1) queued += ",";
+            queued += std::to_string(job.first);
+        } else if (job.second->state == JOB_RUNNING) {
+            if (running.size() > 1) running += ",";
+            running += job_line(*job.second, "status").Object();
+        }
+    }
+    queued += "]";
+    running += "]";
+    return JsonLine()
+        .Add("event", "queue")
+        .Add("workers", mConfig.transcoder.workerCount)
+        .AddRaw("queued", queued)
+        .AddRaw("running", running)
+        .AddRaw("dec_pool", pool_stats_object(mTranscoder->DecPoolStats()))
+        .AddRaw("enc_pool", pool_stats_object(mTranscoder->EncPoolStats()))
+        .Add("mem_used", gMemoryBudget.GetUsed())
+        .Add("mem_peak", gMemoryBudget.GetPeak())
+        .Add("mem_limit", gMemoryBudget.GetLimit());
+}
+
+/// 推送事件给任务提交者和所有订阅者
+void Daemon::emit_locked(const Job &job, const JsonLine &line) {
+    std::string msg = line.Str();
+    for (auto &client : mClients) {
+        if (client.first == job.clientFd || client.second.watchAll) {
+            send_to_locked(client.first, msg);
+        }
+    }
+}
+
+void Daemon::send_to(int fd, const std::string &msg) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    send_to_locked(fd, msg);
+}
+
+/// 非阻塞发送, 发不完的部分留在该客户端的发送缓冲中, 不阻塞工作线程, 也不会发出半行
+/// 客户端读取过慢、积压超过上限时断开该客户端
+void Daemon::send_to_locked(int fd, const std::string &msg) {
+    static const size_t MAX_PENDING_BYTES = 4 << 20;
+    auto it = mClients.find(fd);
+    if (it == mClients.end() || it->second.broken) {
+        return;
+    }
+    Client &client = it->second;
+    if (client.writeBuffer.size() + msg.size() > MAX_PENDING_BYTES) {
+        TF_LOG_WARN("WARNING: Client %d too slow, %zu bytes pending, disconnecting.\n", fd, client.writeBuffer.size());
+        client.broken = true;
+        client.writeBuffer.clear();
+        return;
+    }
+    client.writeBuffer.append(msg);
+    flush_locked(&client, fd);
+}
+
+void Daemon::flush_locked(Client *client, int fd) {
+    while (!client->broken && !client->writeBuffer.empty()) {
+        ssize_t len = send(fd, client->writeBuffer.data(), client->writeBuffer.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (len > 0) {
+            client->writeBuffer.erase(0, len);
+        } else if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            client->broken = true;
+            client->writeBuffer.clear();
+        }
+    }
+}
+
+}  // namespace yitu_codec_daemon
@@ -0,0 +1,118 @@
+#ifndef DAEMON_HPP
+#define DAEMON_HPP
+
+#include <signal.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "transcoder.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 常驻转码服务
+ * 通过 Unix domain socket 接收任务, 协议为 JSON lines, 每行一个对象:
+ *   {"cmd":"submit","input":"a.mp4","output":"a.yuv","device":1}   提交任务, 返回 accepted 事件, 之后推送该任务的进度
+ *       可带编码参数 enc_profile/enc_width/enc_height/enc_gop/enc_level/enc_rate/enc_rcmode/enc_bit_rate/enc_max_bit_rate/enc_device_id,
+ *       含义同命令行参数, 未给出的取服务启动时的值; enc_profile 无效时输出I420原始数据
+ *       "live":true 按直播模式运行, "latency_ms" 为延迟目标, 默认 200
+ *       "trim_start"/"trim_end" 只输出该区间(秒), 完整的 GOP 直接拷贝, 只重编码两端; 输出须为裸码流
+ *       输入已满足编码参数且输出为裸码流时直接拷贝, "stream_copy":false 强制转码
+ *       输出为 mp4/mkv 等容器时带上源文件的音频/字幕(done 事件带 aux_packets), "audio":false 只输出视频
+ *       "scene_cut":true 在场景切换处插入关键帧, "scene_cut_min_gop" 为最小关键帧间隔
+ *       "static_threshold" 大于0时跳过静止帧, "static_max_skip" 为最多连续跳过的帧数
+ *       "quality":true 编码完成后评估 PSNR/SSIM, 逐帧结果写入 <output>.quality.csv; done 事件之后评估, 汇总随 quality 事件返回
+ *       "failover_devices":"2,3" 解码设备故障时切换到这些设备继续, 发生切换时 done 事件带 failovers/duplicate_frames
+ *   {"cmd":"cancel","job":3}                                       取消排队中或运行中的任务
+ *   {"cmd":"status","job":3}                                       查询单个任务
+ *   {"cmd":"queue"}                                                查询队列状态
+ *   {"cmd":"watch"}                                                订阅所有任务的事件
+ *   {"cmd":"shutdown"}                                             取消所有任务并退出
+ * 服务端推送的每行都带 "event" 字段: accepted/started/progress/done/failed/cancelled/quality/status/queue/error
+ * 任务的执行与 session 复用由 libtfcodec 的 Transcoder 完成, 本服务只负责协议与事件推送
+ */
+namespace yitu_codec_daemon {
+
+using namespace yitu_codec_transcoder;
+
+// 服务端记录的任务
+struct Job {
+    long id = 0;
+    std::string inputFileName;
+    int deviceIndex = 1;
+    JobState state = JOB_QUEUED;
+    /// 提交任务的连接, 连接断开后置为 -1
+    int clientFd = -1;
+    JobProgress progress = {0, 0, 0, 0, 0};
+    std::string error;
+};
+
+struct DaemonConfig {
+    std::string socketPath;
+    int defaultDeviceIndex = 1;
+    /// 任务未指定编码参数时使用的默认值
+    tfenc_setting encSetting = yitu_codec_enc::default_enc_setting();
+    /// 工作线程数/缓存/session池等
+    TranscoderConfig transcoder;
+    /// 已结束任务最多保留条数, 超出后淘汰最早的
+    int finishedJobHistory = 1024;
+};
+
+/// SIGINT/SIGTERM 时置位, 服务主循环据此退出
+extern volatile sig_atomic_t gDaemonStopRequested;
+
+class Daemon {
+   public:
+    explicit Daemon(const DaemonConfig &config);
+
+    /// 启动服务并阻塞, 直到收到 shutdown 命令或信号
+    int Run();
+
+   private:
+    // 客户端连接
+    struct Client {
+        std::string readBuffer;
+        /// 尚未发出的事件, 只保存完整的行; 套接字可写时(POLLOUT)继续发送
+        std::string writeBuffer;
+        bool watchAll = false;
+        /// 发送出错或积压超过上限, 由 serve_loop 关闭
+        bool broken = false;
+    };
+
+    void serve_loop();
+    void read_client(int fd);
+    void drop_client_locked(int fd);
+    void handle_line(int fd, const std::string &line);
+    void submit(int fd, std::map<std::string, std::string> &req);
+    void cancel(int fd, long jobId);
+
+    // 以下回调由 Transcoder 工作线程调用
+    void on_started(long jobId, int workerIndex);
+    void on_progress(const JobProgress &progress);
+    void on_finished(const TranscodeResult &result);
+    void on_quality(long jobId, int ret, const yitu_codec_quality::QualityStats &stats);
+
+    JsonLine job_line(const Job &job, const char *event);
+    JsonLine queue_line_locked();
+    void emit_locked(const Job &job, const JsonLine &line);
+    void send_to(int fd, const std::string &msg);
+    void send_to_locked(int fd, const std::string &msg);
+    /// 非阻塞地尽量发出 writeBuffer
+    void flush_locked(Client *client, int fd);
+
+    DaemonConfig mConfig;
+    int mListenFd = -1;
+    std::atomic<bool> mShutdownRequested{false};
+
+    std::mutex mMutex;
+    std::map<long, std::shared_ptr<Job>> mJobs;
+    std::deque<long> mFinished;
+    std::map<int, Client> mClients;
+    /// 在 Run 中创建, 退出前销毁以等待所有任务结束
+    std::unique_ptr<Transcoder> mTranscoder;
+};
+
+}  // namespace yitu_codec_daemon
+#endif  // DAEMON_HPP
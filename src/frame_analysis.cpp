@@ -0,0 +1,188 @@
+#include "frame_analysis.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace yitu_codec_analysis {
+
+void downscale_luma_8x8(const uint8_t *y, int width, int height, int stride, uint8_t *dst) {
+    int dstWidth = width / 8;
+    int dstHeight = height / 8;
+    for (int by = 0; by < dstHeight; by++) {
+        const uint8_t *rows = y + (size_t)by * 8 * stride;
+        uint8_t *out = dst + (size_t)by * dstWidth;
+        int bx = 0;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+        // 每次处理 16 列即两个块: 8 行逐对累加到 uint16, 再两次成对相加得到两个 64 像素之和
+        for (; bx + 2 <= dstWidth; bx += 2) {
+            uint16x8_t acc = vdupq_n_u16(0);
+            for (int r = 0; r < 8; r++) {
+                acc = vpadalq_u8(acc, vld1q_u8(rows + (size_t)r * stride + bx * 8));
+            }
+            uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(acc));
+            out[bx] = (uint8_t)(vgetq_lane_u64(sums, 0) >> 6);
+            out[bx + 1] = (uint8_t)(vgetq_lane_u64(sums, 1) >> 6);
+        }
+#endif
+        for (; bx < dstWidth; bx++) {
+            uint32_t sum = 0;
+            for (int r = 0; r < 8; r++) {
+                const uint8_t *p = rows + (size_t)r * stride + bx * 8;
+                for (int c = 0; c < 8; c++) {
+                    sum += p[c];
+                }
+            }
+            out[bx] = (uint8_t)(sum >> 6);
+        }
+    }
+}
+
+uint64_t sad_u8(const uint8_t *a, const uint8_t *b, size_t count) {
+    uint64_t sad = 0;
+    size_t i = 0;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    // uint32 累加器每轮每格最多加 1020, 分段归并避免溢出
+    while (i + 16 <= count) {
+        uint32x4_t acc = vdupq_n_u32(0);
+        size_t end = std::min(count - count % 16, i + ((size_t)1 << 20));
+        for (; i < end; i += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+        }
+        uint64x2_t sums = vpaddlq_u32(acc);
+        sad += vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+    }
+#endif
+    for (; i < count; i++) {
+        sad += abs((int)a[i] - (int)b[i]);
+    }
+    return sad;
+}
+
+uint32_t block_sad_16x16(const uint8_t *a, int aStride, const uint8_t *b, int bStride) {
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    uint16x8_t acc = vdupq_n_u16(0);
+    for (int r = 0; r < 16; r++) {
+        acc = vpadalq_u8(acc, vabdq_u8(vld1q_u8(a + (size_t)r * aStride), vld1q_u8(b + (size_t)r * bStride)));
+    }
+    uint64x2_t sums = vpaddlq_u32(vpaddlq_u16(acc));
+    return (uint32_t)(vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1));
+#else
+    uint32_t sad = 0;
+    for (int r = 0; r < 16; r++) {
+        const uint8_t *pa = a + (size_t)r * aStride;
+        const uint8_t *pb = b + (size_t)r * bStride;
+        for (int c = 0; c < 16; c++) {
+            sad += abs((int)pa[c] - (int)pb[c]);
+        }
+    }
+    return sad;
+#endif
+}
+
+uint32_t block_sad(const uint8_t *a, int aStride, const uint8_t *b, int bStride, int width, int height) {
+    uint32_t sad = 0;
+    for (int r = 0; r < height; r++) {
+        const uint8_t *pa = a + (size_t)r * aStride;
+        const uint8_t *pb = b + (size_t)r * bStride;
+        for (int c = 0; c < width; c++) {
+            sad += abs((int)pa[c] - (int)pb[c]);
+        }
+    }
+    return sad;
+}
+
+void luma_histogram(const uint8_t *y, size_t count, uint32_t histogram[64]) {
+    memset(histogram, 0, sizeof(uint32_t) * 64);
+    for (size_t i = 0; i < count; i++) {
+        histogram[y[i] >> 2]++;
+    }
+}
+
+bool SceneDetector::Detect(const uint8_t *i420, int width, int height, int maxGopFrames, int stride) {
+    if (!mConfig.enabled) {
+        return false;
+    }
+    size_t thumbSize = (size_t)(width / 8) * (height / 8);
+    if (thumbSize == 0) {
+        return false;
+    }
+    mThumb.resize(thumbSize);
+    downscale_luma_8x8(i420, width, height, stride > 0 ? stride : width, mThumb.data());
+    uint32_t histogram[64];
+    luma_histogram(mThumb.data(), thumbSize, histogram);
+
+    bool cut = false;
+    mFramesSinceKey++;
+    if (!mHasPrev || mPrevThumb.size() != thumbSize) {
+        // 码流的第一帧本身就是关键帧
+        mFramesSinceKey = 0;
+    } else if (maxGopFrames > 0 && mFramesSinceKey >= maxGopFrames) {
+        // 编码器按固定 GOP 插入的关键帧
+        mFramesSinceKey = 0;
+    } else if (mFramesSinceKey >= mConfig.minGopFrames) {
+        double meanSad = (double)sad_u8(mThumb.data(), mPrevThumb.data(), thumbSize) / thumbSize;
+        if (meanSad > mConfig.sadThreshold) {
+            uint64_t histDiff = 0;
+            for (int i = 0; i < 64; i++) {
+                histDiff += abs((int)histogram[i] - (int)mPrevHistogram[i]);
+            }
+            // 两个直方图的差异之和最大为 2 * 像素数
+            cut = (double)histDiff / (2.0 * thumbSize) > mConfig.histThreshold;
+        }
+        if (cut) {
+            mFramesSinceKey = 0;
+        }
+    }
+    mThumb.swap(mPrevThumb);
+    memcpy(mPrevHistogram, histogram, sizeof(histogram));
+    mHasPrev = true;
+    return cut;
+}
+
+bool StaticFrameFilter::IsStatic(const uint8_t *i420, int width, int height, int stride) {
+    if (!Enabled()) {
+        return false;
+    }
+    if (stride <= 0) {
+        stride = width;
+    }
+    size_t lumaSize = (size_t)width * height;
+    bool same = mReference.size() == lumaSize && mSkipped < mConfig.maxSkipFrames;
+    if (same) {
+        // 有一个块超过阈值即为变化帧, 运动画面通常很快退出
+        // 宽高不是 16 的倍数时右侧/底部的不完整块按实际像素数比较, 边缘的字幕/时钟等变化不会被漏掉
+        for (int by = 0; same && by < height; by += 16) {
+            int blockHeight = std::min(16, height - by);
+            for (int bx = 0; bx < width; bx += 16) {
+                int blockWidth = std::min(16, width - bx);
+                const uint8_t *current = i420 + (size_t)by * stride + bx;
+                const uint8_t *reference = mReference.data() + (size_t)by * width + bx;
+                uint32_t sad = blockWidth == 16 && blockHeight == 16
+                                   ? block_sad_16x16(current, stride, reference, width)
+                                   : block_sad(current, stride, reference, width, blockWidth, blockHeight);
+                if (sad > (uint32_t)(mConfig.blockThreshold * blockWidth * blockHeight)) {
+                    same = false;
+                    break;
+                }
+            }
+        }
+    }
+    if (same) {
+        mSkipped++;
+        return true;
+    }
+    // 参考帧按可见宽度紧密存放
+    mReference.resize(lumaSize);
+    for (int r = 0; r < height; r++) {
+        memcpy(mReference.data() + (size_t)r * width, i420 + (size_t)r * stride, width);
+    }
+    mSkipped = 0;
+    return false;
+}
+
+}  // namespace yitu_codec_analysis
@@ -0,0 +1,103 @@
+#ifndef FRAME_ANALYSIS_HPP
+#define FRAME_ANALYSIS_HPP
+
+#include "common.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 解码帧的亮度分析, 供编码前的场景切换检测/静止帧检测使用
+ * 只看 I420 的 Y 平面, 热点函数有 NEON 实现, 其他平台走标量实现
+ */
+namespace yitu_codec_analysis {
+
+/// @brief Y 平面按 8x8 块取平均缩小, 输出 (width/8) x (height/8), 不足 8 像素的边缘丢弃
+/// @param stride Y 平面每行字节数
+void downscale_luma_8x8(const uint8_t *y, int width, int height, int stride, uint8_t *dst);
+
+/// @brief 两段数据的绝对差之和
+uint64_t sad_u8(const uint8_t *a, const uint8_t *b, size_t count);
+
+/// @brief 16x16 块的绝对差之和
+uint32_t block_sad_16x16(const uint8_t *a, int aStride, const uint8_t *b, int bStride);
+
+/// @brief 任意尺寸块的绝对差之和, 用于帧边缘不足 16x16 的块
+uint32_t block_sad(const uint8_t *a, int aStride, const uint8_t *b, int bStride, int width, int height);
+
+/// @brief 64 级亮度直方图
+void luma_histogram(const uint8_t *y, size_t count, uint32_t histogram[64]);
+
+// 场景切换检测参数
+struct SceneCutConfig {
+    bool enabled = false;
+    /// 缩略图逐像素平均亮度差阈值(0~255), 用于排除亮度变化小的帧
+    double sadThreshold = 30;
+    /// 直方图差异阈值(0~1), 用于排除构图不变的大幅运动
+    double histThreshold = 0.4;
+    /// 两个关键帧之间至少间隔的帧数, 避免闪光等连续触发
+    int minGopFrames = 12;
+};
+
+// 场景切换检测器, 每路编码一个, 非线程安全
+// 在 8x8 缩小的亮度图上同时比较 SAD 与直方图, 两者都超过阈值时判定为切换
+class SceneDetector {
+   public:
+    explicit SceneDetector(const SceneCutConfig &config = SceneCutConfig())
+        : mConfig(config), mFramesSinceKey(0), mHasPrev(false) {
+    }
+
+    /// 开始新的码流时调用, 下一帧视为关键帧
+    void Reset() {
+        mHasPrev = false;
+        mFramesSinceKey = 0;
+    }
+
+    /// @brief 分析一帧, 判断是否需要在该帧插入关键帧
+    /// @param i420 I420 帧数据, 只读取 Y 平面
+    /// @param maxGopFrames 编码器固定的 GOP 长度, 到达时编码器自行插入关键帧
+    /// @param stride Y 平面每行字节数, 0 表示等于 width
+    /// @return true 表示场景切换且满足最小 GOP 约束
+    bool Detect(const uint8_t *i420, int width, int height, int maxGopFrames, int stride = 0);
+
+   private:
+    SceneCutConfig mConfig;
+    int mFramesSinceKey;
+    bool mHasPrev;
+    std::vector<uint8_t> mThumb;
+    std::vector<uint8_t> mPrevThumb;
+    uint32_t mPrevHistogram[64];
+};
+
+// 静止帧检测参数
+struct StaticFrameConfig {
+    /// 16x16 块内逐像素平均亮度差阈值(0~255), 所有块都不超过时视为静止帧; 0 表示关闭
+    double blockThreshold = 0;
+    /// 连续丢弃的最大帧数, 到达后强制保留一帧, 保证画面定期刷新
+    int maxSkipFrames = 250;
+};
+
+// 静止帧检测器, 每路一个, 非线程安全
+// 与上一个保留帧逐块比较, 取最大块差而不是整帧平均, 画面中的小目标移动也不会被当成静止
+class StaticFrameFilter {
+   public:
+    explicit StaticFrameFilter(const StaticFrameConfig &config = StaticFrameConfig())
+        : mConfig(config), mSkipped(0) {
+    }
+
+    bool Enabled() const {
+        return mConfig.blockThreshold > 0;
+    }
+
+    /// @brief 判断帧是否与上一个保留帧相同, 返回 false 时该帧成为新的参考
+    /// @param i420 I420 帧数据, 只读取 Y 平面
+    /// @param stride Y 平面每行字节数, 0 表示等于 width
+    bool IsStatic(const uint8_t *i420, int width, int height, int stride = 0);
+
+   private:
+    StaticFrameConfig mConfig;
+    int mSkipped;
+    std::vector<uint8_t> mReference;
+};
+
+}  // namespace yitu_codec_analysis
+#endif  // FRAME_ANALYSIS_HPP
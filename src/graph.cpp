@@ -0,0 +1,636 @@
+#include "graph.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace yitu_codec_graph {
+
+using yitu_codec_dec::DecodedStream;
+using yitu_codec_dec::VideoInfo;
+
+void FrameChannel::Push(const GraphFramePtr &frame) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mNotFull.wait(lock, [this] { return (int)mFrames.size() < mMaxFrames; });
+    mFrames.push_back(frame);
+    mNotEmpty.notify_one();
+}
+
+void FrameChannel::PushEnd() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mEnded++;
+    mNotEmpty.notify_all();
+}
+
+GraphFramePtr FrameChannel::Pop() {
+    std::unique_lock<std::mutex> lock(mLock);
+    mNotEmpty.wait(lock, [this] { return !mFrames.empty() || mEnded >= mProducers; });
+    if (mFrames.empty()) {
+        return nullptr;
+    }
+    GraphFramePtr frame = mFrames.front();
+    mFrames.pop_front();
+    mNotFull.notify_one();
+    return frame;
+}
+
+int Node::Run(FrameChannel *input, const Emit &emit) {
+    int ret = 0;
+    GraphFramePtr frame;
+    while ((frame = input->Pop()) != nullptr) {
+        if (ret != 0) {
+            continue;
+        }
+        ret = Process(frame, emit);
+        if (ret != 0) {
+            TF_LOG_ERROR("ERROR: Graph node %s failed at frame %ld, ret: %d.\n", mName.c_str(), frame->index, ret);
+            continue;
+        }
+        mProcessed++;
+    }
+    if (ret == 0) {
+        ret = Finish(emit);
+    }
+    return ret;
+}
+
+static std::string param_string(const std::map<std::string, std::string> &params, const std::string &key,
+                                 const std::string &defaultValue = "") {
+    auto it = params.find(key);
+    return it != params.end() ? it->second : defaultValue;
+}
+
+static int param_int(const std::map<std::string, std::string> &params, const std::string &key, int defaultValue) {
+    auto it = params.find(key);
+    return it != params.end() && !it->second.empty() ? atoi(it->second.c_str()) : defaultValue;
+}
+
+// 解码: 解封装 -> 码流过滤 -> tfdec, 即一个 run_dec 任务, 解码帧从 DecodedStream 取出后送往下游
+class DecodeNode : public Node {
+   public:
+    DecodeNode(const std::string &name, const std::string &inputFileName, int deviceIndex, int queueFrames)
+        : Node(name), mInputFileName(inputFileName), mDeviceIndex(deviceIndex), mStream(queueFrames) {
+    }
+
+    PortType InputType() const override {
+        return PORT_NONE;
+    }
+    PortType OutputType() const override {
+        return PORT_I420;
+    }
+
+    int Open(const PortFormat &, PortFormat *output) override {
+        yitu_codec_dec::BufferProfile profile = yitu_codec_dec::batch_buffer_profile();
+        if (yitu_codec_dec::open_decoded_stream(mInputFileName, mDeviceIndex, profile, &mStream) != 0) {
+            TF_LOG_ERROR("ERROR: Graph node %s: unable to open %s.\n", mName.c_str(), mInputFileName.c_str());
+            return -1;
+        }
+        const VideoInfo &videoInfo = mStream.videoInfo;
+        AVRational frameRate = videoInfo.avFormatContext->streams[videoInfo.videoIndex]->avg_frame_rate;
+        output->type = PORT_I420;
+        output->width = videoInfo.width;
+        output->height = videoInfo.height;
+        output->bitDepth = videoInfo.bitDepth;
+        output->frameRate = frameRate.den > 0 ? av_q2d(frameRate) : 0;
+        return 0;
+    }
+
+    int Run(FrameChannel *, const Emit &emit) override {
+        yitu_codec_dec::start_decoded_stream(&mStream);
+        FrameData *frameData;
+        while ((frameData = yitu_codec_dec::pop_decoded_frame(&mStream)) != nullptr) {
+            std::shared_ptr<GraphFrame> frame = std::make_shared<GraphFrame>();
+            frame->data = FrameRef(frameData);
+            frame->view = yitu_codec_dec::frame_view(mStream.ctx.get(), frameData);
+            frame->pts = (int64_t)frameData->GetTimestamp();
+            frame->index = mProcessed++;
+            emit(frame);
+        }
+        return yitu_codec_dec::close_decoded_stream(&mStream);
+    }
+
+    void Cancel() override {
+        if (mStream.ctx != nullptr) {
+            mStream.ctx->cancelled = true;
+        }
+    }
+
+    void Close() override {
+        yitu_codec_dec::close_decoded_stream(&mStream);
+    }
+
+   private:
+    std::string mInputFileName;
+    int mDeviceIndex;
+    DecodedStream mStream;
+};
+
+// 缩放到固定尺寸, 位深不变
+class ScaleNode : public Node {
+   public:
+    ScaleNode(const std::string &name, int width, int height, tfg::INTERP_MODE interpMode)
+        : Node(name), mWidth(width & ~1), mHeight(height & ~1), mInterpMode(interpMode) {
+    }
+
+    PortType InputType() const override {
+        return PORT_I420;
+    }
+    PortType OutputType() const override {
+        return PORT_I420;
+    }
+
+    int Open(const PortFormat &input, PortFormat *output) override {
+        if (mWidth <= 0 || mHeight <= 0) {
+            TF_LOG_ERROR("ERROR: Graph node %s: invalid size %dx%d.\n", mName.c_str(), mWidth, mHeight);
+            return -1;
+        }
+        *output = input;
+        output->width = mWidth;
+        output->height = mHeight;
+        mBytesPerSample = input.bitDepth > 8 ? 2 : 1;
+        return 0;
+    }
+
+   protected:
+    int Process(const GraphFramePtr &frame, const Emit &emit) override {
+        unsigned long size = (unsigned long)mWidth * mHeight * 3 / 2 * mBytesPerSample;
+        FrameData *frameData = new FrameData();
+        frameData->SetData(new unsigned char[size]);
+        frameData->SetLength(size);
+        frameData->SetTimestamp(frame->data->GetTimestamp());
+        frameData->SetIsEnd(false);
+        std::shared_ptr<GraphFrame> scaled = std::make_shared<GraphFrame>();
+        scaled->data = FrameRef(frameData);
+        FrameView dst = FrameView::FromI420(frameData->GetWritableData(), mWidth, mHeight, mWidth, mHeight, mBytesPerSample);
+        int ret = yitu_codec_enc::scale_view(frame->view, dst, mInterpMode);
+        if (ret != 0) {
+            return ret;
+        }
+        scaled->view = dst;
+        scaled->pts = frame->pts;
+        scaled->index = frame->index;
+        emit(scaled);
+        return 0;
+    }
+
+   private:
+    int mWidth;
+    int mHeight;
+    tfg::INTERP_MODE mInterpMode;
+    int mBytesPerSample = 1;
+};
+
+// tfenc 编码为 annexb 码流文件, 编码尺寸与输入不同时由编码上下文缩放
+class EncodeNode : public Node {
+   public:
+    EncodeNode(const std::string &name, const std::string &outputFileName, const tfenc_setting &setting, bool rateGiven)
+        : Node(name), mSetting(setting), mRateGiven(rateGiven) {
+        mEnc.outputFileName = outputFileName;
+    }
+
+    PortType InputType() const override {
+        return PORT_I420;
+    }
+    PortType OutputType() const override {
+        return PORT_NONE;
+    }
+
+    int Open(const PortFormat &input, PortFormat *) override {
+        if (mSetting.profile == TF_PROFILE_INVALID) {
+            TF_LOG_ERROR("ERROR: Graph node %s: encoder profile is required.\n", mName.c_str());
+            return -1;
+        }
+        if (mSetting.width == 0 || mSetting.height == 0) {
+            mSetting.width = input.width & ~1;
+            mSetting.height = input.height & ~1;
+        }
+        if (!mRateGiven && input.frameRate > 0) {
+            mSetting.frame_rate = (int)std::lround(input.frameRate);
+        }
+        mSession = yitu_codec_enc::create_enc_session(mSetting);
+        if (mSession == nullptr) {
+            TF_LOG_ERROR("ERROR: Graph node %s: unable to create encoder session.\n", mName.c_str());
+            return -1;
+        }
+        mEnc.srcWidth = input.width;
+        mEnc.srcHeight = input.height;
+        mEnc.bitDepth = input.bitDepth;
+        if (yitu_codec_enc::open_encoder(&mEnc, mSession) != 0) {
+            return -1;
+        }
+        mOpened = true;
+        return 0;
+    }
+
+    void Close() override {
+        if (mOpened) {
+            // 运行失败时编码器未冲刷
+            yitu_codec_enc::flush_encoder(&mEnc);
+            mOpened = false;
+        }
+        if (mSession != nullptr) {
+            yitu_codec_enc::destroy_enc_session(mSession);
+            mSession = nullptr;
+        }
+    }
+
+   protected:
+    int Process(const GraphFramePtr &frame, const Emit &) override {
+        return yitu_codec_enc::encode_view(&mEnc, frame->view, frame->pts);
+    }
+
+    int Finish(const Emit &) override {
+        mOpened = false;
+        return yitu_codec_enc::flush_encoder(&mEnc);
+    }
+
+   private:
+    tfenc_setting mSetting;
+    bool mRateGiven;
+    yitu_codec_enc::EncContext mEnc;
+    yitu_codec_enc::EncSession *mSession = nullptr;
+    bool mOpened = false;
+};
+
+// 每 every 帧取一帧, 按紧密排列的 I420 写入文件; 可以汇合多路
+class RawSinkNode : public Node {
+   public:
+    RawSinkNode(const std::string &name, const std::string &outputFileName, int every)
+        : Node(name), mOutputFileName(outputFileName), mEvery(std::max(every, 1)) {
+    }
+
+    PortType InputType() const override {
+        return PORT_I420;
+    }
+    PortType OutputType() const override {
+        return PORT_NONE;
+    }
+    bool AllowFanIn() const override {
+        return true;
+    }
+
+    int Open(const PortFormat &, PortFormat *) override {
+        mFStream.open(mOutputFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!mFStream.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", mOutputFileName.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    void Close() override {
+        if (mFStream.is_open()) {
+            mFStream.close();
+        }
+    }
+
+   protected:
+    int Process(const GraphFramePtr &frame, const Emit &) override {
+        if (mReceived++ % mEvery != 0) {
+            return 0;
+        }
+        const ConstFrameView &view = frame->view;
+        for (int plane = 0; plane < 3; plane++) {
+            for (int r = 0; r < view.PlaneHeight(plane); r++) {
+                mFStream.write((const char *)view.planes[plane] + (size_t)r * view.strides[plane],
+                               (size_t)view.PlaneWidth(plane) * view.bytesPerSample);
+            }
+        }
+        return mFStream.good() ? 0 : -1;
+    }
+
+   private:
+    std::string mOutputFileName;
+    int mEvery;
+    long mReceived = 0;
+    std::fstream mFStream;
+};
+
+// 分析旁路: 逐帧写出平均亮度与相邻帧 8x8 缩略图的平均亮度差, 只读帧数据; 可以汇合多路
+class TapNode : public Node {
+   public:
+    TapNode(const std::string &name, const std::string &outputFileName) : Node(name), mOutputFileName(outputFileName) {
+    }
+
+    PortType InputType() const override {
+        return PORT_I420;
+    }
+    PortType OutputType() const override {
+        return PORT_NONE;
+    }
+    bool AllowFanIn() const override {
+        return true;
+    }
+
+    int Open(const PortFormat &input, PortFormat *) override {
+        if (input.bitDepth > 8) {
+            TF_LOG_ERROR("ERROR: Graph node %s: tap supports 8 bit frames only.\n", mName.c_str());
+            return -1;
+        }
+        mFStream.open(mOutputFileName, std::ios::out | std::ios::trunc);
+        if (!mFStream.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", mOutputFileName.c_str());
+            return -1;
+        }
+        mFStream << "frame,pts,mean_luma,motion\n";
+        mThumb.resize((size_t)(input.width / 8) * (input.height / 8));
+        return 0;
+    }
+
+    void Close() override {
+        if (mFStream.is_open()) {
+            mFStream.close();
+        }
+    }
+
+   protected:
+    int Process(const GraphFramePtr &frame, const Emit &) override {
+        const ConstFrameView &view = frame->view;
+        uint64_t sum = 0;
+        for (int r = 0; r < view.height; r++) {
+            const uint8_t *row = view.planes[0] + (size_t)r * view.strides[0];
+            for (int c = 0; c < view.width; c++) {
+                sum += row[c];
+            }
+        }
+        double meanLuma = view.width * view.height > 0 ? (double)sum / ((long)view.width * view.height) : 0;
+        double motion = 0;
+        if (!mThumb.empty()) {
+            yitu_codec_analysis::downscale_luma_8x8(view.planes[0], view.width, view.height, view.strides[0], mThumb.data());
+            if (mPrevThumb.size() == mThumb.size()) {
+                motion = (double)yitu_codec_analysis::sad_u8(mThumb.data(), mPrevThumb.data(), mThumb.size()) / mThumb.size();
+            }
+            mPrevThumb.swap(mThumb);
+            mThumb.resize(mPrevThumb.size());
+        }
+        mFStream << frame->index << "," << frame->pts << "," << meanLuma << "," << motion << "\n";
+        return mFStream.good() ? 0 : -1;
+    }
+
+   private:
+    std::string mOutputFileName;
+    std::fstream mFStream;
+    std::vector<uint8_t> mThumb;
+    std::vector<uint8_t> mPrevThumb;
+};
+
+int Graph::find(const std::string &name) const {
+    for (size_t i = 0; i < mVertices.size(); i++) {
+        if (mVertices[i].node->Name() == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int Graph::AddNode(Node *node) {
+    std::unique_ptr<Node> owned(node);
+    if (find(node->Name()) >= 0) {
+        TF_LOG_ERROR("ERROR: Duplicate graph node %s.\n", node->Name().c_str());
+        return -1;
+    }
+    Vertex vertex;
+    vertex.node = std::move(owned);
+    mVertices.push_back(std::move(vertex));
+    return 0;
+}
+
+int Graph::Connect(const std::string &from, const std::string &to, int queueFrames) {
+    int src = find(from);
+    int dst = find(to);
+    if (src < 0 || dst < 0) {
+        TF_LOG_ERROR("ERROR: Graph edge %s -> %s: no such node.\n", from.c_str(), to.c_str());
+        return -1;
+    }
+    Node *srcNode = mVertices[src].node.get();
+    Node *dstNode = mVertices[dst].node.get();
+    if (srcNode->OutputType() == PORT_NONE || srcNode->OutputType() != dstNode->InputType()) {
+        TF_LOG_ERROR("ERROR: Graph edge %s -> %s: port type mismatch.\n", from.c_str(), to.c_str());
+        return -1;
+    }
+    std::vector<int> &upstream = mVertices[dst].upstream;
+    if (std::find(upstream.begin(), upstream.end(), src) != upstream.end()) {
+        TF_LOG_ERROR("ERROR: Graph edge %s -> %s: duplicate edge.\n", from.c_str(), to.c_str());
+        return -1;
+    }
+    if (!upstream.empty() && !dstNode->AllowFanIn()) {
+        TF_LOG_ERROR("ERROR: Graph edge %s -> %s: node %s accepts a single input.\n", from.c_str(), to.c_str(), to.c_str());
+        return -1;
+    }
+    mVertices[src].downstream.push_back(dst);
+    upstream.push_back(src);
+    mVertices[dst].queueFrames = std::max(mVertices[dst].queueFrames, queueFrames);
+    return 0;
+}
+
+bool Graph::topo_order(std::vector<int> *order) const {
+    std::vector<int> inDegree(mVertices.size());
+    std::deque<int> ready;
+    for (size_t i = 0; i < mVertices.size(); i++) {
+        inDegree[i] = (int)mVertices[i].upstream.size();
+        if (inDegree[i] == 0) {
+            ready.push_back((int)i);
+        }
+    }
+    while (!ready.empty()) {
+        int v = ready.front();
+        ready.pop_front();
+        order->push_back(v);
+        for (int d : mVertices[v].downstream) {
+            if (--inDegree[d] == 0) {
+                ready.push_back(d);
+            }
+        }
+    }
+    return order->size() == mVertices.size();
+}
+
+void Graph::Cancel() {
+    for (Vertex &vertex : mVertices) {
+        if (vertex.node->InputType() == PORT_NONE) {
+            vertex.node->Cancel();
+        }
+    }
+}
+
+int Graph::Run(std::vector<NodeStats> *stats) {
+    std::vector<int> order;
+    if (mVertices.empty() || !topo_order(&order)) {
+        TF_LOG_ERROR("ERROR: Graph is empty or has a cycle.\n");
+        return -1;
+    }
+    for (const Vertex &vertex : mVertices) {
+        if (vertex.node->InputType() != PORT_NONE && vertex.upstream.empty()) {
+            TF_LOG_ERROR("ERROR: Graph node %s has no input.\n", vertex.node->Name().c_str());
+            return -1;
+        }
+    }
+
+    // 按拓扑序打开, 上游的输出格式即下游的输入格式
+    int ret = 0;
+    size_t opened = 0;
+    for (; opened < order.size() && ret == 0; opened++) {
+        Vertex &vertex = mVertices[order[opened]];
+        PortFormat input;
+        for (int u : vertex.upstream) {
+            const PortFormat &format = mVertices[u].format;
+            if (input.type != PORT_NONE &&
+                (format.width != input.width || format.height != input.height || format.bitDepth != input.bitDepth)) {
+                TF_LOG_ERROR("ERROR: Graph node %s: inputs have different formats.\n", vertex.node->Name().c_str());
+                ret = -1;
+                break;
+            }
+            input = format;
+        }
+        if (ret == 0) {
+            ret = vertex.node->Open(input, &vertex.format);
+        }
+        if (ret == 0 && vertex.node->OutputType() != PORT_NONE) {
+            TF_LOG_INFO("Graph node %s: %dx%d, %d bit.\n", vertex.node->Name().c_str(), vertex.format.width, vertex.format.height,
+                        vertex.format.bitDepth);
+        }
+    }
+
+    if (ret == 0) {
+        for (Vertex &vertex : mVertices) {
+            if (!vertex.upstream.empty()) {
+                vertex.input.reset(new FrameChannel(vertex.queueFrames));
+                for (size_t i = 0; i < vertex.upstream.size(); i++) {
+                    vertex.input->AddProducer();
+                }
+            }
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < mVertices.size(); i++) {
+            threads.emplace_back([this, i] {
+                Vertex &vertex = mVertices[i];
+                // 分叉时各下游共享同一帧
+                Emit emit = [this, &vertex](const GraphFramePtr &frame) {
+                    for (int d : vertex.downstream) {
+                        mVertices[d].input->Push(frame);
+                    }
+                };
+                vertex.ret = vertex.node->Run(vertex.input.get(), emit);
+                for (int d : vertex.downstream) {
+                    mVertices[d].input->PushEnd();
+                }
+                // 任一节点失败时停止读取输入
+                if (vertex.ret != 0) {
+                    Cancel();
+                }
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        for (const Vertex &vertex : mVertices) {
+            if (vertex.ret != 0) {
+                ret = vertex.ret;
+            }
+        }
+    }
+
+    for (size_t i = opened; i-- > 0;) {
+        mVertices[order[i]].node->Close();
+    }
+    for (Vertex &vertex : mVertices) {
+        vertex.input.reset();
+    }
+    if (stats != nullptr) {
+        for (const Vertex &vertex : mVertices) {
+            stats->push_back({vertex.node->Name(), vertex.node->ProcessedFrames(), vertex.ret});
+        }
+    }
+    return ret;
+}
+
+Node *create_node(const std::string &name, const std::string &kind, const std::map<std::string, std::string> &params,
+                  const tfenc_setting &defaults) {
+    std::string output = param_string(params, "output");
+    if (kind == "decode") {
+        std::string input = param_string(params, "input");
+        if (input.empty()) {
+            TF_LOG_ERROR("ERROR: Graph node %s: input is required.\n", name.c_str());
+            return nullptr;
+        }
+        return new DecodeNode(name, input, param_int(params, "device", 1), param_int(params, "queue", 8));
+    }
+    if (kind == "scale") {
+        return new ScaleNode(name, param_int(params, "width", 0), param_int(params, "height", 0),
+                             tfg::INTERP_MODE(param_int(params, "interp", tfg::INTERP_Bilinear)));
+    }
+    if (output.empty() && (kind == "encode" || kind == "rawsink" || kind == "tap")) {
+        TF_LOG_ERROR("ERROR: Graph node %s: output is required.\n", name.c_str());
+        return nullptr;
+    }
+    if (kind == "encode") {
+        tfenc_setting setting = defaults;
+        setting.profile = tf_profile(param_int(params, "profile", setting.profile));
+        setting.rc_mode = tf_rcmode(param_int(params, "rcmode", setting.rc_mode));
+        setting.width = param_int(params, "width", 0);
+        setting.height = param_int(params, "height", 0);
+        setting.level = param_int(params, "level", setting.level);
+        setting.bit_rate = param_int(params, "bitrate", setting.bit_rate);
+        setting.max_bit_rate = param_int(params, "max_bitrate", std::max(setting.max_bit_rate, setting.bit_rate));
+        setting.gop = param_int(params, "gop", setting.gop);
+        setting.frame_rate = param_int(params, "rate", setting.frame_rate);
+        setting.device_id = param_int(params, "device", setting.device_id);
+        return new EncodeNode(name, output, setting, params.count("rate") > 0);
+    }
+    if (kind == "rawsink") {
+        return new RawSinkNode(name, output, param_int(params, "every", 1));
+    }
+    if (kind == "tap") {
+        return new TapNode(name, output);
+    }
+    TF_LOG_ERROR("ERROR: Graph node %s: unknown type %s.\n", name.c_str(), kind.c_str());
+    return nullptr;
+}
+
+int load_graph(const std::string &fileName, const tfenc_setting &defaults, Graph *graph) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", fileName.c_str());
+        return -1;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::stringstream ss(line);
+        std::string keyword;
+        if (!(ss >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+        std::string first, second;
+        if (!(ss >> first >> second)) {
+            TF_LOG_ERROR("ERROR: %s line %d: expected two names.\n", fileName.c_str(), lineNumber);
+            return -1;
+        }
+        std::map<std::string, std::string> params;
+        std::string token;
+        while (ss >> token) {
+            size_t pos = token.find('=');
+            if (pos == std::string::npos) {
+                TF_LOG_ERROR("ERROR: %s line %d: invalid parameter %s.\n", fileName.c_str(), lineNumber, token.c_str());
+                return -1;
+            }
+            params[token.substr(0, pos)] = token.substr(pos + 1);
+        }
+        int ret = -1;
+        if (keyword == "node") {
+            Node *node = create_node(first, second, params, defaults);
+            ret = node != nullptr ? graph->AddNode(node) : -1;
+        } else if (keyword == "edge") {
+            ret = graph->Connect(first, second, param_int(params, "queue", 8));
+        } else {
+            TF_LOG_ERROR("ERROR: %s line %d: unknown keyword %s.\n", fileName.c_str(), lineNumber, keyword.c_str());
+        }
+        if (ret != 0) {
+            TF_LOG_ERROR("ERROR: %s line %d: invalid graph definition.\n", fileName.c_str(), lineNumber);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+}  // namespace yitu_codec_graph
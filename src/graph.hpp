@@ -0,0 +1,200 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+#include <memory>
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 流水线图: 由节点与有界队列(边)组成, 按配置文件搭建, 多码率输出/缩略图/分析旁路不必各写一套流程
+ * 每个节点一个线程, 声明输入输出端口类型, 连接时检查类型, 打开时沿边传递帧格式(宽高/位深/帧率):
+ *
+ *                      +-> encode(1080p)
+ *   decode(src) ------+-> scale(720p) -> encode(720p)
+ *                      +-> scale(320x180) -> rawsink(每 250 帧一张)
+ *                      +-> tap(亮度统计)
+ *
+ * 一个节点有多个下游时(分叉)各下游共享同一帧(shared_ptr), 不拷贝; 有多个上游时(汇合)各路帧合并到同一输入队列,
+ * 所有上游结束后该节点才结束, 汇合的各路帧格式需相同
+ * 解封装/码流过滤/硬件解码(及超限 JPEG 的 CPU 解码)由 decode 节点经 run_dec 完成, 节点之间只传递解码帧
+ *
+ * 配置文件每行一条, 空行与 # 开头的行忽略:
+ *   node <名称> <类型> [key=value ...]
+ *   edge <上游名称> <下游名称> [queue=帧数]
+ *
+ *   node src  decode  input=in.mp4 device=1
+ *   node s720 scale   width=1280 height=720
+ *   node e1080 encode output=out_1080.h264 profile=2 bitrate=8000000
+ *   node e720 encode  output=out_720.h264 bitrate=3000000
+ *   edge src e1080
+ *   edge src s720
+ *   edge s720 e720
+ *
+ * decode: input device queue; scale: width height interp; encode: output profile level bitrate max_bitrate gop rate rcmode
+ * device width height(默认与输入一致); rawsink: output every; tap: output(CSV: 帧号, pts, 平均亮度, 与上一帧的亮度变化)
+ */
+namespace yitu_codec_graph {
+
+// 端口类型, PORT_NONE 表示没有该方向的端口(源节点没有输入, 终点节点没有输出)
+enum PortType {
+    PORT_NONE = 0,
+    /// 解码帧, I420, 位深大于 8 时每个采样 2 字节
+    PORT_I420
+};
+
+// 端口上的帧格式, 打开节点时由上游确定
+struct PortFormat {
+    PortType type = PORT_NONE;
+    int width = 0;
+    int height = 0;
+    int bitDepth = 8;
+    double frameRate = 0;
+};
+
+// 图中流动的一帧, 分叉时各下游共享, 只读
+struct GraphFrame {
+    /// 持有帧数据的一个引用, 最后一个引用释放时释放
+    FrameRef data;
+    /// 可见区域只读视图, 指向 data 中的数据
+    ConstFrameView view;
+    /// 源视频 pts(源视频时间基)
+    int64_t pts = AV_NOPTS_VALUE;
+    /// 源帧序号(解码输出顺序)
+    long index = 0;
+};
+typedef std::shared_ptr<const GraphFrame> GraphFramePtr;
+
+// 边: 有界帧队列, 可以有多个生产者(汇合), 所有生产者都结束后 Pop 返回 NULL
+class FrameChannel {
+   public:
+    explicit FrameChannel(int maxFrames) : mMaxFrames(std::max(maxFrames, 1)) {
+    }
+
+    void AddProducer() {
+        mProducers++;
+    }
+
+    /// 队列满时阻塞
+    void Push(const GraphFramePtr &frame);
+    /// 一个生产者结束
+    void PushEnd();
+    /// 队列为空时阻塞, 所有生产者都结束后返回 NULL
+    GraphFramePtr Pop();
+
+   private:
+    std::mutex mLock;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::deque<GraphFramePtr> mFrames;
+    int mMaxFrames;
+    int mProducers = 0;
+    int mEnded = 0;
+};
+
+// 送往所有下游
+typedef std::function<void(const GraphFramePtr &)> Emit;
+
+// 节点基类, 各方法只在该节点自己的线程(Open/Close 在调用 Graph::Run 的线程)中调用
+class Node {
+   public:
+    explicit Node(const std::string &name) : mName(name) {
+    }
+    virtual ~Node() = default;
+
+    const std::string &Name() const {
+        return mName;
+    }
+    virtual PortType InputType() const = 0;
+    virtual PortType OutputType() const = 0;
+    /// 是否允许多个上游
+    virtual bool AllowFanIn() const {
+        return false;
+    }
+
+    /// @brief 按输入格式打开, 给出输出格式; 源节点 input.type 为 PORT_NONE
+    /// @return 0 成功, 其他值失败
+    virtual int Open(const PortFormat &input, PortFormat *output) = 0;
+    /// @brief 运行到输入结束, 默认逐帧调用 Process, 最后调用 Finish; 源节点重写本方法
+    /// 失败后继续取走输入直到结束, 上游不会阻塞
+    virtual int Run(FrameChannel *input, const Emit &emit);
+    /// 取消, 源节点停止读取
+    virtual void Cancel() {
+    }
+    virtual void Close() {
+    }
+
+    /// 处理的帧数
+    long ProcessedFrames() const {
+        return mProcessed;
+    }
+
+   protected:
+    virtual int Process(const GraphFramePtr &frame, const Emit &emit) {
+        return 0;
+    }
+    virtual int Finish(const Emit &emit) {
+        return 0;
+    }
+
+    std::string mName;
+    std::atomic<long> mProcessed{0};
+};
+
+// 各节点的统计
+struct NodeStats {
+    std::string name;
+    long frames;
+    int ret;
+};
+
+// 流水线图, 搭建后 Run 一次
+class Graph {
+   public:
+    /// @brief 加入节点, 取得其所有权
+    /// @return 0 成功, -1 名称重复
+    int AddNode(Node *node);
+    /// @brief 连接两个节点, 检查端口类型与汇合
+    /// @param queueFrames 该边的队列帧数上限; 汇合时取各边中的最大值
+    /// @return 0 成功, -1 节点不存在/类型不匹配/不允许汇合
+    int Connect(const std::string &from, const std::string &to, int queueFrames = 8);
+
+    /// @brief 检查环与孤立节点, 按拓扑序打开节点, 每个节点一个线程运行, 阻塞到全部结束
+    /// @param stats 各节点统计, 可为 NULL
+    /// @return 0 成功, 其他值失败
+    int Run(std::vector<NodeStats> *stats);
+    /// 取消运行, 源节点停止读取, 已读取的帧照常流过
+    void Cancel();
+
+   private:
+    struct Vertex {
+        std::unique_ptr<Node> node;
+        std::vector<int> downstream;
+        std::vector<int> upstream;
+        std::unique_ptr<FrameChannel> input;
+        int queueFrames = 0;
+        PortFormat format;
+        int ret = 0;
+    };
+
+    int find(const std::string &name) const;
+    /// 拓扑序, 有环时返回 false
+    bool topo_order(std::vector<int> *order) const;
+
+    std::vector<Vertex> mVertices;
+};
+
+/// @brief 由名称与参数创建内置节点: decode / scale / encode / rawsink / tap
+/// @param defaults encode 节点的默认编码参数, 配置中的参数覆盖其中的对应项
+/// @return 类型未知或参数错误时返回 NULL
+Node *create_node(const std::string &name, const std::string &kind, const std::map<std::string, std::string> &params,
+                  const tfenc_setting &defaults);
+
+/// @brief 读取配置文件搭建图
+/// @return 0 成功, -1 文件无法读取或格式错误
+int load_graph(const std::string &fileName, const tfenc_setting &defaults, Graph *graph);
+
+}  // namespace yitu_codec_graph
+#endif  // GRAPH_HPP
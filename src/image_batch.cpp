@@ -0,0 +1,287 @@
+#include "image_batch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace yitu_codec_image {
+
+// 单个工作线程的状态, 缓冲区在线程内复用
+struct ImageWorker {
+    tfg::TFSession *session = nullptr;
+    std::vector<uint8_t> decoded;
+    std::vector<uint8_t> scaled;
+    std::vector<uint8_t> jpeg;
+    int imageCount = 0;
+    double busySec = 0;
+};
+
+void thumbnail_size(const ImageBatchConfig &config, int srcWidth, int srcHeight, int *width, int *height, int *shortWidth) {
+    *shortWidth = 0;
+    if (config.mode == THUMB_STRETCH) {
+        *width = config.width & ~1;
+        *height = config.height & ~1;
+    } else if (config.mode == THUMB_CENTER_CROP) {
+        // 短边缩放到刚好让两个方向都覆盖目标尺寸
+        double scale = std::max((double)config.width / srcWidth, (double)config.height / srcHeight);
+        *shortWidth = (int)std::ceil(std::min(srcWidth, srcHeight) * scale);
+        *width = config.width & ~1;
+        *height = config.height & ~1;
+    } else {
+        double scale = std::min((double)config.width / srcWidth, (double)config.height / srcHeight);
+        *width = std::max((int)(srcWidth * scale) & ~1, 2);
+        *height = std::max((int)(srcHeight * scale) & ~1, 2);
+    }
+}
+
+int load_image_list(const std::string &listFileName, const std::string &outputDir, std::vector<ImageJob> *jobs) {
+    std::ifstream list(listFileName);
+    if (!list.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", listFileName.c_str());
+        return -1;
+    }
+    // 输出文件 -> 列表中的行号, 不同目录下的同名文件或仅扩展名不同的文件会得到相同的默认输出
+    std::map<std::string, int> outputLines;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(list, line)) {
+        lineNumber++;
+        if (line.empty()) {
+            continue;
+        }
+        ImageJob job;
+        size_t comma = line.find(',');
+        if (comma != std::string::npos) {
+            job.inputFileName = line.substr(0, comma);
+            job.outputFileName = line.substr(comma + 1);
+            if (job.inputFileName.empty() || job.outputFileName.empty()) {
+                TF_LOG_ERROR("ERROR: Invalid line %d in %s: %s.\n", lineNumber, listFileName.c_str(), line.c_str());
+                return -1;
+            }
+            if (job.outputFileName[0] != '/') {
+                job.outputFileName = outputDir + "/" + job.outputFileName;
+            }
+        } else {
+            std::string name = line.substr(line.find_last_of('/') + 1);
+            size_t dot = name.find_last_of('.');
+            if (dot != std::string::npos) {
+                name = name.substr(0, dot);
+            }
+            job.inputFileName = line;
+            job.outputFileName = outputDir + "/" + name + ".jpg";
+        }
+        auto inserted = outputLines.insert(std::make_pair(job.outputFileName, lineNumber));
+        if (!inserted.second) {
+            TF_LOG_ERROR("ERROR: Line %d and line %d of %s both write %s, use \"input,output\" to name the outputs.\n",
+                         inserted.first->second, lineNumber, listFileName.c_str(), job.outputFileName.c_str());
+            return -1;
+        }
+        jobs->push_back(job);
+    }
+    return 0;
+}
+
+// 读取线程: 按顺序读入文件, 预读量由输入队列限制, 最后为每个工作线程送入一个结束帧
+static void read_images(const std::vector<ImageJob> &jobs, int workerCount, FrameQueue *inQueue, std::atomic<int> *failedCount,
+                        std::atomic<long> *inputBytes) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+        std::ifstream file(jobs[i].inputFileName, std::ios::in | std::ios::binary | std::ios::ate);
+        long size = file.is_open() ? (long)file.tellg() : -1;
+        if (size <= 0) {
+            TF_LOG_ERROR("ERROR: Unable to read image %s.\n", jobs[i].inputFileName.c_str());
+            (*failedCount)++;
+            continue;
+        }
+        // 直接读入帧数据, 不再拷贝
+        unsigned char *data = new unsigned char[size];
+        file.seekg(0);
+        file.read((char *)data, size);
+        FrameData *frameData = new FrameData();
+        frameData->SetData(data);
+        frameData->SetLength(size);
+        frameData->SetTimestamp(i);
+        frameData->SetIsEnd(false);
+        *inputBytes += size;
+        inQueue->Push(frameData);
+    }
+    for (int i = 0; i < workerCount; i++) {
+        inQueue->Push(new FrameData());
+    }
+}
+
+/// @brief 处理一张图片: 解码为 I420, 缩放/裁剪, 压缩为 JPEG
+/// @return 0 成功, 结果在 worker->jpeg 的前 jpegSize 字节
+static int process_image(const ImageBatchConfig &config, ImageWorker *worker, FrameData *frameData, unsigned long *jpegSize) {
+    tfg::TFSession *session = worker->session;
+    if (session->ReadImg(const_cast<unsigned char *>(frameData->GetData()), frameData->GetLength()) != 0) {
+        return -1;
+    }
+    int srcWidth = session->GetImgWidth();
+    int srcHeight = session->GetImgHeight();
+    if (srcWidth <= 0 || srcHeight <= 0) {
+        return -1;
+    }
+    worker->decoded.resize(tfg::GetImgBufferSize(srcWidth, srcHeight, tfg::TFSAMP_I420Planar));
+    if (session->BufferImg(worker->decoded.data(), srcWidth, srcHeight, tfg::TFSAMP_I420Planar) != 0) {
+        return -1;
+    }
+
+    int width, height, shortWidth;
+    thumbnail_size(config, srcWidth, srcHeight, &width, &height, &shortWidth);
+    worker->scaled.resize((size_t)width * height * 3 / 2);
+    int ret;
+    if (config.mode == THUMB_CENTER_CROP) {
+        ret = tfg::I420_Planar_CenterCrop(worker->decoded.data(), NULL, srcWidth, srcHeight, worker->scaled.data(), shortWidth, width, height,
+                                          tfg::TFSAMP_I420Planar);
+    } else {
+        ret = tfg::I420_Planar_ScaleEx(worker->decoded.data(), NULL, srcWidth, srcHeight, worker->scaled.data(), NULL, width, height,
+                                       config.interpMode);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    // 低分辨率高质量时 JPEG 可能大于原始数据, 按原始数据两倍预留
+    worker->jpeg.resize((size_t)width * height * 3 + 65536);
+    *jpegSize = worker->jpeg.size();
+    return tfg::I420_Planar_CompressJpeg(worker->scaled.data(), width, height, worker->jpeg.data(), jpegSize, config.quality);
+}
+
+// 工作线程: 每个线程一个 TFSession, 结果按任务序号送入输出队列, 退出前送入结束帧
+static void process_images(const ImageBatchConfig &config, const std::vector<ImageJob> &jobs, ImageWorker *worker, FrameQueue *inQueue,
+                           FrameQueue *outQueue, std::atomic<int> *failedCount) {
+    while (true) {
+        FrameData *frameData = inQueue->Pop();
+        if (frameData->GetIsEnd()) {
+            frameData->Release();
+            break;
+        }
+        auto start = std::chrono::steady_clock::now();
+        unsigned long jpegSize = 0;
+        int ret = process_image(config, worker, frameData, &jpegSize);
+        worker->busySec += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (ret != 0) {
+            TF_LOG_ERROR("ERROR: Image %s failed, ret: %d.\n", jobs[frameData->GetTimestamp()].inputFileName.c_str(), ret);
+            (*failedCount)++;
+        } else {
+            worker->imageCount++;
+            outQueue->Push(new FrameData(worker->jpeg.data(), jpegSize, frameData->GetTimestamp(), false));
+        }
+        frameData->Release();
+    }
+    outQueue->Push(new FrameData());
+}
+
+static void write_batch(const std::vector<ImageJob> &jobs, std::vector<FrameData *> *batch, std::atomic<int> *failedCount,
+                        std::atomic<long> *outputBytes) {
+    for (FrameData *frameData : *batch) {
+        const std::string &fileName = jobs[frameData->GetTimestamp()].outputFileName;
+        std::fstream output(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open() || !output.write((const char *)frameData->GetData(), frameData->GetLength())) {
+            TF_LOG_ERROR("ERROR: Unable to write file %s.\n", fileName.c_str());
+            (*failedCount)++;
+        } else {
+            *outputBytes += frameData->GetLength();
+        }
+        frameData->Release();
+    }
+    batch->clear();
+}
+
+// 写出线程: 有积压时攒够一批再写, 队列空时立即写出; 工作线程不会被磁盘延迟阻塞
+static void write_images(const ImageBatchConfig &config, const std::vector<ImageJob> &jobs, FrameQueue *outQueue, std::atomic<int> *failedCount,
+                         std::atomic<long> *outputBytes) {
+    std::vector<FrameData *> batch;
+    int endCount = 0;
+    while (endCount < config.workerCount) {
+        FrameData *frameData = outQueue->Pop();
+        if (frameData->GetIsEnd()) {
+            frameData->Release();
+            endCount++;
+            continue;
+        }
+        batch.push_back(frameData);
+        if ((int)batch.size() >= config.writeBatchSize || outQueue->Size() == 0) {
+            write_batch(jobs, &batch, failedCount, outputBytes);
+        }
+    }
+    write_batch(jobs, &batch, failedCount, outputBytes);
+}
+
+int run_image_batch(const ImageBatchConfig &config, const std::vector<ImageJob> &jobs, ImageBatchStats *stats) {
+    if (config.workerCount <= 0 || config.width <= 0 || config.height <= 0) {
+        TF_LOG_ERROR("ERROR: Invalid image batch config.\n");
+        return -1;
+    }
+    if (config.hwJpeg && tfg::EnableHwJpegDecoder(MAX_HW_JPEG_Width, MAX_HW_JPEG_Height) != 0) {
+        TF_LOG_WARN("WARNING: Unable to enable hardware jpeg decoder, decode on cpu.\n");
+    }
+
+    std::vector<ImageWorker> workers(config.workerCount);
+    int ret = 0;
+    for (ImageWorker &worker : workers) {
+        worker.session = tfg::TFSession::CreateSession();
+        if (worker.session == nullptr) {
+            TF_LOG_ERROR("ERROR: Unable to create TFSession.\n");
+            ret = -1;
+        }
+    }
+
+    std::atomic<int> failedCount{0};
+    std::atomic<long> inputBytes{0};
+    std::atomic<long> outputBytes{0};
+    auto start = std::chrono::steady_clock::now();
+    if (ret == 0) {
+        MemoryAccount memory;
+        FrameQueue inQueue(config.prefetchCount, config.prefetchBytes);
+        FrameQueue outQueue(config.writeBatchSize * 2, 0);
+        inQueue.SetAccount(&memory, BUDGET_BLOCK);
+        outQueue.SetAccount(&memory, BUDGET_BLOCK);
+
+        std::thread readThread(&read_images, std::cref(jobs), config.workerCount, &inQueue, &failedCount, &inputBytes);
+        std::vector<std::thread> workerThreads;
+        for (ImageWorker &worker : workers) {
+            workerThreads.emplace_back(&process_images, std::cref(config), std::cref(jobs), &worker, &inQueue, &outQueue, &failedCount);
+        }
+        std::thread writeThread(&write_images, std::cref(config), std::cref(jobs), &outQueue, &failedCount, &outputBytes);
+
+        readThread.join();
+        for (std::thread &thread : workerThreads) {
+            thread.join();
+        }
+        writeThread.join();
+    }
+    double elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int imageCount = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        ImageWorker &worker = workers[i];
+        if (worker.session != nullptr) {
+            worker.session->Destroy();
+        }
+        imageCount += worker.imageCount;
+        TF_LOG_INFO("  worker %zu: %d images, %.1f images/s.\n", i, worker.imageCount,
+                    worker.busySec > 0 ? worker.imageCount / worker.busySec : 0);
+    }
+    if (config.hwJpeg) {
+        tfg::DisableHwJpegDecoder();
+    }
+    TF_LOG_INFO("Image batch: %d images, %d failed, %.2fs, %.1f images/s, in %ld bytes, out %ld bytes.\n", imageCount, failedCount.load(),
+                elapsedSec, elapsedSec > 0 ? imageCount / elapsedSec : 0, inputBytes.load(), outputBytes.load());
+
+    if (stats != nullptr) {
+        stats->imageCount = imageCount;
+        stats->failedCount = failedCount;
+        stats->inputBytes = inputBytes;
+        stats->outputBytes = outputBytes;
+        stats->elapsedSec = elapsedSec;
+        stats->workerImageCounts.clear();
+        stats->workerBusySec.clear();
+        for (ImageWorker &worker : workers) {
+            stats->workerImageCounts.push_back(worker.imageCount);
+            stats->workerBusySec.push_back(worker.busySec);
+        }
+    }
+    return ret == 0 && failedCount == 0 ? 0 : -1;
+}
+
+}  // namespace yitu_codec_image
@@ -0,0 +1,78 @@
+#ifndef IMAGE_BATCH_HPP
+#define IMAGE_BATCH_HPP
+
+#include "common.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 批量图片转缩略图: JPEG/PNG/BMP -> I420 -> 缩放/裁剪 -> JPEG
+ * tfg::TFSession 非线程安全, 每个工作线程持有一个; 读文件与写文件各由一个线程负责, 工作线程只做解码/缩放/压缩:
+ *
+ *   读取线程(预读) -> 队列 -> 工作线程 x N (TFSession) -> 队列 -> 写出线程(批量写)
+ *
+ * 输入队列按帧数与字节数限制预读量, 计入进程内存预算
+ */
+namespace yitu_codec_image {
+
+// 缩略图尺寸计算方式
+enum ThumbnailMode {
+    /// 等比缩放到 width x height 以内
+    THUMB_FIT = 0,
+    /// 等比缩放到覆盖 width x height, 再取中心区域
+    THUMB_CENTER_CROP,
+    /// 直接拉伸到 width x height
+    THUMB_STRETCH
+};
+
+// 单张图片任务
+struct ImageJob {
+    std::string inputFileName;
+    std::string outputFileName;
+};
+
+// 批量参数
+struct ImageBatchConfig {
+    int workerCount = 4;
+    int width = 256;
+    int height = 256;
+    ThumbnailMode mode = THUMB_FIT;
+    int quality = 70;
+    tfg::INTERP_MODE interpMode = tfg::INTERP_Bilinear;
+    /// 预读的图片数/字节数上限, 0 表示不限
+    int prefetchCount = 64;
+    long prefetchBytes = 64L << 20;
+    /// 写出线程有积压时攒够该数量后一次写出
+    int writeBatchSize = 32;
+    /// 开启 tfg 全局硬件 JPEG 解码器, 超出 MAX_HW_JPEG_Width x MAX_HW_JPEG_Height 的图片仍由 CPU 解码
+    bool hwJpeg = true;
+};
+
+// 批量统计
+struct ImageBatchStats {
+    int imageCount;
+    int failedCount;
+    long inputBytes;
+    long outputBytes;
+    double elapsedSec;
+    /// 每个工作线程处理的图片数与实际处理耗时(不含等待)
+    std::vector<int> workerImageCounts;
+    std::vector<double> workerBusySec;
+};
+
+/// @brief 按输出尺寸与模式计算缩放后的尺寸(宽高取偶数)
+/// @param shortWidth THUMB_CENTER_CROP 时短边缩放到的长度, 其他模式为0
+void thumbnail_size(const ImageBatchConfig &config, int srcWidth, int srcHeight, int *width, int *height, int *shortWidth);
+
+/// @brief 按文件列表生成任务, 默认输出为 outputDir 下同名 .jpg
+/// @param listFileName 每行一个输入文件路径, 或 "输入路径,输出路径"(相对路径位于 outputDir 下)
+/// @return 0 成功, -1 列表无法读取、格式错误或有两行写同一个输出文件
+int load_image_list(const std::string &listFileName, const std::string &outputDir, std::vector<ImageJob> *jobs);
+
+/// @brief 运行批量转换, 阻塞到所有图片处理完成
+/// @param stats 统计, 可为 NULL
+/// @return 0 全部成功, -1 有图片失败或无法启动
+int run_image_batch(const ImageBatchConfig &config, const std::vector<ImageJob> &jobs, ImageBatchStats *stats);
+
+}  // namespace yitu_codec_image
+#endif  // IMAGE_BATCH_HPP
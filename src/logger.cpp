@@ -0,0 +1,226 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace yitu_codec_log {
+
+// 每个线程缓冲区的日志条数, 2 的幂
+static const unsigned LOG_RING_SIZE = 256;
+
+std::atomic<int> gLogLevel{LOG_LEVEL_INFO};
+
+struct LogEntry {
+    int64_t timeUs;
+    int level;
+    int length;
+    char text[LOG_MAX_MESSAGE];
+};
+
+// 单生产者(所属线程)单消费者(后台线程)环形缓冲区
+struct LogRing {
+    std::atomic<bool> owned{true};
+    /// 生产者写入位置
+    std::atomic<unsigned> head{0};
+    /// 消费者读取位置
+    std::atomic<unsigned> tail{0};
+    std::atomic<long> dropped{0};
+    LogRing *next = nullptr;
+    LogEntry entries[LOG_RING_SIZE];
+};
+
+// 线程退出时放弃缓冲区, 未写出的日志仍由后台线程写出
+struct RingHolder {
+    LogRing *ring = nullptr;
+    ~RingHolder() {
+        if (ring != nullptr) {
+            ring->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local RingHolder tRing;
+/// 所有缓冲区, 只增不减, 进程退出前不释放
+static std::atomic<LogRing *> gRings{nullptr};
+
+static std::atomic<bool> gRunning{false};
+static std::mutex gLoggerLock;
+static std::condition_variable gLoggerCv;
+static bool gStop = false;
+static std::thread gFlusher;
+static LoggerConfig gConfig;
+static FILE *gOutput = stdout;
+static bool gAtExitRegistered = false;
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void set_log_level(LogLevel level) {
+    gLogLevel.store(level, std::memory_order_relaxed);
+}
+
+/// 取得本线程的缓冲区: 优先复用已退出线程留下的, 没有时新分配并无锁地挂到链表头
+static LogRing *thread_ring() {
+    if (tRing.ring != nullptr) {
+        return tRing.ring;
+    }
+    for (LogRing *ring = gRings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+        bool expected = false;
+        if (ring->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            tRing.ring = ring;
+            return ring;
+        }
+    }
+    LogRing *ring = new LogRing();
+    ring->next = gRings.load(std::memory_order_relaxed);
+    while (!gRings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    tRing.ring = ring;
+    return ring;
+}
+
+/// 格式化到 text, 截断时保留结尾的换行
+static int format_message(char *text, const char *format, va_list args) {
+    int length = vsnprintf(text, LOG_MAX_MESSAGE, format, args);
+    if (length < 0) {
+        text[0] = '\0';
+        return 0;
+    }
+    if (length >= LOG_MAX_MESSAGE) {
+        length = LOG_MAX_MESSAGE - 1;
+        text[length - 1] = '\n';
+    }
+    return length;
+}
+
+void log_write(LogLevel level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!gRunning.load(std::memory_order_acquire)) {
+        char text[LOG_MAX_MESSAGE];
+        int length = format_message(text, format, args);
+        va_end(args);
+        fwrite(text, 1, length, stdout);
+        fflush(stdout);
+        return;
+    }
+    LogRing *ring = thread_ring();
+    unsigned head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+        va_end(args);
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    LogEntry &entry = ring->entries[head & (LOG_RING_SIZE - 1)];
+    entry.timeUs = now_us();
+    entry.level = level;
+    entry.length = format_message(entry.text, format, args);
+    va_end(args);
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+/// 取出所有缓冲区中的日志, 按时间排序后写出
+static void drain(std::vector<LogEntry *> *pending, std::vector<std::pair<LogRing *, unsigned>> *consumed) {
+    static const char LEVEL_NAMES[] = {'D', 'I', 'W', 'E'};
+    pending->clear();
+    consumed->clear();
+    long dropped = 0;
+    for (LogRing *ring = gRings.load(std::memory_order_acquire); ring != nullptr; ring = ring->next) {
+        unsigned tail = ring->tail.load(std::memory_order_relaxed);
+        unsigned head = ring->head.load(std::memory_order_acquire);
+        for (unsigned i = tail; i != head; i++) {
+            pending->push_back(&ring->entries[i & (LOG_RING_SIZE - 1)]);
+        }
+        consumed->emplace_back(ring, head);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    std::stable_sort(pending->begin(), pending->end(),
+                     [](const LogEntry *a, const LogEntry *b) { return a->timeUs < b->timeUs; });
+    for (const LogEntry *entry : *pending) {
+        if (gConfig.prefix) {
+            fprintf(gOutput, "[%ld.%06ld] %c ", (long)(entry->timeUs / 1000000), (long)(entry->timeUs % 1000000),
+                    LEVEL_NAMES[entry->level]);
+        }
+        fwrite(entry->text, 1, entry->length, gOutput);
+    }
+    // 写出后才归还缓冲区空间
+    for (const std::pair<LogRing *, unsigned> &item : *consumed) {
+        item.first->tail.store(item.second, std::memory_order_release);
+    }
+    if (dropped > 0) {
+        fprintf(gOutput, "WARNING: logger buffers full, %ld messages dropped.\n", dropped);
+    }
+    if (!pending->empty() || dropped > 0) {
+        fflush(gOutput);
+    }
+}
+
+static void run_flusher() {
+    std::vector<LogEntry *> pending;
+    std::vector<std::pair<LogRing *, unsigned>> consumed;
+    std::unique_lock<std::mutex> lock(gLoggerLock);
+    while (!gStop) {
+        gLoggerCv.wait_for(lock, std::chrono::milliseconds(gConfig.flushIntervalMs));
+        lock.unlock();
+        drain(&pending, &consumed);
+        lock.lock();
+    }
+}
+
+int start_logger(const LoggerConfig &config) {
+    std::lock_guard<std::mutex> lock(gLoggerLock);
+    if (gRunning) {
+        return 0;
+    }
+    FILE *output = stdout;
+    if (!config.fileName.empty()) {
+        output = fopen(config.fileName.c_str(), "a");
+        if (output == nullptr) {
+            printf("ERROR: can not open log file %s.\n", config.fileName.c_str());
+            return -1;
+        }
+    }
+    gConfig = config;
+    gConfig.flushIntervalMs = std::max(gConfig.flushIntervalMs, 1);
+    gOutput = output;
+    gStop = false;
+    gFlusher = std::thread(run_flusher);
+    gRunning.store(true, std::memory_order_release);
+    if (!gAtExitRegistered) {
+        atexit(stop_logger);
+        gAtExitRegistered = true;
+    }
+    return 0;
+}
+
+void stop_logger() {
+    {
+        std::lock_guard<std::mutex> lock(gLoggerLock);
+        if (!gRunning) {
+            return;
+        }
+        gRunning.store(false, std::memory_order_release);
+        gStop = true;
+    }
+    gLoggerCv.notify_all();
+    gFlusher.join();
+    std::vector<LogEntry *> pending;
+    std::vector<std::pair<LogRing *, unsigned>> consumed;
+    drain(&pending, &consumed);
+    if (gOutput != stdout) {
+        fclose(gOutput);
+        gOutput = stdout;
+    }
+}
+
+}  // namespace yitu_codec_log
@@ -0,0 +1,80 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdarg>
+#include <string>
+
+/**
+ * 分级异步日志: 逐帧路径(读取/送帧/解码回调/保存/编码回调)的日志不再直接 printf
+ * 每个线程第一次写日志时分配自己的环形缓冲区, 写入只格式化到本线程的缓冲区, 不加锁也不等待;
+ * 后台线程定期取出所有缓冲区中的日志, 按时间排序后一次写出:
+ *
+ *   读取线程 ---> [环形缓冲区] --\
+ *   解码回调 ---> [环形缓冲区] ---+-> 后台线程(每 flushIntervalMs) -> stdout / 日志文件
+ *   保存线程 ---> [环形缓冲区] --/
+ *
+ * 缓冲区满时丢弃新日志并计数, 写出时提示丢弃条数, 解码器回调线程永远不会因日志阻塞
+ * 单条日志最长 LOG_MAX_MESSAGE - 1 字节, 超出截断; 线程退出后其缓冲区留给之后的新线程复用
+ * 未调用 start_logger 时同步写到 stdout, 与原来的 printf 行为一致
+ * 编译时定义 TFCODEC_LOG_MIN_LEVEL 可以去掉低于该级别的日志调用(连同参数求值), 如 -DTFCODEC_LOG_MIN_LEVEL=1 去掉所有 DEBUG 日志
+ */
+namespace yitu_codec_log {
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+static const int LOG_MAX_MESSAGE = 240;
+
+// 日志参数
+struct LoggerConfig {
+    /// 为空时写到 stdout
+    std::string fileName;
+    /// 后台线程写出间隔
+    int flushIntervalMs = 10;
+    /// 写出时每行前加上时间(秒.微秒, steady_clock)与级别
+    bool prefix = false;
+};
+
+extern std::atomic<int> gLogLevel;
+
+/// 运行时日志级别, 低于该级别的日志不格式化; 默认 LOG_LEVEL_INFO
+void set_log_level(LogLevel level);
+
+inline bool log_enabled(LogLevel level) {
+    return (int)level >= gLogLevel.load(std::memory_order_relaxed);
+}
+
+/// @brief 启动后台写出线程, 进程退出时(atexit)自动停止并写出剩余日志
+/// @return 0 成功, -1 日志文件无法打开
+int start_logger(const LoggerConfig &config);
+
+/// 写出剩余日志并停止后台线程, 之后的日志同步写出
+void stop_logger();
+
+/// 写一条日志, 格式同 printf; 一般通过 TF_LOG_* 宏调用
+void log_write(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+}  // namespace yitu_codec_log
+
+#ifndef TFCODEC_LOG_MIN_LEVEL
+#define TFCODEC_LOG_MIN_LEVEL 0
+#endif
+
+#define TF_LOG(level, ...)                                                                             \
+    do {                                                                                               \
+        if ((int)(level) >= TFCODEC_LOG_MIN_LEVEL && yitu_codec_log::log_enabled(level)) {             \
+            yitu_codec_log::log_write(level, __VA_ARGS__);                                             \
+        }                                                                                              \
+    } while (0)
+
+#define TF_LOG_DEBUG(...) TF_LOG(yitu_codec_log::LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define TF_LOG_INFO(...) TF_LOG(yitu_codec_log::LOG_LEVEL_INFO, __VA_ARGS__)
+#define TF_LOG_WARN(...) TF_LOG(yitu_codec_log::LOG_LEVEL_WARN, __VA_ARGS__)
+#define TF_LOG_ERROR(...) TF_LOG(yitu_codec_log::LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif  // LOGGER_HPP
@@ -1,5 +1,12 @@
 #include "common.hpp"
-#include "common_dec.hpp"
+#include "daemon.hpp"
+#include "graph.hpp"
+#include "image_batch.hpp"
+#include "task_pool.hpp"
+#include "timeline.hpp"
+#include "transcoder.hpp"
+#include "tuner.hpp"
+#include "video_wall.hpp"
 
 using namespace yitu_codec_common;
 
@@ -18,6 +25,8 @@ uint32_t gEncHeight = 0;
 // 解码器参数
 // 解码器id
 int gDecDeviceIndex = -1;
+// 编码器id
+int gEncDeviceIndex = 0;
 
 // 转码参数
 // 压缩格式
@@ -33,6 +42,92 @@ tf_rcmode gEncTfRcMode = RC_CBR;
 uint32_t gEncBitRate = 8000000;
 uint32_t gEncMaxBitRate = 8000000;
 
+// 常驻服务参数
+// 监听的 unix socket 路径, 非空时以服务模式运行 工作线程数
+std::string gDaemonSocket;
+int gDaemonWorkers = 1;
+
+// 直播模式 延迟目标
+bool gLive = false;
+int gLiveLatencyMs = 200;
+
+// 剪辑区间(秒), 结束大于开始时生效
+double gTrimStartSec = 0;
+double gTrimEndSec = 0;
+
+// 输入已满足编码参数时直接拷贝
+bool gStreamCopy = true;
+// 输出为容器时带上源文件的音频/字幕
+bool gAudio = true;
+
+// 场景切换检测 最小关键帧间隔
+bool gSceneCut = false;
+int gSceneCutMinGop = 12;
+
+// 静止帧过滤 块平均亮度差阈值(0关闭) 最多连续跳过帧数
+double gStaticThreshold = 0;
+int gStaticMaxSkip = 250;
+
+// 编码后评估 PSNR/SSIM 计算线程数
+bool gQuality = false;
+int gQualityWorkers = 2;
+std::string gFailoverDevices;
+
+// 时间线渲染的剪辑列表(EDL), 非空时按列表依次解码, 送入同一个编码器
+std::string gTimelineEdl;
+
+// 流水线图配置文件, 非空时按图运行, 编码参数作为 encode 节点的默认值
+std::string gGraph;
+
+// 缓存参数调优: 以 input_filename 为参考视频扫描各设备 调优设备 每个组合解码的帧数
+// 调优结果文件, 调优时写入, 其他模式启动时自动加载
+bool gTune = false;
+std::string gTuneDevices;
+int gTuneFrames = 600;
+std::string gTuneProfile = "tf_codec.tune";
+
+// 高密度模式(lite 解码session, 最小缓存) 每个解码设备的 session 数/内存(MB)上限(0 不限) 设备满时排队的超时(ms, <0 一直等)
+bool gDensity = false;
+int gDecMaxSessions = 0;
+long gDecMaxMemMb = 0;
+int gAdmitTimeoutMs = -1;
+
+// 设备调度: 直播与批处理任务共用设备时, 直播按截止时间优先, 批处理按权重分享 每个解码/编码设备的在途帧数 为直播保留的比例 保底放行时间
+bool gSched = false;
+int gSchedDecSlots = 32;
+int gSchedEncSlots = 2;
+double gSchedLiveReserve = 0.25;
+int gSchedStallMs = 200;
+
+// 共享 CPU 线程池线程数: 0 关闭, 小于0 按核数
+int gCpuThreads = 0;
+
+// 日志: 级别(0 DEBUG 1 INFO 2 WARN 3 ERROR, debug_flag=1 时为 DEBUG) 后台写出 日志文件 行前缀
+int gLogLevel = yitu_codec_log::LOG_LEVEL_INFO;
+bool gLogAsync = true;
+std::string gLogFile;
+bool gLogPrefix = false;
+
+// 进程内存预算(MB), 0 表示不限
+long gMemBudgetMb = 0;
+
+// 电视墙 输入文件列表(逗号分隔, 非空时以电视墙模式运行) 网格(列x行, 空表示自动) 画布宽高 对齐策略 最多重复帧数
+std::string gWallInputs;
+std::string gWallGrid;
+int gWallWidth = 1920;
+int gWallHeight = 1080;
+int gWallSync = yitu_codec_wall::WALL_SYNC_TIMESTAMP;
+int gWallMaxRepeat = 50;
+
+// 批量图片缩略图 输入列表文件(每行一个路径, 非空时以图片模式运行) 输出目录 输出宽高 缩放方式 JPEG质量 工作线程数
+std::string gImageList;
+std::string gImageOutputDir = ".";
+int gImageWidth = 256;
+int gImageHeight = 256;
+int gImageMode = yitu_codec_image::THUMB_FIT;
+int gImageQuality = 70;
+int gImageWorkers = 4;
+
 int parse_param(int argc, char* argv[]) {
     std::map<std::string, std::string> arg_map;
     if (parse_param_map(argc, argv, arg_map)) {
@@ -41,7 +136,7 @@ int parse_param(int argc, char* argv[]) {
 
     for (const auto& pair : arg_map) {
         std::string key = pair.first;
-        std::string val = pair.first;
+        std::string val = pair.second;
         std::cout << "Key: " << key << ", Value: " << val << std::endl;
         if (key == "input_filename") {
             gInputFileName = val;
@@ -51,6 +146,8 @@ int parse_param(int argc, char* argv[]) {
             gDebugEnabled = string_to_bool(val);
         } else if (key == "dec_device_id") {
             gDecDeviceIndex = string_to_int(val);
+        } else if (key == "enc_device_id") {
+            gEncDeviceIndex = string_to_int(val);
         } else if (key == "enc_width") {
             gEncWidth = string_to_int(val);
         } else if (key == "enc_height") {
@@ -69,6 +166,104 @@ int parse_param(int argc, char* argv[]) {
             gEncBitRate = string_to_int(val);
         } else if (key == "enc_max_bit_rate") {
             gEncMaxBitRate = string_to_int(val);
+        } else if (key == "daemon_socket") {
+            gDaemonSocket = val;
+        } else if (key == "daemon_workers") {
+            gDaemonWorkers = string_to_int(val);
+        } else if (key == "live") {
+            gLive = string_to_bool(val);
+        } else if (key == "live_latency_ms") {
+            gLiveLatencyMs = string_to_int(val);
+        } else if (key == "trim_start") {
+            gTrimStartSec = std::stod(val);
+        } else if (key == "trim_end") {
+            gTrimEndSec = std::stod(val);
+        } else if (key == "stream_copy") {
+            gStreamCopy = string_to_bool(val);
+        } else if (key == "audio") {
+            gAudio = string_to_bool(val);
+        } else if (key == "scene_cut") {
+            gSceneCut = string_to_bool(val);
+        } else if (key == "scene_cut_min_gop") {
+            gSceneCutMinGop = string_to_int(val);
+        } else if (key == "static_threshold") {
+            gStaticThreshold = std::stod(val);
+        } else if (key == "static_max_skip") {
+            gStaticMaxSkip = string_to_int(val);
+        } else if (key == "quality") {
+            gQuality = string_to_bool(val);
+        } else if (key == "quality_workers") {
+            gQualityWorkers = string_to_int(val);
+        } else if (key == "failover_devices") {
+            gFailoverDevices = val;
+        } else if (key == "mem_budget_mb") {
+            gMemBudgetMb = string_to_int(val);
+        } else if (key == "density") {
+            gDensity = string_to_bool(val);
+        } else if (key == "dec_max_sessions") {
+            gDecMaxSessions = string_to_int(val);
+        } else if (key == "dec_max_mem_mb") {
+            gDecMaxMemMb = string_to_int(val);
+        } else if (key == "admit_timeout_ms") {
+            gAdmitTimeoutMs = string_to_int(val);
+        } else if (key == "sched") {
+            gSched = string_to_bool(val);
+        } else if (key == "sched_dec_slots") {
+            gSchedDecSlots = string_to_int(val);
+        } else if (key == "sched_enc_slots") {
+            gSchedEncSlots = string_to_int(val);
+        } else if (key == "sched_live_reserve") {
+            gSchedLiveReserve = std::stod(val);
+        } else if (key == "sched_stall_ms") {
+            gSchedStallMs = string_to_int(val);
+        } else if (key == "cpu_threads") {
+            gCpuThreads = string_to_int(val);
+        } else if (key == "log_level") {
+            gLogLevel = string_to_int(val);
+        } else if (key == "log_async") {
+            gLogAsync = string_to_bool(val);
+        } else if (key == "log_file") {
+            gLogFile = val;
+        } else if (key == "log_prefix") {
+            gLogPrefix = string_to_bool(val);
+        } else if (key == "tune") {
+            gTune = string_to_bool(val);
+        } else if (key == "tune_devices") {
+            gTuneDevices = val;
+        } else if (key == "tune_frames") {
+            gTuneFrames = string_to_int(val);
+        } else if (key == "tune_profile") {
+            gTuneProfile = val;
+        } else if (key == "graph") {
+            gGraph = val;
+        } else if (key == "timeline_edl") {
+            gTimelineEdl = val;
+        } else if (key == "wall_inputs") {
+            gWallInputs = val;
+        } else if (key == "wall_grid") {
+            gWallGrid = val;
+        } else if (key == "wall_width") {
+            gWallWidth = string_to_int(val);
+        } else if (key == "wall_height") {
+            gWallHeight = string_to_int(val);
+        } else if (key == "wall_sync") {
+            gWallSync = string_to_int(val);
+        } else if (key == "wall_max_repeat") {
+            gWallMaxRepeat = string_to_int(val);
+        } else if (key == "image_list") {
+            gImageList = val;
+        } else if (key == "image_output_dir") {
+            gImageOutputDir = val;
+        } else if (key == "image_width") {
+            gImageWidth = string_to_int(val);
+        } else if (key == "image_height") {
+            gImageHeight = string_to_int(val);
+        } else if (key == "image_mode") {
+            gImageMode = string_to_int(val);
+        } else if (key == "image_quality") {
+            gImageQuality = string_to_int(val);
+        } else if (key == "image_workers") {
+            gImageWorkers = string_to_int(val);
         }
     }
 
@@ -83,6 +278,7 @@ void print_help() {
     printf("        --output_filename=[filename]        输出文件名,包括路径。编码结果视频文件\n");
     printf("        --debug_flag=[flag]                 是否输出详细的debug信息。默认0。\n");
     printf("        --dec_device_id=[device_id]         指定使用的解码器,解码器id\n");
+    printf("        --enc_device_id=[device_id]         指定使用的编码器,编码器id。默认0。\n");
     printf("        --enc_width=[count]                 输出视频宽度像素值\n");
     printf("        --enc_height=[count]                输出视频高度像素值\n");
     printf("        --enc_profile=[profile_name]        指定压缩编码格式。0:AVC_BASELINE,1:AVC_MAIN,2:AVC_HIGH,3:HEVC_MAIN,4:HEVC_MAIN10。\n");
@@ -92,13 +288,85 @@ void print_help() {
     printf("        --enc_rcmode=[mode_name]            指定编码码率模式。0:CBR,1:VBR。\n");
     printf("        --enc_bit_rate=[count]              bit rate. default: 8000000\n");
     printf("        --enc_max_bit_rate=[count]          max bit rate. default: 8000000\n");
+    printf("        --daemon_socket=[path]              以常驻服务模式运行, 在此unix socket上接收JSON lines任务\n");
+    printf("        --daemon_workers=[count]            服务模式的工作线程数。默认1。\n");
+    printf("        --live=[flag]                       直播模式, 按时间戳读入, 超过延迟目标的帧被丢弃。默认0。\n");
+    printf("        --live_latency_ms=[ms]              直播模式的端到端延迟目标。默认200。\n");
+    printf("        --trim_start=[sec]                  剪辑起点(秒), 与 trim_end 一起使用\n");
+    printf("        --trim_end=[sec]                    剪辑终点(秒), 区间内完整的GOP直接拷贝, 只重编码两端, 编码参数跟随源视频, 输出须为裸码流\n");
+    printf("        --stream_copy=[flag]                输入的编码格式/分辨率已符合要求且码率不超过上限且输出为裸码流时直接拷贝, 不转码。默认1。\n");
+    printf("        --audio=[flag]                      输出为 mp4/mkv 等容器时, 源文件的音频/字幕不解码直接写入, 为0时只封装视频。默认1。\n");
+    printf("        --scene_cut=[flag]                  在场景切换处插入关键帧, enc_gop 作为最大GOP。默认0。\n");
+    printf("        --scene_cut_min_gop=[count]         场景切换关键帧的最小间隔帧数。默认12。\n");
+    printf("        --static_threshold=[value]          静止帧过滤, 16x16块平均亮度差都不超过该值的帧不编码, 时间戳另存为 .timestamps。默认0关闭。\n");
+    printf("        --static_max_skip=[count]           最多连续跳过的静止帧数。默认250。\n");
+    printf("        --quality=[flag]                    编码完成后再解码输出, 与源视频逐帧比较 PSNR/SSIM, 逐帧结果写入 <output>.quality.csv。默认0。\n");
+    printf("        --quality_workers=[count]           同时计算 PSNR/SSIM 的帧数, 未开启共享线程池时另起同样数量的线程。默认2。\n");
+    printf("        --failover_devices=[id,id,...]      解码设备故障时切换到的设备, 从最近的关键帧重放, 任务不中断。默认不切换。\n");
+    printf("        --mem_budget_mb=[MB]                进程内存预算, 所有任务排队中的帧都计入, 达到后阻塞或丢帧。默认0不限。\n");
+    printf("        --density=[flag]                    高密度模式, 解码使用 tfdec_create_lite 与最小缓存, 用于单卡几十路低分辨率流。默认0。\n");
+    printf("        --dec_max_sessions=[count]          每个解码设备的 session 上限, 达到后新任务排队等待。默认0, 按创建失败时实测的容量。\n");
+    printf("        --dec_max_mem_mb=[MB]               每个解码设备的 session 估算内存上限。默认0不限。\n");
+    printf("        --admit_timeout_ms=[ms]             解码设备满时排队的超时, 超时任务失败; 0 不排队, 小于0一直等。默认-1。\n");
+    printf("        --sched=[flag]                      设备调度, 直播帧按截止时间优先送入设备, 批处理任务按 weight 分享剩余能力。默认0。\n");
+    printf("        --sched_dec_slots=[count]           开启调度时每个解码设备同时在途的帧数。默认32。\n");
+    printf("        --sched_enc_slots=[count]           开启调度时每个编码设备同时进行的编码调用数。默认2。\n");
+    printf("        --sched_live_reserve=[ratio]        有直播任务时为直播保留的在途帧比例。默认0.25。\n");
+    printf("        --sched_stall_ms=[ms]               任务超过该时间没有获得或归还空位时不受上限保底放行一帧, 避免解码器等待输入时互相等待。默认200。\n");
+    printf("        --cpu_threads=[count]               共享 CPU 线程池线程数, NV12 转换/电视墙缩放/质量计算按片并行, 线程数不随路数增长; 0 关闭, 小于0按核数。默认0。\n");
+    printf("        --log_level=[level]                 日志级别: 0 DEBUG 1 INFO 2 WARN 3 ERROR; debug_flag=1 时为0。默认1。\n");
+    printf("        --log_async=[flag]                  逐帧日志写入各线程缓冲区, 由后台线程写出, 不阻塞解码回调; 缓冲区满时丢弃并计数。默认1。\n");
+    printf("        --log_file=[path]                   后台写出的日志文件, 为空时写到标准输出。默认空。\n");
+    printf("        --log_prefix=[flag]                 后台写出时每行加上时间与级别。默认0。\n");
+    printf("        --tune=[flag]                       以 input_filename 为参考视频扫描 out_buffer_num/在途帧数/队列深度, Pareto 最优结果写入 tune_profile。默认0。\n");
+    printf("        --tune_devices=[id,id,...]          调优的解码设备。默认 dec_device_id。\n");
+    printf("        --tune_frames=[count]               每个组合解码的帧数, 0表示整个文件。默认600。\n");
+    printf("        --tune_profile=[path]               调优结果文件, 其他模式启动时自动加载, 按设备与分辨率取用。默认 tf_codec.tune。\n");
+    printf("        --timeline_edl=[path]               时间线模式, 文件每行 \"文件,入点秒,出点秒\", 各段首尾相接编码为一路输出, 编码参数同上\n");
+    printf("        --graph=[path]                      流水线图模式, 按配置文件搭建 decode/scale/encode/rawsink/tap 节点, 分叉时共享解码帧不拷贝\n");
+    printf("        --wall_inputs=[file,file,...]       电视墙模式, 多路输入合成一路编码输出, 帧率取 enc_rate\n");
+    printf("        --wall_grid=[cols]x[rows]           电视墙网格, 默认按输入路数自动取正方形网格\n");
+    printf("        --wall_width=[count]                电视墙画布宽。默认1920。\n");
+    printf("        --wall_height=[count]               电视墙画布高。默认1080。\n");
+    printf("        --wall_sync=[mode]                  0: 按时间戳对齐, 快的路丢帧 慢的路重复; 1: 每路各取一帧, 不丢不重复。默认0。\n");
+    printf("        --wall_max_repeat=[count]           一路连续重复超过该帧数后涂黑, 0表示保持最后一帧。默认50。\n");
+    printf("        --image_list=[path]                 批量图片模式, 文件每行一个 JPEG/PNG/BMP 路径(或 \"输入,输出\"), 转为 JPEG 缩略图\n");
+    printf("        --image_output_dir=[path]           缩略图输出目录, 文件名与输入相同, 扩展名为 .jpg。默认当前目录。\n");
+    printf("        --image_width=[count]               缩略图宽。默认256。\n");
+    printf("        --image_height=[count]              缩略图高。默认256。\n");
+    printf("        --image_mode=[mode]                 0: 等比缩放到宽高以内; 1: 等比缩放后中心裁剪; 2: 拉伸。默认0。\n");
+    printf("        --image_quality=[1-100]             JPEG 质量。默认70。\n");
+    printf("        --image_workers=[count]             工作线程数, 每个线程一个 TFSession。默认4。\n");
     printf("\n");
     printf("Example:\n");
     printf("./multi_rnc --input_filename=./yuv/1.yuv --output_filename=output/1.h264 --enc_profile=2 --in_width=1920 --in_height=1080\n");
     printf("./multi_rnc --input_filename=./yuv/2.yuv --output_filename=output/2.h264 --enc_profile=2 --in_width=1920 --in_height=1080\n");
+    printf("./multi_rnc --daemon_socket=/tmp/tf_codec.sock --daemon_workers=2 --dec_device_id=1\n");
+    printf("./multi_rnc --wall_inputs=1.mp4,2.mp4,3.mp4,4.mp4 --wall_grid=2x2 --output_filename=output/wall.h264 --enc_profile=2\n");
+    printf("./multi_rnc --daemon_socket=/tmp/tf_codec.sock --daemon_workers=32 --density=1 --dec_max_sessions=32\n");
+    printf("./multi_rnc --tune=1 --input_filename=ref_1080p.mp4 --tune_devices=1,2\n");
+    printf("./multi_rnc --graph=ladder.graph --enc_profile=2\n");
+    printf("./multi_rnc --timeline_edl=edit.edl --output_filename=output/edit.h264 --enc_profile=2\n");
+    printf("./multi_rnc --image_list=images.txt --image_output_dir=thumbs --image_width=320 --image_height=240 --image_workers=8\n");
     printf("\n");
 }
 
+// 由命令行参数生成编码参数, 宽高为0表示与源视频一致
+tfenc_setting build_enc_setting() {
+    tfenc_setting setting = yitu_codec_enc::default_enc_setting();
+    setting.width = gEncWidth;
+    setting.height = gEncHeight;
+    setting.profile = gEncTfProfile;
+    setting.level = gEncLevel;
+    setting.bit_rate = gEncBitRate;
+    setting.max_bit_rate = gEncMaxBitRate;
+    setting.gop = gEncGop;
+    setting.frame_rate = gEncFrameRate;
+    setting.device_id = gEncDeviceIndex;
+    setting.rc_mode = gEncTfRcMode;
+    return setting;
+}
+
 int main(int argc, char* argv[]) {
     gInputFileName = "/root/saibo/tf_codec/video/002.mp4";
     gOutputFileName = "/root/saibo/tf_codec/video/003.mp4";
@@ -108,19 +376,191 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    yitu_codec_log::set_log_level(yitu_codec_log::LogLevel(gDebugEnabled ? yitu_codec_log::LOG_LEVEL_DEBUG : gLogLevel));
+    if (gLogAsync) {
+        yitu_codec_log::LoggerConfig logConfig;
+        logConfig.fileName = gLogFile;
+        logConfig.prefix = gLogPrefix;
+        if (yitu_codec_log::start_logger(logConfig) != 0) {
+            return -1;
+        }
+    }
+
+    if (gTune) {
+        yitu_codec_tuner::TuneConfig config;
+        config.inputFileName = gInputFileName;
+        config.deviceIndexes = string_to_int_list(gTuneDevices);
+        if (config.deviceIndexes.empty()) {
+            config.deviceIndexes.push_back(gDecDeviceIndex);
+        }
+        config.maxFrames = gTuneFrames;
+        config.profileFileName = gTuneProfile;
+        return yitu_codec_tuner::run_tune(config, nullptr) == 0 ? 0 : -1;
+    }
+    if (yitu_codec_tuner::load_tuned_profiles(gTuneProfile) < 0) {
+        return -1;
+    }
+    yitu_codec_dec::DeviceCapacity capacity;
+    capacity.maxSessions = gDecMaxSessions;
+    capacity.maxMemoryBytes = gDecMaxMemMb << 20;
+    yitu_codec_dec::gDeviceAdmission.SetDefaultCapacity(capacity);
+    yitu_codec_dec::gDeviceAdmission.SetWaitTimeout(gAdmitTimeoutMs);
+    yitu_codec_sched::SchedulerConfig schedConfig;
+    schedConfig.enabled = gSched;
+    schedConfig.decSlots = gSchedDecSlots;
+    schedConfig.encSlots = gSchedEncSlots;
+    schedConfig.liveReserveRatio = gSchedLiveReserve;
+    schedConfig.stallMs = gSchedStallMs;
+    yitu_codec_sched::configure_schedulers(schedConfig);
+    yitu_codec_task::configure_cpu_pool(gCpuThreads);
+
+    if (!gDaemonSocket.empty()) {
+        yitu_codec_daemon::DaemonConfig config;
+        config.socketPath = gDaemonSocket;
+        config.transcoder.workerCount = gDaemonWorkers;
+        config.transcoder.memoryBudgetBytes = gMemBudgetMb << 20;
+        config.transcoder.density = gDensity;
+        config.defaultDeviceIndex = gDecDeviceIndex;
+        config.encSetting = build_enc_setting();
+        yitu_codec_daemon::Daemon daemon(config);
+        return daemon.Run();
+    }
+
+    if (!gImageList.empty()) {
+        yitu_codec_image::ImageBatchConfig config;
+        config.workerCount = gImageWorkers;
+        config.width = gImageWidth;
+        config.height = gImageHeight;
+        config.mode = yitu_codec_image::ThumbnailMode(gImageMode);
+        config.quality = gImageQuality;
+        config.interpMode = gRecInterpMod;
+        std::vector<yitu_codec_image::ImageJob> jobs;
+        if (yitu_codec_image::load_image_list(gImageList, gImageOutputDir, &jobs) != 0) {
+            return -1;
+        }
+        gMemoryBudget.SetLimit(gMemBudgetMb << 20);
+        return yitu_codec_image::run_image_batch(config, jobs, nullptr);
+    }
+
+    if (!gGraph.empty()) {
+        yitu_codec_graph::Graph graph;
+        if (yitu_codec_graph::load_graph(gGraph, build_enc_setting(), &graph) != 0) {
+            return -1;
+        }
+        gMemoryBudget.SetLimit(gMemBudgetMb << 20);
+        std::vector<yitu_codec_graph::NodeStats> stats;
+        int ret = graph.Run(&stats);
+        // 各节点的日志先写出, 汇总行在其后输出
+        yitu_codec_log::stop_logger();
+        for (const yitu_codec_graph::NodeStats &node : stats) {
+            printf("Graph node %s: %ld frames, ret %d.\n", node.name.c_str(), node.frames, node.ret);
+        }
+        return ret == 0 ? 0 : -1;
+    }
+
+    if (!gTimelineEdl.empty()) {
+        yitu_codec_timeline::TimelineConfig config;
+        if (yitu_codec_timeline::load_edl(gTimelineEdl, &config.clips) != 0) {
+            return -1;
+        }
+        config.decDeviceIndex = gDecDeviceIndex;
+        config.encSetting = build_enc_setting();
+        config.interpMode = gRecInterpMod;
+        config.outputFileName = gOutputFileName;
+        gMemoryBudget.SetLimit(gMemBudgetMb << 20);
+        return yitu_codec_timeline::run_timeline(config, nullptr) == 0 ? 0 : -1;
+    }
+
+    if (!gWallInputs.empty()) {
+        yitu_codec_wall::WallConfig config;
+        std::stringstream ss(gWallInputs);
+        std::string name;
+        while (std::getline(ss, name, ',')) {
+            if (!name.empty()) {
+                yitu_codec_wall::WallInput input;
+                input.inputFileName = name;
+                input.decDeviceIndex = gDecDeviceIndex;
+                config.inputs.push_back(input);
+            }
+        }
+        if (sscanf(gWallGrid.c_str(), "%dx%d", &config.columns, &config.rows) != 2) {
+            config.columns = 0;
+            config.rows = 0;
+        }
+        config.width = gWallWidth;
+        config.height = gWallHeight;
+        config.frameRate = gEncFrameRate;
+        config.syncPolicy = yitu_codec_wall::WallSyncPolicy(gWallSync);
+        config.maxRepeatFrames = gWallMaxRepeat;
+        config.interpMode = gRecInterpMod;
+        config.encSetting = build_enc_setting();
+        config.outputFileName = gOutputFileName;
+        gMemoryBudget.SetLimit(gMemBudgetMb << 20);
+        return yitu_codec_wall::run_wall(config, nullptr) == 0 ? 0 : -1;
+    }
+
     // 视频 -> 缓存 -> 解码器 -> 缓存 -> resize -> 缓存 -> 编码器 -> 缓存 ->  文件
-    // 读取视频信息
-    yitu_codec_dec::gDebugEnabled = true;
-    yitu_codec_dec::VideoInfo* videoInfo = new yitu_codec_dec::VideoInfo();
-    yitu_codec_dec::read_video_file(gInputFileName, videoInfo);
-    int* userData = new int(1);
-    // 创建解码器sesion
-    auto dec_session = yitu_codec_dec::create_session(gDecDeviceIndex, videoInfo->role, videoInfo->width, videoInfo->height, userData);
-    // 启动解码器
-    yitu_codec_dec::run_dec(videoInfo, dec_session, 512, 512, 32);
-
-    while (yitu_codec_dec::gDecodeCompleted == false) {
-        sleep(1);
+    // 未指定编码格式时只解码, 输出I420原始数据
+    yitu_codec_transcoder::TranscodeJob job;
+    job.inputFileName = gInputFileName;
+    job.outputFileName = gOutputFileName;
+    job.decDeviceIndex = gDecDeviceIndex;
+    job.encSetting = build_enc_setting();
+    job.interpMode = gRecInterpMod;
+    job.live = gLive;
+    job.latencyTargetMs = gLiveLatencyMs;
+    job.trimStartSec = gTrimStartSec;
+    job.trimEndSec = gTrimEndSec;
+    job.allowStreamCopy = gStreamCopy;
+    job.passthroughAudio = gAudio;
+    job.sceneCut.enabled = gSceneCut;
+    job.sceneCut.minGopFrames = gSceneCutMinGop;
+    job.staticFrame.blockThreshold = gStaticThreshold;
+    job.staticFrame.maxSkipFrames = gStaticMaxSkip;
+    job.measureQuality = gQuality;
+    job.qualityWorkerCount = gQualityWorkers;
+    job.failoverDeviceIndexes = string_to_int_list(gFailoverDevices);
+
+    yitu_codec_transcoder::TranscoderConfig config;
+    config.memoryBudgetBytes = gMemBudgetMb << 20;
+    config.density = gDensity;
+    // 质量评估在任务结束之后进行, 等评估结果一起输出
+    std::promise<yitu_codec_quality::QualityStats> qualityPromise;
+    std::future<yitu_codec_quality::QualityStats> qualityFuture = qualityPromise.get_future();
+    job.onQuality = [&qualityPromise](long, int ret, const yitu_codec_quality::QualityStats &stats) {
+        qualityPromise.set_value(ret == 0 ? stats : yitu_codec_quality::QualityStats());
+    };
+    yitu_codec_transcoder::Transcoder transcoder(config);
+    yitu_codec_transcoder::TranscodeResult result = transcoder.Submit(job).get();
+    yitu_codec_quality::QualityStats quality = result.qualityPending ? qualityFuture.get() : yitu_codec_quality::QualityStats();
+    // 任务与评估都已结束, 先写出异步日志中剩余的行, 汇总行不会排到 "Decode complete" 等日志之前
+    yitu_codec_log::stop_logger();
+    printf("Transcode %s: decoded %d frames, encoded %ld bytes in %.2fs. %s\n", yitu_codec_transcoder::job_state_name(result.state),
+           result.decodedFrameCount, result.encodedBytes, result.elapsedSec, result.error.c_str());
+    printf("Latency: avg %.1f ms, p99 %.1f ms, max %.1f ms, dropped %d frames.\n", result.avgLatencyMs, result.p99LatencyMs,
+           result.maxLatencyMs, result.droppedFrameCount);
+    printf("Memory: peak %ld bytes.\n", result.peakMemoryBytes);
+    if (result.sceneCutCount > 0) {
+        printf("Scene cuts: %d keyframes placed at scene changes.\n", result.sceneCutCount);
     }
-    return 0;
+    if (result.staticFrameCount > 0) {
+        printf("Static frames skipped: %d.\n", result.staticFrameCount);
+    }
+    if (result.failoverCount > 0) {
+        printf("Decoder failover: %d times, %d duplicate frames dropped.\n", result.failoverCount, result.duplicateFrameCount);
+    }
+    if (result.auxPacketCount > 0) {
+        printf("Audio/subtitle packets passed through: %ld.\n", result.auxPacketCount);
+    }
+    if (result.streamCopied) {
+        printf("Input already matches the target, stream copied.\n");
+    }
+    if (result.copiedPacketCount > 0) {
+        printf("Copied %d packets, %ld bytes without re-encoding.\n", result.copiedPacketCount, result.copiedBytes);
+    }
+    if (quality.frameCount > 0) {
+        printf("Quality: PSNR avg %.3f dB, min %.3f dB; SSIM avg %.5f, min %.5f over %d frames.\n", quality.avgPsnr, quality.minPsnr,
+               quality.avgSsim, quality.minSsim, quality.frameCount);
+    }
+    return result.state == yitu_codec_transcoder::JOB_DONE ? 0 : -1;
 }
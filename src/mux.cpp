@@ -0,0 +1,243 @@
+#include "mux.hpp"
+
+namespace yitu_codec_mux {
+
+bool container_output(const std::string &fileName) {
+    const AVOutputFormat *format = av_guess_format(NULL, fileName.c_str(), NULL);
+    if (format == nullptr) {
+        return false;
+    }
+    std::string name = format->name;
+    return name != "h264" && name != "hevc" && name != "rawvideo";
+}
+
+// 查找 annexb 数据中第一个 VCL NAL 的起始码位置, 没有时返回 len; key 为该 NAL 是否为 IDR/IRAP
+static int find_vcl(const uint8_t *data, int len, AVCodecID codecId, bool *key) {
+    *key = false;
+    for (int i = 0; i + 3 < len; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+        uint8_t header = data[i + 3];
+        int start = i > 0 && data[i - 1] == 0 ? i - 1 : i;
+        if (codecId == AV_CODEC_ID_HEVC) {
+            int type = (header >> 1) & 0x3f;
+            if (type < 32) {
+                *key = type >= 16 && type <= 23;
+                return start;
+            }
+        } else {
+            int type = header & 0x1f;
+            if (type >= 1 && type <= 5) {
+                *key = type == 5;
+                return start;
+            }
+        }
+        i += 2;
+    }
+    return len;
+}
+
+Muxer::~Muxer() {
+    for (AVPacket *packet : mPendingAux) {
+        av_packet_free(&packet);
+    }
+    if (mOutput != nullptr) {
+        if (!(mOutput->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&mOutput->pb);
+        }
+        avformat_free_context(mOutput);
+    }
+}
+
+int Muxer::Open(const std::string &fileName, AVFormatContext *input, int videoIndex, const tfenc_setting &setting,
+                bool withAux) {
+    mFileName = fileName;
+    if (avformat_alloc_output_context2(&mOutput, NULL, NULL, fileName.c_str()) < 0 || mOutput == nullptr) {
+        TF_LOG_ERROR("ERROR: Unable to create muxer for %s.\n", fileName.c_str());
+        return -1;
+    }
+    mVideoTimeBase = input->streams[videoIndex]->time_base;
+    mVideoStream = avformat_new_stream(mOutput, NULL);
+    if (mVideoStream == nullptr) {
+        return -1;
+    }
+    AVCodecParameters *codecpar = mVideoStream->codecpar;
+    codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    bool hevc = setting.profile == PROFILE_HEVC_MAIN || setting.profile == PROFILE_HEVC_MAIN10;
+    codecpar->codec_id = hevc ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    codecpar->width = setting.width;
+    codecpar->height = setting.height;
+    codecpar->format = setting.profile == PROFILE_HEVC_MAIN10 ? AV_PIX_FMT_YUV420P10LE : AV_PIX_FMT_YUV420P;
+    mVideoStream->time_base = mVideoTimeBase;
+    mVideoStream->avg_frame_rate = input->streams[videoIndex]->avg_frame_rate;
+
+    mStreamMap.assign(input->nb_streams, -1);
+    mInputTimeBases.resize(input->nb_streams);
+    for (unsigned int i = 0; i < input->nb_streams; i++) {
+        AVStream *in = input->streams[i];
+        mInputTimeBases[i] = in->time_base;
+        AVMediaType type = in->codecpar->codec_type;
+        if (!withAux || (int)i == videoIndex || (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE)) {
+            continue;
+        }
+        // 如 mp4 不能存放 ass 字幕, 明确不支持的跳过, 未知的交给 muxer 判断
+        if (avformat_query_codec(mOutput->oformat, in->codecpar->codec_id, FF_COMPLIANCE_NORMAL) == 0) {
+            TF_LOG_WARN("WARNING: Stream %u (%s) is not supported by %s, dropped.\n", i, avcodec_get_name(in->codecpar->codec_id),
+                        mOutput->oformat->name);
+            continue;
+        }
+        AVStream *out = avformat_new_stream(mOutput, NULL);
+        if (out == nullptr || avcodec_parameters_copy(out->codecpar, in->codecpar) < 0) {
+            return -1;
+        }
+        out->codecpar->codec_tag = 0;
+        out->time_base = in->time_base;
+        av_dict_copy(&out->metadata, in->metadata, 0);
+        out->disposition = in->disposition;
+        mStreamMap[i] = out->index;
+    }
+
+    if (!(mOutput->oformat->flags & AVFMT_NOFILE) && avio_open(&mOutput->pb, fileName.c_str(), AVIO_FLAG_WRITE) < 0) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", fileName.c_str());
+        return -1;
+    }
+    TF_LOG_INFO("Muxer open: %s (%s), %d streams.\n", fileName.c_str(), mOutput->oformat->name, mOutput->nb_streams);
+    return 0;
+}
+
+int Muxer::write_packet(AVPacket *packet, AVRational timeBase) {
+    av_packet_rescale_ts(packet, timeBase, mOutput->streams[packet->stream_index]->time_base);
+    int ret = av_interleaved_write_frame(mOutput, packet);
+    if (ret < 0) {
+        TF_LOG_ERROR("ERROR: Unable to write packet to %s, ret: %d.\n", mFileName.c_str(), ret);
+        mFailed = true;
+        return -1;
+    }
+    return 0;
+}
+
+// 视频参数集已在 extradata 中, 写出文件头后补写缓存的音频/字幕
+int Muxer::write_header() {
+    if (avformat_write_header(mOutput, NULL) < 0) {
+        TF_LOG_ERROR("ERROR: Unable to write header to %s.\n", mFileName.c_str());
+        mFailed = true;
+        return -1;
+    }
+    mHeaderWritten = true;
+    while (!mPendingAux.empty()) {
+        AVPacket *packet = mPendingAux.front();
+        mPendingAux.pop_front();
+        AVRational timeBase = mInputTimeBases[packet->stream_index];
+        packet->stream_index = mStreamMap[packet->stream_index];
+        int ret = write_packet(packet, timeBase);
+        av_packet_free(&packet);
+        if (ret != 0) {
+            return -1;
+        }
+        mAuxPacketCount++;
+    }
+    return 0;
+}
+
+int Muxer::WriteVideo(const uint8_t *data, int len, int64_t pts) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFailed) {
+        return -1;
+    }
+    bool key;
+    int vcl = find_vcl(data, len, mVideoStream->codecpar->codec_id, &key);
+    if (vcl == len) {
+        mVideoPrefix.insert(mVideoPrefix.end(), data, data + len);
+        return 1;
+    }
+    if (!mHeaderWritten) {
+        // 第一帧之前的 SPS/PPS(/VPS) 作为 extradata, mp4 等容器据此生成 avcC/hvcC
+        std::vector<uint8_t> extradata = mVideoPrefix;
+        extradata.insert(extradata.end(), data, data + vcl);
+        AVCodecParameters *codecpar = mVideoStream->codecpar;
+        codecpar->extradata = (uint8_t *)av_mallocz(extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(codecpar->extradata, extradata.data(), extradata.size());
+        codecpar->extradata_size = extradata.size();
+        if (write_header() != 0) {
+            return -1;
+        }
+    }
+    AVPacket *packet = av_packet_alloc();
+    if (av_new_packet(packet, mVideoPrefix.size() + len) < 0) {
+        av_packet_free(&packet);
+        mFailed = true;
+        return -1;
+    }
+    if (!mVideoPrefix.empty()) {
+        memcpy(packet->data, mVideoPrefix.data(), mVideoPrefix.size());
+    }
+    memcpy(packet->data + mVideoPrefix.size(), data, len);
+    mVideoPrefix.clear();
+    packet->pts = pts;
+    packet->dts = pts;
+    packet->flags = key ? AV_PKT_FLAG_KEY : 0;
+    packet->stream_index = mVideoStream->index;
+    int ret = write_packet(packet, mVideoTimeBase);
+    av_packet_free(&packet);
+    if (ret == 0) {
+        mVideoPacketCount++;
+    }
+    return ret;
+}
+
+int Muxer::WriteAux(AVPacket *packet) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mFailed) {
+        return -1;
+    }
+    if (packet->stream_index < 0 || packet->stream_index >= (int)mStreamMap.size() || mStreamMap[packet->stream_index] < 0) {
+        return 0;
+    }
+    if (!mHeaderWritten) {
+        AVPacket *pending = av_packet_alloc();
+        av_packet_move_ref(pending, packet);
+        mPendingAux.push_back(pending);
+        return 0;
+    }
+    AVRational timeBase = mInputTimeBases[packet->stream_index];
+    packet->stream_index = mStreamMap[packet->stream_index];
+    if (write_packet(packet, timeBase) != 0) {
+        return -1;
+    }
+    mAuxPacketCount++;
+    return 0;
+}
+
+int Muxer::Close() {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (mOutput == nullptr) {
+        return -1;
+    }
+    if (mHeaderWritten) {
+        if (av_write_trailer(mOutput) < 0) {
+            mFailed = true;
+        }
+    } else {
+        TF_LOG_ERROR("ERROR: No video written to %s.\n", mFileName.c_str());
+        mFailed = true;
+    }
+    if (!(mOutput->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&mOutput->pb);
+    }
+    avformat_free_context(mOutput);
+    mOutput = nullptr;
+    TF_LOG_INFO("Muxer closed: %s, video packets: %ld, audio/subtitle packets: %ld.\n", mFileName.c_str(), mVideoPacketCount.load(),
+                mAuxPacketCount.load());
+    return mFailed ? -1 : 0;
+}
+
+void write_aux_packets(Muxer *muxer, PacketQueue *queue) {
+    AVPacket *packet;
+    while ((packet = queue->Pop()) != nullptr) {
+        muxer->WriteAux(packet);
+        av_packet_free(&packet);
+    }
+}
+
+}  // namespace yitu_codec_mux
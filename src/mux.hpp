@@ -0,0 +1,128 @@
+#ifndef MUX_HPP
+#define MUX_HPP
+
+#include "common.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 封装输出: 编码后的视频与源文件的音频/字幕一起写入 mp4/mkv 等容器
+ * 音频/字幕 packet 不经过解码, 由读取线程送入独立的队列, 写出线程取出后交给 muxer;
+ * 视频 packet 在编码回调中写入. 两路按 dts 交错由 av_interleaved_write_frame 完成:
+ *
+ *   读取线程 --视频--> 解码 -> 编码 -> 编码回调 --\
+ *            \                                      +-> Muxer -> 文件
+ *             --音频/字幕--> PacketQueue -> 写出线程 --/
+ *
+ * 视频时间戳沿用源视频的 pts(时间基相同), 音频/字幕时间戳原样拷贝, 因此音画同步与源文件一致
+ * tfenc 输出不含 B 帧, 每次回调为一帧(或单独的参数集), dts 取 pts
+ */
+namespace yitu_codec_mux {
+
+/// 输出文件扩展名对应容器格式(mp4/mkv/mov/ts/flv 等)时需要封装, 裸码流(.h264/.265 等)或无法识别时返回 false
+bool container_output(const std::string &fileName);
+
+// 不解码的 packet 队列, 按字节数限制, Push 取得 packet 的所有权; 空指针为结束标记
+// 与视频压缩帧队列分开, 长时间只有音频的片段不会占满视频队列
+class PacketQueue {
+   public:
+    PacketQueue(long maxBytes = 32L << 20)
+        : mMaxBytes(maxBytes), mBytes(0) {
+    }
+
+    ~PacketQueue() {
+        for (AVPacket *packet : mPackets) {
+            av_packet_free(&packet);
+        }
+    }
+
+    void Push(AVPacket *packet) {
+        std::unique_lock<std::mutex> lock(mLock);
+        if (packet != nullptr) {
+            mNotFull.wait(lock, [this, packet] { return mPackets.empty() || mBytes + packet->size <= mMaxBytes; });
+            mBytes += packet->size;
+        }
+        mPackets.push_back(packet);
+        mNotEmpty.notify_one();
+    }
+
+    AVPacket *Pop() {
+        std::unique_lock<std::mutex> lock(mLock);
+        mNotEmpty.wait(lock, [this] { return !mPackets.empty(); });
+        AVPacket *packet = mPackets.front();
+        mPackets.pop_front();
+        if (packet != nullptr) {
+            mBytes -= packet->size;
+        }
+        mNotFull.notify_one();
+        return packet;
+    }
+
+   private:
+    std::mutex mLock;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+    std::deque<AVPacket *> mPackets;
+    long mMaxBytes;
+    long mBytes;
+};
+
+// 容器输出, 线程安全: 编码回调与音频写出线程同时写入
+class Muxer {
+   public:
+    ~Muxer();
+
+    /// @brief 创建输出文件, 视频流参数取编码设置, 输入中的音频/字幕流拷贝参数(容器不支持的字幕流跳过)
+    /// 文件头在第一个视频帧到达、取得参数集后写出, 之前到达的音频/字幕先缓存
+    /// @param withAux false 时只输出视频流
+    /// @return 0 成功, -1 失败
+    int Open(const std::string &fileName, AVFormatContext *input, int videoIndex, const tfenc_setting &setting,
+             bool withAux = true);
+
+    /// @brief 写入一次编码回调的 annexb 数据
+    /// @param pts 对应源帧的 pts, 源视频时间基
+    /// @return 0 已写入一帧, 1 只有参数集(已缓存, 拼到下一帧前, 未使用 pts), -1 失败
+    int WriteVideo(const uint8_t *data, int len, int64_t pts);
+
+    /// @brief 写入一个输入 packet, 非音频/字幕流的忽略; 调用方保留 packet, 内容被取走
+    /// @return 0 成功, -1 失败
+    int WriteAux(AVPacket *packet);
+
+    /// @brief 写出文件尾并关闭, 之前有任何写入失败时也返回 -1
+    int Close();
+
+    long VideoPacketCount() {
+        return mVideoPacketCount;
+    }
+
+    long AuxPacketCount() {
+        return mAuxPacketCount;
+    }
+
+   private:
+    int write_header();
+    int write_packet(AVPacket *packet, AVRational timeBase);
+
+    std::mutex mLock;
+    std::string mFileName;
+    AVFormatContext *mOutput = nullptr;
+    AVStream *mVideoStream = nullptr;
+    AVRational mVideoTimeBase = {1, 1};
+    /// 输入流序号 -> 输出流序号, -1 表示不输出
+    std::vector<int> mStreamMap;
+    std::vector<AVRational> mInputTimeBases;
+    /// 尚未写出的参数集
+    std::vector<uint8_t> mVideoPrefix;
+    /// 文件头写出前到达的音频/字幕
+    std::deque<AVPacket *> mPendingAux;
+    bool mHeaderWritten = false;
+    bool mFailed = false;
+    std::atomic<long> mVideoPacketCount{0};
+    std::atomic<long> mAuxPacketCount{0};
+};
+
+/// @brief 写出线程: 从队列取 packet 交给 muxer, 直到结束标记
+void write_aux_packets(Muxer *muxer, PacketQueue *queue);
+
+}  // namespace yitu_codec_mux
+#endif  // MUX_HPP
@@ -0,0 +1,359 @@
+#include "quality.hpp"
+#include "task_pool.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace yitu_codec_quality {
+
+using yitu_codec_dec::DecContext;
+using yitu_codec_dec::DecodedStream;
+using yitu_codec_dec::VideoInfo;
+
+uint64_t plane_sse(const uint8_t *a, const uint8_t *b, size_t count) {
+    uint64_t sse = 0;
+    size_t i = 0;
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    // 每轮每格最多加 4 * 255^2, uint32 累加器每 8192 轮归并一次
+    while (i + 16 <= count) {
+        uint32x4_t acc = vdupq_n_u32(0);
+        size_t end = std::min(count - count % 16, i + (size_t)16 * 8192);
+        for (; i < end; i += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+        }
+        uint64x2_t sums = vpaddlq_u32(acc);
+        sse += vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+    }
+#endif
+    for (; i < count; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        sse += diff * diff;
+    }
+    return sse;
+}
+
+double sse_to_psnr(uint64_t sse, size_t count) {
+    if (sse == 0 || count == 0) {
+        return 100;
+    }
+    return std::min(100.0, 10 * log10(255.0 * 255.0 * count / sse));
+}
+
+// 8x8 窗口的 Σa, Σb, Σ(a²+b²), Σab
+static void window_sums_8x8(const uint8_t *a, const uint8_t *b, int stride, uint32_t sums[4]) {
+#if defined(_USE_NEON) && defined(__ARM_NEON)
+    uint16x8_t sumA = vdupq_n_u16(0);
+    uint16x8_t sumB = vdupq_n_u16(0);
+    uint32x4_t sumSq = vdupq_n_u32(0);
+    uint32x4_t sumAB = vdupq_n_u32(0);
+    for (int r = 0; r < 8; r++) {
+        uint8x8_t va = vld1_u8(a + (size_t)r * stride);
+        uint8x8_t vb = vld1_u8(b + (size_t)r * stride);
+        sumA = vaddw_u8(sumA, va);
+        sumB = vaddw_u8(sumB, vb);
+        sumSq = vpadalq_u16(sumSq, vmull_u8(va, va));
+        sumSq = vpadalq_u16(sumSq, vmull_u8(vb, vb));
+        sumAB = vpadalq_u16(sumAB, vmull_u8(va, vb));
+    }
+    uint64x2_t s;
+    s = vpaddlq_u32(vpaddlq_u16(sumA));
+    sums[0] = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+    s = vpaddlq_u32(vpaddlq_u16(sumB));
+    sums[1] = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+    s = vpaddlq_u32(sumSq);
+    sums[2] = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+    s = vpaddlq_u32(sumAB);
+    sums[3] = (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+#else
+    uint32_t sumA = 0, sumB = 0, sumSq = 0, sumAB = 0;
+    for (int r = 0; r < 8; r++) {
+        const uint8_t *pa = a + (size_t)r * stride;
+        const uint8_t *pb = b + (size_t)r * stride;
+        for (int c = 0; c < 8; c++) {
+            sumA += pa[c];
+            sumB += pb[c];
+            sumSq += pa[c] * pa[c] + pb[c] * pb[c];
+            sumAB += pa[c] * pb[c];
+        }
+    }
+    sums[0] = sumA;
+    sums[1] = sumB;
+    sums[2] = sumSq;
+    sums[3] = sumAB;
+#endif
+}
+
+double plane_ssim(const uint8_t *a, const uint8_t *b, int width, int height) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    double total = 0;
+    int count = 0;
+    for (int y = 0; y + 8 <= height; y += 4) {
+        for (int x = 0; x + 8 <= width; x += 4) {
+            uint32_t sums[4];
+            size_t offset = (size_t)y * width + x;
+            window_sums_8x8(a + offset, b + offset, width, sums);
+            double meanA = sums[0] / 64.0;
+            double meanB = sums[1] / 64.0;
+            double varSum = sums[2] / 64.0 - meanA * meanA - meanB * meanB;
+            double cov = sums[3] / 64.0 - meanA * meanB;
+            total += ((2 * meanA * meanB + c1) * (2 * cov + c2)) / ((meanA * meanA + meanB * meanB + c1) * (varSum + c2));
+            count++;
+        }
+    }
+    return count > 0 ? total / count : 1;
+}
+
+// 单路解码输入
+struct MeterInput {
+    MeterInput() : stream(4) {
+    }
+
+    DecodedStream stream;
+    double timeBase = 0;
+    int64_t startPts = 0;
+};
+
+// 配对后的一帧
+struct QualityTask {
+    int index;
+    double timestampMs;
+    FrameData *ref;
+    FrameData *dist;
+};
+
+// 单帧计算结果, 按帧序交付汇总
+struct MeasuredFrame {
+    int ret = 0;
+    FrameQuality quality;
+    uint64_t sse = 0;
+    size_t samples = 0;
+};
+
+// 计算线程的缓冲区, 随线程复用, 不必每帧重新分配
+struct QualityBuffers {
+    std::vector<uint8_t> refBuffer;
+    std::vector<uint8_t> scaledBuffer;
+    std::vector<uint8_t> distBuffer;
+};
+static thread_local QualityBuffers tBuffers;
+
+static int open_input(const std::string &fileName, int deviceIndex, MeterInput *input) {
+    yitu_codec_dec::BufferProfile profile = yitu_codec_dec::batch_buffer_profile();
+    profile.inFrameCacheSize = 64;
+    profile.outFrameCacheSize = 4;
+    if (yitu_codec_dec::open_decoded_stream(fileName, deviceIndex, profile, &input->stream) != 0) {
+        return -1;
+    }
+    VideoInfo *videoInfo = &input->stream.videoInfo;
+    AVStream *stream = videoInfo->avFormatContext->streams[videoInfo->videoIndex];
+    input->timeBase = av_q2d(stream->time_base);
+    input->startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    return 0;
+}
+
+/// 解码帧整理为紧密排列的 8 bit I420: 高位深帧降位深, 带对齐填充的帧去掉填充, 其他帧原样返回
+static const uint8_t *to_8bit(const DecContext *ctx, const FrameData *frameData, std::vector<uint8_t> *buffer) {
+    ConstFrameView view = yitu_codec_dec::frame_view(ctx, frameData);
+    if (view.bytesPerSample == 1 && view.IsPacked()) {
+        return view.planes[0];
+    }
+    buffer->resize((size_t)view.width * view.height * 3 / 2);
+    if (view.bytesPerSample == 2) {
+        yitu_codec_enc::i420_16_to_8(view, ctx->videoInfo->bitDepth, buffer->data());
+        return buffer->data();
+    }
+    uint8_t *dst = buffer->data();
+    for (int plane = 0; plane < 3; plane++) {
+        for (int r = 0; r < view.PlaneHeight(plane); r++) {
+            memcpy(dst, view.planes[plane] + (size_t)r * view.strides[plane], view.PlaneWidth(plane));
+            dst += view.PlaneWidth(plane);
+        }
+    }
+    return buffer->data();
+}
+
+static int measure_frame(const DecContext *refCtx, const DecContext *distCtx, const QualityTask &task, MeasuredFrame *measured) {
+    const VideoInfo *refInfo = refCtx->videoInfo;
+    int width = distCtx->videoInfo->width;
+    int height = distCtx->videoInfo->height;
+    QualityBuffers *buffers = &tBuffers;
+    const uint8_t *ref = to_8bit(refCtx, task.ref, &buffers->refBuffer);
+    const uint8_t *dist = to_8bit(distCtx, task.dist, &buffers->distBuffer);
+    if (refInfo->width != width || refInfo->height != height) {
+        buffers->scaledBuffer.resize((size_t)width * height * 3 / 2);
+        // tfg 接口的源参数未声明 const, 只读取
+        int ret = tfg::I420_Planar_ScaleEx(const_cast<uint8_t *>(ref), nullptr, refInfo->width, refInfo->height, buffers->scaledBuffer.data(), nullptr, width,
+                                           height, tfg::INTERP_Bilinear);
+        if (ret != 0) {
+            TF_LOG_ERROR("ERROR: I420_Planar_ScaleEx failed. ret: %d\n", ret);
+            return ret;
+        }
+        ref = buffers->scaledBuffer.data();
+    }
+
+    size_t ySize = (size_t)width * height;
+    size_t uvSize = (size_t)(width / 2) * (height / 2);
+    uint64_t sseY = plane_sse(ref, dist, ySize);
+    uint64_t sseU = plane_sse(ref + ySize, dist + ySize, uvSize);
+    uint64_t sseV = plane_sse(ref + ySize + uvSize, dist + ySize + uvSize, uvSize);
+
+    FrameQuality &quality = measured->quality;
+    quality.index = task.index;
+    quality.timestampMs = task.timestampMs;
+    quality.psnrY = sse_to_psnr(sseY, ySize);
+    quality.psnrU = sse_to_psnr(sseU, uvSize);
+    quality.psnrV = sse_to_psnr(sseV, uvSize);
+    quality.psnr = sse_to_psnr(sseY + sseU + sseV, ySize + uvSize * 2);
+    quality.ssimY = plane_ssim(ref, dist, width, height);
+    measured->sse = sseY + sseU + sseV;
+    measured->samples = ySize + uvSize * 2;
+    return 0;
+}
+
+/// 读取静止帧过滤生成的 timestamp v2 文件, 不存在时返回空
+static std::vector<double> load_timestamps(const std::string &fileName) {
+    std::vector<double> timestamps;
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line[0] != '#') {
+            timestamps.push_back(std::stod(line));
+        }
+    }
+    return timestamps;
+}
+
+static void write_csv(const std::string &fileName, const std::vector<FrameQuality> &results) {
+    std::fstream csv(fileName, std::ios::out | std::ios::trunc);
+    if (!csv.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", fileName.c_str());
+        return;
+    }
+    csv << "frame,timestamp_ms,psnr_y,psnr_u,psnr_v,psnr,ssim_y\n";
+    csv << std::fixed;
+    for (const FrameQuality &q : results) {
+        csv << q.index << "," << std::setprecision(3) << q.timestampMs << "," << std::setprecision(4) << q.psnrY << "," << q.psnrU << ","
+            << q.psnrV << "," << q.psnr << "," << std::setprecision(6) << q.ssimY << "\n";
+    }
+}
+
+int run_quality(const QualityConfig &config, QualityStats *stats) {
+    if (config.workerCount <= 0) {
+        TF_LOG_ERROR("ERROR: Invalid quality config.\n");
+        return -1;
+    }
+    MeterInput source, encoded;
+    int ret = open_input(config.sourceFileName, config.decDeviceIndex, &source);
+    if (ret == 0) {
+        ret = open_input(config.encodedFileName, config.decDeviceIndex, &encoded);
+    }
+    if (ret != 0) {
+        yitu_codec_dec::close_decoded_stream(&encoded.stream);
+        yitu_codec_dec::close_decoded_stream(&source.stream);
+        return ret;
+    }
+
+    std::vector<double> timestamps = load_timestamps(config.encodedFileName + ".timestamps");
+    for (MeterInput *input : {&source, &encoded}) {
+        yitu_codec_dec::start_decoded_stream(&input->stream);
+    }
+    // 没有共享线程池时使用本次评估自己的 workerCount 个线程
+    std::unique_ptr<yitu_codec_task::TaskPool> localPool;
+    yitu_codec_task::TaskPool *pool = yitu_codec_task::cpu_pool();
+    if (pool == nullptr) {
+        localPool.reset(new yitu_codec_task::TaskPool(config.workerCount));
+        pool = localPool.get();
+    }
+    // 在途帧数限制为 workerCount * 2, 结果按帧序汇总
+    yitu_codec_task::OrderedStage stage(pool, config.workerCount * 2);
+    std::vector<FrameQuality> results;
+    uint64_t totalSse = 0;
+    size_t totalSamples = 0;
+    bool failed = false;
+    const DecContext *refCtx = source.stream.ctx.get();
+    const DecContext *distCtx = encoded.stream.ctx.get();
+
+    // 编码输出的第 index 帧与源视频中时间戳对应(或显示顺序相同)的帧配对
+    int index = 0;
+    FrameData *dist;
+    while ((dist = yitu_codec_dec::pop_decoded_frame(&encoded.stream)) != nullptr) {
+        FrameData *ref;
+        double timestampMs = 0;
+        while ((ref = yitu_codec_dec::pop_decoded_frame(&source.stream)) != nullptr) {
+            timestampMs = ((int64_t)ref->GetTimestamp() - source.startPts) * source.timeBase * 1000;
+            if (index >= (int)timestamps.size() || timestampMs + 0.5 >= timestamps[index]) {
+                break;
+            }
+            // 静止帧过滤跳过的源帧
+            ref->Release();
+        }
+        if (ref == nullptr) {
+            TF_LOG_WARN("WARNING: Source ended before encoded output, %d frames compared.\n", index);
+            dist->Release();
+            break;
+        }
+        QualityTask task = {index, timestampMs, ref, dist};
+        std::shared_ptr<MeasuredFrame> measured = std::make_shared<MeasuredFrame>();
+        stage.Submit(
+            [refCtx, distCtx, task, measured] {
+                measured->ret = measure_frame(refCtx, distCtx, task, measured.get());
+                task.ref->Release();
+                task.dist->Release();
+            },
+            [measured, &results, &totalSse, &totalSamples, &failed] {
+                if (measured->ret != 0) {
+                    failed = true;
+                    return;
+                }
+                results.push_back(measured->quality);
+                totalSse += measured->sse;
+                totalSamples += measured->samples;
+            });
+        index++;
+    }
+    stage.Flush();
+    if (!timestamps.empty() && index != (int)timestamps.size()) {
+        TF_LOG_WARN("WARNING: %d encoded frames but %zu timestamps, pairs after the mismatch may be misaligned.\n", index,
+                    timestamps.size());
+    }
+    int encodedRet = yitu_codec_dec::close_decoded_stream(&encoded.stream);
+    int sourceRet = yitu_codec_dec::close_decoded_stream(&source.stream);
+    if (sourceRet != 0 || encodedRet != 0 || failed) {
+        ret = -1;
+    }
+
+    if (!config.csvFileName.empty()) {
+        write_csv(config.csvFileName, results);
+    }
+
+    QualityStats summary = QualityStats();
+    summary.frameCount = results.size();
+    summary.minPsnr = 100;
+    summary.minSsim = 1;
+    for (const FrameQuality &q : results) {
+        summary.avgPsnr += q.psnr;
+        summary.avgSsim += q.ssimY;
+        summary.minPsnr = std::min(summary.minPsnr, q.psnr);
+        summary.minSsim = std::min(summary.minSsim, q.ssimY);
+    }
+    if (!results.empty()) {
+        summary.avgPsnr /= results.size();
+        summary.avgSsim /= results.size();
+    }
+    summary.globalPsnr = sse_to_psnr(totalSse, totalSamples);
+    TF_LOG_INFO("Quality: %d frames, PSNR avg %.3f dB (min %.3f, global %.3f), SSIM avg %.5f (min %.5f).\n", summary.frameCount,
+                summary.avgPsnr, summary.minPsnr, summary.globalPsnr, summary.avgSsim, summary.minSsim);
+    if (stats != nullptr) {
+        *stats = summary;
+    }
+    return ret;
+}
+
+}  // namespace yitu_codec_quality
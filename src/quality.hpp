@@ -0,0 +1,74 @@
+#ifndef QUALITY_HPP
+#define QUALITY_HPP
+
+#include "common_dec.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 编码质量评估: 把编码输出再经 tfdec 解码, 与源视频逐帧比较 PSNR/SSIM, 用于比较不同码率/GOP/码率模式
+ * 两路解码各自送入队列, 配对线程按时间戳对齐后交给线程池计算, 结果按帧序汇总, 计算较慢时只阻塞评估本身:
+ *
+ *   源视频   -> tfdec -> 队列 --\
+ *                               +-> 按时间戳配对 -> 共享 CPU 线程池 -> 按帧序汇总 -> 逐帧 CSV + 汇总
+ *   编码输出 -> tfdec -> 队列 --/
+ *
+ * 编码输出是不带时间戳的 annexb 码流, 第 i 帧对应源视频显示顺序的第 i 帧;
+ * 存在 "<编码输出>.timestamps"(静止帧过滤或 Transcoder 开启质量评估时写出)时按其中的时间戳对齐, 被跳过或丢弃的源帧不参与比较
+ * 分辨率不同时源帧先缩放到编码尺寸; 高位深帧按 8 bit 计算
+ */
+namespace yitu_codec_quality {
+
+/// @brief 两段数据的差值平方和
+uint64_t plane_sse(const uint8_t *a, const uint8_t *b, size_t count);
+
+/// @brief 由差值平方和计算 PSNR(8 bit), 完全相同时记为 100
+double sse_to_psnr(uint64_t sse, size_t count);
+
+/// @brief 单平面 SSIM, 8x8 窗口每 4 像素滑动一次, 取所有窗口的平均值
+double plane_ssim(const uint8_t *a, const uint8_t *b, int width, int height);
+
+// 评估参数
+struct QualityConfig {
+    std::string sourceFileName;
+    /// 编码输出(annexb 码流)
+    std::string encodedFileName;
+    int decDeviceIndex = 1;
+    /// 同时计算的帧数; 未开启共享 CPU 线程池时另起同样数量的计算线程
+    int workerCount = 2;
+    /// 逐帧结果, 为空时不输出
+    std::string csvFileName;
+};
+
+// 单帧结果
+struct FrameQuality {
+    int index;
+    /// 源帧显示时间(ms, 相对视频开头)
+    double timestampMs;
+    double psnrY;
+    double psnrU;
+    double psnrV;
+    /// 三个平面合计的 PSNR
+    double psnr;
+    double ssimY;
+};
+
+// 汇总
+struct QualityStats {
+    int frameCount;
+    /// 逐帧 PSNR/SSIM 的平均值与最小值
+    double avgPsnr;
+    double minPsnr;
+    double avgSsim;
+    double minSsim;
+    /// 按全部帧的差值平方和计算的 PSNR
+    double globalPsnr;
+};
+
+/// @brief 运行评估, 阻塞到两路都解码完成
+/// @param stats 汇总, 可为 NULL
+/// @return 0 成功, 其他值失败
+int run_quality(const QualityConfig &config, QualityStats *stats);
+
+}  // namespace yitu_codec_quality
+#endif  // QUALITY_HPP
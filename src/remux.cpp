@@ -0,0 +1,142 @@
+#include "remux.hpp"
+
+namespace yitu_codec_remux {
+
+using namespace yitu_codec_dec;
+
+int64_t packet_ts(const AVPacket *packet) {
+    return packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+}
+
+int seek_video(VideoInfo *videoInfo, int64_t pts) {
+    if (av_seek_frame(videoInfo->avFormatContext, videoInfo->videoIndex, pts, AVSEEK_FLAG_BACKWARD) < 0) {
+        TF_LOG_ERROR("ERROR: Unable to seek to %ld.\n", (long)pts);
+        return -1;
+    }
+    return 0;
+}
+
+int match_source_setting(const VideoInfo *videoInfo, tfenc_setting *setting) {
+    const AVCodecParameters *codecpar = videoInfo->avFormatContext->streams[videoInfo->videoIndex]->codecpar;
+    switch (codecpar->codec_id) {
+        case AV_CODEC_ID_H264:
+            if (codecpar->profile == FF_PROFILE_H264_BASELINE || codecpar->profile == FF_PROFILE_H264_CONSTRAINED_BASELINE) {
+                setting->profile = PROFILE_AVC_BASELINE;
+            } else if (codecpar->profile == FF_PROFILE_H264_MAIN) {
+                setting->profile = PROFILE_AVC_MAIN;
+            } else {
+                setting->profile = PROFILE_AVC_HIGH;
+            }
+            if (codecpar->level > 0) {
+                setting->level = codecpar->level;
+            }
+            break;
+
+        case AV_CODEC_ID_HEVC:
+            setting->profile = codecpar->profile == FF_PROFILE_HEVC_MAIN_10 ? PROFILE_HEVC_MAIN10 : PROFILE_HEVC_MAIN;
+            // HEVC 的 general_level_idc 为 level*30, 换算为与 H264 相同的 level*10
+            if (codecpar->level > 0) {
+                setting->level = codecpar->level / 3;
+            }
+            break;
+
+        default:
+            return -1;
+    }
+    setting->width = codecpar->width;
+    setting->height = codecpar->height;
+    return 0;
+}
+
+bool can_stream_copy(const VideoInfo *videoInfo, const tfenc_setting &setting, std::string *reason) {
+    std::string why;
+    tfenc_setting source = setting;
+    const AVCodecParameters *codecpar = videoInfo->avFormatContext->streams[videoInfo->videoIndex]->codecpar;
+    // 流的码率未知时用整个文件的平均码率, 含音频, 偏保守
+    long bitRate = codecpar->bit_rate > 0 ? codecpar->bit_rate : videoInfo->avFormatContext->bit_rate;
+    if (setting.profile == TF_PROFILE_INVALID) {
+        why = "no target profile";
+    } else if (match_source_setting(videoInfo, &source) != 0) {
+        why = "codec not supported by encoder";
+    } else if (source.profile != setting.profile) {
+        why = "profile differs";
+    } else if (source.level > setting.level) {
+        why = "level above target";
+    } else if ((setting.width != 0 && source.width != setting.width) || (setting.height != 0 && source.height != setting.height)) {
+        why = "resolution differs";
+    } else if (bitRate <= 0) {
+        why = "bit rate unknown";
+    } else if (bitRate > (long)setting.max_bit_rate) {
+        why = "bit rate above cap";
+    }
+    if (reason != nullptr) {
+        *reason = why;
+    }
+    return why.empty();
+}
+
+int copy_packets(DecContext *ctx, int64_t fromPts, int64_t toPts, CopyStats *stats) {
+    VideoInfo *videoInfo = ctx->videoInfo;
+    if (fromPts != AV_NOPTS_VALUE && seek_video(videoInfo, fromPts) != 0) {
+        return -1;
+    }
+    AVBSFContext *bsf = nullptr;
+    if (open_bitstream_filter(videoInfo, &bsf) != 0) {
+        return -1;
+    }
+    std::ofstream output(ctx->outputFileName, std::ios::out | std::ios::binary | std::ios::app);
+    if (!output.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", ctx->outputFileName.c_str());
+        av_bsf_free(&bsf);
+        return -1;
+    }
+
+    int ret = 0;
+    bool started = false;
+    AVPacket *packet = av_packet_alloc();
+    while (!ctx->cancelled && av_read_frame(videoInfo->avFormatContext, packet) >= 0) {
+        if (packet->stream_index != videoInfo->videoIndex) {
+            av_packet_unref(packet);
+            continue;
+        }
+        int64_t ts = packet_ts(packet);
+        bool key = packet->flags & AV_PKT_FLAG_KEY;
+        if (key && toPts != AV_NOPTS_VALUE && ts >= toPts) {
+            av_packet_unref(packet);
+            break;
+        }
+        // seek 可能落在更早的关键帧上, 跳到 fromPts 处的关键帧
+        if (!started && (!key || (fromPts != AV_NOPTS_VALUE && ts < fromPts))) {
+            av_packet_unref(packet);
+            continue;
+        }
+        started = true;
+        if (key) {
+            stats->gopCount++;
+        } else if (fromPts != AV_NOPTS_VALUE && ts < fromPts) {
+            // 开放 GOP 的前置帧参考了 fromPts 之前的 GOP, 无法直接拷贝
+            stats->skippedLeadingCount++;
+            av_packet_unref(packet);
+            continue;
+        }
+        if (bsf != nullptr && filter_packet(bsf, packet) != 0) {
+            TF_LOG_ERROR("ERROR: Bitstream filter failed while copying.\n");
+            ret = -1;
+            break;
+        }
+        output.write((const char *)packet->data, packet->size);
+        stats->packetCount++;
+        stats->bytes += packet->size;
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+    av_bsf_free(&bsf);
+    if (!output.good()) {
+        TF_LOG_ERROR("ERROR: Unable to write file %s.\n", ctx->outputFileName.c_str());
+        ret = -1;
+    }
+    TF_LOG_INFO("Packets copied: [%ld, %ld), packets: %d, bytes: %ld.\n", (long)fromPts, (long)toPts, stats->packetCount, stats->bytes);
+    return ret;
+}
+
+}  // namespace yitu_codec_remux
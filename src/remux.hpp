@@ -0,0 +1,52 @@
+#ifndef REMUX_HPP
+#define REMUX_HPP
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 压缩packet直接拷贝(不经过解码/编码)
+ * 输入已满足交付要求时整个文件直接拷贝, 剪辑时区间内完整的 GOP 也走这里
+ * avcC/hvcC 封装的 H264/HEVC 经 mp4toannexb 过滤后输出 annexb 码流
+ */
+namespace yitu_codec_remux {
+
+using yitu_codec_dec::DecContext;
+using yitu_codec_dec::VideoInfo;
+
+// 拷贝统计
+struct CopyStats {
+    int gopCount;
+    int packetCount;
+    long bytes;
+    /// 开放 GOP 中被丢弃的前置帧
+    int skippedLeadingCount;
+};
+
+/// packet 的显示时间, 没有 pts 时用 dts
+int64_t packet_ts(const AVPacket *packet);
+
+/// seek 到视频流 pts 处或之前最近的关键帧
+int seek_video(VideoInfo *videoInfo, int64_t pts);
+
+/// @brief 按源视频设置编码 profile/level/宽高
+/// @return 0 成功, -1 源视频不是 tfenc 支持的 H264/HEVC
+int match_source_setting(const VideoInfo *videoInfo, tfenc_setting *setting);
+
+/// @brief 判断源视频是否已满足编码参数, 可以直接拷贝
+/// 条件: profile 相同, level 不高于目标, 分辨率相同(目标宽高为0表示与源一致), 码率不超过 max_bit_rate
+/// @param reason 不能拷贝时写入原因, 可为 NULL
+bool can_stream_copy(const VideoInfo *videoInfo, const tfenc_setting &setting, std::string *reason);
+
+/// @brief 拷贝 [fromPts, toPts) 之间的完整 GOP, 转为 annexb 后追加到 ctx->outputFileName
+/// 从 fromPts 处的关键帧开始, 到 toPts 处(含之后)的第一个关键帧之前结束
+/// @param fromPts 为 AV_NOPTS_VALUE 时从当前读取位置开始, 不 seek
+/// @param toPts 为 AV_NOPTS_VALUE 时拷贝到文件结束
+/// @param stats 累加拷贝统计
+/// @return 0 成功, 其他值失败; ctx->cancelled 置位时提前结束
+int copy_packets(DecContext *ctx, int64_t fromPts, int64_t toPts, CopyStats *stats);
+
+}  // namespace yitu_codec_remux
+#endif  // REMUX_HPP
@@ -0,0 +1,188 @@
+#include "scheduler.hpp"
+
+#include <memory>
+
+namespace yitu_codec_sched {
+
+static std::mutex gSchedLock;
+static SchedulerConfig gSchedConfig;
+static std::map<int, std::unique_ptr<DeviceScheduler>> gDecSchedulers;
+static std::map<int, std::unique_ptr<DeviceScheduler>> gEncSchedulers;
+
+int64_t sched_now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DeviceScheduler::DeviceScheduler(int slots, int liveReserve, int stallMs)
+    : mSlots(std::max(slots, 1)), mLiveReserve(std::min(std::max(liveReserve, 0), mSlots - 1)), mStallMs(std::max(stallMs, 1)) {
+}
+
+void DeviceScheduler::Attach(SchedClient *client) {
+    std::lock_guard<std::mutex> lock(mLock);
+    client->inFlight = 0;
+    client->lastProgressMs = sched_now_ms();
+    if (client->schedClass == SCHED_CLASS_LIVE) {
+        mLiveClients++;
+    } else {
+        // 新任务从当前最小的虚拟时间开始, 不会因为来得晚而长期独占
+        bool found = false;
+        double minTime = 0;
+        for (SchedClient *c : mClients) {
+            if (c->schedClass == SCHED_CLASS_BATCH && (!found || c->virtualTime < minTime)) {
+                minTime = c->virtualTime;
+                found = true;
+            }
+        }
+        client->virtualTime = minTime;
+        mBatchClients++;
+    }
+    mClients.push_back(client);
+}
+
+void DeviceScheduler::Detach(SchedClient *client) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mInFlight -= client->inFlight;
+    client->inFlight = 0;
+    mClients.remove(client);
+    if (client->schedClass == SCHED_CLASS_LIVE) {
+        mLiveClients--;
+    } else {
+        mBatchClients--;
+    }
+    mCv.notify_all();
+}
+
+const DeviceScheduler::Request *DeviceScheduler::next_request() {
+    // 保底放行最早的一个: 没有在途帧, 或在途帧迟迟没有输出(解码器在等待更多输入)
+    int64_t now = sched_now_ms();
+    const Request *best = nullptr;
+    for (const Request &r : mWaiting) {
+        if ((r.client->inFlight == 0 || now - r.client->lastProgressMs >= mStallMs) && (best == nullptr || r.seq < best->seq)) {
+            best = &r;
+        }
+    }
+    if (best != nullptr) {
+        return best;
+    }
+    for (const Request &r : mWaiting) {
+        if (r.client->schedClass == SCHED_CLASS_LIVE &&
+            (best == nullptr || r.deadlineMs < best->deadlineMs || (r.deadlineMs == best->deadlineMs && r.seq < best->seq))) {
+            best = &r;
+        }
+    }
+    // 有直播请求等待时只放行直播
+    if (best != nullptr) {
+        return mInFlight < mSlots ? best : nullptr;
+    }
+    int batchSlots = mLiveClients > 0 ? mSlots - mLiveReserve : mSlots;
+    if (mInFlight >= batchSlots) {
+        return nullptr;
+    }
+    for (const Request &r : mWaiting) {
+        if (best == nullptr || r.client->virtualTime < best->client->virtualTime ||
+            (r.client->virtualTime == best->client->virtualTime && r.seq < best->seq)) {
+            best = &r;
+        }
+    }
+    return best;
+}
+
+bool DeviceScheduler::Acquire(SchedClient *client, int64_t deadlineMs, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto it = mWaiting.insert(mWaiting.end(), {client, deadlineMs, mSeq++});
+    auto granted = [this, it] { return next_request() == &*it; };
+    if (!granted()) {
+        if (client->schedClass == SCHED_CLASS_BATCH && mLiveClients > 0) {
+            mBatchPreempted++;
+        }
+        // 保底条件随时间成立, 没有通知时也按 stallMs 重新检查
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeoutMs, 0));
+        while (!granted()) {
+            std::chrono::steady_clock::duration step = std::chrono::milliseconds(mStallMs);
+            if (timeoutMs >= 0) {
+                std::chrono::steady_clock::duration remaining = deadline - std::chrono::steady_clock::now();
+                if (remaining <= std::chrono::steady_clock::duration::zero()) {
+                    mWaiting.erase(it);
+                    mCv.notify_all();
+                    return false;
+                }
+                step = std::min(step, remaining);
+            }
+            mCv.wait_for(lock, step);
+        }
+    }
+    mWaiting.erase(it);
+    if (mInFlight >= mSlots) {
+        mOvercommitted++;
+    }
+    mInFlight++;
+    client->inFlight++;
+    client->grantedCount++;
+    client->lastProgressMs = sched_now_ms();
+    if (client->schedClass == SCHED_CLASS_LIVE) {
+        mLiveGranted++;
+        if (sched_now_ms() > deadlineMs) {
+            client->lateCount++;
+            mLiveLate++;
+        }
+    } else {
+        client->virtualTime += 1.0 / std::max(client->weight, 1);
+        mBatchGranted++;
+    }
+    // 还有空位时下一个请求可以继续放行
+    mCv.notify_all();
+    return true;
+}
+
+void DeviceScheduler::Complete(SchedClient *client) {
+    std::lock_guard<std::mutex> lock(mLock);
+    if (client->inFlight <= 0) {
+        return;
+    }
+    client->inFlight--;
+    client->lastProgressMs = sched_now_ms();
+    mInFlight--;
+    mCv.notify_all();
+}
+
+SchedulerStats DeviceScheduler::Stats() {
+    std::lock_guard<std::mutex> lock(mLock);
+    SchedulerStats stats;
+    stats.liveClients = mLiveClients;
+    stats.batchClients = mBatchClients;
+    stats.inFlight = mInFlight;
+    stats.waiting = (int)mWaiting.size();
+    stats.liveGranted = mLiveGranted;
+    stats.batchGranted = mBatchGranted;
+    stats.batchPreempted = mBatchPreempted;
+    stats.liveLate = mLiveLate;
+    stats.overcommitted = mOvercommitted;
+    return stats;
+}
+
+void configure_schedulers(const SchedulerConfig &config) {
+    std::lock_guard<std::mutex> lock(gSchedLock);
+    gSchedConfig = config;
+}
+
+static DeviceScheduler *get_scheduler(std::map<int, std::unique_ptr<DeviceScheduler>> *schedulers, int device, int slots) {
+    std::lock_guard<std::mutex> lock(gSchedLock);
+    if (!gSchedConfig.enabled) {
+        return nullptr;
+    }
+    std::unique_ptr<DeviceScheduler> &scheduler = (*schedulers)[device];
+    if (scheduler == nullptr) {
+        scheduler.reset(new DeviceScheduler(slots, (int)(slots * gSchedConfig.liveReserveRatio + 0.5), gSchedConfig.stallMs));
+    }
+    return scheduler.get();
+}
+
+DeviceScheduler *dec_scheduler(int deviceIndex) {
+    return get_scheduler(&gDecSchedulers, deviceIndex, gSchedConfig.decSlots);
+}
+
+DeviceScheduler *enc_scheduler(int deviceId) {
+    return get_scheduler(&gEncSchedulers, deviceId, gSchedConfig.encSlots);
+}
+
+}  // namespace yitu_codec_sched
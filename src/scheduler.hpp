@@ -0,0 +1,133 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include "common.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 设备级帧调度: 直播与批处理任务共用解码/编码卡时, 按类别与截止时间仲裁各 session 的送帧
+ * (tfdec_enqueue_buffer / tfenc_process_frame), 批处理只使用直播剩下的能力:
+ *
+ *   session A(直播) --\                                   直播: 最早截止时间优先(EDF)
+ *   session B(直播) ---+-> 设备调度器(在途帧空位) -> 设备    批处理: 按权重公平分配(虚拟时间最小者优先)
+ *   session C(批处理) -/
+ *
+ * 每个设备的在途帧数有上限, 送帧前申请空位, 解码回调(编码为 tfenc_process_frame 返回)时归还
+ * 有直播请求等待时不再放行批处理; 有直播任务时批处理最多占用 slots - liveReserve 个空位,
+ * 直播帧到达时总有空位可用. 已在设备中的批处理帧无法撤回, 抢占发生在帧边界
+ * 保底: 没有在途帧的任务, 以及超过 stallMs 既没有获得也没有归还空位的任务, 不受空位上限限制直接放行;
+ * 解码器有重排序延迟时需要更多输入才会输出, 任务数多于空位时否则会互相等待. 因此在途帧数可能暂时超过 slots
+ * 调度默认关闭, 此时不经过调度器, 行为与之前相同
+ */
+namespace yitu_codec_sched {
+
+enum SchedClass {
+    SCHED_CLASS_LIVE = 0,
+    SCHED_CLASS_BATCH
+};
+
+// 调度对象, 对应一个解码或编码任务; 由任务持有, Attach 后到 Detach 前不能销毁
+struct SchedClient {
+    SchedClass schedClass = SCHED_CLASS_BATCH;
+    /// 批处理的份额权重, 越大分到的空位越多
+    int weight = 1;
+
+    // 以下由调度器维护
+    /// 批处理的虚拟时间, 每获得一个空位增加 1/weight
+    double virtualTime = 0;
+    int inFlight = 0;
+    long grantedCount = 0;
+    /// 直播截止时间已过才获得空位的帧数
+    long lateCount = 0;
+    /// 最近一次 Attach/获得空位/归还空位的时间(steady_clock 毫秒)
+    int64_t lastProgressMs = 0;
+};
+
+// 调度参数
+struct SchedulerConfig {
+    bool enabled = false;
+    /// 每个解码设备同时在途的帧数
+    int decSlots = 32;
+    /// 每个编码设备同时进行中的 tfenc_process_frame 调用数
+    int encSlots = 2;
+    /// 有直播任务时为直播保留的空位比例
+    double liveReserveRatio = 0.25;
+    /// 任务超过该时间没有进展时保底放行一帧
+    int stallMs = 200;
+};
+
+// 调度统计
+struct SchedulerStats {
+    int liveClients;
+    int batchClients;
+    int inFlight;
+    int waiting;
+    long liveGranted;
+    long batchGranted;
+    /// 因直播等待或保留空位而推迟的批处理申请次数
+    long batchPreempted;
+    long liveLate;
+    /// 保底放行时已达空位上限的次数
+    long overcommitted;
+};
+
+// 单个设备的调度器, 线程安全
+class DeviceScheduler {
+   public:
+    DeviceScheduler(int slots, int liveReserve, int stallMs);
+
+    void Attach(SchedClient *client);
+    /// 归还该任务所有未归还的空位(如故障切换后在途帧不会再有回调)
+    void Detach(SchedClient *client);
+
+    /// @brief 申请一个空位
+    /// @param deadlineMs 直播帧的截止时间(steady_clock 毫秒), 批处理忽略
+    /// @param timeoutMs 等待超时, 小于0一直等待
+    /// @return false 表示超时
+    bool Acquire(SchedClient *client, int64_t deadlineMs, int timeoutMs);
+    /// 归还一个空位, 该任务没有在途帧时忽略
+    void Complete(SchedClient *client);
+
+    SchedulerStats Stats();
+
+   private:
+    struct Request {
+        SchedClient *client;
+        int64_t deadlineMs;
+        long seq;
+    };
+
+    /// 当前应当放行的请求, 没有可以放行的返回 NULL; 在锁内调用
+    const Request *next_request();
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    int mSlots;
+    int mLiveReserve;
+    int mStallMs;
+    int mInFlight = 0;
+    int mLiveClients = 0;
+    int mBatchClients = 0;
+    long mSeq = 0;
+    std::list<Request> mWaiting;
+    std::list<SchedClient *> mClients;
+    long mLiveGranted = 0;
+    long mBatchGranted = 0;
+    long mBatchPreempted = 0;
+    long mLiveLate = 0;
+    long mOvercommitted = 0;
+};
+
+/// @brief 设置调度参数, 在第一个任务开始前调用
+void configure_schedulers(const SchedulerConfig &config);
+
+/// @brief 解码/编码设备的调度器, 调度关闭时返回 NULL
+DeviceScheduler *dec_scheduler(int deviceIndex);
+DeviceScheduler *enc_scheduler(int deviceId);
+
+/// 当前 steady_clock 毫秒数, 与截止时间使用同一时钟
+int64_t sched_now_ms();
+
+}  // namespace yitu_codec_sched
+#endif  // SCHEDULER_HPP
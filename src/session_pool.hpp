@@ -0,0 +1,244 @@
+#ifndef SESSION_POOL_HPP
+#define SESSION_POOL_HPP
+
+#include <tuple>
+#include <vector>
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 解码/编码 session 池
+ * 创建 tfdec/tfenc session 需要几百毫秒, 短视频任务的初始化时间甚至超过转码本身
+ * 任务结束时 session 已在 EOS 时冲刷完毕, 归还到池中供参数相同的下一个任务直接使用
+ */
+namespace yitu_codec_pool {
+
+using yitu_codec_dec::DecSession;
+using yitu_codec_enc::EncSession;
+
+// 解码session的复用条件: 设备 类型 宽 高 输出buffer数 是否 lite
+struct DecSessionKey {
+    int deviceIndex;
+    TFDEC_DECODER_ROLE role;
+    int width;
+    int height;
+    int outBufferNum;
+    bool lite;
+
+    bool operator<(const DecSessionKey &other) const {
+        return std::tie(deviceIndex, role, width, height, outBufferNum, lite) <
+               std::tie(other.deviceIndex, other.role, other.width, other.height, other.outBufferNum, other.lite);
+    }
+};
+
+// 编码session的复用条件: tfenc_setting 全部字段相同
+struct EncSessionKey {
+    tfenc_setting setting;
+
+    bool operator<(const EncSessionKey &other) const {
+        const tfenc_setting &a = setting;
+        const tfenc_setting &b = other.setting;
+        return std::tie(a.pix_format, a.width, a.height, a.profile, a.level, a.bit_rate, a.max_bit_rate, a.gop, a.frame_rate, a.device_id, a.rc_mode) <
+               std::tie(b.pix_format, b.width, b.height, b.profile, b.level, b.bit_rate, b.max_bit_rate, b.gop, b.frame_rate, b.device_id, b.rc_mode);
+    }
+};
+
+// 池统计
+struct PoolStats {
+    long created = 0;
+    long reused = 0;
+    long destroyed = 0;
+    int idle = 0;
+    int inUse = 0;
+};
+
+/// 按 Key 分组保存空闲 session 的池, 线程安全
+/// session 的创建与销毁都在锁外进行, 不会阻塞其他线程的借还
+template <typename Key, typename Session>
+class SessionPool {
+   public:
+    SessionPool(std::function<Session *(const Key &)> create, std::function<void(Session *)> destroy,
+                int maxIdlePerKey = 2, int idleTimeoutSec = 300)
+        : mCreate(create), mDestroy(destroy), mMaxIdlePerKey(maxIdlePerKey), mIdleTimeoutSec(idleTimeoutSec) {
+    }
+
+    ~SessionPool() {
+        Clear();
+    }
+
+    /// 借出一个 session, 没有空闲的则新建, 新建失败返回 NULL
+    Session *Acquire(const Key &key) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto it = mIdle.find(key);
+            if (it != mIdle.end() && !it->second.empty()) {
+                Session *session = it->second.back().session;
+                it->second.pop_back();
+                if (it->second.empty()) {
+                    mIdle.erase(it);
+                }
+                mStats.reused++;
+                mStats.idle--;
+                mStats.inUse++;
+                return session;
+            }
+        }
+        Session *session = mCreate(key);
+        if (session != nullptr) {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStats.created++;
+            mStats.inUse++;
+        }
+        return session;
+    }
+
+    /// 归还已在 EOS 冲刷完成的 session, 该 Key 空闲数已满时直接销毁
+    void Release(const Key &key, Session *session) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStats.inUse--;
+            std::vector<IdleEntry> &idle = mIdle[key];
+            if ((int)idle.size() < mMaxIdlePerKey) {
+                idle.push_back({session, std::chrono::steady_clock::now()});
+                mStats.idle++;
+                return;
+            }
+            mStats.destroyed++;
+        }
+        mDestroy(session);
+    }
+
+    /// 丢弃状态异常(如冲刷超时)的 session
+    void Discard(Session *session) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mStats.inUse--;
+            mStats.destroyed++;
+        }
+        mDestroy(session);
+    }
+
+    /// 销毁空闲超过 idleTimeoutSec 的 session, 释放设备通道
+    void EvictIdle() {
+        std::vector<Session *> expired;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(mIdleTimeoutSec);
+            for (auto it = mIdle.begin(); it != mIdle.end();) {
+                std::vector<IdleEntry> &idle = it->second;
+                for (auto entry = idle.begin(); entry != idle.end();) {
+                    if (entry->since < deadline) {
+                        expired.push_back(entry->session);
+                        entry = idle.erase(entry);
+                    } else {
+                        ++entry;
+                    }
+                }
+                it = idle.empty() ? mIdle.erase(it) : std::next(it);
+            }
+            mStats.idle -= expired.size();
+            mStats.destroyed += expired.size();
+        }
+        for (Session *session : expired) {
+            mDestroy(session);
+        }
+    }
+
+    /// 销毁 Key 满足条件的空闲 session, 如设备达到容量时释放该设备上的通道
+    void EvictIf(const std::function<bool(const Key &)> &match) {
+        std::vector<Session *> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (auto it = mIdle.begin(); it != mIdle.end();) {
+                if (!match(it->first)) {
+                    ++it;
+                    continue;
+                }
+                for (auto &entry : it->second) {
+                    evicted.push_back(entry.session);
+                }
+                it = mIdle.erase(it);
+            }
+            mStats.idle -= evicted.size();
+            mStats.destroyed += evicted.size();
+        }
+        for (Session *session : evicted) {
+            mDestroy(session);
+        }
+    }
+
+    /// 销毁所有空闲 session
+    void Clear() {
+        std::vector<Session *> all;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (auto &idle : mIdle) {
+                for (auto &entry : idle.second) {
+                    all.push_back(entry.session);
+                }
+            }
+            mIdle.clear();
+            mStats.idle = 0;
+            mStats.destroyed += all.size();
+        }
+        for (Session *session : all) {
+            mDestroy(session);
+        }
+    }
+
+    PoolStats GetStats() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mStats;
+    }
+
+   private:
+    struct IdleEntry {
+        Session *session;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::function<Session *(const Key &)> mCreate;
+    std::function<void(Session *)> mDestroy;
+    int mMaxIdlePerKey;
+    int mIdleTimeoutSec;
+
+    std::mutex mLock;
+    std::map<Key, std::vector<IdleEntry>> mIdle;
+    PoolStats mStats;
+};
+
+class DecSessionPool : public SessionPool<DecSessionKey, DecSession> {
+   public:
+    DecSessionPool(int maxIdlePerKey = 2, int idleTimeoutSec = 300)
+        : SessionPool<DecSessionKey, DecSession>(
+              [](const DecSessionKey &key) {
+                  return yitu_codec_dec::create_session(key.deviceIndex, key.role, key.width, key.height, key.outBufferNum, key.lite);
+              },
+              yitu_codec_dec::destroy_session, maxIdlePerKey, idleTimeoutSec) {
+    }
+};
+
+class EncSessionPool : public SessionPool<EncSessionKey, EncSession> {
+   public:
+    EncSessionPool(int maxIdlePerKey = 2, int idleTimeoutSec = 300)
+        : SessionPool<EncSessionKey, EncSession>(
+              [](const EncSessionKey &key) {
+                  return yitu_codec_enc::create_enc_session(key.setting);
+              },
+              yitu_codec_enc::destroy_enc_session, maxIdlePerKey, idleTimeoutSec) {
+    }
+};
+
+inline DecSessionKey dec_session_key(const DecSession *session) {
+    return {session->deviceIndex, session->role, session->width, session->height, session->outBufferNum, session->lite};
+}
+
+inline EncSessionKey enc_session_key(const EncSession *session) {
+    return {session->setting};
+}
+
+}  // namespace yitu_codec_pool
+#endif  // SESSION_POOL_HPP
@@ -0,0 +1,206 @@
+#include "task_pool.hpp"
+
+#include <memory>
+
+namespace yitu_codec_task {
+
+// 当前线程所属的线程池与序号, 非工作线程为 NULL/-1
+static thread_local TaskPool *tPool = nullptr;
+static thread_local int tWorkerIndex = -1;
+
+static std::mutex gCpuPoolLock;
+static int gCpuPoolThreads = 0;
+static std::unique_ptr<TaskPool> gCpuPool;
+
+TaskPool::TaskPool(int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < threadCount; i++) {
+        mWorkers.emplace_back(new Worker());
+    }
+    for (int i = 0; i < threadCount; i++) {
+        mThreads.emplace_back(&TaskPool::run_worker, this, i);
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mIdleLock);
+        mStop = true;
+    }
+    mIdleCv.notify_all();
+    for (std::thread &thread : mThreads) {
+        thread.join();
+    }
+}
+
+void TaskPool::Submit(std::function<void()> task) {
+    int index = tPool == this ? tWorkerIndex : (int)(mNextWorker++ % mWorkers.size());
+    {
+        std::lock_guard<std::mutex> lock(mWorkers[index]->lock);
+        mWorkers[index]->tasks.push_back(std::move(task));
+    }
+    mQueued++;
+    {
+        // 与空闲线程的检查互斥, 避免通知丢失
+        std::lock_guard<std::mutex> lock(mIdleLock);
+    }
+    mIdleCv.notify_one();
+}
+
+bool TaskPool::pop_task(int self, std::function<void()> *task) {
+    {
+        Worker *worker = mWorkers[self].get();
+        std::lock_guard<std::mutex> lock(worker->lock);
+        if (!worker->tasks.empty()) {
+            *task = std::move(worker->tasks.back());
+            worker->tasks.pop_back();
+            mQueued--;
+            return true;
+        }
+    }
+    int count = (int)mWorkers.size();
+    for (int i = 1; i < count; i++) {
+        Worker *victim = mWorkers[(self + i) % count].get();
+        std::lock_guard<std::mutex> lock(victim->lock);
+        if (!victim->tasks.empty()) {
+            *task = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+            mQueued--;
+            mStolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::run_worker(int index) {
+    tPool = this;
+    tWorkerIndex = index;
+    while (true) {
+        std::function<void()> task;
+        if (pop_task(index, &task)) {
+            task();
+            mExecuted++;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mIdleLock);
+        mIdleCv.wait(lock, [this] { return mStop || mQueued > 0; });
+        if (mStop && mQueued == 0) {
+            return;
+        }
+    }
+}
+
+void TaskPool::ParallelFor(int count, const std::function<void(int begin, int end)> &body, int minGrain) {
+    if (count <= 0) {
+        return;
+    }
+    int slices = std::min(ThreadCount(), (count + std::max(minGrain, 1) - 1) / std::max(minGrain, 1));
+    if (slices <= 1) {
+        body(0, count);
+        return;
+    }
+    struct State {
+        std::atomic<int> next{0};
+        int done = 0;
+        std::mutex lock;
+        std::condition_variable cv;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    // 分片由调用线程与池中线程共同领取, 调用线程领完时晚到的线程直接返回, 不再访问 body
+    auto runSlices = [state, slices, count, &body] {
+        int slice;
+        while ((slice = state->next++) < slices) {
+            body((int)((long)count * slice / slices), (int)((long)count * (slice + 1) / slices));
+            std::lock_guard<std::mutex> lock(state->lock);
+            if (++state->done == slices) {
+                state->cv.notify_all();
+            }
+        }
+    };
+    for (int i = 1; i < slices; i++) {
+        Submit(runSlices);
+    }
+    runSlices();
+    std::unique_lock<std::mutex> lock(state->lock);
+    state->cv.wait(lock, [state, slices] { return state->done == slices; });
+}
+
+TaskPoolStats TaskPool::Stats() const {
+    TaskPoolStats stats;
+    stats.threadCount = ThreadCount();
+    stats.executed = mExecuted;
+    stats.stolen = mStolen;
+    return stats;
+}
+
+OrderedStage::OrderedStage(TaskPool *pool, int window) : mPool(pool), mWindow(std::max(window, 1)) {
+}
+
+void OrderedStage::Submit(std::function<void()> work, std::function<void()> done) {
+    long seq;
+    {
+        std::unique_lock<std::mutex> lock(mLock);
+        mCv.wait(lock, [this] { return mNextSeq - mNextDone < mWindow; });
+        seq = mNextSeq++;
+        mSlots[seq].done = std::move(done);
+    }
+    mPool->Submit([this, seq, work] {
+        work();
+        complete(seq);
+    });
+}
+
+void OrderedStage::complete(long seq) {
+    std::unique_lock<std::mutex> lock(mLock);
+    mSlots[seq].ready = true;
+    // 已有线程在交付时由它继续交付
+    if (mDelivering) {
+        return;
+    }
+    mDelivering = true;
+    while (true) {
+        auto it = mSlots.find(mNextDone);
+        if (it == mSlots.end() || !it->second.ready) {
+            break;
+        }
+        std::function<void()> done = std::move(it->second.done);
+        lock.unlock();
+        if (done) {
+            done();
+        }
+        lock.lock();
+        mSlots.erase(mNextDone);
+        mNextDone++;
+        mCv.notify_all();
+    }
+    mDelivering = false;
+    mCv.notify_all();
+}
+
+void OrderedStage::Flush() {
+    std::unique_lock<std::mutex> lock(mLock);
+    mCv.wait(lock, [this] { return mNextDone == mNextSeq && !mDelivering; });
+}
+
+void configure_cpu_pool(int threadCount) {
+    std::lock_guard<std::mutex> lock(gCpuPoolLock);
+    gCpuPoolThreads = threadCount;
+    gCpuPool.reset();
+}
+
+TaskPool *cpu_pool() {
+    std::lock_guard<std::mutex> lock(gCpuPoolLock);
+    if (gCpuPoolThreads == 0) {
+        return nullptr;
+    }
+    if (gCpuPool == nullptr) {
+        gCpuPool.reset(new TaskPool(gCpuPoolThreads));
+        TF_LOG_INFO("CPU task pool: %d threads.\n", gCpuPool->ThreadCount());
+    }
+    return gCpuPool.get();
+}
+
+}  // namespace yitu_codec_task
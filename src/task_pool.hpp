@@ -0,0 +1,110 @@
+#ifndef TASK_POOL_HPP
+#define TASK_POOL_HPP
+
+#include "common.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 共享 CPU 线程池: NV12 转换、软件缩放、质量计算等 CPU 阶段不再各自起线程, 统一提交到按核数设置的线程池,
+ * 几十路流同时运行时线程数不随路数增长
+ * 每个工作线程有自己的任务队列, 从队尾取自己提交的任务, 空闲时从其他线程的队头窃取:
+ *
+ *   session A --Submit--> [线程0 队列] <--窃取-- 线程1(空闲)
+ *   session B --Submit--> [线程1 队列]
+ *
+ * 单帧可以切成若干片(按行或按电视墙格子)由 ParallelFor 并行处理, 调用线程也参与计算, 在工作线程中调用不会死锁
+ * 逐帧并行处理时由 OrderedStage 按提交顺序交付结果, 每个 session 一个, 处理完成的先后不影响输出顺序
+ */
+namespace yitu_codec_task {
+
+// 线程池统计
+struct TaskPoolStats {
+    int threadCount;
+    long executed;
+    /// 从其他线程队列窃取执行的任务数
+    long stolen;
+};
+
+// 工作窃取线程池, 线程安全
+class TaskPool {
+   public:
+    /// @param threadCount 线程数, 小于等于0时取 CPU 核数
+    explicit TaskPool(int threadCount);
+    /// 执行完已提交的任务后退出
+    ~TaskPool();
+
+    /// 提交一个任务; 在本池的工作线程中提交时放入该线程自己的队列
+    void Submit(std::function<void()> task);
+
+    /// @brief 把 [0, count) 切成最多 ThreadCount() 片并行执行 body(begin, end), 阻塞到全部完成
+    /// @param minGrain 每片至少的数量, count 不超过该值时直接在调用线程中执行
+    void ParallelFor(int count, const std::function<void(int begin, int end)> &body, int minGrain = 1);
+
+    int ThreadCount() const {
+        return (int)mWorkers.size();
+    }
+    TaskPoolStats Stats() const;
+
+   private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    /// 先取自己队尾的任务, 没有时从其他线程队头窃取
+    bool pop_task(int self, std::function<void()> *task);
+    void run_worker(int index);
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::vector<std::thread> mThreads;
+    std::mutex mIdleLock;
+    std::condition_variable mIdleCv;
+    /// 已提交未取走的任务数
+    std::atomic<long> mQueued{0};
+    std::atomic<unsigned> mNextWorker{0};
+    bool mStop = false;
+    std::atomic<long> mExecuted{0};
+    std::atomic<long> mStolen{0};
+};
+
+// 按提交顺序交付结果: work 在线程池中并行执行, done 按提交顺序逐个执行(同一时刻最多一个)
+// 在途数达到 window 时 Submit 阻塞, 下游慢时反压到提交线程; 不能在线程池的工作线程中调用 Submit/Flush
+class OrderedStage {
+   public:
+    OrderedStage(TaskPool *pool, int window);
+    /// 析构前需调用 Flush
+    ~OrderedStage() = default;
+
+    void Submit(std::function<void()> work, std::function<void()> done);
+    /// 阻塞到已提交的 done 全部执行完
+    void Flush();
+
+   private:
+    struct Slot {
+        std::function<void()> done;
+        bool ready = false;
+    };
+
+    /// work 完成后调用, 交付所有已按序就绪的结果
+    void complete(long seq);
+
+    TaskPool *mPool;
+    int mWindow;
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::map<long, Slot> mSlots;
+    long mNextSeq = 0;
+    long mNextDone = 0;
+    bool mDelivering = false;
+};
+
+/// @brief 设置共享线程池的线程数, 在第一个任务开始前调用
+/// @param threadCount 0 关闭共享线程池(各阶段在自己的线程中计算), 小于0 取 CPU 核数
+void configure_cpu_pool(int threadCount);
+
+/// @brief 共享线程池, 关闭时返回 NULL
+TaskPool *cpu_pool();
+
+}  // namespace yitu_codec_task
+#endif  // TASK_POOL_HPP
@@ -0,0 +1,277 @@
+#include "timeline.hpp"
+#include "remux.hpp"
+
+#include <cmath>
+#include <iomanip>
+
+namespace yitu_codec_timeline {
+
+using yitu_codec_dec::DecContext;
+using yitu_codec_dec::DecodedStream;
+using yitu_codec_dec::VideoInfo;
+
+// 单个片段的解码任务
+struct ClipState {
+    ClipState(int queueFrames) : stream(queueFrames) {
+    }
+
+    /// 解码帧由本片段保存线程送入 stream.queue, 编码线程取出
+    DecodedStream stream;
+
+    /// 视频流时间基(秒)与入点/出点 pts, 没有出点时为 INT64_MAX
+    double timeBase = 0;
+    int64_t inPts = 0;
+    int64_t outPts = INT64_MAX;
+    /// 一帧的时长(秒), 用于计算没有出点的片段的长度
+    double frameDuration = 0;
+    int frameRate = 0;
+};
+
+int load_edl(const std::string &edlFileName, std::vector<TimelineClip> *clips) {
+    std::ifstream edl(edlFileName);
+    if (!edl.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", edlFileName.c_str());
+        return -1;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(edl, line)) {
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ',')) {
+            fields.push_back(field);
+        }
+        TimelineClip clip;
+        clip.inputFileName = fields[0];
+        try {
+            if (fields.size() > 1 && !fields[1].empty()) {
+                clip.inSec = std::stod(fields[1]);
+            }
+            if (fields.size() > 2 && !fields[2].empty()) {
+                clip.outSec = std::stod(fields[2]);
+            }
+        } catch (const std::exception &) {
+            TF_LOG_ERROR("ERROR: %s line %d: invalid in/out point.\n", edlFileName.c_str(), lineNumber);
+            return -1;
+        }
+        if (fields.size() > 3 || clip.inputFileName.empty() || clip.inSec < 0) {
+            TF_LOG_ERROR("ERROR: %s line %d: expected file[,in[,out]].\n", edlFileName.c_str(), lineNumber);
+            return -1;
+        }
+        clips->push_back(clip);
+    }
+    return 0;
+}
+
+/// 打开片段并开始解码, 解码帧送入 clip->stream.queue; 失败时已打开的资源由 close_decoded_stream 释放
+static int open_clip(const TimelineConfig &config, int index, ClipState *clip) {
+    const TimelineClip &entry = config.clips[index];
+    // 编码线程按顺序取帧, 每个片段只需少量解码帧缓存
+    yitu_codec_dec::BufferProfile profile = yitu_codec_dec::batch_buffer_profile();
+    profile.inFrameCacheSize = 64;
+    profile.outFrameCacheSize = config.clipQueueFrames;
+    if (yitu_codec_dec::open_decoded_stream(entry.inputFileName, config.decDeviceIndex, profile, &clip->stream) != 0) {
+        TF_LOG_ERROR("ERROR: Clip %d: unable to open %s.\n", index, entry.inputFileName.c_str());
+        return -1;
+    }
+    VideoInfo *videoInfo = &clip->stream.videoInfo;
+    if (videoInfo->bitDepth > 8) {
+        TF_LOG_ERROR("ERROR: Clip %d: %d bit input is not supported.\n", index, videoInfo->bitDepth);
+        return -1;
+    }
+
+    AVStream *stream = videoInfo->avFormatContext->streams[videoInfo->videoIndex];
+    AVRational microseconds = {1, 1000000};
+    int64_t origin = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    clip->timeBase = av_q2d(stream->time_base);
+    clip->inPts = origin + av_rescale_q((int64_t)(entry.inSec * 1000000), microseconds, stream->time_base);
+    if (entry.outSec > entry.inSec) {
+        clip->outPts = origin + av_rescale_q((int64_t)(entry.outSec * 1000000), microseconds, stream->time_base);
+    }
+    AVRational frameRate = stream->avg_frame_rate;
+    if (frameRate.num > 0 && frameRate.den > 0) {
+        clip->frameRate = (int)std::lround(av_q2d(frameRate));
+        clip->frameDuration = 1 / av_q2d(frameRate);
+    }
+    if (entry.inSec > 0 && yitu_codec_remux::seek_video(videoInfo, clip->inPts) != 0) {
+        TF_LOG_ERROR("ERROR: Clip %d: unable to seek to %.3fs.\n", index, entry.inSec);
+        return -1;
+    }
+
+    DecContext *ctx = clip->stream.ctx.get();
+    int64_t inPts = clip->inPts;
+    int64_t outPts = clip->outPts;
+    bool started = false;
+    ctx->packetSelector = [outPts, started](DecContext *, const AVPacket *packet) mutable {
+        bool key = packet->flags & AV_PKT_FLAG_KEY;
+        // seek 可能落在非关键帧上
+        if (!started && !key) {
+            return yitu_codec_dec::PACKET_SKIP;
+        }
+        started = true;
+        if ((key && yitu_codec_remux::packet_ts(packet) >= outPts) || (packet->dts != AV_NOPTS_VALUE && packet->dts >= outPts)) {
+            return yitu_codec_dec::PACKET_STOP;
+        }
+        return yitu_codec_dec::PACKET_DECODE;
+    };
+    ctx->frameSelector = [inPts, outPts](DecContext *, FrameData *frameData) {
+        int64_t ts = (int64_t)frameData->GetTimestamp();
+        return ts >= inPts && ts < outPts;
+    };
+    yitu_codec_dec::start_decoded_stream(&clip->stream);
+    TF_LOG_INFO("Clip %d opened: %s [%.3f, %.3f).\n", index, entry.inputFileName.c_str(), entry.inSec, entry.outSec);
+    return 0;
+}
+
+int run_timeline(const TimelineConfig &config, TimelineStats *stats) {
+    int clipCount = (int)config.clips.size();
+    if (clipCount == 0 || config.encSetting.profile == TF_PROFILE_INVALID) {
+        TF_LOG_ERROR("ERROR: Timeline needs clips and a valid encoder profile.\n");
+        return -1;
+    }
+    std::vector<int> clipFrameCounts(clipCount, 0);
+    int encodedFrameCount = 0;
+    double offsetSec = 0;
+
+    std::unique_ptr<ClipState> current(new ClipState(config.clipQueueFrames));
+    int ret = open_clip(config, 0, current.get());
+
+    // 编码参数按第一个片段补全, 之后所有片段共用这一个 session
+    yitu_codec_enc::EncContext enc;
+    yitu_codec_enc::EncSession *encSession = nullptr;
+    bool encoderOpened = false;
+    tfenc_setting setting = config.encSetting;
+    if (ret == 0) {
+        if (setting.width == 0 || setting.height == 0) {
+            setting.width = current->stream.videoInfo.width & ~1;
+            setting.height = current->stream.videoInfo.height & ~1;
+        }
+        if (config.frameRate > 0) {
+            setting.frame_rate = (int)std::lround(config.frameRate);
+        } else if (current->frameRate > 0) {
+            setting.frame_rate = current->frameRate;
+        }
+        encSession = yitu_codec_enc::create_enc_session(setting);
+        enc.outputFileName = config.outputFileName;
+        enc.srcWidth = setting.width;
+        enc.srcHeight = setting.height;
+        enc.interpMode = config.interpMode;
+        if (encSession == nullptr || yitu_codec_enc::open_encoder(&enc, encSession) != 0) {
+            TF_LOG_ERROR("ERROR: Unable to open timeline encoder.\n");
+            ret = -1;
+        } else {
+            encoderOpened = true;
+        }
+    }
+    int width = setting.width;
+    int height = setting.height;
+    // 与编码尺寸不同的片段先缩放到这里
+    std::vector<uint8_t> scaleBuffer((size_t)width * height * 3 / 2);
+    FrameView scaled = FrameView::FromI420(scaleBuffer.data(), width, height, width, height);
+
+    std::fstream timestampFStream;
+    if (ret == 0) {
+        std::string timestampFileName = config.outputFileName + ".timestamps";
+        timestampFStream.open(timestampFileName, std::ios::out | std::ios::trunc);
+        if (!timestampFStream.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", timestampFileName.c_str());
+            ret = -1;
+        } else {
+            timestampFStream << "# timestamp format v2\n";
+        }
+    }
+
+    for (int i = 0; i < clipCount && ret == 0; i++) {
+        // 预读下一片段: 打开文件、创建解码session并开始解码, 与当前片段的编码并行
+        std::unique_ptr<ClipState> next;
+        std::thread prefetch;
+        int nextRet = 0;
+        if (i + 1 < clipCount) {
+            next.reset(new ClipState(config.clipQueueFrames));
+            ClipState *n = next.get();
+            prefetch = std::thread([&config, i, n, &nextRet] { nextRet = open_clip(config, i + 1, n); });
+        }
+
+        ClipState *clip = current.get();
+        bool scale = clip->stream.videoInfo.width != width || clip->stream.videoInfo.height != height;
+        double lastSec = -1;
+        bool first = true;
+        FrameData *frameData;
+        while (ret == 0 && (frameData = yitu_codec_dec::pop_decoded_frame(&clip->stream)) != nullptr) {
+            ConstFrameView view = yitu_codec_dec::frame_view(clip->stream.ctx.get(), frameData);
+            if (scale) {
+                ret = yitu_codec_enc::scale_view(view, scaled, config.interpMode);
+                if (ret != 0) {
+                    TF_LOG_ERROR("ERROR: Clip %d: scale failed, ret: %d.\n", i, ret);
+                }
+                view = scaled;
+            }
+            if (ret == 0 && first && config.keyframeAtCut && i > 0) {
+                tfenc_restart_GOP(encSession->handle);
+            }
+            first = false;
+            if (ret == 0) {
+                ret = yitu_codec_enc::encode_view(&enc, view);
+            }
+            if (ret == 0) {
+                double sec = ((int64_t)frameData->GetTimestamp() - clip->inPts) * clip->timeBase;
+                lastSec = std::max(lastSec, sec);
+                timestampFStream << std::fixed << std::setprecision(3) << (offsetSec + sec) * 1000 << "\n";
+                clipFrameCounts[i]++;
+                encodedFrameCount++;
+            }
+            frameData->Release();
+        }
+
+        // 片段长度: 有出点时取出点, 否则取最后一帧之后一帧的时间
+        if (clip->outPts != INT64_MAX) {
+            offsetSec += (clip->outPts - clip->inPts) * clip->timeBase;
+        } else if (lastSec >= 0) {
+            offsetSec += lastSec + (clip->frameDuration > 0 ? clip->frameDuration : 1.0 / setting.frame_rate);
+        }
+        int clipRet = yitu_codec_dec::close_decoded_stream(&clip->stream);
+        if (ret == 0) {
+            ret = clipRet;
+        }
+        TF_LOG_INFO("Clip %d done: %d frames, timeline at %.3fs.\n", i, clipFrameCounts[i], offsetSec);
+
+        if (prefetch.joinable()) {
+            prefetch.join();
+        }
+        current = std::move(next);
+        if (ret == 0) {
+            ret = nextRet;
+        }
+    }
+    if (current != nullptr) {
+        yitu_codec_dec::close_decoded_stream(&current->stream);
+    }
+
+    if (encoderOpened && yitu_codec_enc::flush_encoder(&enc) != 0) {
+        ret = -1;
+    }
+    if (encSession != nullptr) {
+        yitu_codec_enc::destroy_enc_session(encSession);
+    }
+    if (timestampFStream.is_open()) {
+        timestampFStream.close();
+    }
+
+    TF_LOG_INFO("Timeline rendered: %d frames from %d clips, %.3fs.\n", encodedFrameCount, clipCount, offsetSec);
+    if (stats != nullptr) {
+        stats->encodedFrameCount = encodedFrameCount;
+        stats->durationSec = offsetSec;
+        stats->clipFrameCounts = clipFrameCounts;
+    }
+    return ret;
+}
+
+}  // namespace yitu_codec_timeline
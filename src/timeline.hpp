@@ -0,0 +1,66 @@
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 时间线渲染: 按剪辑列表(EDL, 每条为 文件/入点/出点)依次解码各段, 首尾相接送入同一个 tfenc session,
+ * 输出一个连续的码流, 不再逐段转码后拼接:
+ *
+ *   片段0 -> tfdec -> 队列 --\
+ *   片段1 -> tfdec -> 队列 ---+-> 按顺序取帧 -> (缩放) -> tfenc -> 文件
+ *   ...                    --/
+ *
+ * 当前片段解码时预先打开下一片段(读文件头, 创建解码session, seek 到入点)并开始解码, 帧先缓存在其队列中,
+ * 当前片段结束后立即切换, 同一时刻最多两个片段在解码
+ * 编码尺寸与帧率默认取第一个片段, 尺寸不同的片段拉伸到编码尺寸; 每个片段从关键帧开始
+ * 码流不带时间戳, 各帧在时间线上的显示时间(ms, 片段间连续)按 mkvmerge timestamp v2 格式写入 outputFileName + ".timestamps"
+ */
+namespace yitu_codec_timeline {
+
+// 剪辑列表中的一条
+struct TimelineClip {
+    std::string inputFileName;
+    /// 入点/出点(秒, 相对于视频开头), outSec 不大于 inSec 时到文件结尾
+    double inSec = 0;
+    double outSec = 0;
+};
+
+// 渲染参数
+struct TimelineConfig {
+    std::vector<TimelineClip> clips;
+    int decDeviceIndex = 1;
+    /// 宽高为0时取第一个片段的尺寸; profile 必须有效
+    tfenc_setting encSetting;
+    /// 编码帧率, 为0时取第一个片段的帧率
+    double frameRate = 0;
+    /// 片段切换处重新开始 GOP
+    bool keyframeAtCut = true;
+    /// 每个片段解码帧队列的帧数上限, 即预读下一片段时最多缓存的帧数
+    int clipQueueFrames = 8;
+    tfg::INTERP_MODE interpMode = tfg::INTERP_Bilinear;
+    std::string outputFileName;
+};
+
+// 渲染统计
+struct TimelineStats {
+    int encodedFrameCount;
+    /// 时间线总时长(秒)
+    double durationSec;
+    std::vector<int> clipFrameCounts;
+};
+
+/// @brief 读取剪辑列表, 每行 "文件[,入点秒[,出点秒]]", 空行与 # 开头的行忽略
+/// @return 0 成功, -1 文件无法读取或格式错误
+int load_edl(const std::string &edlFileName, std::vector<TimelineClip> *clips);
+
+/// @brief 运行时间线渲染, 阻塞到所有片段编码完成
+/// @param stats 渲染统计, 可为 NULL
+/// @return 0 成功, 其他值失败
+int run_timeline(const TimelineConfig &config, TimelineStats *stats);
+
+}  // namespace yitu_codec_timeline
+#endif  // TIMELINE_HPP
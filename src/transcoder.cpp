@@ -0,0 +1,554 @@
+#include "transcoder.hpp"
+#include "mux.hpp"
+#include "tuner.hpp"
+
+namespace yitu_codec_transcoder {
+
+using namespace yitu_codec_dec;
+using namespace yitu_codec_pool;
+using namespace yitu_codec_remux;
+using namespace yitu_codec_trim;
+
+/// 逐帧回调旁路队列的帧数上限, 回调跟不上时保存线程在此等待
+static const int FRAME_TAP_FRAMES = 8;
+
+const char *job_state_name(JobState state) {
+    switch (state) {
+        case JOB_QUEUED: return "queued";
+        case JOB_RUNNING: return "running";
+        case JOB_DONE: return "done";
+        case JOB_FAILED: return "failed";
+        case JOB_CANCELLED: return "cancelled";
+    }
+    return "unknown";
+}
+
+Transcoder::Transcoder(const TranscoderConfig &config)
+    : mConfig(config),
+      mDecPool(config.density ? std::min(config.poolMaxIdlePerKey, 1) : config.poolMaxIdlePerKey, config.poolIdleTimeoutSec),
+      mEncPool(config.poolMaxIdlePerKey, config.poolIdleTimeoutSec) {
+    gMemoryBudget.SetLimit(mConfig.memoryBudgetBytes);
+    // 设备达到容量时先释放池中该设备上的空闲session
+    gDeviceAdmission.SetReclaim([this](int deviceIndex) {
+        mDecPool.EvictIf([deviceIndex](const DecSessionKey &key) { return key.deviceIndex == deviceIndex; });
+    });
+    for (int i = 0; i < mConfig.workerCount; i++) {
+        mWorkers.push_back(std::thread(&Transcoder::worker_loop, this, i));
+    }
+    mQualityThread = std::thread(&Transcoder::quality_loop, this);
+}
+
+Transcoder::~Transcoder() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    CancelAll();
+    mQueueCv.notify_all();
+    for (auto &worker : mWorkers) {
+        worker.join();
+    }
+    mQualityCv.notify_all();
+    mQualityThread.join();
+    gDeviceAdmission.SetReclaim(nullptr);
+    mDecPool.Clear();
+    mEncPool.Clear();
+}
+
+std::future<TranscodeResult> Transcoder::Submit(const TranscodeJob &job, long *jobId) {
+    std::shared_ptr<Task> task(new Task());
+    task->job = job;
+    std::future<TranscodeResult> future = task->promise.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        task->id = ++mLastJobId;
+        mQueue.push_back(task);
+    }
+    if (jobId != nullptr) {
+        *jobId = task->id;
+    }
+    mQueueCv.notify_one();
+    return future;
+}
+
+bool Transcoder::Cancel(long jobId) {
+    std::shared_ptr<Task> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto running = mRunning.find(jobId);
+        if (running != mRunning.end()) {
+            // 运行中的任务停止读取, 已入队的帧解码完后由工作线程结束; 尚未绑定上下文时由工作线程在下一步之前检查
+            running->second->cancelRequested = true;
+            if (running->second->ctx != nullptr) {
+                running->second->ctx->cancelled = true;
+            }
+            return true;
+        }
+        for (auto it = mQueue.begin(); it != mQueue.end(); ++it) {
+            if ((*it)->id == jobId) {
+                cancelled = *it;
+                mQueue.erase(it);
+                break;
+            }
+        }
+    }
+    if (cancelled == nullptr) {
+        return false;
+    }
+    TranscodeResult result;
+    result.state = JOB_CANCELLED;
+    finish(cancelled, result);
+    return true;
+}
+
+void Transcoder::CancelAll() {
+    std::deque<std::shared_ptr<Task>> queued;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        queued.swap(mQueue);
+        for (auto &task : mRunning) {
+            task.second->cancelRequested = true;
+            if (task.second->ctx != nullptr) {
+                task.second->ctx->cancelled = true;
+            }
+        }
+    }
+    for (auto &task : queued) {
+        TranscodeResult result;
+        result.state = JOB_CANCELLED;
+        finish(task, result);
+    }
+}
+
+int Transcoder::QueuedCount() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mQueue.size();
+}
+
+std::vector<JobProgress> Transcoder::RunningJobs() {
+    std::vector<JobProgress> jobs;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &task : mRunning) {
+        DecContext *ctx = task.second->ctx;
+        JobProgress progress = {task.first, 0, 0, 0, 0};
+        if (ctx != nullptr) {
+            progress.loadedFrameCount = ctx->loadedFrameCount;
+            progress.decodedFrameCount = ctx->decodedFrameCount;
+            progress.savedFrameCount = ctx->savedFrameCount;
+            progress.memoryBytes = ctx->memory.Used();
+        }
+        jobs.push_back(progress);
+    }
+    return jobs;
+}
+
+PoolStats Transcoder::DecPoolStats() {
+    return mDecPool.GetStats();
+}
+
+PoolStats Transcoder::EncPoolStats() {
+    return mEncPool.GetStats();
+}
+
+void Transcoder::worker_loop(int workerIndex) {
+    while (true) {
+        std::shared_ptr<Task> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (!mQueueCv.wait_for(lock, std::chrono::seconds(1), [this] { return mStopping || !mQueue.empty(); })) {
+                // 空闲时顺便回收超时的 session
+                lock.unlock();
+                mDecPool.EvictIdle();
+                mEncPool.EvictIdle();
+                continue;
+            }
+            if (mQueue.empty()) {
+                break;
+            }
+            task = mQueue.front();
+            mQueue.pop_front();
+            mRunning[task->id] = task;
+        }
+        run_task(workerIndex, task);
+    }
+}
+
+void Transcoder::run_task(int workerIndex, std::shared_ptr<Task> task) {
+    const TranscodeJob &job = task->job;
+    TranscodeResult result;
+    auto startTime = std::chrono::steady_clock::now();
+
+    if (cancel_requested(task)) {
+        result.state = JOB_CANCELLED;
+        finish(task, result);
+        return;
+    }
+    VideoInfo videoInfo = VideoInfo();
+    if (read_video_file(job.inputFileName, &videoInfo) != 0) {
+        result.state = JOB_FAILED;
+        result.error = "unable to open input";
+        finish(task, result);
+        return;
+    }
+    // 剪辑任务先扫描关键帧, 编码参数跟随源视频以便与拷贝的 GOP 拼接
+    bool trim = job.trimEndSec > job.trimStartSec;
+    // 容器输出只能经过编码后由 Muxer 写出; 拷贝与剪辑写出的是裸码流
+    bool containerOutput = yitu_codec_mux::container_output(job.outputFileName);
+    if (trim && containerOutput) {
+        close_video_file(&videoInfo);
+        result.state = JOB_FAILED;
+        result.error = "trim output must be a raw h264/hevc stream";
+        finish(task, result);
+        return;
+    }
+    TrimPlan plan;
+    EncSessionKey encKey = {job.encSetting};
+    if (trim && (plan_trim(&videoInfo, job.trimStartSec, job.trimEndSec, &plan) != 0 ||
+                 match_source_setting(&videoInfo, &encKey.setting) != 0)) {
+        close_video_file(&videoInfo);
+        result.state = JOB_FAILED;
+        result.error = "unable to trim input";
+        finish(task, result);
+        return;
+    }
+    // 获取 session 可能等待设备容量, 拷贝也可能很长, 开始之前检查取消
+    if (cancel_requested(task)) {
+        close_video_file(&videoInfo);
+        result.state = JOB_CANCELLED;
+        finish(task, result);
+        return;
+    }
+    // 输入已满足编码参数时直接拷贝packet, 不占用解码/编码设备
+    std::string copyReason;
+    if (!trim && !containerOutput && job.allowStreamCopy && !job.onFrame && job.encSetting.profile != TF_PROFILE_INVALID) {
+        if (can_stream_copy(&videoInfo, job.encSetting, &copyReason)) {
+            run_copy(workerIndex, task, &videoInfo, startTime);
+            return;
+        }
+        TF_LOG_INFO("Stream copy not possible: %s.\n", copyReason.c_str());
+    }
+    BufferProfile profile = mConfig.density ? density_buffer_profile() : mConfig.batchProfile;
+    // 有该设备/分辨率档位的调优结果时替换批处理缓存参数, 高密度模式的缓存参数固定
+    if (!job.live && !mConfig.density && yitu_codec_tuner::tuned_buffer_profile(job.decDeviceIndex, videoInfo.width, videoInfo.height, &profile)) {
+        TF_LOG_INFO("Using tuned buffer profile: out_buffer_num %d, hw_cache %d, queue %d/%d.\n", profile.outBufferNum,
+                    profile.frameHardwareCacheSize, profile.inFrameCacheSize, profile.outFrameCacheSize);
+    }
+    if (job.live) {
+        AVRational frameRate = videoInfo.avFormatContext->streams[videoInfo.videoIndex]->avg_frame_rate;
+        profile = live_buffer_profile(videoInfo.width, videoInfo.height, frameRate.den > 0 ? av_q2d(frameRate) : 0,
+                                      job.latencyTargetMs);
+    }
+    DecSessionKey decKey = {job.decDeviceIndex, videoInfo.role, videoInfo.width, videoInfo.height, profile.outBufferNum, mConfig.density};
+    DecSession *session = mDecPool.Acquire(decKey);
+    for (size_t i = 0; session == nullptr && i < job.failoverDeviceIndexes.size() && !cancel_requested(task); i++) {
+        if (job.failoverDeviceIndexes[i] != job.decDeviceIndex) {
+            TF_LOG_INFO("Unable to create decoder session on device %d, try device %d.\n", decKey.deviceIndex, job.failoverDeviceIndexes[i]);
+            decKey.deviceIndex = job.failoverDeviceIndexes[i];
+            session = mDecPool.Acquire(decKey);
+        }
+    }
+    if (session == nullptr || cancel_requested(task)) {
+        if (session != nullptr) {
+            mDecPool.Release(decKey, session);
+        }
+        close_video_file(&videoInfo);
+        if (cancel_requested(task)) {
+            result.state = JOB_CANCELLED;
+        } else {
+            result.state = JOB_FAILED;
+            result.error = "unable to create decoder session";
+        }
+        finish(task, result);
+        return;
+    }
+
+    DecContext ctx(profile);
+    ctx.videoInfo = &videoInfo;
+    ctx.session = session;
+    ctx.outputFileName = job.outputFileName;
+    ctx.progressIntervalMs = mConfig.progressIntervalMs;
+    ctx.failoverDevices = job.failoverDeviceIndexes;
+    // 设备调度: 直播按截止时间优先, 批处理按权重分享剩余能力
+    yitu_codec_sched::SchedClass schedClass = job.live ? yitu_codec_sched::SCHED_CLASS_LIVE : yitu_codec_sched::SCHED_CLASS_BATCH;
+    ctx.sched.schedClass = schedClass;
+    ctx.sched.weight = job.weight;
+    // 静止帧检测按 8 bit 亮度比较, 高位深源视频不做过滤
+    if (videoInfo.bitDepth == 8) {
+        ctx.staticFilter = yitu_codec_analysis::StaticFrameFilter(job.staticFrame);
+    }
+    // 直播超时、内存预算与故障切换都可能在编码前丢帧, 质量评估按保留帧的时间戳与源视频对齐
+    ctx.writeTimestamps = job.measureQuality && !trim;
+
+    // 编码session, 编码尺寸为0时与源视频一致
+    yitu_codec_enc::EncContext enc;
+    yitu_codec_enc::EncSession *encSession = nullptr;
+    yitu_codec_mux::Muxer muxer;
+    yitu_codec_mux::PacketQueue auxPackets;
+    bool mux = false;
+    if (encKey.setting.profile != TF_PROFILE_INVALID) {
+        if (encKey.setting.width == 0 || encKey.setting.height == 0) {
+            encKey.setting.width = videoInfo.width;
+            encKey.setting.height = videoInfo.height;
+        }
+        encSession = mEncPool.Acquire(encKey);
+        enc.outputFileName = job.outputFileName;
+        enc.srcWidth = videoInfo.width;
+        enc.srcHeight = videoInfo.height;
+        enc.bitDepth = videoInfo.bitDepth;
+        enc.interpMode = job.interpMode;
+        enc.memory = &ctx.memory;
+        enc.sceneDetector = yitu_codec_analysis::SceneDetector(job.sceneCut);
+        enc.sched.schedClass = schedClass;
+        enc.sched.weight = job.weight;
+        enc.schedLatencyMs = job.latencyTargetMs;
+        mux = containerOutput && encSession != nullptr;
+        if (mux) {
+            if (muxer.Open(job.outputFileName, videoInfo.avFormatContext, videoInfo.videoIndex, encKey.setting,
+                           job.passthroughAudio) != 0) {
+                mEncPool.Release(encKey, encSession);
+                mDecPool.Release(decKey, session);
+                close_video_file(&videoInfo);
+                result.state = JOB_FAILED;
+                result.error = "unable to open output";
+                finish(task, result);
+                return;
+            }
+            enc.muxer = &muxer;
+            if (job.passthroughAudio) {
+                ctx.auxPacketSink = &auxPackets;
+            }
+        }
+        // 剪辑时每个重编码段各自打开编码器
+        if (encSession == nullptr || (!trim && yitu_codec_enc::open_encoder(&enc, encSession) != 0)) {
+            if (encSession != nullptr) {
+                mEncPool.Release(encKey, encSession);
+            }
+            mDecPool.Release(decKey, session);
+            close_video_file(&videoInfo);
+            result.state = JOB_FAILED;
+            result.error = "unable to create encoder session";
+            finish(task, result);
+            return;
+        }
+        enc.session = encSession;
+        ctx.encoder = &enc;
+    }
+
+    long jobId = task->id;
+    // 非剪辑任务经旁路队列共享解码帧, 在单独的线程中回调, 不阻塞编码; 剪辑时每段各送入一个结束帧, 仍在保存线程中回调
+    FrameQueue frameTap(FRAME_TAP_FRAMES, 0);
+    std::thread frameTapThread;
+    if (job.onFrame && trim) {
+        ctx.frameCallback = [&job, jobId, &videoInfo](DecContext *c, FrameData *frameData) {
+            DecodedFrame frame = {jobId, c->savedFrameCount, frameData->GetData(), frameData->GetLength(),
+                                  videoInfo.width, videoInfo.height, frame_view(c, frameData), frameData};
+            job.onFrame(frame);
+        };
+    } else if (job.onFrame) {
+        frameTap.SetAccount(&ctx.memory, BUDGET_BLOCK);
+        ctx.frameTaps.push_back(&frameTap);
+        frameTapThread = std::thread([&job, jobId, &videoInfo, &ctx, &frameTap] {
+            int index = 0;
+            FrameData *frameData;
+            while ((frameData = frameTap.Pop()) != nullptr && !frameData->GetIsEnd()) {
+                DecodedFrame frame = {jobId, ++index, frameData->GetData(), frameData->GetLength(),
+                                      videoInfo.width, videoInfo.height, frame_view(&ctx, frameData), frameData};
+                job.onFrame(frame);
+                frameData->Release();
+            }
+            if (frameData != nullptr) {
+                frameData->Release();
+            }
+        });
+    }
+    if (job.onProgress) {
+        ctx.progressCallback = [&job, jobId](DecContext *c) {
+            JobProgress progress = {jobId, c->loadedFrameCount, c->decodedFrameCount, c->savedFrameCount, c->memory.Used()};
+            job.onProgress(progress);
+        };
+    }
+    set_task_context(task, &ctx);
+    if (job.onStarted) {
+        job.onStarted(jobId, workerIndex);
+    }
+
+    // 音频/字幕写出线程, 读取线程送入结束标记后退出
+    std::thread auxWriter;
+    if (ctx.auxPacketSink != nullptr) {
+        auxWriter = std::thread(yitu_codec_mux::write_aux_packets, &muxer, &auxPackets);
+    }
+    TrimStats trimStats = TrimStats();
+    int ret = trim ? run_trim(&ctx, plan, &trimStats) : run_dec(&ctx);
+    if (frameTapThread.joinable()) {
+        frameTapThread.join();
+    }
+    bool muxerCloseFailed = false;
+    if (mux) {
+        if (auxWriter.joinable()) {
+            auxWriter.join();
+        }
+        // 编码器已冲刷, 所有视频帧都已写入
+        muxerCloseFailed = muxer.Close() != 0;
+        result.auxPacketCount = muxer.AuxPacketCount();
+    }
+    close_video_file(&videoInfo);
+    // 解码器与编码器都已在 EOS 时冲刷, 归还给池; 故障切换后的session按其所在设备归还
+    if (ctx.decoderFailed) {
+        mDecPool.Discard(ctx.session);
+    } else {
+        decKey.deviceIndex = ctx.session->deviceIndex;
+        mDecPool.Release(decKey, ctx.session);
+    }
+    if (encSession != nullptr) {
+        if (ctx.encoderFlushFailed) {
+            mEncPool.Discard(encSession);
+        } else {
+            mEncPool.Release(encKey, encSession);
+        }
+        result.encodedPacketCount = enc.packetCount;
+        result.encodedBytes = enc.encodedBytes;
+        result.sceneCutCount = enc.sceneCutCount;
+    }
+    set_task_context(task, nullptr);
+
+    result.decodedFrameCount = ctx.decodedFrameCount;
+    result.staticFrameCount = ctx.staticFrameCount;
+    result.avgLatencyMs = ctx.latency.AvgMs();
+    result.p99LatencyMs = ctx.latency.PercentileMs(0.99);
+    result.maxLatencyMs = ctx.latency.MaxMs();
+    result.droppedFrameCount = ctx.droppedFrameCount;
+    result.failoverCount = ctx.failoverCount;
+    result.duplicateFrameCount = ctx.duplicateFrameCount;
+    result.peakMemoryBytes = ctx.memory.Peak();
+    result.copiedPacketCount = trimStats.copy.packetCount;
+    result.copiedBytes = trimStats.copy.bytes;
+    result.elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    // 按实际原因报告失败; 编码器冲刷超时不影响返回值, 但输出缺少末尾的帧, 同样算失败
+    if (ret != 0 || muxerCloseFailed || ctx.encoderFlushFailed) {
+        result.state = JOB_FAILED;
+        if (ctx.decoderFailed) {
+            result.error = "decoder failed";
+        } else if (ctx.encoderFlushFailed) {
+            result.error = "encoder flush failed";
+        } else if (muxerCloseFailed) {
+            result.error = "unable to finalize container";
+        } else {
+            result.error = "unable to write output";
+        }
+    } else {
+        result.state = ctx.cancelled ? JOB_CANCELLED : JOB_DONE;
+    }
+    // 评估需要再解码源视频与输出, 先结束任务, 交给评估线程, 工作线程继续执行下一个任务
+    result.qualityPending = result.state == JOB_DONE && job.measureQuality && !trim && encSession != nullptr;
+    finish(task, result);
+    if (result.qualityPending) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQualityQueue.push_back(task);
+        mQualityCv.notify_one();
+    }
+}
+
+void Transcoder::run_copy(int workerIndex, std::shared_ptr<Task> task, VideoInfo *videoInfo,
+                          std::chrono::steady_clock::time_point startTime) {
+    const TranscodeJob &job = task->job;
+    TranscodeResult result;
+    DecContext ctx(mConfig.batchProfile);
+    ctx.videoInfo = videoInfo;
+    ctx.outputFileName = job.outputFileName;
+    set_task_context(task, &ctx);
+    if (job.onStarted) {
+        job.onStarted(task->id, workerIndex);
+    }
+
+    int ret = 0;
+    CopyStats stats = CopyStats();
+    {
+        // copy_packets 追加写入, 先清空输出文件
+        std::ofstream output(job.outputFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", job.outputFileName.c_str());
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        ret = copy_packets(&ctx, AV_NOPTS_VALUE, AV_NOPTS_VALUE, &stats);
+    }
+    close_video_file(videoInfo);
+    set_task_context(task, nullptr);
+
+    result.streamCopied = true;
+    result.copiedPacketCount = stats.packetCount;
+    result.copiedBytes = stats.bytes;
+    result.elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    if (ret != 0) {
+        result.state = JOB_FAILED;
+        result.error = "unable to copy stream";
+    } else {
+        result.state = ctx.cancelled ? JOB_CANCELLED : JOB_DONE;
+    }
+    finish(task, result);
+}
+
+void Transcoder::set_task_context(std::shared_ptr<Task> task, DecContext *ctx) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    task->ctx = ctx;
+    // 取消可能在出队之后、绑定上下文之前发生
+    if (ctx != nullptr && (mStopping || task->cancelRequested)) {
+        ctx->cancelled = true;
+    }
+}
+
+bool Transcoder::cancel_requested(std::shared_ptr<Task> task) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStopping || task->cancelRequested;
+}
+
+void Transcoder::quality_loop() {
+    while (true) {
+        std::shared_ptr<Task> task;
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mQualityCv.wait(lock, [this] { return mStopping || !mQualityQueue.empty(); });
+            if (mQualityQueue.empty()) {
+                break;
+            }
+            task = mQualityQueue.front();
+            mQualityQueue.pop_front();
+            stopping = mStopping;
+        }
+        const TranscodeJob &job = task->job;
+        yitu_codec_quality::QualityStats stats = yitu_codec_quality::QualityStats();
+        int ret = -1;
+        if (!stopping) {
+            yitu_codec_quality::QualityConfig qualityConfig;
+            qualityConfig.sourceFileName = job.inputFileName;
+            qualityConfig.encodedFileName = job.outputFileName;
+            qualityConfig.decDeviceIndex = job.decDeviceIndex;
+            qualityConfig.workerCount = job.qualityWorkerCount;
+            qualityConfig.csvFileName = job.outputFileName + ".quality.csv";
+            ret = yitu_codec_quality::run_quality(qualityConfig, &stats);
+            // 评估失败不影响转码结果, 只打印错误
+            if (ret != 0) {
+                TF_LOG_ERROR("ERROR: Quality measurement failed for %s.\n", job.outputFileName.c_str());
+            }
+        }
+        if (job.onQuality) {
+            job.onQuality(task->id, ret, stats);
+        }
+    }
+}
+
+void Transcoder::finish(std::shared_ptr<Task> task, TranscodeResult &result) {
+    result.jobId = task->id;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRunning.erase(task->id);
+    }
+    if (task->job.onFinished) {
+        task->job.onFinished(result);
+    }
+    task->promise.set_value(result);
+}
+
+}  // namespace yitu_codec_transcoder
@@ -0,0 +1,232 @@
+#ifndef TRANSCODER_HPP
+#define TRANSCODER_HPP
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+#include "quality.hpp"
+#include "session_pool.hpp"
+#include "trim.hpp"
+
+/**
+ * libtfcodec 对外接口
+ * Transcoder 内部持有工作线程与 session 池, 提交的任务按顺序由工作线程执行,
+ * 参数相同的任务复用设备 session. 线程安全, 一个进程内通常只需要一个实例.
+ *
+ *   yitu_codec_transcoder::Transcoder transcoder;
+ *   yitu_codec_transcoder::TranscodeJob job;
+ *   job.inputFileName = "in.mp4";
+ *   job.outputFileName = "out.h264";
+ *   job.encSetting.profile = PROFILE_AVC_HIGH;
+ *   auto result = transcoder.Submit(job).get();
+ */
+namespace yitu_codec_transcoder {
+
+enum JobState {
+    JOB_QUEUED = 0,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED
+};
+
+const char *job_state_name(JobState state);
+
+// 解码帧, 数据仅在回调期间有效; 回调之后仍要使用时 Retain 保留 frameData, 不必拷贝
+// 帧与编码等其他下游共享, 只读; 需要修改时对自己持有的引用 MakeWritable, 得到独占的副本
+struct DecodedFrame {
+    long jobId;
+    /// 从1开始的帧序号
+    int index;
+    const uint8_t *data;
+    size_t size;
+    int width;
+    int height;
+    /// 各平面地址与行距; 解码器按对齐尺寸输出时 data 不是紧密排列的 width x height I420, 需按视图读取
+    ConstFrameView view;
+    /// 帧本身, frameData->Retain() 后在 Release() 之前数据一直有效; 与编码等其他下游共享, 只读
+    FrameData *frameData;
+};
+
+// 任务进度
+struct JobProgress {
+    long jobId;
+    int loadedFrameCount;
+    int decodedFrameCount;
+    int savedFrameCount;
+    /// 任务当前计入内存预算的字节数
+    long memoryBytes;
+};
+
+// 任务结果
+struct TranscodeResult {
+    long jobId = 0;
+    JobState state = JOB_QUEUED;
+    int decodedFrameCount = 0;
+    int encodedPacketCount = 0;
+    long encodedBytes = 0;
+    /// 场景切换插入的关键帧数
+    int sceneCutCount = 0;
+    /// 静止帧过滤跳过的帧数
+    int staticFrameCount = 0;
+    /// 从开始运行到结束的耗时, 不含排队时间
+    double elapsedSec = 0;
+    /// 帧从读入到写出/送编码的延迟
+    double avgLatencyMs = 0;
+    double p99LatencyMs = 0;
+    double maxLatencyMs = 0;
+    /// 直播模式下超过延迟上限被丢弃的帧数
+    int droppedFrameCount = 0;
+    /// 任务计入内存预算的峰值
+    long peakMemoryBytes = 0;
+    /// 输入已满足编码参数, 整个文件直接拷贝, 未经解码/编码
+    bool streamCopied = false;
+    /// 直接拷贝的压缩packet数与字节数
+    int copiedPacketCount = 0;
+    long copiedBytes = 0;
+    /// 解码session故障切换次数与切换后丢弃的重复帧数
+    int failoverCount = 0;
+    int duplicateFrameCount = 0;
+    /// 封装输出时写入的音频/字幕 packet 数
+    long auxPacketCount = 0;
+    /// 已安排质量评估, 评估在任务结束后进行, 结果由 onQuality 给出
+    bool qualityPending = false;
+    std::string error;
+};
+
+// 转码任务, profile 为 TF_PROFILE_INVALID 时只解码, 以I420原始数据写入 outputFileName
+struct TranscodeJob {
+    std::string inputFileName;
+    std::string outputFileName;
+    int decDeviceIndex = 1;
+    /// 解码设备故障(或 decDeviceIndex 上无法创建session)时依次尝试的设备, 为空时不切换, 任务失败
+    std::vector<int> failoverDeviceIndexes;
+    /// 编码参数, 宽高为0表示与源视频一致
+    tfenc_setting encSetting = yitu_codec_enc::default_enc_setting();
+    tfg::INTERP_MODE interpMode = tfg::INTERP_Bilinear;
+    /// 直播模式: 按时间戳节奏读入, 队列按字节与延迟限制, 超过 latencyTargetMs 的帧被丢弃
+    bool live = false;
+    int latencyTargetMs = 200;
+    /// 开启设备调度时批处理任务的份额权重, 同一设备上的批处理任务按权重分享直播剩下的能力
+    int weight = 1;
+    /// 剪辑区间(秒, 相对于视频开头), trimEndSec > trimStartSec 时只输出 [trimStartSec, trimEndSec)
+    /// 区间内完整的 GOP 直接拷贝, 两端按源视频的 profile/level 重编码, encSetting 中只有码率/帧率等生效
+    /// 剪辑只输出裸码流, 输出为 mp4/mkv 等容器时任务失败
+    double trimStartSec = 0;
+    double trimEndSec = 0;
+    /// 输入的 profile/分辨率已与 encSetting 一致, level 与码率不超过目标时直接拷贝packet
+    /// 设置了 onFrame 或输出为容器时不会拷贝, 容器输出经过编码与封装
+    bool allowStreamCopy = true;
+    /// 输出为 mp4/mkv 等容器时, 源文件的音频/字幕流不解码直接写入, 与编码后的视频按 dts 交错
+    /// false 时容器中只有视频流; 输出为裸码流时只输出视频
+    bool passthroughAudio = true;
+    /// 场景切换检测, 开启后关键帧放在切换处, encSetting.gop 作为最大 GOP
+    yitu_codec_analysis::SceneCutConfig sceneCut;
+    /// 静止帧过滤, 开启后与上一保留帧相同的帧不编码, 保留帧时间戳写入 outputFileName + ".timestamps"
+    /// 剪辑与直接拷贝的任务不做过滤
+    yitu_codec_analysis::StaticFrameConfig staticFrame;
+    /// 编码完成后再解码输出, 与源视频逐帧比较 PSNR/SSIM, 逐帧结果写入 outputFileName + ".quality.csv"
+    /// 保留帧的时间戳写入 outputFileName + ".timestamps", 评估据此跳过编码前被丢弃的源帧
+    /// 只对完整转码的任务评估, 剪辑与直接拷贝的任务忽略; 评估在任务结束(future 就绪)之后由单独的评估线程依次进行, 不占用工作线程
+    bool measureQuality = false;
+    int qualityWorkerCount = 2;
+
+    // 以下回调均在工作线程中调用, 不应长时间阻塞
+    std::function<void(long jobId, int workerIndex)> onStarted;
+    /// 逐帧回调; 非剪辑任务经旁路队列在单独的线程中调用, 与编码同时进行, 回调较慢时限制解码速度
+    /// 静态帧过滤跳过的帧不回调; 剪辑任务在编码之前于保存线程中调用
+    std::function<void(const DecodedFrame &)> onFrame;
+    std::function<void(const JobProgress &)> onProgress;
+    /// 结束回调, 在 future 就绪之前调用
+    std::function<void(const TranscodeResult &)> onFinished;
+    /// 质量评估结束回调, 在评估线程中调用, 只对 qualityPending 的任务调用一次; ret 非0表示评估失败或 Transcoder 析构时未评估
+    std::function<void(long jobId, int ret, const yitu_codec_quality::QualityStats &)> onQuality;
+};
+
+struct TranscoderConfig {
+    /// 工作线程数, 每个线程同一时刻运行一个任务
+    int workerCount = 1;
+    /// 进程内存预算(所有任务的排队帧与编码中间buffer), 0 表示不限; 达到预算时批处理任务阻塞, 直播任务丢帧
+    long memoryBudgetBytes = 0;
+    /// 非直播任务的缓存配置, 直播任务按源视频帧率与延迟目标计算
+    yitu_codec_dec::BufferProfile batchProfile = yitu_codec_dec::batch_buffer_profile();
+    /// 高密度模式: 解码session以 tfdec_create_lite 创建, 批处理任务使用 density_buffer_profile, 每组参数最多保留一个空闲session
+    /// 设备容量由 gDeviceAdmission 控制, 达到容量的任务排队等待通道而不是失败
+    bool density = false;
+    /// 每组参数最多保留的空闲session数, 空闲超时秒数
+    int poolMaxIdlePerKey = 2;
+    int poolIdleTimeoutSec = 300;
+    /// 进度回调的最小间隔
+    int progressIntervalMs = 500;
+};
+
+class Transcoder {
+   public:
+    explicit Transcoder(const TranscoderConfig &config = TranscoderConfig());
+    /// 取消所有任务, 等待工作线程退出并销毁池中的 session
+    ~Transcoder();
+
+    Transcoder(const Transcoder &) = delete;
+    Transcoder &operator=(const Transcoder &) = delete;
+
+    /// 提交任务, 返回的 future 在任务结束(完成/失败/取消)时就绪
+    /// @param jobId 不为空时返回任务id, 用于 Cancel
+    std::future<TranscodeResult> Submit(const TranscodeJob &job, long *jobId = nullptr);
+
+    /// 取消任务. 排队中的任务直接结束; 运行中的任务停止读取, 已入队的帧处理完后结束
+    /// @return 任务不存在或已结束返回 false
+    bool Cancel(long jobId);
+    void CancelAll();
+
+    int QueuedCount();
+    std::vector<JobProgress> RunningJobs();
+    yitu_codec_pool::PoolStats DecPoolStats();
+    yitu_codec_pool::PoolStats EncPoolStats();
+
+   private:
+    struct Task {
+        long id;
+        TranscodeJob job;
+        std::promise<TranscodeResult> promise;
+        /// 运行中任务的上下文, 受 mMutex 保护
+        yitu_codec_dec::DecContext *ctx = nullptr;
+        /// 出队之后、绑定上下文之前收到的取消, 受 mMutex 保护; 绑定上下文时转为 ctx->cancelled
+        bool cancelRequested = false;
+    };
+
+    void worker_loop(int workerIndex);
+    void run_task(int workerIndex, std::shared_ptr<Task> task);
+    /// 直接拷贝压缩packet, 用于输入已满足编码参数的任务
+    void run_copy(int workerIndex, std::shared_ptr<Task> task, yitu_codec_dec::VideoInfo *videoInfo,
+                  std::chrono::steady_clock::time_point startTime);
+    /// 绑定/解除运行中任务的上下文, 供 Cancel 与 RunningJobs 使用
+    void set_task_context(std::shared_ptr<Task> task, yitu_codec_dec::DecContext *ctx);
+    /// 任务是否已被取消(Cancel/CancelAll/析构), 用于打开输入/获取session等耗时步骤之前
+    bool cancel_requested(std::shared_ptr<Task> task);
+    void finish(std::shared_ptr<Task> task, TranscodeResult &result);
+    /// 评估线程: 依次评估已结束任务的编码质量, 析构时剩余的任务不再评估
+    void quality_loop();
+
+    TranscoderConfig mConfig;
+    yitu_codec_pool::DecSessionPool mDecPool;
+    yitu_codec_pool::EncSessionPool mEncPool;
+
+    std::mutex mMutex;
+    std::condition_variable mQueueCv;
+    bool mStopping = false;
+    long mLastJobId = 0;
+    std::deque<std::shared_ptr<Task>> mQueue;
+    std::map<long, std::shared_ptr<Task>> mRunning;
+    std::vector<std::thread> mWorkers;
+    /// 等待质量评估的任务, 受 mMutex 保护
+    std::deque<std::shared_ptr<Task>> mQualityQueue;
+    std::condition_variable mQualityCv;
+    std::thread mQualityThread;
+};
+
+}  // namespace yitu_codec_transcoder
+#endif  // TRANSCODER_HPP
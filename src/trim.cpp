@@ -0,0 +1,187 @@
+#include "trim.hpp"
+
+namespace yitu_codec_trim {
+
+using namespace yitu_codec_dec;
+using namespace yitu_codec_remux;
+
+int plan_trim(VideoInfo *videoInfo, double startSec, double endSec, TrimPlan *plan) {
+    AVStream *stream = videoInfo->avFormatContext->streams[videoInfo->videoIndex];
+    AVRational microseconds = {1, 1000000};
+    int64_t origin = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    plan->startPts = origin + av_rescale_q((int64_t)(startSec * 1000000), microseconds, stream->time_base);
+    plan->endPts = origin + av_rescale_q((int64_t)(endSec * 1000000), microseconds, stream->time_base);
+    plan->headKeyPts = AV_NOPTS_VALUE;
+    plan->firstKeyPts = AV_NOPTS_VALUE;
+    plan->lastKeyPts = AV_NOPTS_VALUE;
+    plan->endIsKey = false;
+    if (plan->endPts <= plan->startPts) {
+        TF_LOG_ERROR("ERROR: Trim end must be after start.\n");
+        return -1;
+    }
+    if (seek_video(videoInfo, plan->startPts) != 0) {
+        return -1;
+    }
+
+    // 从 start 前的关键帧读到 end, 只记录关键帧位置, 不解码
+    int ret = 0;
+    AVPacket *packet = av_packet_alloc();
+    while (av_read_frame(videoInfo->avFormatContext, packet) >= 0) {
+        if (packet->stream_index != videoInfo->videoIndex) {
+            av_packet_unref(packet);
+            continue;
+        }
+        int64_t ts = packet_ts(packet);
+        if (ts == AV_NOPTS_VALUE) {
+            TF_LOG_ERROR("ERROR: Trim needs timestamps in the input.\n");
+            av_packet_unref(packet);
+            ret = -1;
+            break;
+        }
+        if (packet->flags & AV_PKT_FLAG_KEY) {
+            // 起点之前没有关键帧时, 从第一个关键帧开始
+            if (ts <= plan->startPts || plan->headKeyPts == AV_NOPTS_VALUE) {
+                plan->headKeyPts = ts;
+            }
+            if (ts >= plan->startPts && ts < plan->endPts) {
+                if (plan->firstKeyPts == AV_NOPTS_VALUE) {
+                    plan->firstKeyPts = ts;
+                }
+                plan->lastKeyPts = ts;
+            }
+            if (ts == plan->endPts) {
+                plan->endIsKey = true;
+            }
+        }
+        // 解码顺序在 end 之后的帧显示时间也不早于 end
+        bool pastEnd = (packet->dts != AV_NOPTS_VALUE ? packet->dts : ts) >= plan->endPts;
+        av_packet_unref(packet);
+        if (pastEnd) {
+            break;
+        }
+    }
+    av_packet_free(&packet);
+    if (ret == 0 && plan->headKeyPts == AV_NOPTS_VALUE) {
+        TF_LOG_ERROR("ERROR: No keyframe found before trim end.\n");
+        ret = -1;
+    }
+    if (ret == 0) {
+        TF_LOG_INFO("Trim plan: start %ld, end %ld, head key %ld, first key %ld, last key %ld, end is key %d.\n", (long)plan->startPts,
+                    (long)plan->endPts, (long)plan->headKeyPts, (long)plan->firstKeyPts, (long)plan->lastKeyPts, plan->endIsKey);
+    }
+    return ret;
+}
+
+/// 解码 seekPts 所在 GOP 起的一段, 只编码显示时间在 [keepFrom, keepTo) 内的帧, 追加到输出文件
+static int decode_segment(DecContext *ctx, int64_t seekPts, int64_t keepFrom, int64_t keepTo, TrimStats *stats) {
+    if (ctx->cancelled) {
+        return 0;
+    }
+    if (seek_video(ctx->videoInfo, seekPts) != 0) {
+        return -1;
+    }
+    yitu_codec_enc::EncContext *encoder = ctx->encoder;
+    if (yitu_codec_enc::open_encoder(encoder, encoder->session) != 0) {
+        return -1;
+    }
+    // 每段都从 IDR 开始, 拼接处不依赖前一段的参考帧
+    tfenc_restart_GOP(encoder->session->handle);
+
+    DecContext segment(ctx->profile);
+    segment.videoInfo = ctx->videoInfo;
+    segment.session = ctx->session;
+    segment.encoder = encoder;
+    segment.outputFileName = ctx->outputFileName;
+    segment.frameCallback = ctx->frameCallback;
+    segment.progressCallback = ctx->progressCallback;
+    segment.progressIntervalMs = ctx->progressIntervalMs;
+    segment.failoverDevices = ctx->failoverDevices;
+    segment.maxFailovers = ctx->maxFailovers - ctx->failoverCount;
+    segment.sched.schedClass = ctx->sched.schedClass;
+    segment.sched.weight = ctx->sched.weight;
+    bool started = false;
+    segment.packetSelector = [ctx, keepTo, started](DecContext *, const AVPacket *packet) mutable {
+        if (ctx->cancelled) {
+            return PACKET_STOP;
+        }
+        bool key = packet->flags & AV_PKT_FLAG_KEY;
+        // seek 可能落在非关键帧上
+        if (!started && !key) {
+            return PACKET_SKIP;
+        }
+        started = true;
+        if ((key && packet_ts(packet) >= keepTo) || (packet->dts != AV_NOPTS_VALUE && packet->dts >= keepTo)) {
+            return PACKET_STOP;
+        }
+        return PACKET_DECODE;
+    };
+    segment.frameSelector = [keepFrom, keepTo](DecContext *, FrameData *frameData) {
+        int64_t ts = (int64_t)frameData->GetTimestamp();
+        return ts >= keepFrom && ts < keepTo;
+    };
+
+    int ret = run_dec(&segment);
+    ctx->loadedFrameCount += segment.loadedFrameCount;
+    ctx->tfEnqueuedFrameCount += segment.tfEnqueuedFrameCount;
+    ctx->decodedFrameCount += segment.decodedFrameCount;
+    ctx->decodedBytes += segment.decodedBytes;
+    ctx->savedFrameCount += segment.savedFrameCount;
+    ctx->droppedFrameCount += segment.droppedFrameCount;
+    // 段内发生故障切换时后续段使用新session
+    ctx->session = segment.session;
+    ctx->failoverCount += segment.failoverCount;
+    ctx->duplicateFrameCount += segment.duplicateFrameCount;
+    if (segment.decoderFailed) {
+        ctx->decoderFailed = true;
+    }
+    if (segment.failed) {
+        ctx->failed = true;
+    }
+    if (segment.encoderFlushFailed) {
+        // 编码session状态未知, 后续段不能再使用
+        ctx->encoderFlushFailed = true;
+        ret = -1;
+    }
+    stats->reencodedSegmentCount++;
+    TF_LOG_INFO("Trim segment re-encoded: [%ld, %ld), frames: %d.\n", (long)keepFrom, (long)keepTo, segment.savedFrameCount.load());
+    return ret;
+}
+
+int run_trim(DecContext *ctx, const TrimPlan &plan, TrimStats *stats) {
+    *stats = TrimStats();
+    if (ctx->encoder == nullptr || ctx->encoder->session == nullptr) {
+        TF_LOG_ERROR("ERROR: Trim needs an encoder session.\n");
+        return -1;
+    }
+    // 先清空输出文件, 之后各段都追加写入
+    {
+        std::ofstream output(ctx->outputFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", ctx->outputFileName.c_str());
+            return -1;
+        }
+    }
+    ctx->encoder->appendOutput = true;
+
+    // 区间内没有关键帧, 整段重编码
+    if (plan.firstKeyPts == AV_NOPTS_VALUE) {
+        return decode_segment(ctx, plan.headKeyPts, plan.startPts, plan.endPts, stats);
+    }
+
+    int ret = 0;
+    if (plan.startPts < plan.firstKeyPts && plan.headKeyPts < plan.firstKeyPts) {
+        ret = decode_segment(ctx, plan.headKeyPts, plan.startPts, plan.firstKeyPts, stats);
+    }
+    int64_t copyEnd = plan.endIsKey ? plan.endPts : plan.lastKeyPts;
+    if (ret == 0 && copyEnd > plan.firstKeyPts) {
+        ret = copy_packets(ctx, plan.firstKeyPts, copyEnd, &stats->copy);
+    }
+    if (ret == 0 && !plan.endIsKey) {
+        ret = decode_segment(ctx, plan.lastKeyPts, plan.lastKeyPts, plan.endPts, stats);
+    }
+    TF_LOG_INFO("Trim complete: copied %d GOPs / %d packets, re-encoded %d segments / %d frames.\n", stats->copy.gopCount,
+                stats->copy.packetCount, stats->reencodedSegmentCount, ctx->savedFrameCount.load());
+    return ret;
+}
+
+}  // namespace yitu_codec_trim
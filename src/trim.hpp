@@ -0,0 +1,55 @@
+#ifndef TRIM_HPP
+#define TRIM_HPP
+
+#include "remux.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 智能剪辑: 从长视频中截取 [start, end) 一段
+ * 区间内完整的 GOP 以压缩packet直接拷贝, 只有两端不完整的 GOP 经 tfdec -> tfenc 重新编码,
+ * 编码参数由 yitu_codec_remux::match_source_setting 取源视频的 profile/level/分辨率, 各段按解码顺序拼接为一个 annexb 码流:
+ *
+ *   K0 ... start ... K1 ........... K2 ... end
+ *   |-- 头部重编码 --|---- 拷贝 ----|-- 尾部重编码 --|
+ *
+ * 每段重编码都从 IDR 开始, 拷贝段的关键帧前由 mp4toannexb 插入源视频的 SPS/PPS, 拼接处解码器按新参数集重新开始
+ * 假定为闭合 GOP; 开放 GOP 中显示时间早于关键帧的前置帧在拷贝时被丢弃
+ */
+namespace yitu_codec_trim {
+
+using yitu_codec_dec::DecContext;
+using yitu_codec_dec::VideoInfo;
+
+// 剪辑计划, 时间均为视频流 time_base 下的 pts
+struct TrimPlan {
+    int64_t startPts;
+    int64_t endPts;
+    /// start 之前(含)最近的关键帧, 头部从这里开始解码
+    int64_t headKeyPts;
+    /// 区间内第一个和最后一个关键帧, 区间内没有关键帧时为 AV_NOPTS_VALUE
+    int64_t firstKeyPts;
+    int64_t lastKeyPts;
+    /// end 恰好是关键帧时, 最后一个 GOP 也完整, 不需要尾部重编码
+    bool endIsKey;
+};
+
+// 剪辑统计
+struct TrimStats {
+    yitu_codec_remux::CopyStats copy;
+    int reencodedSegmentCount;
+};
+
+/// @brief 扫描 [startSec, endSec) 附近的关键帧, 生成剪辑计划
+/// @param startSec 起点, 相对于视频流开始的秒数
+/// @param endSec 终点, 不含
+/// @return 0 成功, -1 无法定位或输入没有时间戳
+int plan_trim(VideoInfo *videoInfo, double startSec, double endSec, TrimPlan *plan);
+
+/// @brief 执行剪辑, 结果写入 ctx->outputFileName
+/// ctx 需已设置 videoInfo/session/encoder(已绑定session, 未 open), 各段的解码统计累加到 ctx 中
+/// @return 0 成功, 其他值失败
+int run_trim(DecContext *ctx, const TrimPlan &plan, TrimStats *stats);
+
+}  // namespace yitu_codec_trim
+#endif  // TRIM_HPP
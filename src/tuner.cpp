@@ -0,0 +1,280 @@
+#include "tuner.hpp"
+
+#include <iomanip>
+
+namespace yitu_codec_tuner {
+
+using yitu_codec_dec::BufferProfile;
+using yitu_codec_dec::DecContext;
+using yitu_codec_dec::DecSession;
+using yitu_codec_dec::VideoInfo;
+
+// 生产任务使用的调优结果, 由 load_tuned_profiles 加载
+static std::mutex gTunedLock;
+static std::vector<TunePoint> gTunedPoints;
+
+std::string resolution_class(int width, int height) {
+    long pixels = (long)width * height;
+    if (pixels <= 854L * 480) {
+        return "480p";
+    }
+    if (pixels <= 1280L * 720) {
+        return "720p";
+    }
+    if (pixels <= 1920L * 1088) {
+        return "1080p";
+    }
+    if (pixels <= 4096L * 2160) {
+        return "4k";
+    }
+    return "8k";
+}
+
+bool dominates(const TunePoint &a, const TunePoint &b) {
+    bool noWorse = a.fps >= b.fps && a.memoryBytes <= b.memoryBytes && a.p99LatencyMs <= b.p99LatencyMs;
+    bool better = a.fps > b.fps || a.memoryBytes < b.memoryBytes || a.p99LatencyMs < b.p99LatencyMs;
+    return noWorse && better;
+}
+
+/// 用给定组合解码参考视频的前 maxFrames 帧, 解码帧直接丢弃
+static int measure(const TuneConfig &config, int deviceIndex, const BufferProfile &profile, TunePoint *point) {
+    VideoInfo videoInfo = VideoInfo();
+    if (yitu_codec_dec::read_video_file(config.inputFileName, &videoInfo) != 0) {
+        TF_LOG_ERROR("ERROR: Unable to read %s.\n", config.inputFileName.c_str());
+        return -1;
+    }
+    DecSession *session =
+        yitu_codec_dec::create_session(deviceIndex, videoInfo.role, videoInfo.width, videoInfo.height, profile.outBufferNum);
+    if (session == nullptr) {
+        yitu_codec_dec::close_video_file(&videoInfo);
+        return -1;
+    }
+
+    // 下游取走即释放, 不限制解码速度
+    FrameQueue sink(16, 0);
+    DecContext ctx(profile);
+    ctx.videoInfo = &videoInfo;
+    ctx.session = session;
+    ctx.frameSink = &sink;
+    if (config.maxFrames > 0) {
+        int maxFrames = config.maxFrames;
+        int count = 0;
+        ctx.packetSelector = [maxFrames, count](DecContext *, const AVPacket *) mutable {
+            return count++ < maxFrames ? yitu_codec_dec::PACKET_DECODE : yitu_codec_dec::PACKET_STOP;
+        };
+    }
+    std::thread drain([&sink] {
+        while (true) {
+            FrameData *frameData = sink.Pop();
+            bool end = frameData->GetIsEnd();
+            frameData->Release();
+            if (end) {
+                break;
+            }
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    int ret = yitu_codec_dec::run_dec(&ctx);
+    drain.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (ctx.decoderFailed) {
+        ret = -1;
+    }
+    yitu_codec_dec::destroy_session(ctx.session);
+
+    // tfdec 输出buffer按一帧原始数据估算
+    long frameBytes = (long)videoInfo.width * videoInfo.height * 3 / 2 * (videoInfo.bitDepth > 8 ? 2 : 1);
+    point->deviceIndex = deviceIndex;
+    point->resolutionClass = resolution_class(videoInfo.width, videoInfo.height);
+    point->profile = profile;
+    point->fps = sec > 0 ? ctx.decodedFrameCount / sec : 0;
+    point->memoryBytes = ctx.memory.Peak() + frameBytes * profile.outBufferNum;
+    point->p99LatencyMs = ctx.latency.PercentileMs(0.99);
+    yitu_codec_dec::close_video_file(&videoInfo);
+    if (ret != 0 || ctx.decodedFrameCount == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static std::vector<TunePoint> pareto_front(const std::vector<TunePoint> &points) {
+    std::vector<TunePoint> front;
+    for (const TunePoint &p : points) {
+        bool dominated = false;
+        for (const TunePoint &q : points) {
+            if (dominates(q, p)) {
+                dominated = true;
+                break;
+            }
+        }
+        if (!dominated) {
+            front.push_back(p);
+        }
+    }
+    return front;
+}
+
+int run_tune(const TuneConfig &config, std::vector<TunePoint> *pareto) {
+    if (config.inputFileName.empty() || config.deviceIndexes.empty() || config.profileFileName.empty()) {
+        TF_LOG_ERROR("ERROR: Tune needs a reference clip, devices and a profile file.\n");
+        return -1;
+    }
+    std::vector<TunePoint> front;
+    for (int deviceIndex : config.deviceIndexes) {
+        // 第一次运行包含设备初始化, 不计入结果
+        TunePoint warmup;
+        if (measure(config, deviceIndex, yitu_codec_dec::batch_buffer_profile(), &warmup) != 0) {
+            TF_LOG_ERROR("ERROR: Tune device %d: reference decode failed.\n", deviceIndex);
+            return -1;
+        }
+        std::vector<TunePoint> points;
+        for (int outBufferNum : config.outBufferNums) {
+            for (int hardwareCacheSize : config.hardwareCacheSizes) {
+                for (int queueSize : config.queueSizes) {
+                    BufferProfile profile = yitu_codec_dec::batch_buffer_profile();
+                    profile.outBufferNum = outBufferNum;
+                    profile.frameHardwareCacheSize = hardwareCacheSize;
+                    profile.inFrameCacheSize = queueSize;
+                    profile.outFrameCacheSize = queueSize;
+                    TunePoint point;
+                    if (measure(config, deviceIndex, profile, &point) != 0) {
+                        TF_LOG_INFO("Tune device %d: out_buffer_num %d, hw_cache %d, queue %d failed, skipped.\n", deviceIndex, outBufferNum,
+                                    hardwareCacheSize, queueSize);
+                        continue;
+                    }
+                    TF_LOG_INFO("Tune device %d %s: out_buffer_num %d, hw_cache %d, queue %d -> %.1f fps, %ld bytes, p99 %.1f ms.\n",
+                                deviceIndex, point.resolutionClass.c_str(), outBufferNum, hardwareCacheSize, queueSize, point.fps,
+                                point.memoryBytes, point.p99LatencyMs);
+                    points.push_back(point);
+                }
+            }
+        }
+        std::vector<TunePoint> deviceFront = pareto_front(points);
+        TF_LOG_INFO("Tune device %d: %zu of %zu settings are Pareto optimal.\n", deviceIndex, deviceFront.size(), points.size());
+        front.insert(front.end(), deviceFront.begin(), deviceFront.end());
+    }
+    if (front.empty()) {
+        TF_LOG_ERROR("ERROR: Tune produced no result.\n");
+        return -1;
+    }
+
+    // 合并到已有结果: 本次调优的 设备/档位 整体替换, 其他保留
+    std::vector<TunePoint> merged;
+    std::vector<TunePoint> existing;
+    std::ifstream probe(config.profileFileName);
+    if (probe.is_open()) {
+        probe.close();
+        if (read_tune_file(config.profileFileName, &existing) != 0) {
+            return -1;
+        }
+    }
+    for (const TunePoint &p : existing) {
+        bool replaced = false;
+        for (const TunePoint &q : front) {
+            if (p.deviceIndex == q.deviceIndex && p.resolutionClass == q.resolutionClass) {
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) {
+            merged.push_back(p);
+        }
+    }
+    merged.insert(merged.end(), front.begin(), front.end());
+    if (write_tune_file(config.profileFileName, merged) != 0) {
+        return -1;
+    }
+    TF_LOG_INFO("Tune result written to %s.\n", config.profileFileName.c_str());
+    if (pareto != nullptr) {
+        *pareto = front;
+    }
+    return 0;
+}
+
+int read_tune_file(const std::string &fileName, std::vector<TunePoint> *points) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", fileName.c_str());
+        return -1;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::stringstream ss(line);
+        TunePoint point;
+        point.profile = yitu_codec_dec::batch_buffer_profile();
+        BufferProfile &profile = point.profile;
+        if (!(ss >> point.deviceIndex >> point.resolutionClass >> profile.outBufferNum >> profile.frameHardwareCacheSize >>
+              profile.inFrameCacheSize >> profile.outFrameCacheSize >> point.fps >> point.memoryBytes >> point.p99LatencyMs)) {
+            TF_LOG_ERROR("ERROR: %s line %d: invalid tune result.\n", fileName.c_str(), lineNumber);
+            return -1;
+        }
+        points->push_back(point);
+    }
+    return 0;
+}
+
+int write_tune_file(const std::string &fileName, const std::vector<TunePoint> &points) {
+    std::ofstream file(fileName, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        TF_LOG_ERROR("ERROR: Unable to open file %s.\n", fileName.c_str());
+        return -1;
+    }
+    file << "# device class out_buffer_num hw_cache in_cache out_cache fps mem_bytes p99_ms\n";
+    for (const TunePoint &p : points) {
+        const BufferProfile &profile = p.profile;
+        file << p.deviceIndex << " " << p.resolutionClass << " " << profile.outBufferNum << " " << profile.frameHardwareCacheSize << " "
+             << profile.inFrameCacheSize << " " << profile.outFrameCacheSize << " " << std::fixed << std::setprecision(3) << p.fps << " "
+             << p.memoryBytes << " " << p.p99LatencyMs << "\n";
+    }
+    return file.good() ? 0 : -1;
+}
+
+int load_tuned_profiles(const std::string &fileName) {
+    std::ifstream probe(fileName);
+    if (!probe.is_open()) {
+        return 0;
+    }
+    probe.close();
+    std::vector<TunePoint> points;
+    if (read_tune_file(fileName, &points) != 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(gTunedLock);
+    gTunedPoints = points;
+    TF_LOG_INFO("Loaded %zu tuned buffer settings from %s.\n", points.size(), fileName.c_str());
+    return (int)points.size();
+}
+
+bool tuned_buffer_profile(int deviceIndex, int width, int height, BufferProfile *profile) {
+    std::string resolutionClass = resolution_class(width, height);
+    std::lock_guard<std::mutex> lock(gTunedLock);
+    double bestFps = 0;
+    for (const TunePoint &p : gTunedPoints) {
+        if (p.deviceIndex == deviceIndex && p.resolutionClass == resolutionClass) {
+            bestFps = std::max(bestFps, p.fps);
+        }
+    }
+    // 吞吐接近最高值的点中取内存最少的
+    const TunePoint *selected = nullptr;
+    for (const TunePoint &p : gTunedPoints) {
+        if (p.deviceIndex == deviceIndex && p.resolutionClass == resolutionClass && p.fps >= bestFps * 0.95 &&
+            (selected == nullptr || p.memoryBytes < selected->memoryBytes)) {
+            selected = &p;
+        }
+    }
+    if (selected == nullptr) {
+        return false;
+    }
+    profile->outBufferNum = selected->profile.outBufferNum;
+    profile->frameHardwareCacheSize = selected->profile.frameHardwareCacheSize;
+    profile->inFrameCacheSize = selected->profile.inFrameCacheSize;
+    profile->outFrameCacheSize = selected->profile.outFrameCacheSize;
+    return true;
+}
+
+}  // namespace yitu_codec_tuner
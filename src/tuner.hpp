@@ -0,0 +1,72 @@
+#ifndef TUNER_HPP
+#define TUNER_HPP
+
+#include "common_dec.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 缓存参数自动调优: 用参考视频在每个解码设备上扫描 out_buffer_num、硬件在途帧数与队列深度的组合,
+ * 测量吞吐(fps)、内存(排队帧峰值 + tfdec 输出buffer)与 p99 延迟, 保留 Pareto 最优的组合写入配置文件
+ * 配置文件按 设备/分辨率档位 索引, 生产任务启动时加载, 批处理任务按设备与源视频分辨率取用:
+ *
+ *   # device class out_buffer_num hw_cache in_cache out_cache fps mem_bytes p99_ms
+ *   1 1080p 4 16 64 64 412.300 31850496 38.200
+ *
+ * 同一档位有多个 Pareto 点时, 取吞吐不低于最高值 95% 的点中内存最少的一个; 直播任务的缓存仍按延迟目标计算
+ */
+namespace yitu_codec_tuner {
+
+// 调优参数, 各列表的笛卡尔积即扫描的组合
+struct TuneConfig {
+    /// 参考视频, 其分辨率决定调优结果所属的档位
+    std::string inputFileName;
+    std::vector<int> deviceIndexes;
+    std::vector<int> outBufferNums = {3, 4, 5, 6};
+    std::vector<int> hardwareCacheSizes = {4, 8, 16, 32};
+    /// 压缩帧与解码帧队列的帧数上限(两者取相同值)
+    std::vector<int> queueSizes = {16, 64, 512};
+    /// 每个组合最多解码的帧数, 0 表示整个文件
+    int maxFrames = 600;
+    /// 结果合并写入该文件, 其他设备/档位的已有结果保留
+    std::string profileFileName;
+};
+
+// 一个组合的测量结果
+struct TunePoint {
+    int deviceIndex;
+    std::string resolutionClass;
+    yitu_codec_dec::BufferProfile profile;
+    double fps;
+    long memoryBytes;
+    double p99LatencyMs;
+};
+
+/// @brief 分辨率档位: 480p/720p/1080p/4k/8k, 按像素数向上归档
+std::string resolution_class(int width, int height);
+
+/// @brief a 在吞吐/内存/延迟上都不差于 b, 且至少一项更好
+bool dominates(const TunePoint &a, const TunePoint &b);
+
+/// @brief 运行调优, 每个设备的 Pareto 最优组合合并写入 config.profileFileName
+/// @param pareto 所有设备的 Pareto 最优组合, 可为 NULL
+/// @return 0 成功, 其他值失败
+int run_tune(const TuneConfig &config, std::vector<TunePoint> *pareto);
+
+/// @brief 读取调优结果文件
+/// @return 0 成功, -1 文件无法读取或格式错误
+int read_tune_file(const std::string &fileName, std::vector<TunePoint> *points);
+
+/// @brief 写入调优结果文件, 覆盖原文件
+int write_tune_file(const std::string &fileName, const std::vector<TunePoint> &points);
+
+/// @brief 加载调优结果供 tuned_buffer_profile 使用, 替换之前加载的结果; 文件不存在时不加载
+/// @return 加载的组合数, -1 格式错误
+int load_tuned_profiles(const std::string &fileName);
+
+/// @brief 按设备与分辨率取加载的调优结果, 在批处理缓存策略上替换队列深度/在途帧数/输出buffer数
+/// @return 没有对应的调优结果时返回 false, profile 不变
+bool tuned_buffer_profile(int deviceIndex, int width, int height, yitu_codec_dec::BufferProfile *profile);
+
+}  // namespace yitu_codec_tuner
+#endif  // TUNER_HPP
@@ -0,0 +1,273 @@
+#include "video_wall.hpp"
+#include "task_pool.hpp"
+
+#include <cmath>
+
+namespace yitu_codec_wall {
+
+using yitu_codec_dec::DecodedStream;
+using yitu_codec_dec::VideoInfo;
+
+// 单路输入的解码任务与合成状态
+struct WallTile {
+    WallTile(int queueFrames) : stream(queueFrames) {
+    }
+
+    /// 解码帧由本路保存线程送入 stream.queue, 合成线程取出
+    DecodedStream stream;
+
+    /// 时间戳换算为相对本路起点的秒数
+    double timeBase = 0;
+    int64_t startPts = 0;
+    /// 已取出但显示时间未到的帧
+    FrameData *next = nullptr;
+    /// 连续重复显示的帧数
+    int repeat = 0;
+
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+static double frame_time(const WallTile *tile, FrameData *frameData) {
+    return ((int64_t)frameData->GetTimestamp() - tile->startPts) * tile->timeBase;
+}
+
+static void fill_black(const FrameView &area) {
+    for (int plane = 0; plane < 3; plane++) {
+        for (int r = 0; r < area.PlaneHeight(plane); r++) {
+            memset(area.planes[plane] + (size_t)r * area.strides[plane], plane == 0 ? 16 : 128, area.PlaneWidth(plane));
+        }
+    }
+}
+
+void tile_rect(const WallConfig &config, int index, int *x, int *y, int *width, int *height) {
+    int columns = config.columns;
+    int rows = config.rows;
+    if (columns <= 0 || rows <= 0) {
+        columns = (int)std::ceil(std::sqrt((double)config.inputs.size()));
+        columns = std::max(columns, 1);
+        rows = ((int)config.inputs.size() + columns - 1) / columns;
+        rows = std::max(rows, 1);
+    }
+    *width = (config.width / columns) & ~1;
+    *height = (config.height / rows) & ~1;
+    *x = (index % columns) * *width;
+    *y = (index / columns) * *height;
+}
+
+static int open_tile(const WallConfig &config, int index, WallTile *tile) {
+    const WallInput &input = config.inputs[index];
+    // 合成线程按输出时钟取帧, 每路只需少量解码帧缓存
+    yitu_codec_dec::BufferProfile profile = yitu_codec_dec::batch_buffer_profile();
+    profile.inFrameCacheSize = 64;
+    profile.outFrameCacheSize = config.tileQueueFrames;
+    if (yitu_codec_dec::open_decoded_stream(input.inputFileName, input.decDeviceIndex, profile, &tile->stream) != 0) {
+        TF_LOG_ERROR("ERROR: Wall input %d: unable to open %s.\n", index, input.inputFileName.c_str());
+        return -1;
+    }
+    VideoInfo *videoInfo = &tile->stream.videoInfo;
+    if (videoInfo->bitDepth > 8) {
+        TF_LOG_ERROR("ERROR: Wall input %d: %d bit input is not supported.\n", index, videoInfo->bitDepth);
+        return -1;
+    }
+
+    AVStream *stream = videoInfo->avFormatContext->streams[videoInfo->videoIndex];
+    tile->timeBase = av_q2d(stream->time_base);
+    tile->startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    tile_rect(config, index, &tile->x, &tile->y, &tile->width, &tile->height);
+    return 0;
+}
+
+/// 合成提前结束时先释放等待显示的帧, 其余由 close_decoded_stream 取走
+static int close_tile(WallTile *tile) {
+    if (tile->next != nullptr) {
+        tile->next->Release();
+        tile->next = nullptr;
+    }
+    return yitu_codec_dec::close_decoded_stream(&tile->stream);
+}
+
+/// @brief 为当前输出时刻选出本路要显示的帧
+/// @return 新的帧, 没有新帧(重复上一帧)时返回 NULL
+static FrameData *select_frame(WallTile *tile, WallSyncPolicy policy, double tick, int *dropped) {
+    if (policy == WALL_SYNC_LOCKSTEP) {
+        return yitu_codec_dec::pop_decoded_frame(&tile->stream);
+    }
+    FrameData *selected = nullptr;
+    while (true) {
+        if (tile->next == nullptr) {
+            if ((tile->next = yitu_codec_dec::pop_decoded_frame(&tile->stream)) == nullptr) {
+                break;
+            }
+        }
+        if (frame_time(tile, tile->next) > tick) {
+            break;
+        }
+        // 同一输出时刻内有更新的帧, 旧帧不再显示
+        if (selected != nullptr) {
+            selected->Release();
+            (*dropped)++;
+        }
+        selected = tile->next;
+        tile->next = nullptr;
+    }
+    return selected;
+}
+
+int run_wall(const WallConfig &config, WallStats *stats) {
+    int inputCount = (int)config.inputs.size();
+    if (inputCount == 0 || config.width <= 0 || config.height <= 0 || config.frameRate <= 0) {
+        TF_LOG_ERROR("ERROR: Invalid wall config.\n");
+        return -1;
+    }
+    int canvasWidth = config.width & ~1;
+    int canvasHeight = config.height & ~1;
+    std::vector<int> dropped(inputCount, 0), repeated(inputCount, 0);
+    int composedFrameCount = 0;
+
+    std::vector<std::unique_ptr<WallTile>> tiles;
+    int ret = 0;
+    for (int i = 0; i < inputCount && ret == 0; i++) {
+        tiles.emplace_back(new WallTile(config.tileQueueFrames));
+        ret = open_tile(config, i, tiles.back().get());
+    }
+
+    // 画布即编码器的源帧, 编码尺寸与画布相同, 不再缩放
+    yitu_codec_enc::EncContext enc;
+    yitu_codec_enc::EncSession *encSession = nullptr;
+    bool encoderOpened = false;
+    std::fstream rawFStream;
+    bool encode = config.encSetting.profile != TF_PROFILE_INVALID;
+    if (ret == 0 && encode) {
+        tfenc_setting setting = config.encSetting;
+        setting.width = canvasWidth;
+        setting.height = canvasHeight;
+        setting.frame_rate = (int)std::lround(config.frameRate);
+        encSession = yitu_codec_enc::create_enc_session(setting);
+        enc.outputFileName = config.outputFileName;
+        enc.srcWidth = canvasWidth;
+        enc.srcHeight = canvasHeight;
+        enc.interpMode = config.interpMode;
+        if (encSession == nullptr || yitu_codec_enc::open_encoder(&enc, encSession) != 0) {
+            TF_LOG_ERROR("ERROR: Unable to open wall encoder.\n");
+            ret = -1;
+        } else {
+            encoderOpened = true;
+        }
+    } else if (ret == 0) {
+        rawFStream.open(config.outputFileName, std::ios::out | std::ios::binary);
+        if (!rawFStream.is_open()) {
+            TF_LOG_ERROR("ERROR: Unable to open file %s.\n", config.outputFileName.c_str());
+            ret = -1;
+        }
+    }
+
+    std::vector<uint8_t> canvas((size_t)canvasWidth * canvasHeight * 3 / 2);
+    FrameView canvasView = FrameView::FromI420(canvas.data(), canvasWidth, canvasHeight, canvasWidth, canvasHeight);
+    fill_black(canvasView);
+
+    if (ret == 0) {
+        for (auto &tile : tiles) {
+            WallTile *t = tile.get();
+            yitu_codec_dec::start_decoded_stream(&t->stream);
+        }
+    }
+
+    yitu_codec_task::TaskPool *pool = yitu_codec_task::cpu_pool();
+    std::vector<FrameData *> selected(inputCount, nullptr);
+    std::vector<int> scaleRets(inputCount, 0);
+    for (int64_t k = 0; ret == 0; k++) {
+        double tick = k / config.frameRate;
+        bool updated = false;
+        bool allEnded = true;
+        for (int i = 0; i < inputCount; i++) {
+            WallTile *tile = tiles[i].get();
+            FrameData *frameData = select_frame(tile, config.syncPolicy, tick, &dropped[i]);
+            selected[i] = frameData;
+            if (frameData != nullptr) {
+                tile->repeat = 0;
+                updated = true;
+            } else {
+                // 画布上保留着上一帧, 重复显示不需要再写
+                tile->repeat++;
+                if (!tile->stream.ended) {
+                    repeated[i]++;
+                }
+                if (config.maxRepeatFrames > 0 && tile->repeat == config.maxRepeatFrames) {
+                    fill_black(canvasView.Crop(tile->x, tile->y, tile->width, tile->height));
+                }
+            }
+            allEnded = allEnded && tile->stream.ended && tile->next == nullptr;
+        }
+        // 各格子互不重叠, 有共享线程池时按格子并行缩放
+        auto scaleTiles = [&](int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                if (selected[i] == nullptr) {
+                    continue;
+                }
+                WallTile *tile = tiles[i].get();
+                // 目标为画布上该格子的视图, 直接按画布行距写入
+                scaleRets[i] = yitu_codec_enc::scale_view(yitu_codec_dec::frame_view(tile->stream.ctx.get(), selected[i]),
+                                                          canvasView.Crop(tile->x, tile->y, tile->width, tile->height), config.interpMode);
+            }
+        };
+        if (pool != nullptr) {
+            pool->ParallelFor(inputCount, scaleTiles);
+        } else {
+            scaleTiles(0, inputCount);
+        }
+        for (int i = 0; i < inputCount; i++) {
+            if (selected[i] != nullptr && scaleRets[i] != 0 && ret == 0) {
+                TF_LOG_ERROR("ERROR: Wall input %d: scale failed, ret: %d.\n", i, scaleRets[i]);
+                ret = scaleRets[i];
+            }
+            if (selected[i] != nullptr) {
+                selected[i]->Release();
+                selected[i] = nullptr;
+            }
+        }
+        if (ret != 0 || (allEnded && !updated)) {
+            break;
+        }
+        if (encode) {
+            ret = yitu_codec_enc::encode_frame(&enc, canvas.data());
+        } else {
+            rawFStream.write((const char *)canvas.data(), canvas.size());
+        }
+        composedFrameCount++;
+        if (allEnded) {
+            break;
+        }
+    }
+
+    for (auto &tile : tiles) {
+        int tileRet = close_tile(tile.get());
+        if (tileRet != 0) {
+            ret = tileRet;
+        }
+    }
+    if (encoderOpened && yitu_codec_enc::flush_encoder(&enc) != 0) {
+        ret = -1;
+    }
+    if (encSession != nullptr) {
+        yitu_codec_enc::destroy_enc_session(encSession);
+    }
+    if (rawFStream.is_open()) {
+        rawFStream.close();
+    }
+
+    TF_LOG_INFO("Wall composed: %d frames from %d inputs.\n", composedFrameCount, inputCount);
+    for (int i = 0; i < inputCount; i++) {
+        TF_LOG_INFO("  input %d: dropped %d, repeated %d.\n", i, dropped[i], repeated[i]);
+    }
+    if (stats != nullptr) {
+        stats->composedFrameCount = composedFrameCount;
+        stats->droppedFrameCounts = dropped;
+        stats->repeatedFrameCounts = repeated;
+    }
+    return ret;
+}
+
+}  // namespace yitu_codec_wall
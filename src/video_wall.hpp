@@ -0,0 +1,74 @@
+#ifndef VIDEO_WALL_HPP
+#define VIDEO_WALL_HPP
+
+#include "common_dec.hpp"
+#include "common_enc.hpp"
+
+using namespace yitu_codec_common;
+
+/**
+ * 电视墙: 多路输入各自经 tfdec 解码, 缩放到画布上的格子后合成一路, 由一个 tfenc session 编码
+ * 缩放时以画布行距直接写入格子位置, 不经过中间buffer拷贝:
+ *
+ *   输入0 -> tfdec -> 队列 --\
+ *   输入1 -> tfdec -> 队列 ---+-> 按输出时钟取帧 -> 缩放写入画布 -> tfenc -> 文件
+ *   ...                    --/
+ *
+ * 各路时间戳换算为相对本路起点的秒数, 与输出时钟对齐; 开启共享 CPU 线程池时各格子并行缩放
+ */
+namespace yitu_codec_wall {
+
+// 多路时间对齐策略
+enum WallSyncPolicy {
+    /// 按输出时钟取每路不晚于当前时刻的最新帧: 帧率高于输出的路丢帧, 低于输出或卡顿的路重复上一帧
+    WALL_SYNC_TIMESTAMP = 0,
+    /// 每个输出帧从每路各取一帧, 不丢帧也不重复, 最慢的一路决定整体进度
+    WALL_SYNC_LOCKSTEP
+};
+
+// 单路输入
+struct WallInput {
+    std::string inputFileName;
+    int decDeviceIndex = 1;
+};
+
+// 电视墙参数
+struct WallConfig {
+    std::vector<WallInput> inputs;
+    /// 网格行列数, 为0时按输入路数取最小的正方形网格
+    int rows = 0;
+    int columns = 0;
+    /// 画布即编码尺寸, setting 中的宽高被忽略
+    int width = 1920;
+    int height = 1080;
+    /// 输出帧率
+    double frameRate = 25;
+    WallSyncPolicy syncPolicy = WALL_SYNC_TIMESTAMP;
+    /// 一路连续重复超过该帧数(卡住或已结束)后格子涂黑, 0 表示一直保持最后一帧
+    int maxRepeatFrames = 50;
+    /// 每路解码帧队列的帧数上限, 解码快于合成时阻塞该路解码
+    int tileQueueFrames = 4;
+    tfg::INTERP_MODE interpMode = tfg::INTERP_Bilinear;
+    /// profile 为 TF_PROFILE_INVALID 时输出 I420 原始画布
+    tfenc_setting encSetting;
+    std::string outputFileName;
+};
+
+// 合成统计
+struct WallStats {
+    int composedFrameCount;
+    /// 每路被丢弃(被更新的帧取代)与重复显示的帧数
+    std::vector<int> droppedFrameCounts;
+    std::vector<int> repeatedFrameCounts;
+};
+
+/// @brief 计算第 index 路的格子位置, 坐标与宽高都取偶数, 保证色度平面对齐
+void tile_rect(const WallConfig &config, int index, int *x, int *y, int *width, int *height);
+
+/// @brief 运行电视墙合成, 阻塞到所有输入结束
+/// @param stats 合成统计, 可为 NULL
+/// @return 0 成功, 其他值失败
+int run_wall(const WallConfig &config, WallStats *stats);
+
+}  // namespace yitu_codec_wall
+#endif  // VIDEO_WALL_HPP